@@ -0,0 +1,111 @@
+// back to front order of the render positions for alpha blending, run every frame by ClDepthSort
+// the positions of every draw command are keyed by their distance to the camera, sorted with cl/radix_sort.cl and
+// gathered into the range of the first draw command, which then draws them all
+
+// matches ClDepthSort::KEY_BITS
+#define DEPTH_KEY_MAX 0xFFFFu
+
+// state: the number of positions to sort, then the bits of the smallest and largest view distances of the frame
+__kernel void prepareDepthSort(
+	__global const uint* drawCommands,
+	uint numDrawCommands,
+	__global uint* state)
+{
+	uint count = 0;
+	for (uint i = 0; i < numDrawCommands; ++i)
+	{
+		count += drawCommands[i * 4];
+	}
+	state[0] = count;
+	state[1] = 0xFFFFFFFFu;
+	state[2] = 0;
+}
+
+// one work-item per render position, those not covered by a draw command are skipped
+// depthRow is the row of the model view matrix giving view z, the camera looks down -z
+// keys quantize the distance over depthRange, the near distance and keys per unit, farthest first
+__kernel void computeDepthKeys(
+	__global const float* positions,
+	__global const uint* drawCommands,
+	uint numDrawCommands,
+	float4 depthRow,
+	float2 depthRange,
+	__global uint* keys,
+	__global uint* values,
+	__global float* unsortedPositions,
+	__global uint* state)
+{
+	__local uint groupMin;
+	__local uint groupMax;
+	if (get_local_id(0) == 0)
+	{
+		groupMin = 0xFFFFFFFFu;
+		groupMax = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// the draw commands are packed one after the other
+	uint id = (uint)get_global_id(0);
+	uint sortId = 0;
+	bool drawn = false;
+	for (uint i = 0; i < numDrawCommands && !drawn; ++i)
+	{
+		uint count = drawCommands[i * 4];
+		uint first = drawCommands[i * 4 + 2];
+		if (id >= first && id - first < count)
+		{
+			sortId += id - first;
+			drawn = true;
+		}
+		else
+		{
+			sortId += count;
+		}
+	}
+
+	if (drawn)
+	{
+		float3 position = vload3(id, positions);
+		float distance = max(-(dot(depthRow.xyz, position) + depthRow.w), 0.f);
+		float key = clamp((distance - depthRange.x) * depthRange.y, 0.f, (float)DEPTH_KEY_MAX);
+
+		keys[sortId] = DEPTH_KEY_MAX - (uint)key;
+		values[sortId] = sortId;
+		vstore3(position, sortId, unsortedPositions);
+
+		// positive floats compare like their bits
+		atomic_min(&groupMin, as_uint(distance));
+		atomic_max(&groupMax, as_uint(distance));
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0 && groupMin <= groupMax)
+	{
+		atomic_min(&state[1], groupMin);
+		atomic_max(&state[2], groupMax);
+	}
+}
+
+// one work-item per render position: the sorted positions are written from the start of the render positions and the
+// first draw command draws them all
+__kernel void scatterDepthSorted(
+	__global const uint* sortedValues,
+	__global const uint* state,
+	__global const float* unsortedPositions,
+	__global float* positions,
+	__global uint* drawCommands,
+	uint numDrawCommands)
+{
+	uint i = (uint)get_global_id(0);
+	uint count = state[0];
+	if (i < count)
+	{
+		vstore3(vload3(sortedValues[i], unsortedPositions), i, positions);
+	}
+
+	if (i < numDrawCommands)
+	{
+		drawCommands[i * 4] = i == 0 ? count : 0;
+		drawCommands[i * 4 + 2] = 0;
+	}
+}
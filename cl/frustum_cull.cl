@@ -0,0 +1,103 @@
+// drops the render positions nobody can see before they are drawn, run every frame by ClFrustumCull
+// the kept positions of every draw command are packed into the range of the first one, like cl/depth_sort.cl does,
+// which then draws them all, the command after the last one is rewritten to draw them as instanced 4 vertex strips
+
+// one work-item per render position, those not covered by a draw command are skipped
+// a position is kept if its bounding sphere of the given radius is inside the six planes, normalized with the inside
+// positive, and it is no farther than maxDistance along distanceRow, the distance at which it covers too few pixels
+// kept positions are appended to culledPositions in any order, state[0] counts them and must be zero before
+__kernel void cullParticles(
+	__global const float* positions,
+	__global const uint* drawCommands,
+	uint numDrawCommands,
+	float4 leftPlane,
+	float4 rightPlane,
+	float4 bottomPlane,
+	float4 topPlane,
+	float4 nearPlane,
+	float4 farPlane,
+	float4 distanceRow,
+	float radius,
+	float maxDistance,
+	__global float* culledPositions,
+	__global uint* state)
+{
+	__local uint groupCount;
+	__local uint groupFirst;
+	if (get_local_id(0) == 0)
+	{
+		groupCount = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint id = (uint)get_global_id(0);
+	bool drawn = false;
+	for (uint i = 0; i < numDrawCommands && !drawn; ++i)
+	{
+		uint count = drawCommands[i * 4];
+		uint first = drawCommands[i * 4 + 2];
+		drawn = id >= first && id - first < count;
+	}
+
+	float4 position = (float4)(0.f, 0.f, 0.f, 1.f);
+	uint localIndex = 0;
+	bool kept = false;
+	if (drawn)
+	{
+		position.xyz = vload3(id, positions);
+		kept = dot(leftPlane, position) >= -radius
+			&& dot(rightPlane, position) >= -radius
+			&& dot(bottomPlane, position) >= -radius
+			&& dot(topPlane, position) >= -radius
+			&& dot(nearPlane, position) >= -radius
+			&& dot(farPlane, position) >= -radius
+			&& dot(distanceRow, position) <= maxDistance;
+	}
+	if (kept)
+	{
+		localIndex = atomic_inc(&groupCount);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// one global atomic per work-group, each group appends a contiguous range
+	if (get_local_id(0) == 0 && groupCount > 0)
+	{
+		groupFirst = atomic_add(&state[0], groupCount);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (kept)
+	{
+		vstore3(position.xyz, groupFirst + localIndex, culledPositions);
+	}
+}
+
+// one work-item per render position: the kept positions are copied back from the start of the render positions,
+// the first draw command draws them all and the others none
+__kernel void writeCulledPositions(
+	__global const float* culledPositions,
+	__global const uint* state,
+	__global float* positions,
+	__global uint* drawCommands,
+	uint numDrawCommands)
+{
+	uint i = (uint)get_global_id(0);
+	uint count = state[0];
+	if (i < count)
+	{
+		vstore3(vload3(i, culledPositions), i, positions);
+	}
+
+	if (i < numDrawCommands)
+	{
+		drawCommands[i * 4] = i == 0 ? count : 0;
+		drawCommands[i * 4 + 2] = 0;
+	}
+	else if (i == numDrawCommands)
+	{
+		drawCommands[i * 4] = 4;
+		drawCommands[i * 4 + 1] = count;
+		drawCommands[i * 4 + 2] = 0;
+		drawCommands[i * 4 + 3] = 0;
+	}
+}
@@ -0,0 +1,119 @@
+// reordering of particle storage by Morton code, run every few frames by ClMortonOrder
+// the alive particles of a page are keyed by the Morton code of their cell, sorted with cl/radix_sort.cl, gathered in
+// sorted order and written back to the front of the page, the rest of the page becomes the free list
+
+// cells are wrapped to 10 bits per axis around the origin, 30 bits of key
+#define MORTON_AXIS_BITS 10
+#define MORTON_AXIS_MASK 0x3FFu
+#define MORTON_AXIS_OFFSET 512
+
+// the low 10 bits of v, two zero bits between each
+uint spreadMortonBits(uint v)
+{
+	v &= MORTON_AXIS_MASK;
+	v = (v | (v << 16)) & 0x030000FFu;
+	v = (v | (v << 8)) & 0x0300F00Fu;
+	v = (v | (v << 4)) & 0x030C30C3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+uint getMortonCode(float3 position, float cellSize)
+{
+	uint3 cell = as_uint3(convert_int3(floor(position / cellSize)) + MORTON_AXIS_OFFSET);
+	return spreadMortonBits(cell.x) | (spreadMortonBits(cell.y) << 1) | (spreadMortonBits(cell.z) << 2);
+}
+
+// one work-item per alive particle of the page, the alive list is that of the last compaction
+__kernel void computeMortonKeys(
+	__global const float* positions,
+	__global const uint* aliveIndices,
+	__global const uint* pageAliveCounts,
+	uint pageIndex,
+	float cellSize,
+	__global uint* keys,
+	__global uint* values)
+{
+	size_t aliveId = get_global_id(0);
+	if (aliveId >= pageAliveCounts[pageIndex])
+	{
+		return;
+	}
+
+	uint id = aliveIndices[aliveId];
+	keys[aliveId] = getMortonCode(vload3(id, positions), cellSize);
+	values[aliveId] = id;
+}
+
+// one work-item per alive particle of the page, in Morton order
+__kernel void gatherMortonOrder(
+	__global const uint* sortedValues,
+	__global const uint* pageAliveCounts,
+	uint pageIndex,
+	__global const float* positions,
+	__global const float* velocities,
+	__global const float* spawnTimes,
+	__global const uint* spawnIds,
+	__global float* orderedPositions,
+	__global float* orderedVelocities,
+	__global float* orderedSpawnTimes,
+	__global uint* orderedSpawnIds)
+{
+	size_t i = get_global_id(0);
+	if (i >= pageAliveCounts[pageIndex])
+	{
+		return;
+	}
+
+	uint id = sortedValues[i];
+	vstore3(vload3(id, positions), i, orderedPositions);
+	vstore3(vload3(id, velocities), i, orderedVelocities);
+	orderedSpawnTimes[i] = spawnTimes[id];
+	orderedSpawnIds[i] = spawnIds[id];
+}
+
+// one work-item per particle of the page: the alive particles take the first slots in Morton order and the alive list
+// follows them, the free list gets the other slots with the lowest on top like after initParticleState
+__kernel void writeMortonOrder(
+	__global float* positions,
+	__global float* velocities,
+	__global float* spawnTimes,
+	__global uint* spawnIds,
+	__global uchar* isAlive,
+	__global uint* aliveIndices,
+	__global const uint* pageAliveCounts,
+	uint pageIndex,
+	__global uint* freeIndices,
+	__global int* freeCount,
+	__global const float* orderedPositions,
+	__global const float* orderedVelocities,
+	__global const float* orderedSpawnTimes,
+	__global const uint* orderedSpawnIds)
+{
+	uint id = (uint)get_global_id(0);
+	uint numParticles = (uint)get_global_size(0);
+	uint count = pageAliveCounts[pageIndex];
+	if (id < count)
+	{
+		vstore3(vload3(id, orderedPositions), id, positions);
+		vstore3(vload3(id, orderedVelocities), id, velocities);
+		spawnTimes[id] = orderedSpawnTimes[id];
+		spawnIds[id] = orderedSpawnIds[id];
+		isAlive[id] = 1;
+		aliveIndices[id] = id;
+	}
+	else
+	{
+		isAlive[id] = 0;
+	}
+
+	uint numFree = numParticles - count;
+	if (id < numFree)
+	{
+		freeIndices[id] = numParticles - 1 - id;
+	}
+	if (id == 0)
+	{
+		*freeCount = (int)numFree;
+	}
+}
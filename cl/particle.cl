@@ -1,26 +1,23 @@
-// *Really* minimal PCG32 code / (c) 2014 M.E. O'Neill / pcg-random.org
-// Licensed under Apache License 2.0 (NO WARRANTY, etc. see website)
+// Philox4x32-10 counter-based generator, Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC11
+// stateless: the numbers of a particle are a function of its counter and key, there is no seeding step
 
-typedef struct { ulong state; ulong inc; } pcg32_random_t;
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
 
-uint pcg32_random_r(pcg32_random_t* rng)
+uint4 philox4x32_10(uint4 counter, uint2 key)
 {
-	ulong oldstate = rng->state;
-	// Advance internal state
-	rng->state = oldstate * 6364136223846793005UL + (rng->inc | 1);
-	// Calculate output function (XSH RR), uses old state for max ILP
-	uint xorshifted = ((oldstate >> 18u) ^ oldstate) >> 27u;
-	uint rot = oldstate >> 59u;
-	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
-}
-
-void pcg32_srandom_r(pcg32_random_t* rng, ulong initstate, ulong initseq)
-{
-	rng->state = 0U;
-	rng->inc = (initseq << 1u) | 1u;
-	pcg32_random_r(rng);
-	rng->state += initstate;
-	pcg32_random_r(rng);
+	for (int round = 0; round < 10; ++round)
+	{
+		uint hi0 = mul_hi(PHILOX_M0, counter.x);
+		uint lo0 = PHILOX_M0 * counter.x;
+		uint hi1 = mul_hi(PHILOX_M1, counter.z);
+		uint lo1 = PHILOX_M1 * counter.z;
+		counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+		key += (uint2)(PHILOX_W0, PHILOX_W1);
+	}
+	return counter;
 }
 
 //////
@@ -28,13 +25,28 @@ void pcg32_srandom_r(pcg32_random_t* rng, ulong initstate, ulong initseq)
 const float3 initialPosition = (float3)(0.f, 20.f, 0.f);
 const float3 initialVelocity = (float3)(0.f, 0.f, 0.f);
 
-typedef struct
-{
-	float3 position __attribute__((aligned(16)));
-	float3 velocity __attribute__((aligned(16)));
-	float spawnTime __attribute__((aligned(4)));
-	uchar isAlive __attribute__((aligned(1)));
-} __attribute__((aligned(64))) ParticleState;
+// particle state is stored in fixed-size pages, each a structure of arrays:
+// positions and velocities are tightly packed float3 (12 bytes per particle, see vload3/vstore3),
+// spawn times are floats, alive flags are uchars and spawn ids are the uint ordinals keying the particles' random numbers
+// every kernel but scanPageAliveCounts is launched once per page, particle indices are local to the page
+#define PARTICLE_STATE_PARAMS \
+	__global float* positions, \
+	__global float* velocities, \
+	__global float* spawnTimes, \
+	__global uchar* isAlive, \
+	__global uint* spawnIds
+
+// dense list of the indices of the page's alive particles, rebuilt every frame by compactAliveParticles
+// pageAliveCounts holds the length of the alive list of every page
+#define ALIVE_LIST_PARAMS \
+	__global const uint* aliveIndices, \
+	__global const uint* pageAliveCounts, \
+	uint pageIndex
+
+// per page stack of dead particle indices, simulateParticles pushes and spawnParticle pops
+#define FREE_LIST_PARAMS \
+	__global uint* freeIndices, \
+	volatile __global int* freeCount
 
 float3 rotateVector(float3 v, float3 k, float theta)
 {
@@ -44,24 +56,51 @@ float3 rotateVector(float3 v, float3 k, float theta)
 	return (v * cos_theta) + (cross(k, v) * sin_theta) + (k * dot(k, v)) * (1 - cos_theta);
 }
 
-typedef pcg32_random_t RngValue;
+// one stream per kernel drawing numbers, a particle spawned and simulated in the same step gets different ones
+#define RNG_STREAM_SIMULATE 0u
+#define RNG_STREAM_SPAWN 1u
+
+// the key is the run seed and the step index, the counter the particle's spawn id, the stream and the block of four
+// numbers, so numbers do not depend on the slot a particle landed in, the alive list order or the device
+// spawn ids count the particles requested since the simulation was created and wrap at 2^32, two alive particles
+// only share numbers if 2^32 spawns happen within a lifetime
+// blocks are only computed when drawn from, a particle that draws nothing costs nothing
+typedef struct
+{
+	uint4 counter;
+	uint2 key;
+	// numbers left in the current block, next one in x
+	uint4 block;
+	uint numLeft;
+} RngValue;
 typedef RngValue* Rng;
 
-void randomInit(Rng rng, int globalSeed)
+void randomInit(Rng rng, uint seed, uint step, uint stream, uint spawnId)
 {
-	ulong initState = globalSeed;
-	ulong initSeq = get_global_id(0);
-	pcg32_srandom_r(rng, initState, initSeq);
+	rng->counter = (uint4)(spawnId, 0u, stream, 0u);
+	rng->key = (uint2)(seed, step);
+	rng->numLeft = 0;
 }
 
+// rotates the block instead of indexing it, dynamically indexed private arrays end up in scratch memory on some GPUs
 uint randomUint(Rng rng)
 {
-	return pcg32_random_r(rng);
+	if (rng->numLeft == 0)
+	{
+		rng->block = philox4x32_10(rng->counter, rng->key);
+		rng->counter.w++;
+		rng->numLeft = 4;
+	}
+	uint value = rng->block.x;
+	rng->block = rng->block.yzwx;
+	rng->numLeft--;
+	return value;
 }
 
+// in [0, 1), the top 24 bits scaled by 2^-24 are exact in single precision, no fp64 needed
 float random01(Rng rng)
 {
-	return (float)((double)randomUint(rng) / UINT_MAX);
+	return (float)(randomUint(rng) >> 8) * (1.f / 16777216.f);
 }
 
 float random(Rng rng, float min, float max)
@@ -70,98 +109,80 @@ float random(Rng rng, float min, float max)
 	return min + randomFloat * (max - min);
 }
 
-__kernel void initParticleState(__global ParticleState* particles)
+__kernel void initParticleState(PARTICLE_STATE_PARAMS, FREE_LIST_PARAMS)
 {
 	size_t id = get_global_id(0);
-	__global ParticleState* particle = &particles[id];
-	particle->position = initialPosition;
-	particle->velocity = initialVelocity;
-	particle->isAlive = 0;
+	vstore3(initialPosition, id, positions);
+	vstore3(initialVelocity, id, velocities);
+	spawnTimes[id] = 0.f;
+	isAlive[id] = 0;
+
+	// the top of the stack is the last entry, lowest indices are handed out first
+	size_t numParticles = get_global_size(0);
+	freeIndices[id] = numParticles - 1 - id;
+	if (id == 0)
+	{
+		*freeCount = numParticles;
+	}
 }
 
 // uniform cylinder distribution
-void initRandomOnCylinder(__global ParticleState* particle, float radius, float height, Rng rng)
+float3 initRandomOnCylinder(float radius, float height, Rng rng)
 {
 	float randomAngle = random(rng, 0.f, M_PI_F * 2.f);
 	float randomRadius = sqrt(random(rng, 0.f, 1.f)) * radius;
 	float randomY = random(rng, height * -0.5f, height * 0.5f);
-	particle->position.x = cos(randomAngle) * randomRadius;
-	particle->position.y = randomY;
-	particle->position.z = sin(randomAngle) * randomRadius;
+	return (float3)(cos(randomAngle) * randomRadius, randomY, sin(randomAngle) * randomRadius);
 }
 
 // non uniform sphere surface distribution
-void initRandomOnSphere(__global ParticleState* particle, float radius, Rng rng)
+float3 initRandomOnSphere(float radius, Rng rng)
 {
 	float x = random(rng, -1.f, 1.f);
 	float y = random(rng, -1.f, 1.f);
 	float z = random(rng, -1.f, 1.f);
 	const float length = sqrt(x * x + y * y + z * z);
-	particle->position.x = x / length * radius;
-	particle->position.y = y / length * radius;
-	particle->position.z = z / length * radius;
+	return (float3)(x, y, z) / length * radius;
 }
 
+// launched with one work-item per particle to spawn
+// the global size is rounded up to the local size, work-items past numParticlesToSpawn do nothing
+// the spawn id is that of the work-item, the slot popped by it depends on the order of the atomics
 __kernel void spawnParticle(
-	__global ParticleState* particles,
-	__local uchar* canSpawnParticles,
+	PARTICLE_STATE_PARAMS,
+	FREE_LIST_PARAMS,
+	uint seed,
+	uint step,
+	float currentTime,
 	uint numParticlesToSpawn,
-	int globalSeed,
-	float currentTime)
+	uint firstSpawnId)
 {
-	size_t id = get_global_id(0);
-	size_t localId = get_local_id(0);
-	__global ParticleState* particle = &particles[id];
-	canSpawnParticles[localId] = !particle->isAlive;
-
-	RngValue rng;
-	randomInit(&rng, globalSeed);
-
-	barrier(CLK_LOCAL_MEM_FENCE);
-
-	if (localId == 0)
+	if (get_global_id(0) >= numParticlesToSpawn)
 	{
-		size_t localSize = get_local_size(0);
-		size_t groupId = get_group_id(0);
-		size_t numGroups = get_num_groups(0);
-
-		uint numParticleToSpawnForWorkGroup = numParticlesToSpawn / get_num_groups(0);
-		if ((groupId + globalSeed) % numGroups < numParticlesToSpawn % numGroups)
-		{
-			++numParticleToSpawnForWorkGroup;
-		}
-		numParticleToSpawnForWorkGroup = min(numParticleToSpawnForWorkGroup, (uint)localSize);
-
-		uint numSpawnedParticles = 0;
+		return;
+	}
 
-		for (uint i = 0; i < localSize; ++i)
-		{
-			if (canSpawnParticles[i])
-			{
-				if (numSpawnedParticles < numParticleToSpawnForWorkGroup)
-				{
-					++numSpawnedParticles;
-				}
-				else
-				{
-					canSpawnParticles[i] = 0;
-				}
-			}
-		}
+	// a failed pop gives its decrement back, the count never goes above zero again until the next push
+	int top = atomic_dec(freeCount);
+	if (top <= 0)
+	{
+		atomic_inc(freeCount);
+		return;
 	}
+	size_t id = freeIndices[top - 1];
+	uint spawnId = firstSpawnId + (uint)get_global_id(0);
 
-	barrier(CLK_LOCAL_MEM_FENCE);
+	RngValue rng;
+	randomInit(&rng, seed, step, RNG_STREAM_SPAWN, spawnId);
 
-	if (canSpawnParticles[localId])
-	{
-		particle->velocity = (float3)(0.f, 0.f, 0.f);
-		particle->spawnTime = currentTime;
-		particle->isAlive = 1;
+	vstore3((float3)(0.f, 0.f, 0.f), id, velocities);
+	spawnTimes[id] = currentTime;
+	isAlive[id] = 1;
+	spawnIds[id] = spawnId;
 
-		initRandomOnCylinder(particle, 45.f, 0.f, &rng);
-		//initRandomOnSphere(particle, 100.f, &rng);
-		//particle->position = (float3)(0.f, 0.f, 0.f);
-	}
+	vstore3(initRandomOnCylinder(45.f, 0.f, &rng), id, positions);
+	//vstore3(initRandomOnSphere(100.f, &rng), id, positions);
+	//vstore3((float3)(0.f, 0.f, 0.f), id, positions);
 }
 
 float remap(float value, float min1, float max1, float min2, float max2)
@@ -169,78 +190,243 @@ float remap(float value, float min1, float max1, float min2, float max2)
 	return min2 + (value - min1) * (max2 - min2) / (max1 - min1);
 }
 
-void updateVortex(__global ParticleState* particle, float minRadius, float minRadiusAngularSpeed, float maxRadius, float maxRadiusAngularSpeed, float deltaTime)
+void updateVortex(float3* position, float minRadius, float minRadiusAngularSpeed, float maxRadius, float maxRadiusAngularSpeed, float deltaTime)
 {
-	const float radius = sqrt(particle->position.x * particle->position.x + particle->position.z * particle->position.z);
+	const float radius = sqrt(position->x * position->x + position->z * position->z);
 	float angularSpeed = remap(radius, minRadius, maxRadius, minRadiusAngularSpeed, maxRadiusAngularSpeed);
 	float angle = angularSpeed * deltaTime;
-	particle->position = rotateVector(particle->position, (float3)(0.f, 1.f, 0.f), angle);
+	*position = rotateVector(*position, (float3)(0.f, 1.f, 0.f), angle);
 }
 
-void updateRadial(__global ParticleState* particle, float minRadius, float minRadiusSpeed, float maxRadius, float maxRadiusSpeed, float deltaTime)
+void updateRadial(float3* position, float minRadius, float minRadiusSpeed, float maxRadius, float maxRadiusSpeed, float deltaTime)
 {
-	const float radius = sqrt(particle->position.x * particle->position.x + particle->position.z * particle->position.z);
+	const float radius = sqrt(position->x * position->x + position->z * position->z);
 	float speed = remap(radius, minRadius, maxRadius, minRadiusSpeed, maxRadiusSpeed);
-	float3 velocity = particle->position * speed;
-	particle->position += velocity * deltaTime;
+	float3 velocity = *position * speed;
+	*position += velocity * deltaTime;
 }
 
-void accelerate(__global ParticleState* particle, float3 direction, float deltaTime)
+void accelerate(float3* velocity, float3 direction, float deltaTime)
 {
-	particle->velocity += direction * deltaTime;
+	*velocity += direction * deltaTime;
 }
 
-void applyVelocity(__global ParticleState* particle, float deltaTime)
+void randomAccelerate(float3* velocity, Rng rng, float minX, float maxX, float minY, float maxY, float minZ, float maxZ, float deltaTime)
 {
-	particle->position += particle->velocity * deltaTime;
+	float accelerationX = random(rng, minX, maxX);
+	float accelerationY = random(rng, minY, maxY);
+	float accelerationZ = random(rng, minZ, maxZ);
+	accelerate(velocity, (float3)(accelerationX, accelerationY, accelerationZ), deltaTime);
 }
 
-__kernel void updateParticleState(
-	__global ParticleState* particles,
-	int globalSeed,
-	float deltaTime)
+void applyVelocity(float3* position, float3 velocity, float deltaTime)
 {
-	size_t id = get_global_id(0);
-	__global ParticleState* particle = &particles[id];
-	if (!particle->isAlive)
+	*position += velocity * deltaTime;
+}
+
+bool checkAge(float spawnTime, float currentTime, float maxAge)
+{
+	return currentTime - spawnTime >= maxAge;
+}
+
+// force fields are 3D images of vectors filtered by the texture units, see ClForceFields
+// forceFieldBounds holds two float4 per field: the minimum of its box, then the inverse of its extent with w set to 1
+// once every brick of the image was uploaded, 0 before so that a field still streaming in pushes nothing
+#ifdef FORCE_FIELD_PARAMS
+// normalized coordinates with a zero border, particles outside the box feel nothing
+const sampler_t forceFieldSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP | CLK_FILTER_LINEAR;
+
+void applyForceField(float3* position, float3* velocity, __read_only image3d_t field, __constant float4* forceFieldBounds, uint fieldIndex,
+	float strength, float3 center, float scale, float yaw, float deltaTime)
+{
+	float4 boundsMin = forceFieldBounds[fieldIndex * 2];
+	float4 boundsScale = forceFieldBounds[fieldIndex * 2 + 1];
+	float3 local = rotateVector((*position - center) / scale, (float3)(0.f, 1.f, 0.f), -yaw);
+	float3 force = read_imagef(field, forceFieldSampler, (float4)((local - boundsMin.xyz) * boundsScale.xyz, 0.f)).xyz;
+	accelerate(velocity, rotateVector(force, (float3)(0.f, 1.f, 0.f), yaw) * (strength * boundsScale.w), deltaTime);
+}
+#else
+#define FORCE_FIELD_PARAMS
+#endif
+
+// the host generates APPLY_PARTICLE_MODIFIERS and the MAX_AGE/MODIFIER_*_PARAM_* defines from a ParticleSimulationConfig
+// the defaults below are the demo's simulation when this file is built on its own
+#ifndef APPLY_PARTICLE_MODIFIERS
+#define APPLY_PARTICLE_MODIFIERS(position, velocity, rng, deltaTime) \
+	randomAccelerate(velocity, rng, -50.f, 50.f, -5.f, -10.f, -50.f, 50.f, deltaTime);
+#endif
+
+#ifndef MAX_AGE
+#define MAX_AGE 5.f
+#endif
+
+// one read-modify-write per alive particle per frame: death test, modifiers then integration
+__kernel void simulateParticles(
+	PARTICLE_STATE_PARAMS,
+	ALIVE_LIST_PARAMS,
+	FREE_LIST_PARAMS,
+	uint seed,
+	uint step,
+	float currentTime,
+	float deltaTime
+	FORCE_FIELD_PARAMS)
+{
+	size_t aliveId = get_global_id(0);
+	if (aliveId >= pageAliveCounts[pageIndex])
 	{
 		return;
 	}
+	size_t id = aliveIndices[aliveId];
 
-	RngValue rng;
-	randomInit(&rng, globalSeed);
+	if (checkAge(spawnTimes[id], currentTime, MAX_AGE))
+	{
+		isAlive[id] = 0;
+		vstore3(initialPosition, id, positions);
+		freeIndices[atomic_inc(freeCount)] = id;
+		return;
+	}
+
+	float3 position = vload3(id, positions);
+	float3 velocity = vload3(id, velocities);
 
-	//updateVortex(particle, 0.f, -2.f, 50.f, 0.f, deltaTime);
-	//updateRadial(particle, 0.f, -0.6f, 50.f, 0.f, deltaTime);
+	RngValue rng;
+	randomInit(&rng, seed, step, RNG_STREAM_SIMULATE, spawnIds[id]);
 
-	float accelerationX = random(&rng, -50.f, 50.f);
-	float accelerationY = random(&rng, -5.f, -10.f);
-	float accelerationZ = random(&rng, -50.f, 50.f);
-	float3 acceleration = (float3)(accelerationX, accelerationY, accelerationZ);
-	accelerate(particle, acceleration, deltaTime);
+	APPLY_PARTICLE_MODIFIERS(&position, &velocity, &rng, deltaTime)
 
-	//accelerate(particle, (float3)(0.f, -10.f, 0.f), deltaTime);
+	applyVelocity(&position, velocity, deltaTime);
 
-	applyVelocity(particle, deltaTime);
+	vstore3(position, id, positions);
+	vstore3(velocity, id, velocities);
 }
 
-bool checkAge(__global ParticleState* particle, float currentTime, float maxAge)
+// alive list compaction: countAliveParticles and scanBlockCounts for every page, scanPageAliveCounts once,
+// then compactAliveParticles for every page
+// blocks are one work-group wide, the per page kernels must be launched with the same local size
+
+// returns the exclusive prefix sum of value over the work-group, scratch[get_local_size(0) - 1] holds the inclusive total
+uint workGroupExclusiveScan(uint value, __local uint* scratch)
 {
-	return currentTime - particle->spawnTime >= maxAge;
+	size_t localId = get_local_id(0);
+	size_t localSize = get_local_size(0);
+
+	scratch[localId] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (size_t offset = 1; offset < localSize; offset <<= 1)
+	{
+		uint previous = localId >= offset ? scratch[localId - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[localId] += previous;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	return scratch[localId] - value;
 }
 
-__kernel void checkParticleDeath(__global ParticleState* particles, float currentTime)
+__kernel void countAliveParticles(
+	__global const uchar* isAlive,
+	__global uint* blockCounts,
+	uint numParticles,
+	__local uint* scratch)
 {
 	size_t id = get_global_id(0);
-	__global ParticleState* particle = &particles[id];
-	if (!particle->isAlive)
+	uint alive = id < numParticles && isAlive[id] ? 1 : 0;
+
+	workGroupExclusiveScan(alive, scratch);
+
+	if (get_local_id(0) == 0)
 	{
-		return;
+		blockCounts[get_group_id(0)] = scratch[get_local_size(0) - 1];
 	}
+}
 
-	if (checkAge(particle, currentTime, 5.f))
+// launched as a single work-group, turns block counts into block offsets and writes the page's alive count
+__kernel void scanBlockCounts(
+	__global uint* blockCounts,
+	uint numBlocks,
+	__global uint* pageAliveCounts,
+	uint pageIndex,
+	__local uint* scratch)
+{
+	size_t localId = get_local_id(0);
+	size_t localSize = get_local_size(0);
+
+	uint carry = 0;
+	for (uint base = 0; base < numBlocks; base += localSize)
 	{
-		particle->isAlive = 0;
-		particle->position = initialPosition;
+		uint i = base + localId;
+		uint count = i < numBlocks ? blockCounts[i] : 0;
+		uint offset = workGroupExclusiveScan(count, scratch);
+		uint total = scratch[localSize - 1];
+		if (i < numBlocks)
+		{
+			blockCounts[i] = carry + offset;
+		}
+		carry += total;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (localId == 0)
+	{
+		pageAliveCounts[pageIndex] = carry;
+	}
+}
+
+// launched as a single work-item, pages are few: turns page alive counts into offsets in the render positions
+// aliveCount[0] is the number of render positions written, which is copied into the indirect draw command,
+// aliveCount[1] is the number of alive particles
+__kernel void scanPageAliveCounts(
+	__global const uint* pageAliveCounts,
+	uint numPages,
+	__global uint* pageOffsets,
+	uint renderCapacity,
+	__global uint* aliveCount)
+{
+	uint total = 0;
+	for (uint i = 0; i < numPages; ++i)
+	{
+		pageOffsets[i] = total;
+		total += pageAliveCounts[i];
+	}
+
+	aliveCount[0] = min(total, renderCapacity);
+	aliveCount[1] = total;
+}
+
+// also gathers the positions of alive particles, densely packed after those of the previous pages, into the render slot
+// being written, positions past renderCapacity are not drawn, a renderCapacity of 0 only rebuilds the alive list
+// positions are moved back along the last step by renderTimeOffset (<= 0) to land between the last two states,
+// exact for applyVelocity which integrates the updated velocity but blind to updateVortex and updateRadial, which move
+// the position itself: the host passes 0 when those are compiled in, see hasPositionModifiers
+__kernel void compactAliveParticles(
+	__global const uchar* isAlive,
+	__global const uint* blockOffsets,
+	__global uint* aliveIndices,
+	__global const float* positions,
+	__global const float* velocities,
+	__global const uint* pageOffsets,
+	uint pageIndex,
+	__global float* renderPositions,
+	float renderTimeOffset,
+	uint renderCapacity,
+	uint numParticles,
+	__local uint* scratch)
+{
+	size_t id = get_global_id(0);
+	uint alive = id < numParticles && isAlive[id] ? 1 : 0;
+
+	uint offset = workGroupExclusiveScan(alive, scratch);
+
+	if (alive)
+	{
+		uint aliveId = blockOffsets[get_group_id(0)] + offset;
+		aliveIndices[aliveId] = id;
+
+		uint renderId = pageOffsets[pageIndex] + aliveId;
+		if (renderId < renderCapacity)
+		{
+			vstore3(vload3(id, positions) + vload3(id, velocities) * renderTimeOffset, renderId, renderPositions);
+		}
 	}
 }
\ No newline at end of file
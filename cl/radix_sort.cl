@@ -0,0 +1,145 @@
+// least significant digit radix sort of uint key/value pairs, 4 bits per pass, see ClRadixSort
+// every kernel is launched over the same blocks of one work-item per pair and the same local size,
+// the number of pairs is only known on the device, pairs past it are left alone
+
+#define RADIX_BITS 4
+#define RADIX 16
+
+// returns the exclusive prefix sum of value over the work-group, scratch[get_local_size(0) - 1] holds the inclusive total
+uint workGroupExclusiveScan(uint value, __local uint* scratch)
+{
+	size_t localId = get_local_id(0);
+	size_t localSize = get_local_size(0);
+
+	scratch[localId] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (size_t offset = 1; offset < localSize; offset <<= 1)
+	{
+		uint previous = localId >= offset ? scratch[localId - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[localId] += previous;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	return scratch[localId] - value;
+}
+
+// digit counts of every block, stored digit-major so that one scan gives every block its offset for every digit
+__kernel void radixSortHistogram(
+	__global const uint* keys,
+	__global const uint* numElements,
+	uint numElementsIndex,
+	uint shift,
+	__global uint* blockHistograms,
+	__local uint* histogram)
+{
+	size_t id = get_global_id(0);
+	size_t localId = get_local_id(0);
+
+	if (localId < RADIX)
+	{
+		histogram[localId] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (id < numElements[numElementsIndex])
+	{
+		atomic_inc(&histogram[(keys[id] >> shift) & (RADIX - 1)]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (localId < RADIX)
+	{
+		blockHistograms[localId * get_num_groups(0) + get_group_id(0)] = histogram[localId];
+	}
+}
+
+// launched as a single work-group, turns the block histograms into exclusive offsets in place
+__kernel void radixSortScan(
+	__global uint* blockHistograms,
+	uint numEntries,
+	__local uint* scratch)
+{
+	size_t localId = get_local_id(0);
+	size_t localSize = get_local_size(0);
+
+	uint carry = 0;
+	for (uint base = 0; base < numEntries; base += localSize)
+	{
+		uint i = base + localId;
+		uint count = i < numEntries ? blockHistograms[i] : 0;
+		uint offset = workGroupExclusiveScan(count, scratch);
+		uint total = scratch[localSize - 1];
+		if (i < numEntries)
+		{
+			blockHistograms[i] = carry + offset;
+		}
+		carry += total;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+// sorts the block by the digit in local memory with one split per bit, which keeps it stable,
+// then writes every pair at its block's offset for the digit plus its rank among the block's pairs with that digit
+// pairs past the end are given the largest key so that they sort after every pair of the block
+__kernel void radixSortScatter(
+	__global const uint* keysIn,
+	__global const uint* valuesIn,
+	__global uint* keysOut,
+	__global uint* valuesOut,
+	__global const uint* numElements,
+	uint numElementsIndex,
+	uint shift,
+	__global const uint* blockOffsets,
+	__local uint* localKeys,
+	__local uint* localValues,
+	__local uint* digitStarts,
+	__local uint* scratch)
+{
+	size_t id = get_global_id(0);
+	size_t localId = get_local_id(0);
+	size_t localSize = get_local_size(0);
+
+	uint count = numElements[numElementsIndex];
+	size_t blockStart = get_group_id(0) * localSize;
+	if (blockStart >= count)
+	{
+		return;
+	}
+	uint numValid = min((uint)localSize, (uint)(count - blockStart));
+
+	uint key = id < count ? keysIn[id] : 0xFFFFFFFFu;
+	uint value = id < count ? valuesIn[id] : 0;
+
+	for (uint bit = 0; bit < RADIX_BITS; ++bit)
+	{
+		uint isSet = (key >> (shift + bit)) & 1;
+		uint zerosBefore = workGroupExclusiveScan(1 - isSet, scratch);
+		uint numZeros = scratch[localSize - 1];
+		uint position = isSet ? numZeros + (uint)localId - zerosBefore : zerosBefore;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		localKeys[position] = key;
+		localValues[position] = value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		key = localKeys[localId];
+		value = localValues[localId];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	uint digit = (key >> shift) & (RADIX - 1);
+	if (localId < numValid && (localId == 0 || digit != ((localKeys[localId - 1] >> shift) & (RADIX - 1))))
+	{
+		digitStarts[digit] = localId;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (localId < numValid)
+	{
+		uint position = blockOffsets[digit * get_num_groups(0) + get_group_id(0)] + (uint)localId - digitStarts[digit];
+		keysOut[position] = key;
+		valuesOut[position] = value;
+	}
+}
@@ -0,0 +1,323 @@
+// uniform grid over the alive particles, rebuilt every frame by ClSpatialGrid
+// cells are hashed into a table of a power of two entries, particles are sorted by entry so that the particles of an
+// entry are contiguous between its start and end
+// cells far apart can share an entry, their particles are told apart by the cell of their own position
+
+#define GRID_CELL_EMPTY 0xFFFFFFFFu
+
+// the grid as kernel parameters, for kernels iterating neighbours, see ClSpatialGrid::setGridArgs
+// gridPositions and gridParticles are in sorted order, gridParticles holds pageIndex * pageSize + index in the page
+#define SPATIAL_GRID_PARAMS \
+	__global const uint* gridCellStarts, \
+	__global const uint* gridCellEnds, \
+	__global const float* gridPositions, \
+	__global const uint* gridParticles, \
+	float gridCellSize, \
+	uint gridCellMask
+
+#define SPATIAL_GRID_ARGS gridCellStarts, gridCellEnds, gridPositions, gridParticles, gridCellSize, gridCellMask
+
+int3 getGridCell(float3 position, float cellSize)
+{
+	return convert_int3(floor(position / cellSize));
+}
+
+uint hashGridCell(int3 cell, uint cellMask)
+{
+	return ((uint)cell.x * 73856093u ^ (uint)cell.y * 19349663u ^ (uint)cell.z * 83492791u) & cellMask;
+}
+
+// iterates the particles within radius of center, cell by cell:
+//     NeighbourIterator it = beginNeighbours(center, radius, gridCellSize);
+//     uint i;
+//     while (nextNeighbour(&it, SPATIAL_GRID_ARGS, &i))
+//     {
+//         float3 neighbourPosition = vload3(i, gridPositions);
+//         ...
+//     }
+// a radius of half a cell or less visits at most 8 cells
+typedef struct
+{
+	float3 center;
+	float radiusSquared;
+	int3 firstCell;
+	int3 numCells;
+	int3 cell;
+	int cellIndex;
+	uint next;
+	uint end;
+} NeighbourIterator;
+
+NeighbourIterator beginNeighbours(float3 center, float radius, float cellSize)
+{
+	NeighbourIterator it;
+	it.center = center;
+	it.radiusSquared = radius * radius;
+	it.firstCell = getGridCell(center - radius, cellSize);
+	it.numCells = getGridCell(center + radius, cellSize) - it.firstCell + 1;
+	it.cell = it.firstCell;
+	it.cellIndex = -1;
+	it.next = 0;
+	it.end = 0;
+	return it;
+}
+
+// sets index to the sorted index of the next particle within the radius, false once every cell was visited
+bool nextNeighbour(NeighbourIterator* it, SPATIAL_GRID_PARAMS, uint* index)
+{
+	for (;;)
+	{
+		while (it->next < it->end)
+		{
+			uint i = it->next++;
+			float3 position = vload3(i, gridPositions);
+			float3 offset = position - it->center;
+			if (dot(offset, offset) <= it->radiusSquared && all(getGridCell(position, gridCellSize) == it->cell))
+			{
+				*index = i;
+				return true;
+			}
+		}
+
+		if (++it->cellIndex >= it->numCells.x * it->numCells.y * it->numCells.z)
+		{
+			return false;
+		}
+
+		it->cell = it->firstCell + (int3)(
+			it->cellIndex % it->numCells.x,
+			it->cellIndex / it->numCells.x % it->numCells.y,
+			it->cellIndex / (it->numCells.x * it->numCells.y));
+		uint entry = hashGridCell(it->cell, gridCellMask);
+		it->next = gridCellStarts[entry];
+		it->end = it->next != GRID_CELL_EMPTY ? gridCellEnds[entry] : 0;
+	}
+}
+
+// grid build: clearGridCells, computeGridKeys for every page, the radix sort of cl/radix_sort.cl by key,
+// then buildGridCells; numParticles holds the alive count copied from the simulation
+
+__kernel void clearGridCells(__global uint* cellStarts)
+{
+	cellStarts[get_global_id(0)] = GRID_CELL_EMPTY;
+}
+
+// one work-item per alive particle of the page, in the order of the render positions
+__kernel void computeGridKeys(
+	__global const float* positions,
+	__global const uint* aliveIndices,
+	__global const uint* pageAliveCounts,
+	__global const uint* pageOffsets,
+	uint pageIndex,
+	uint pageSize,
+	float cellSize,
+	uint cellMask,
+	__global uint* keys,
+	__global uint* values,
+	__global float* unsortedPositions,
+	__global uint* unsortedParticles)
+{
+	size_t aliveId = get_global_id(0);
+	if (aliveId >= pageAliveCounts[pageIndex])
+	{
+		return;
+	}
+
+	uint id = aliveIndices[aliveId];
+	uint gridId = pageOffsets[pageIndex] + (uint)aliveId;
+	float3 position = vload3(id, positions);
+
+	keys[gridId] = hashGridCell(getGridCell(position, cellSize), cellMask);
+	values[gridId] = gridId;
+	vstore3(position, gridId, unsortedPositions);
+	unsortedParticles[gridId] = pageIndex * pageSize + id;
+}
+
+// one work-item per sorted particle: the first and last particles of an entry write its bounds,
+// positions and particle references are gathered in sorted order so that an entry's particles are contiguous
+__kernel void buildGridCells(
+	__global const uint* sortedKeys,
+	__global const uint* sortedValues,
+	__global const uint* numParticles,
+	__global const float* unsortedPositions,
+	__global const uint* unsortedParticles,
+	__global uint* cellStarts,
+	__global uint* cellEnds,
+	__global float* gridPositions,
+	__global uint* gridParticles)
+{
+	uint i = (uint)get_global_id(0);
+	uint count = numParticles[0];
+	if (i >= count)
+	{
+		return;
+	}
+
+	uint key = sortedKeys[i];
+	if (i == 0 || key != sortedKeys[i - 1])
+	{
+		cellStarts[key] = i;
+	}
+	if (i == count - 1 || key != sortedKeys[i + 1])
+	{
+		cellEnds[key] = i + 1;
+	}
+
+	uint gridId = sortedValues[i];
+	vstore3(vload3(gridId, unsortedPositions), i, gridPositions);
+	gridParticles[i] = unsortedParticles[gridId];
+}
+
+// queries: initGridQuery then the query kernel, writing the two uints of results, then the readback of results
+// queries run one after the other on the in-order queue and share results
+// the query kernels run one work-item per cell of the region, or per particle when scanAll is set because the region
+// spans more cells than there are particles
+#define GRID_QUERY_PARAMS \
+	__global const uint* numParticles, \
+	int4 firstCell, \
+	int4 numCells, \
+	uint scanAll, \
+	__global uint* results
+
+__kernel void initGridQuery(
+	__global uint* results,
+	uint value0,
+	uint value1)
+{
+	results[0] = value0;
+	results[1] = value1;
+}
+
+// region of the query, a box narrowed to a sphere when sphere.w is not negative
+bool isInRegion(float3 position, float4 boxMin, float4 boxMax, float4 sphere)
+{
+	if (any(position < boxMin.xyz) || any(position > boxMax.xyz))
+	{
+		return false;
+	}
+	float3 offset = position - sphere.xyz;
+	return sphere.w < 0.f || dot(offset, offset) <= sphere.w * sphere.w;
+}
+
+// range of sorted particles the work-item looks at and the cell they must be in, none if cell mode and the entry is empty
+bool getQueryRange(SPATIAL_GRID_PARAMS, __global const uint* numParticles, int4 firstCell, int4 numCells, uint scanAll,
+	uint* begin, uint* end, int3* cell)
+{
+	size_t id = get_global_id(0);
+	if (scanAll)
+	{
+		*begin = (uint)id;
+		*end = min((uint)id + 1, numParticles[0]);
+		return *begin < *end;
+	}
+
+	if (id >= (size_t)(numCells.x * numCells.y * numCells.z))
+	{
+		return false;
+	}
+
+	int cellId = (int)id;
+	*cell = firstCell.xyz + (int3)(cellId % numCells.x, cellId / numCells.x % numCells.y, cellId / (numCells.x * numCells.y));
+	uint entry = hashGridCell(*cell, gridCellMask);
+	*begin = gridCellStarts[entry];
+	*end = *begin != GRID_CELL_EMPTY ? gridCellEnds[entry] : 0;
+	return *begin < *end;
+}
+
+// results: the number of particles in the region, unused
+__kernel void countGridRegion(
+	SPATIAL_GRID_PARAMS,
+	GRID_QUERY_PARAMS,
+	float4 boxMin,
+	float4 boxMax,
+	float4 sphere)
+{
+	__local uint groupCount;
+	if (get_local_id(0) == 0)
+	{
+		groupCount = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint begin;
+	uint end;
+	int3 cell;
+	uint count = 0;
+	if (getQueryRange(SPATIAL_GRID_ARGS, numParticles, firstCell, numCells, scanAll, &begin, &end, &cell))
+	{
+		for (uint i = begin; i < end; ++i)
+		{
+			float3 position = vload3(i, gridPositions);
+			if (isInRegion(position, boxMin, boxMax, sphere) && (scanAll || all(getGridCell(position, gridCellSize) == cell)))
+			{
+				++count;
+			}
+		}
+	}
+
+	if (count > 0)
+	{
+		atomic_add(&groupCount, count);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0 && groupCount > 0)
+	{
+		atomic_add(&results[0], groupCount);
+	}
+}
+
+// launched twice, results: the bits of the smallest squared distance, initialized to the largest one allowed,
+// then the smallest particle reference at that distance, initialized to GRID_CELL_EMPTY
+// positive floats compare like their bits, the first pass finds the distance and the second the particle
+__kernel void findGridNearest(
+	SPATIAL_GRID_PARAMS,
+	GRID_QUERY_PARAMS,
+	float4 point,
+	uint findParticle)
+{
+	__local uint groupNearest;
+	if (get_local_id(0) == 0)
+	{
+		groupNearest = GRID_CELL_EMPTY;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint nearestDistance = results[0];
+	uint begin;
+	uint end;
+	int3 cell;
+	uint nearest = GRID_CELL_EMPTY;
+	if (getQueryRange(SPATIAL_GRID_ARGS, numParticles, firstCell, numCells, scanAll, &begin, &end, &cell))
+	{
+		for (uint i = begin; i < end; ++i)
+		{
+			float3 position = vload3(i, gridPositions);
+			float3 offset = position - point.xyz;
+			uint distance = as_uint(dot(offset, offset));
+			if (distance > nearestDistance || !(scanAll || all(getGridCell(position, gridCellSize) == cell)))
+			{
+				continue;
+			}
+			if (findParticle)
+			{
+				nearest = distance == nearestDistance ? min(nearest, gridParticles[i]) : nearest;
+			}
+			else
+			{
+				nearest = min(nearest, distance);
+			}
+		}
+	}
+
+	if (nearest != GRID_CELL_EMPTY)
+	{
+		atomic_min(&groupNearest, nearest);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0 && groupNearest != GRID_CELL_EMPTY)
+	{
+		atomic_min(&results[findParticle], groupNearest);
+	}
+}
@@ -0,0 +1,32 @@
+#version 330 core
+
+// one instance per particle, a triangle strip of 4 vertices each, no geometry shader
+layout(location = 0) in vec4 position;
+
+// updated once per frame, shared by every particle program
+layout(std140) uniform FrameUniforms
+{
+	mat4 modelViewMatrix;
+	mat4 projectionMatrix;
+	mat4 modelViewProjectionMatrix;
+};
+
+out vec2 uv;
+
+// Vulkan GLSL names gl_VertexID gl_VertexIndex
+#ifdef VULKAN
+#define VERTEX_ID gl_VertexIndex
+#else
+#define VERTEX_ID gl_VertexID
+#endif
+
+void main()
+{
+	const float particleSize = 0.2;
+
+	// bottom left, top left, bottom right, top right, the order shader.geom emits
+	vec2 corner = vec2(float(VERTEX_ID >> 1), float(VERTEX_ID & 1));
+	uv = corner;
+
+	gl_Position = modelViewProjectionMatrix * vec4(position.xy + (corner - 0.5) * particleSize, position.zw);
+}
\ No newline at end of file
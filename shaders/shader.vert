@@ -1,6 +1,6 @@
-#version 150
+#version 330 core
 
-in vec4 position;
+layout(location = 0) in vec4 position;
 
 void main()
 {
@@ -5,6 +5,11 @@
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
 #include <CL/opencl.h>
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
@@ -15,6 +20,25 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/norm.hpp>
 
+#include "compute/ClAutotuner.h"
+#include "compute/ClDepthSort.h"
+#include "compute/ClDevice.h"
+#include "compute/ClDeviceSelection.h"
+#include "compute/ClErrors.h"
+#include "compute/ClFrustumCull.h"
+#include "compute/ClMortonOrder.h"
+#include "compute/ClParticleDeviceGroup.h"
+#include "compute/ClParticleSimulation.h"
+#include "compute/ClProgramCache.h"
+#include "compute/ClSpatialGrid.h"
+#include "engine/BinaryCache.h"
+#include "engine/FixedTimestep.h"
+#include "engine/PhaseTimings.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/VectorField.h"
+#include "GlParticleSimulation.h"
+#include "GlProgramCache.h"
+
 #ifdef _WIN32
 #include <windows.h>
 #define getCurrentDeviceContext() wglGetCurrentDC()
@@ -23,7 +47,130 @@
 #error Unsupported platform
 #endif
 
-#define GL_SHARING_EXTENSION "cl_khr_gl_sharing"
+#define GL_EVENT_EXTENSION "cl_khr_gl_event"
+
+// bytes of force field bricks queued per device and frame, a field of 128^3 voxels takes 8 frames
+const size_t FORCE_FIELD_UPLOAD_BUDGET = 4 << 20;
+
+// the side of the particle quads, particleSize in shaders/shader.geom and shaders/billboard.vert
+const float PARTICLE_SIZE = 0.2f;
+
+// layout(location = 0) of the particle vertex shaders
+const GLuint POSITION_ATTRIBUTE = 0;
+// uniform buffer binding point of FrameUniforms, bound once
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+
+// FrameUniforms of the particle shaders, std140
+struct FrameUniforms
+{
+	glm::mat4 modelViewMatrix;
+	glm::mat4 projectionMatrix;
+	glm::mat4 modelViewProjectionMatrix;
+};
+
+// extension entry points are queried at runtime, the import library does not export them
+typedef cl_event (CL_API_CALL *clCreateEventFromGLsyncKHR_fn)(cl_context context, cl_GLsync sync, cl_int* errcodeRet);
+
+// GL buffers one frame of simulation is written to, OpenCL and GL alternate between several of them
+struct RenderSlot
+{
+	GLuint positionVbo = 0;
+	// particles positionVbo can hold, follows the capacity of the simulation
+	size_t positionCapacity = 0;
+	GLuint drawCommandVbo = 0;
+	// shared with the GL buffers, or plain OpenCL buffers copied to them through the host without sharing
+	cl_mem positionVboCl = nullptr;
+	cl_mem drawCommandVboCl = nullptr;
+
+	// without sharing: CL_MEM_ALLOC_HOST_PTR copies of the used positions and the draw commands,
+	// mapped for reading once the frame is written and unmapped once uploaded to GL
+	cl_mem positionStagingCl = nullptr;
+	cl_mem drawCommandStagingCl = nullptr;
+	const cl_float* mappedPositions = nullptr;
+	const ClDrawArraysIndirectCommand* mappedDrawCommands = nullptr;
+	size_t numStagedPositions = 0;
+	// positionVbo mapped for good when created with GL_MAP_PERSISTENT_BIT
+	void* persistentPositions = nullptr;
+	// positionVbo as attribute 0, per vertex for the geometry shader and per instance for the instanced quads
+	GLuint pointVertexArray = 0;
+	GLuint instancedVertexArray = 0;
+
+	// signaled once GL is done drawing the slot
+	GLsync drawFence = nullptr;
+	// signaled once OpenCL is done writing the slot
+	cl_event releaseEvent = nullptr;
+
+	cl_uint aliveParticleCount = 0;
+	// alive particles including those past positionCapacity, which are simulated but not drawn
+	cl_uint totalAliveCount = 0;
+
+	// commands of the frame that wrote the slot, read once the slot is drawn
+	std::vector<ClProfilingEvent> profilingEvents;
+	// GL_TIME_ELAPSED around the last draw of the slot, read when the slot is drawn again
+	GLuint drawTimeQuery = 0;
+	bool drawTimeQueryPending = false;
+	// the phase of the pending query, the billboard mode may have changed since
+	const char* drawTimePhase = "gl/draw";
+};
+
+const unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+
+// how each particle position is expanded into a textured quad
+enum class BillboardMode
+{
+	// shaders/shader.geom emits a triangle strip per point
+	GeometryShader,
+	// shaders/billboard.vert draws a 4 vertex strip per instance, the position is a per-instance attribute
+	Instanced,
+};
+
+const char* getBillboardModeName(BillboardMode billboardMode)
+{
+	return billboardMode == BillboardMode::Instanced ? "instanced quads" : "geometry shader";
+}
+
+// where the particles are simulated
+enum class SimulationBackend
+{
+	// cl/particle.cl on the OpenCL devices, positions reach GL through shared buffers or host copies
+	OpenCl,
+	// shaders/particle.comp on the GL context, see GlParticleSimulation
+	ComputeShader,
+};
+
+// host transfers of render slots, for devices without GL sharing
+enum class HostTransfer
+{
+	None,
+	// GL_ARB_buffer_storage positions mapped once, written after waiting on the slot's draw fence
+	Persistent,
+	// positions reallocated with glBufferData every upload so GL never waits on a previous draw
+	Orphan,
+};
+
+// reallocates the position VBO of a render slot, the vertex arrays of the slot are created or pointed at the new buffer
+void allocateRenderSlotPositions(RenderSlot& slot, size_t capacity, HostTransfer hostTransfer);
+
+// also recreates the OpenCL objects of the position VBO, the slot must not be in use by either API
+cl_int resizeRenderSlotPositions(RenderSlot& slot, cl_context context, size_t capacity, HostTransfer hostTransfer);
+
+// copies the first numPositions positions and the draw commands to the staging buffers and maps them, without blocking
+// the mapping of the draw commands is the last command, its event tells when the slot can be uploaded
+cl_int enqueueRenderSlotDownload(RenderSlot& slot, cl_command_queue commandQueue, size_t numPositions, size_t numDrawCommands,
+	std::vector<ClProfilingEvent>* profilingEvents, cl_event* event);
+
+// writes the drawn positions and the draw commands of a downloaded slot to its GL buffers and unmaps the staging buffers
+// numBytes is set to the bytes copied
+cl_int uploadRenderSlot(RenderSlot& slot, cl_command_queue commandQueue, size_t numDrawCommands, HostTransfer hostTransfer, size_t* numBytes);
+
+// buffers and textures are set up with direct state access when the context has it (GL 4.5 or
+// GL_ARB_direct_state_access) and bound to GL_ARRAY_BUFFER or their target to be edited otherwise
+bool hasDirectStateAccess();
+GLuint createBuffer();
+void setBufferData(GLuint buffer, size_t size, const void* data, GLenum usage);
+void setBufferSubData(GLuint buffer, size_t offset, size_t size, const void* data);
+// attribute POSITION_ATTRIBUTE of vertexArray reads three floats per vertex, or per instance with a divisor of 1
+void setPositionAttribute(GLuint vertexArray, GLuint buffer, GLuint divisor);
 
 // read shader or opencl file
 std::string readFile(const std::string& filePath);
@@ -32,14 +179,14 @@ std::string readFile(const std::string& filePath);
 GLuint loadImage(const std::string& filePath);
 
 // shaders
-GLuint compileProgram(GLuint vertexShaderId, GLuint geometryShaderId, GLuint fragmentShaderId);
+// compiles and links the shaders, each a type and a source, or loads the program from the binary cache
+// returns 0 and prints the log on failure
+GLuint loadProgram(BinaryCache& binaryCache, const std::vector<std::pair<GLenum, std::string>>& shaderSources);
+GLuint compileProgram(const std::vector<GLuint>& shaderIds);
 bool checkProgram(GLuint programId);
 GLuint loadShader(GLenum shaderType, const GLchar* source);
 bool checkShader(GLuint shaderId);
 
-// OpenCL
-const char* getErrorString(cl_int error);
-std::string getErrorLog(cl_program program, cl_device_id deviceId);
 
 #define DEBUG_BREAK() *(int*)0 = 0
 
@@ -58,7 +205,7 @@ std::string getErrorLog(cl_program program, cl_device_id deviceId);
 		std::cerr << #function " returned " << code << ": " << getErrorString(code)	\
 			<< " (line " << __LINE__ << ")" << std::endl							\
 			<< "Log:" << std::endl													\
-			<< getErrorLog(program, deviceId) << std::endl;							\
+			<< getProgramBuildLog(program, deviceId) << std::endl;							\
 		DEBUG_BREAK();																\
 		return EXIT_FAILURE;														\
 	}
@@ -66,6 +213,157 @@ std::string getErrorLog(cl_program program, cl_device_id deviceId);
 
 int main(int argc, char* argv[])
 {
+	// 1 runs OpenCL and GL in lockstep, more lets OpenCL simulate frame N while GL draws frame N - 1
+	unsigned int framesInFlight = 2;
+	// simulation steps per second, and the most steps run in a single frame before simulated time is dropped
+	double simulationRate = 120.0;
+	unsigned int maxSubsteps = 8;
+	// enables OpenCL, GL and host timings, summarized at exit in CSV (or JSON if the path ends with .json)
+	std::string timingsPath;
+	// work sizes and build options are tuned once per device and reused, --autotune tunes again
+	bool autotune = true;
+	bool forceAutotune = false;
+	// particle storage grows and shrinks with the alive count in pages, up to maxNumParticles
+	size_t maxNumParticles = 1000000;
+	size_t pageSize = ClParticleSimulation::DEFAULT_PAGE_SIZE;
+	float particleSpawnRate = 200000.f;
+	// particles are only simulated on the device sharing the GL context, "--devices all" partitions them between every
+	// OpenCL device
+	bool allDevices = false;
+	// every device is calibrated once and the fastest one sharing the GL context is used, unless overridden
+	// by "cpu", "gpu", "platform:device" or part of a device name
+	std::string deviceOverride = getDefaultDeviceOverride();
+	bool forceDeviceScoring = false;
+	// seeds the particle random numbers, random unless set
+	cl_uint seed = 0;
+	bool seedSet = false;
+	// without GL sharing, positions reach GL through persistently mapped buffers if supported, orphaned ones otherwise
+	bool persistentMapping = true;
+	// rebuilds a spatial grid of the particles every frame and counts those around the view center, 0 skips it
+	float gridCellSize = 0.f;
+	// the render positions are sorted back to front every frame so that alpha blending composes them in order
+	bool depthSort = true;
+	// positions outside the view or covering less than minPixelSize pixels are dropped every frame before the draw
+	bool culling = true;
+	float minPixelSize = 1.f;
+	// reorders the particle storage by Morton code every this many frames for locality, 0 never does
+	unsigned int mortonOrderInterval = 0;
+	// FGA vector fields accelerating the particles, each sampled by a ForceField modifier with its index
+	std::vector<std::string> forceFieldPaths;
+	// instanced quads unless the context is older than 3.3, B switches between both while running
+	BillboardMode billboardMode = BillboardMode::Instanced;
+	// OpenCL, or GL 4.3 compute shaders without any OpenCL device, culling, depth sort, grid or Morton order
+	SimulationBackend backend = SimulationBackend::OpenCl;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			framesInFlight = static_cast<unsigned int>(std::max(1, std::min(atoi(argv[++i]), static_cast<int>(MAX_FRAMES_IN_FLIGHT))));
+		}
+		else if (strcmp(argv[i], "--simulation-rate") == 0 && i + 1 < argc)
+		{
+			simulationRate = std::max(1.0, atof(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--max-substeps") == 0 && i + 1 < argc)
+		{
+			maxSubsteps = static_cast<unsigned int>(std::max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--timings") == 0 && i + 1 < argc)
+		{
+			timingsPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--autotune") == 0)
+		{
+			forceAutotune = true;
+		}
+		else if (strcmp(argv[i], "--no-autotune") == 0)
+		{
+			autotune = false;
+		}
+		else if (strcmp(argv[i], "--max-particles") == 0 && i + 1 < argc)
+		{
+			maxNumParticles = static_cast<size_t>(std::max(1.0, atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc)
+		{
+			pageSize = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--spawn-rate") == 0 && i + 1 < argc)
+		{
+			particleSpawnRate = std::max(0.f, static_cast<float>(atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc)
+		{
+			allDevices = strcmp(argv[++i], "all") == 0;
+		}
+		else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+		{
+			deviceOverride = argv[++i];
+		}
+		else if (strcmp(argv[i], "--calibrate-devices") == 0)
+		{
+			forceDeviceScoring = true;
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = static_cast<cl_uint>(strtoul(argv[++i], nullptr, 10));
+			seedSet = true;
+		}
+		else if (strcmp(argv[i], "--orphan-buffers") == 0)
+		{
+			persistentMapping = false;
+		}
+		else if (strcmp(argv[i], "--spatial-grid") == 0 && i + 1 < argc)
+		{
+			gridCellSize = std::max(0.f, static_cast<float>(atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--no-depth-sort") == 0)
+		{
+			depthSort = false;
+		}
+		else if (strcmp(argv[i], "--no-culling") == 0)
+		{
+			culling = false;
+		}
+		else if (strcmp(argv[i], "--min-pixel-size") == 0 && i + 1 < argc)
+		{
+			minPixelSize = std::max(0.f, static_cast<float>(atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--morton-order") == 0 && i + 1 < argc)
+		{
+			mortonOrderInterval = static_cast<unsigned int>(std::max(0, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "--force-field") == 0 && i + 1 < argc)
+		{
+			forceFieldPaths.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--billboards") == 0 && i + 1 < argc)
+		{
+			billboardMode = strcmp(argv[++i], "geometry") == 0 ? BillboardMode::GeometryShader : BillboardMode::Instanced;
+		}
+		else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+		{
+			backend = strcmp(argv[++i], "compute") == 0 ? SimulationBackend::ComputeShader : SimulationBackend::OpenCl;
+		}
+	}
+
+	// the fields are read while the window and devices are set up, then streamed to the devices over the first frames
+	std::vector<std::future<std::shared_ptr<const VectorField>>> forceFieldLoads;
+	for (const std::string& path : forceFieldPaths)
+	{
+		forceFieldLoads.push_back(std::async(std::launch::async, [path]() -> std::shared_ptr<const VectorField>
+		{
+			VectorField field;
+			std::string error;
+			if (!loadVectorFieldFga(path, &field, &error))
+			{
+				std::cerr << error << std::endl;
+				return nullptr;
+			}
+			return std::make_shared<const VectorField>(std::move(field));
+		}));
+	}
+
 	// init SDL window
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -88,10 +386,24 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	SDL_GLContext glContext = SDL_GL_CreateContext(window);
+	// a core profile, 4.5 for direct state access where the driver has it, 3.3 otherwise
+	// the attributes only apply to contexts created after they are set
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	SDL_GLContext glContext = nullptr;
+	const int contextVersions[][2] = { { 4, 5 }, { 3, 3 } };
+	for (const int* contextVersion : contextVersions)
+	{
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, contextVersion[0]);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, contextVersion[1]);
+		glContext = SDL_GL_CreateContext(window);
+		if (glContext != nullptr)
+		{
+			break;
+		}
+	}
 	if (glContext == nullptr)
 	{
-		std::cerr << "Could not create GL context" << std::endl;
+		std::cerr << "Could not create GL context: " << SDL_GetError() << std::endl;
 		return EXIT_FAILURE;
 	}
 
@@ -99,75 +411,68 @@ int main(int argc, char* argv[])
 
 	// init OpenGL
 	glewExperimental = GL_TRUE;
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	int err = glewInit();
 	if (err != GLEW_OK)
 	{
 		std::cerr << "glewInit failed: " << glewGetErrorString(err) << std::endl;
 		return EXIT_FAILURE;
 	}
+	// glewInit queries GL_EXTENSIONS, an invalid enum in a core profile
+	glGetError();
 
-	if (!(GLEW_ARB_vertex_program
-		&& GLEW_ARB_fragment_program
-		&& GLEW_ARB_texture_float
-		&& GLEW_ARB_draw_buffers
-		&& GLEW_ARB_framebuffer_object))
+	if (!GLEW_VERSION_3_3)
 	{
-		std::cerr << "Shaders not supported!" << std::endl;
+		std::cerr << "OpenGL 3.3 not supported!" << std::endl;
 		return EXIT_FAILURE;
 	}
+	std::cout << "OpenGL: " << glGetString(GL_VERSION) << (hasDirectStateAccess() ? " (direct state access)" : "") << std::endl;
 
-	std::string vertexShaderSource = readFile("shaders/shader.vert");
-	GLuint vertexShaderId = loadShader(GL_VERTEX_SHADER, vertexShaderSource.c_str());
-	if (vertexShaderId == 0)
-	{
-		DEBUG_BREAK();
-		return EXIT_FAILURE;
-	}
+	// compiled programs are cached on disk, keyed by driver and sources
+	BinaryCache binaryCache(getDefaultCacheDirectory());
 
-	std::string geometryShaderSource = readFile("shaders/shader.geom");
-	GLuint geometryShaderId = loadShader(GL_GEOMETRY_SHADER, geometryShaderSource.c_str());
-	if (geometryShaderId == 0)
+	// the geometry shader path is the reference, the instanced one skips the geometry stage
+	GLuint programId = loadProgram(binaryCache, {
+		{ GL_VERTEX_SHADER, readFile("shaders/shader.vert") },
+		{ GL_GEOMETRY_SHADER, readFile("shaders/shader.geom") },
+		{ GL_FRAGMENT_SHADER, readFile("shaders/shader.frag") },
+	});
+	if (programId == 0)
 	{
 		DEBUG_BREAK();
 		return EXIT_FAILURE;
 	}
 
-	std::string fragmentShaderSource = readFile("shaders/shader.frag");
-	GLuint fragmentShaderId = loadShader(GL_FRAGMENT_SHADER, fragmentShaderSource.c_str());
-	if (fragmentShaderId == 0)
+	GLuint billboardProgramId = loadProgram(binaryCache, {
+		{ GL_VERTEX_SHADER, readFile("shaders/billboard.vert") },
+		{ GL_FRAGMENT_SHADER, readFile("shaders/shader.frag") },
+	});
+	if (billboardProgramId == 0)
 	{
 		DEBUG_BREAK();
 		return EXIT_FAILURE;
 	}
 
-	GLuint programId = compileProgram(vertexShaderId, geometryShaderId, fragmentShaderId);
-	if (programId == 0)
+	// the matrices are the only per-frame uniforms, a single buffer bound once and read by both programs
+	// the texture stays bound to unit 0
+	GLuint frameUniformBuffer = createBuffer();
+	setBufferData(frameUniformBuffer, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameUniformBuffer);
+	for (GLuint particleProgramId : { programId, billboardProgramId })
 	{
-		DEBUG_BREAK();
-		return EXIT_FAILURE;
+		const GLuint frameUniformsIndex = glGetUniformBlockIndex(particleProgramId, "FrameUniforms");
+		if (frameUniformsIndex == GL_INVALID_INDEX)
+			std::cerr << "warning: FrameUniforms invalid" << std::endl;
+		else
+			glUniformBlockBinding(particleProgramId, frameUniformsIndex, FRAME_UNIFORMS_BINDING);
+
+		GLint particleTextureUniform = glGetUniformLocation(particleProgramId, "particleTexture");
+		if (particleTextureUniform == -1)
+			std::cerr << "warning: particleTextureUniform invalid" << std::endl;
+		glUseProgram(particleProgramId);
+		glUniform1i(particleTextureUniform, 0);
 	}
-
-	GLint particleTextureUniform = glGetUniformLocation(programId, "particleTexture");
-	if (particleTextureUniform == -1)
-		std::cerr << "warning: particleTextureUniform invalid" << std::endl;
-
-	GLint projectionMatrixUniform = glGetUniformLocation(programId, "projectionMatrix");
-	if (projectionMatrixUniform == -1)
-		std::cerr << "warning: projectionMatrixUniform invalid" << std::endl;
-
-	GLint modelViewMatrixUniform = glGetUniformLocation(programId, "modelViewMatrix");
-	if (modelViewMatrixUniform == -1)
-		std::cerr << "warning: modelViewMatrixUniform invalid" << std::endl;
-
-	GLint positionAttribute = glGetAttribLocation(programId, "position");
-	if (positionAttribute == -1)
-		std::cerr << "warning: positionAttribute invalid" << std::endl;
-
-	GLint isAliveAttribute = glGetAttribLocation(programId, "isAlive");
-	if (isAliveAttribute == -1)
-		std::cerr << "warning: isAliveAttribute invalid" << std::endl;
+	glUseProgram(0);
+	std::cout << "Billboards: " << getBillboardModeName(billboardMode) << std::endl;
 
 	glDisable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);
@@ -220,194 +525,38 @@ int main(int argc, char* argv[])
 	};
 	updateCamera();
 
-	// load particle texture
-	GLuint textureId = loadImage("data/particle.png");
-
-	// init OpenCL
-	cl_int code;
-
-	// platform
-	cl_platform_id platformId;
-	code = clGetPlatformIDs(1, &platformId, nullptr);
-	CHECK_ERROR_CODE(clGetPlatformIDs);
-
-	// device
-	cl_device_id deviceId;
-	code = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_GPU, 1, &deviceId, nullptr);
-	CHECK_ERROR_CODE(clGetDeviceIDs);
-
-	char deviceString[1024];
-	clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(deviceString), &deviceString, NULL);
-	std::cout << "Device name   : " << deviceString << std::endl;
-	clGetDeviceInfo(deviceId, CL_DEVICE_VENDOR, sizeof(deviceString), &deviceString, NULL);
-	std::cout << "Device vendor : " << deviceString << std::endl;
-	clGetDeviceInfo(deviceId, CL_DRIVER_VERSION, sizeof(deviceString), &deviceString, NULL);
-	std::cout << "Device version: " << deviceString << std::endl;
-
-	// check if sharing is supported on the device
-	size_t extensionSize;
-	code = clGetDeviceInfo(deviceId, CL_DEVICE_EXTENSIONS, 0, nullptr, &extensionSize);
-	CHECK_ERROR_CODE(clGetDeviceInfo);
-
-	bool sharingSupported = false;
-
-	if (extensionSize > 0)
-	{
-		char* extensions = new char[extensionSize];
-		code = clGetDeviceInfo(deviceId, CL_DEVICE_EXTENSIONS, extensionSize, extensions, &extensionSize);
-		CHECK_ERROR_CODE(clGetDeviceInfo);
-		std::string stdDevString(extensions);
-		delete extensions;
-
-		size_t szOldPos = 0;
-		size_t szSpacePos = stdDevString.find(' ', szOldPos); // extensions string is space delimited
-		while (szSpacePos != stdDevString.npos)
-		{
-			if (strcmp(GL_SHARING_EXTENSION, stdDevString.substr(szOldPos, szSpacePos - szOldPos).c_str()) == 0)
-			{
-				// Device supports context sharing with OpenGL
-				sharingSupported = true;
-				break;
-			}
-			do
-			{
-				szOldPos = szSpacePos + 1;
-				szSpacePos = stdDevString.find(' ', szOldPos);
-			} while (szSpacePos == szOldPos);
-		}
-	}
-
-	if (!sharingSupported)
-	{
-		std::cerr << "Sharing not supported" << std::endl;
-		return EXIT_FAILURE;
-	}
-
-	// context
-	cl_context_properties props[] =
-	{
-		CL_GL_CONTEXT_KHR,				reinterpret_cast<cl_context_properties>(glContext),
-		DEVICE_CONTEXT_PROPERTY_NAME,	reinterpret_cast<cl_context_properties>(getCurrentDeviceContext()),
-		CL_CONTEXT_PLATFORM,			reinterpret_cast<cl_context_properties>(platformId),
-		0
-	};
-	cl_context gpuContext = clCreateContext(props, 1, &deviceId, nullptr, nullptr, &code);
-	CHECK_ERROR_CODE(clCreateContext);
-
-	// command queue
-	cl_command_queue commandQueue = clCreateCommandQueue(gpuContext, deviceId, 0, &code);
-	CHECK_ERROR_CODE(clCreateCommandQueue);
-
-	// program
-	std::string clProgramSource = readFile("cl/particle.cl");
-	const char* clProgramSourceCStr = clProgramSource.c_str();
-	cl_program program = clCreateProgramWithSource(gpuContext, 1, &clProgramSourceCStr, nullptr, &code);
-	CHECK_ERROR_CODE(clCreateProgramWithSource);
-
-	code = clBuildProgram(program, 0, nullptr, nullptr, nullptr, nullptr);
-	CHECK_ERROR_CODE_LOG(clBuildProgram);
-
-	// VBO
-	const size_t NUM_PARTICLES = 1000000;
-	size_t globalWorkSize[] = { NUM_PARTICLES };
-
-	// create particle state buffer object
-	GLuint particleStateVbo;
-	glGenBuffers(1, &particleStateVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, particleStateVbo);
-
-	unsigned int particleStateStructSize = 64;
-	unsigned int particleStateSize = NUM_PARTICLES * particleStateStructSize;
-	glBufferData(GL_ARRAY_BUFFER, particleStateSize, 0, GL_DYNAMIC_DRAW);
-
-	cl_mem particleStateVboCl = clCreateFromGLBuffer(gpuContext, CL_MEM_WRITE_ONLY, particleStateVbo, nullptr);
-	CHECK_ERROR_CODE(clCreateFromGLBuffer);
-
-	float currentTime = 0;
-
-	float particleSpawnRate = 200000.f;
-
-	glFinish();
-
-	// init particle state
-	cl_kernel initParticleStateKernel = clCreateKernel(program, "initParticleState", &code);
-	CHECK_ERROR_CODE_LOG(clCreateKernel);
-
-	code = clSetKernelArg(initParticleStateKernel, 0, sizeof(cl_mem), (void*)&particleStateVboCl);
-	CHECK_ERROR_CODE(clSetKernelArg);
-
-	code = clEnqueueAcquireGLObjects(commandQueue, 1, &particleStateVboCl, 0, 0, 0);
-	CHECK_ERROR_CODE(clEnqueueAcquireGLObjects);
-
-	code = clEnqueueNDRangeKernel(commandQueue, initParticleStateKernel, 1, nullptr, globalWorkSize, nullptr, 0, 0, 0);
-	CHECK_ERROR_CODE(clEnqueueNDRangeKernel);
-
-	code = clEnqueueReleaseGLObjects(commandQueue, 1, &particleStateVboCl, 0, 0, 0);
-	CHECK_ERROR_CODE(clEnqueueReleaseGLObjects);
-
-	code = clFinish(commandQueue);
-	CHECK_ERROR_CODE(clFinish);
-
-	// spawn kernel
-	cl_kernel spawnParticleKernel = clCreateKernel(program, "spawnParticle", &code);
-	CHECK_ERROR_CODE_LOG(clCreateKernel);
-
-	size_t spawnParticleKernelWorkGroupSize = 0;
-	clGetKernelWorkGroupInfo(
-		spawnParticleKernel,
-		deviceId,
-		CL_KERNEL_WORK_GROUP_SIZE,
-		sizeof(size_t),
-		(void*)&spawnParticleKernelWorkGroupSize,
-		nullptr
-	);
-
-	code = clSetKernelArg(spawnParticleKernel, 0, sizeof(cl_mem), (void*)&particleStateVboCl);
-	CHECK_ERROR_CODE(clSetKernelArg);
-	code = clSetKernelArg(spawnParticleKernel, 1, spawnParticleKernelWorkGroupSize * sizeof(cl_uchar), nullptr);
-	CHECK_ERROR_CODE(clSetKernelArg);
-
-	// set update particle state kernel constant arguments
-	cl_kernel updateParticleStateKernel = clCreateKernel(program, "updateParticleState", &code);
-	CHECK_ERROR_CODE_LOG(clCreateKernel);
-
-	code = clSetKernelArg(updateParticleStateKernel, 0, sizeof(cl_mem), (void*)&particleStateVboCl);
-	CHECK_ERROR_CODE(clSetKernelArg);
-
-	// check particle death conditions
-	cl_kernel checkParticleDeathKernel = clCreateKernel(program, "checkParticleDeath", &code);
-	CHECK_ERROR_CODE_LOG(clCreateKernel);
-
-	code = clSetKernelArg(checkParticleDeathKernel, 0, sizeof(cl_mem), (void*)&particleStateVboCl);
-	CHECK_ERROR_CODE(clSetKernelArg);
-
-	Uint32 t1 = SDL_GetTicks();
-
-	char windowTitle[128];
-
-	// main loop
-	SDL_Event event;
-	Uint32 deltaTime = 0;
-	bool loop = true;
-	while (loop)
+	// window events, spawn rate and billboard keys, then the camera keys, false once the window is closed
+	auto handleInput = [&](float deltaTimeSeconds)
 	{
-		//std::cout << "Frame start ===================================================" << std::endl;
-		const cl_float currentTimeSeconds = static_cast<cl_float>(t1) * 0.001f;
-		const cl_float deltaTimeSeconds = static_cast<cl_float>(deltaTime) * 0.001f;
-
+		bool running = true;
+		SDL_Event event;
 		while (SDL_PollEvent(&event))
 		{
 			switch (event.type)
 			{
 			case SDL_QUIT:
-				loop = false;
+				running = false;
 				break;
 
 			case SDL_KEYDOWN:
 				switch (event.key.keysym.sym)
 				{
 				case SDLK_ESCAPE:
-					loop = false;
+					running = false;
+					break;
+
+				// the simulation allocates and releases pages as the population follows
+				case SDLK_PAGEUP:
+					particleSpawnRate *= 2.f;
+					break;
+
+				case SDLK_PAGEDOWN:
+					particleSpawnRate *= 0.5f;
+					break;
+
+				case SDLK_b:
+					billboardMode = billboardMode == BillboardMode::Instanced ? BillboardMode::GeometryShader : BillboardMode::Instanced;
+					std::cout << "Billboards: " << getBillboardModeName(billboardMode) << std::endl;
 					break;
 				}
 				break;
@@ -455,155 +604,1102 @@ int main(int argc, char* argv[])
 		{
 			cameraElevation -= cameraRotationSpeed * deltaTimeSeconds;
 		}
-		
+
 		updateCamera();
+		return running;
+	};
 
-		// map OpenGL buffer object for writing from OpenCL
-		glFinish();
+	// a uniform buffer update, a program and a vertex array, the rest of the draw state was set up once
+	auto beginParticleDraw = [&](const RenderSlot& slot, bool instanced)
+	{
+		FrameUniforms frameUniforms;
+		frameUniforms.modelViewMatrix = modelViewMatrix;
+		frameUniforms.projectionMatrix = projectionMatrix;
+		// one matrix product per frame instead of four per particle for the instanced quads
+		frameUniforms.modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
+		setBufferSubData(frameUniformBuffer, 0, sizeof(frameUniforms), &frameUniforms);
+
+		glUseProgram(instanced ? billboardProgramId : programId);
+		glBindVertexArray(instanced ? slot.instancedVertexArray : slot.pointVertexArray);
+	};
 
-		code = clEnqueueAcquireGLObjects(commandQueue, 1, &particleStateVboCl, 0, 0, 0);
-		CHECK_ERROR_CODE(clEnqueueAcquireGLObjects);
+	// load particle texture
+	GLuint textureId = loadImage("data/particle.png");
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textureId);
 
-		// prepare particles to spawn
-		const cl_int numParticlesToSpawn = static_cast<cl_int>(std::ceil(particleSpawnRate * deltaTimeSeconds));
+	// deletes what both backends share, the window last
+	auto releaseWindow = [&]()
+	{
+		glDeleteTextures(1, &textureId);
+		glDeleteBuffers(1, &frameUniformBuffer);
+		glDeleteProgram(programId);
+		glDeleteProgram(billboardProgramId);
 
-		if (numParticlesToSpawn > 0)
-		{
-			// spawn new particles
-			code = clSetKernelArg(spawnParticleKernel, 2, sizeof(cl_int), &numParticlesToSpawn);
-			CHECK_ERROR_CODE(clSetKernelArg);
+		SDL_GL_DeleteContext(glContext);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+	};
 
-			cl_int globalSeed = rand();
-			code = clSetKernelArg(spawnParticleKernel, 3, sizeof(cl_int), &globalSeed);
-			CHECK_ERROR_CODE(clSetKernelArg);
+	// the simulation config is compiled into simulateParticles, one program per distinct config
+	ParticleSimulationConfig simulationConfig = getDefaultParticleSimulationConfig();
+	for (size_t i = 0; i < forceFieldPaths.size(); ++i)
+	{
+		simulationConfig.modifiers.push_back(ParticleModifier::forceField(static_cast<unsigned int>(i), 1.f));
+	}
+	// positions moved by modifiers cannot be extrapolated along the velocity, those configs draw the last step as it is
+	const bool interpolateRender = !hasPositionModifiers(simulationConfig);
 
-			code = clSetKernelArg(spawnParticleKernel, 4, sizeof(cl_float), &currentTimeSeconds);
-			CHECK_ERROR_CODE(clSetKernelArg);
+	// compute shaders simulate straight into the vertex buffer GL draws, ordered by memory barriers: no OpenCL device,
+	// no acquire and release of shared buffers and no glFinish or clFinish handing them between APIs
+	if (backend == SimulationBackend::ComputeShader)
+	{
+		if (!GLEW_VERSION_4_3)
+		{
+			std::cerr << "Compute shaders need OpenGL 4.3" << std::endl;
+			return EXIT_FAILURE;
+		}
 
-			code = clEnqueueNDRangeKernel(commandQueue, spawnParticleKernel, 1, nullptr, globalWorkSize, nullptr, 0, 0, 0);
-			CHECK_ERROR_CODE(clEnqueueNDRangeKernel);
+		const std::vector<std::string> computeSources = { generateParticleModifierGlslSource(simulationConfig), readFile("shaders/particle.comp") };
+		std::vector<GLuint> computePrograms;
+		for (size_t i = 0; i < NUM_GL_PARTICLE_KERNELS; ++i)
+		{
+			const GLuint computeProgramId = loadProgram(binaryCache, {
+				{ GL_COMPUTE_SHADER, getGlParticleKernelSource(static_cast<GlParticleKernel>(i), computeSources) },
+			});
+			if (computeProgramId == 0)
+			{
+				DEBUG_BREAK();
+				return EXIT_FAILURE;
+			}
+			computePrograms.push_back(computeProgramId);
 		}
 
+		GlParticleSimulation computeSimulation;
+		if (!computeSimulation.create(computePrograms, maxNumParticles))
+		{
+			std::cerr << "Could not allocate " << maxNumParticles << " particles for the compute shaders" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::cout << "Simulation: compute shaders, " << maxNumParticles << " particles" << std::endl;
+
+		// a single render slot, GL orders the dispatches writing it after the draws reading it
+		// the compaction writes a point command then an instanced quad command, the host never reads them
+		RenderSlot computeSlot;
+		computeSlot.positionVbo = createBuffer();
+		allocateRenderSlotPositions(computeSlot, maxNumParticles, HostTransfer::None);
+		const ClDrawArraysIndirectCommand computeDrawCommands[2] = { { 0, 1, 0, 0 }, { 4, 0, 0, 0 } };
+		computeSlot.drawCommandVbo = createBuffer();
+		setBufferData(computeSlot.drawCommandVbo, sizeof(computeDrawCommands), computeDrawCommands, GL_DYNAMIC_DRAW);
+
+		// GL_TIME_ELAPSED around the dispatches then the draws, two frames of them so that the previous frame's are read
+		// while this one is queued, results the GPU has not reached yet are skipped
+		const bool profiling = !timingsPath.empty();
+		GLuint timeQueries[2][2] = {};
+		const char* drawTimePhases[2] = { "gl/draw", "gl/draw" };
+		if (profiling)
 		{
-			// update the particles
-			cl_int globalSeed = rand();
-			code = clSetKernelArg(updateParticleStateKernel, 1, sizeof(cl_int), &globalSeed);
-			CHECK_ERROR_CODE(clSetKernelArg);
+			glGenQueries(4, &timeQueries[0][0]);
+		}
 
-			code = clSetKernelArg(updateParticleStateKernel, 2, sizeof(cl_float), &deltaTimeSeconds);
-			CHECK_ERROR_CODE(clSetKernelArg);
+		FixedTimestep fixedTimestep(1.0 / simulationRate, maxSubsteps);
+		const cl_uint randomSeed = seedSet ? seed : static_cast<cl_uint>(rand());
+		cl_uint simulationStep = 0;
+		double particleSpawnRemainder = 0.0;
 
-			code = clEnqueueNDRangeKernel(commandQueue, updateParticleStateKernel, 1, nullptr, globalWorkSize, nullptr, 0, 0, 0);
-			CHECK_ERROR_CODE(clEnqueueNDRangeKernel);
+		PhaseTimings timings;
+		const double performanceFrequency = static_cast<double>(SDL_GetPerformanceFrequency());
+		auto getCounterMs = [performanceFrequency](Uint64 counter)
+		{
+			return static_cast<double>(counter) * 1000.0 / performanceFrequency;
+		};
+		Uint64 t1 = SDL_GetPerformanceCounter();
+		char windowTitle[224];
+
+		double deltaTime = 0.0;
+		size_t frameIndex = 0;
+		bool loop = true;
+		while (loop)
+		{
+			const Uint64 frameStartCounter = SDL_GetPerformanceCounter();
+			const unsigned int numSubsteps = fixedTimestep.advance(deltaTime);
 
-			// check the particles' death conditions
-			code = clSetKernelArg(checkParticleDeathKernel, 1, sizeof(cl_float), &currentTimeSeconds);
-			CHECK_ERROR_CODE(clSetKernelArg);
+			loop = handleInput(static_cast<float>(deltaTime));
 
-			code = clEnqueueNDRangeKernel(commandQueue, checkParticleDeathKernel, 1, nullptr, globalWorkSize, nullptr, 0, 0, 0);
-			CHECK_ERROR_CODE(clEnqueueNDRangeKernel);
-		}
+			const Uint64 enqueueStartCounter = SDL_GetPerformanceCounter();
 
-		// unmap buffer objectS
-		code = clEnqueueReleaseGLObjects(commandQueue, 1, &particleStateVboCl, 0, 0, 0);
-		CHECK_ERROR_CODE(clEnqueueReleaseGLObjects);
+			// loaded fields are uploaded whole
+			for (size_t i = 0; i < forceFieldLoads.size(); ++i)
+			{
+				if (forceFieldLoads[i].valid() && forceFieldLoads[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				{
+					computeSimulation.setForceField(i, forceFieldLoads[i].get());
+				}
+			}
 
-		code = clFinish(commandQueue);
-		CHECK_ERROR_CODE(clFinish);
+			GLuint* frameTimeQueries = timeQueries[frameIndex % 2];
+			const GLuint* previousTimeQueries = timeQueries[(frameIndex + 1) % 2];
+			for (int phase = 0; phase < 2 && profiling && frameIndex > 0; ++phase)
+			{
+				GLint available = GL_FALSE;
+				glGetQueryObjectiv(previousTimeQueries[phase], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available)
+				{
+					GLuint64 timeNs = 0;
+					glGetQueryObjectui64v(previousTimeQueries[phase], GL_QUERY_RESULT, &timeNs);
+					timings.addSample(phase == 0 ? "gl/simulate" : drawTimePhases[(frameIndex + 1) % 2], static_cast<double>(timeNs) * 1e-6);
+				}
+			}
 
-		// opengl render
-		glClear(GL_COLOR_BUFFER_BIT);
+			if (profiling)
+			{
+				glBeginQuery(GL_TIME_ELAPSED, frameTimeQueries[0]);
+			}
 
-		glUseProgram(programId);
+			// the same substeps and compactions as the OpenCL backend
+			const float stepSeconds = static_cast<float>(fixedTimestep.getStepSeconds());
+			const float renderTimeOffset = interpolateRender
+				? static_cast<float>((fixedTimestep.getInterpolationAlpha() - 1.0) * fixedTimestep.getStepSeconds())
+				: 0.f;
+			const unsigned int numCompactions = std::max(numSubsteps, 1u);
+			for (unsigned int substep = 0; substep < numCompactions; ++substep)
+			{
+				if (substep < numSubsteps)
+				{
+					fixedTimestep.step();
+					particleSpawnRemainder += particleSpawnRate * fixedTimestep.getStepSeconds();
+					const cl_uint numParticlesToSpawn = static_cast<cl_uint>(particleSpawnRemainder);
+					particleSpawnRemainder -= numParticlesToSpawn;
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-		glUniform1i(particleTextureUniform, 0);
+					computeSimulation.dispatchSubstep(randomSeed, simulationStep++, static_cast<float>(fixedTimestep.getSimulationTime()), stepSeconds, numParticlesToSpawn);
+				}
 
-		glUniformMatrix4fv(projectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-		glUniformMatrix4fv(modelViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(modelViewMatrix));
+				const size_t renderCapacity = substep + 1 == numCompactions ? computeSlot.positionCapacity : 0;
+				computeSimulation.dispatchCompaction(computeSlot.positionVbo, renderCapacity, computeSlot.drawCommandVbo, renderTimeOffset);
+			}
 
-		glEnableClientState(GL_VERTEX_ARRAY);
+			if (profiling)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+			}
 
-		glEnableVertexAttribArray(positionAttribute);
-		glEnableVertexAttribArray(isAliveAttribute);
+			const Uint64 drawStartCounter = SDL_GetPerformanceCounter();
 
-		glBindBuffer(GL_ARRAY_BUFFER, particleStateVbo);
-		glVertexAttribPointer(positionAttribute, 3, GL_FLOAT, GL_FALSE, particleStateStructSize, 0);
-		glVertexAttribPointer(isAliveAttribute, 1, GL_UNSIGNED_BYTE, GL_FALSE, particleStateStructSize, (void*)16);
+			glClear(GL_COLOR_BUFFER_BIT);
 
-		glDrawArrays(GL_POINTS, 0, NUM_PARTICLES);
+			const bool instanced = billboardMode == BillboardMode::Instanced;
+			beginParticleDraw(computeSlot, instanced);
+			if (profiling)
+			{
+				drawTimePhases[frameIndex % 2] = instanced ? "gl/drawInstanced" : "gl/draw";
+				glBeginQuery(GL_TIME_ELAPSED, frameTimeQueries[1]);
+			}
 
-		glDisableVertexAttribArray(positionAttribute);
-		glDisableVertexAttribArray(isAliveAttribute);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, computeSlot.drawCommandVbo);
+			glDrawArraysIndirect(instanced ? GL_TRIANGLE_STRIP : GL_POINTS, reinterpret_cast<const void*>(instanced ? sizeof(ClDrawArraysIndirectCommand) : 0));
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 
-		glDisableClientState(GL_VERTEX_ARRAY);
+			if (profiling)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+			}
 
-		glUseProgram(0);
+			glBindVertexArray(0);
+			glUseProgram(0);
 
-		SDL_GL_SwapWindow(window);
+			const Uint64 swapStartCounter = SDL_GetPerformanceCounter();
 
-		Uint32 t2 = SDL_GetTicks();
-		deltaTime = t2 - t1;
-		t1 = t2;
-		sprintf_s(windowTitle, "%.1f fps", 1000.f / static_cast<float>(deltaTime));
-		SDL_SetWindowTitle(window, windowTitle);
-	}
+			SDL_GL_SwapWindow(window);
 
-	// release opencl stuff
-	clReleaseContext(gpuContext);
-	clReleaseCommandQueue(commandQueue);
-	clReleaseMemObject(particleStateVboCl);
-	clReleaseKernel(initParticleStateKernel);
-	clReleaseKernel(spawnParticleKernel);
-	clReleaseKernel(updateParticleStateKernel);
-	clReleaseKernel(checkParticleDeathKernel);
-	clReleaseProgram(program);
+			++frameIndex;
 
-	// release opengl stuff
-	glDeleteTextures(1, &textureId);
-	glDeleteBuffers(1, &particleStateVbo);
-	glDeleteShader(vertexShaderId);
-	glDeleteShader(geometryShaderId);
-	glDeleteShader(fragmentShaderId);
-	glDeleteProgram(programId);
-
-	// release sdl stuff
-	SDL_GL_DeleteContext(glContext);
-	SDL_DestroyWindow(window);
-	SDL_Quit();
+			Uint64 t2 = SDL_GetPerformanceCounter();
+			deltaTime = static_cast<double>(t2 - t1) / performanceFrequency;
+			t1 = t2;
 
-	return EXIT_SUCCESS;
-}
+			if (profiling)
+			{
+				timings.addSample("host/input", getCounterMs(enqueueStartCounter - frameStartCounter));
+				timings.addSample("host/enqueue", getCounterMs(drawStartCounter - enqueueStartCounter));
+				timings.addSample("host/draw", getCounterMs(swapStartCounter - drawStartCounter));
+				timings.addSample("host/swap", getCounterMs(t2 - swapStartCounter));
+				timings.addSample("host/frame", getCounterMs(t2 - frameStartCounter));
+			}
+			sprintf_s(windowTitle, "%.1f fps, %u substeps at %.0f Hz, compute shaders",
+				deltaTime > 0.0 ? 1.0 / deltaTime : 0.0, numSubsteps, simulationRate);
+			SDL_SetWindowTitle(window, windowTitle);
+		}
 
-// shaders
-GLuint compileProgram(GLuint vertexShaderId, GLuint geometryShaderId, GLuint fragmentShaderId)
-{
-	GLuint programId = glCreateProgram();
-	glAttachShader(programId, vertexShaderId);
-	glAttachShader(programId, geometryShaderId);
-	glAttachShader(programId, fragmentShaderId);
-	glLinkProgram(programId);
-	if (!checkProgram(programId))
-	{
-		glDeleteProgram(programId);
-		return 0;
+		if (profiling)
+		{
+			timings.print(std::cout);
+			if (!timings.write(timingsPath))
+			{
+				std::cerr << "Could not write " << timingsPath << std::endl;
+			}
+			glDeleteQueries(4, &timeQueries[0][0]);
+		}
+
+		computeSimulation.release();
+		glDeleteVertexArrays(1, &computeSlot.pointVertexArray);
+		glDeleteVertexArrays(1, &computeSlot.instancedVertexArray);
+		glDeleteBuffers(1, &computeSlot.positionVbo);
+		glDeleteBuffers(1, &computeSlot.drawCommandVbo);
+		releaseWindow();
+		return EXIT_SUCCESS;
 	}
-	return programId;
-}
 
-bool checkProgram(GLuint programId)
-{
-	GLint result = GL_FALSE;
-	glGetProgramiv(programId, GL_LINK_STATUS, &result);
+	// init OpenCL
+	cl_int code;
 
-	if (!result)
+	std::string clProgramSource = readFile("cl/particle.cl");
+
+	// every platform/device pair, scored by a short calibration run persisted in the binary cache
+	const std::vector<ClDeviceScore> deviceScores = scoreDevices(binaryCache, clProgramSource, simulationConfig, forceDeviceScoring);
+	const std::vector<size_t> candidateDevices = deviceOverride.empty()
+		? rankDeviceScores(deviceScores, true)
+		: findDeviceScores(deviceScores, deviceOverride);
+
+	// a device with cl_khr_gl_sharing still fails to share a GL context created on another device,
+	// the first candidate that does is used, otherwise the first one that creates a context at all
+	// without sharing the positions are copied to the GL buffers through the host
+	int selectedDevice = -1;
+	bool glSharing = false;
+	cl_context gpuContext = nullptr;
+	for (int pass = 0; pass < 2 && gpuContext == nullptr; ++pass)
 	{
-		GLint infoLogLength;
-		glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-		GLchar* message = static_cast<GLchar*>(alloca(infoLogLength * sizeof(GLchar)));
-		glGetProgramInfoLog(programId, infoLogLength, NULL, message);
-		fprintf(stderr, "Warning: %s\n", message);
+		for (size_t candidate : candidateDevices)
+		{
+			const ClDeviceScore& score = deviceScores[candidate];
+			if (pass == 0 && !score.glSharing)
+			{
+				continue;
+			}
+
+			cl_context_properties sharingProps[] =
+			{
+				CL_GL_CONTEXT_KHR,				reinterpret_cast<cl_context_properties>(glContext),
+				DEVICE_CONTEXT_PROPERTY_NAME,	reinterpret_cast<cl_context_properties>(getCurrentDeviceContext()),
+				CL_CONTEXT_PLATFORM,			reinterpret_cast<cl_context_properties>(score.platformId),
+				0
+			};
+			cl_context_properties props[] =
+			{
+				CL_CONTEXT_PLATFORM,			reinterpret_cast<cl_context_properties>(score.platformId),
+				0
+			};
+			gpuContext = clCreateContext(pass == 0 ? sharingProps : props, 1, &score.deviceId, nullptr, nullptr, &code);
+			if (code == CL_SUCCESS)
+			{
+				selectedDevice = static_cast<int>(candidate);
+				glSharing = pass == 0;
+				break;
+			}
+			std::cout << "No " << (pass == 0 ? "GL sharing " : "") << "context on " << score.name << " (" << getErrorString(code) << ")" << std::endl;
+			gpuContext = nullptr;
+		}
+	}
+
+	std::string selectionReason;
+	if (selectedDevice < 0)
+	{
+		selectionReason = deviceOverride.empty() ? "no usable device" : "no usable device matches \"" + deviceOverride + "\"";
+	}
+	else
+	{
+		selectionReason = deviceOverride.empty() ? "fastest" : "fastest matching \"" + deviceOverride + "\"";
+		if (glSharing)
+		{
+			selectionReason += " device sharing the GL context";
+		}
+		else
+		{
+			selectionReason += (deviceScores[selectedDevice].deviceType & CL_DEVICE_TYPE_CPU) ? " CPU device" : " device";
+			selectionReason += ", no GL sharing: positions are copied through the host";
+		}
+	}
+	printDeviceScores(std::cout, deviceScores, selectedDevice, selectionReason);
+	if (selectedDevice < 0)
+	{
+		std::cerr << "No OpenCL device" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const cl_device_id deviceId = deviceScores[selectedDevice].deviceId;
+	const HostTransfer hostTransfer = glSharing ? HostTransfer::None
+		: persistentMapping && GLEW_ARB_buffer_storage ? HostTransfer::Persistent : HostTransfer::Orphan;
+	std::cout << "Device name   : " << getDeviceInfoString(deviceId, CL_DEVICE_NAME) << std::endl;
+	std::cout << "Device vendor : " << getDeviceInfoString(deviceId, CL_DEVICE_VENDOR) << std::endl;
+	std::cout << "Device version: " << getDeviceInfoString(deviceId, CL_DRIVER_VERSION) << std::endl;
+
+	// the other devices get their own context, they may be on other platforms
+	std::vector<cl_device_id> otherDeviceIds;
+	if (allDevices)
+	{
+		for (cl_device_id otherDeviceId : getDevices(CL_DEVICE_TYPE_ALL))
+		{
+			if (otherDeviceId != deviceId)
+			{
+				otherDeviceIds.push_back(otherDeviceId);
+			}
+		}
+	}
+
+	// command queue
+	// the load balancer times the kernels of every device
+	const bool profiling = !timingsPath.empty();
+	cl_command_queue commandQueue = clCreateCommandQueue(gpuContext, deviceId, profiling || !otherDeviceIds.empty() ? CL_QUEUE_PROFILING_ENABLE : 0, &code);
+	CHECK_ERROR_CODE(clCreateCommandQueue);
+
+	// program
+	ClProgramCache programCache(gpuContext, deviceId, &binaryCache);
+
+	ClParticleTuning tuning;
+	if (autotune)
+	{
+		code = getParticleTuning(gpuContext, deviceId, programCache, binaryCache, clProgramSource, simulationConfig, forceAutotune, &tuning);
+		if (code != CL_SUCCESS)
+		{
+			// not fatal, the driver picks the work sizes
+			std::cerr << "Autotuning failed (" << getErrorString(code) << "), using the defaults" << std::endl;
+		}
+		std::cout << "Autotuner : options \"" << tuning.buildOptions << "\", local sizes "
+			<< tuning.workSizes.simulate << " / " << tuning.workSizes.spawn << " / " << tuning.workSizes.scan << std::endl;
+	}
+
+	std::string buildLog;
+	cl_program program = programCache.getProgram(
+		{ generateParticleModifierSource(simulationConfig), clProgramSource },
+		appendBuildOptions(getParticleModifierBuildOptions(simulationConfig), tuning.buildOptions),
+		&code,
+		&buildLog
+	);
+	if (code != CL_SUCCESS)
+	{
+		std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code)
+			<< " (line " << __LINE__ << ")" << std::endl
+			<< "Log:" << std::endl
+			<< buildLog << std::endl;
+		DEBUG_BREAK();
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Program cache : " << binaryCache.getNumHits() << " hits, "
+		<< binaryCache.getNumMisses() << " misses, "
+		<< binaryCache.getNumInvalidations() << " invalidations" << std::endl;
+
+	// VBO
+	// particle state is paged structures of arrays owned by OpenCL, the renderer only reads the render slots
+	ClParticleSimulation simulation(gpuContext, deviceId, commandQueue);
+	code = simulation.create(program, maxNumParticles, tuning.workSizes, pageSize);
+	CHECK_ERROR_CODE_LOG(ClParticleSimulation::create);
+
+	// every other device simulates its own slice of the particles, maxNumParticles bounds their sum
+	ClParticleDeviceGroup deviceGroup(deviceId, commandQueue, simulation, framesInFlight);
+	for (cl_device_id otherDeviceId : otherDeviceIds)
+	{
+		code = deviceGroup.addDevice(otherDeviceId, binaryCache, clProgramSource, simulationConfig, autotune, maxNumParticles, pageSize, &buildLog);
+		std::cout << "Other device  : " << getDeviceInfoString(otherDeviceId, CL_DEVICE_NAME);
+		if (code != CL_SUCCESS)
+		{
+			std::cout << ", not used (" << getErrorString(code) << ")";
+		}
+		std::cout << std::endl;
+	}
+
+	// the grid only holds the particles of this device, its count query stands in for gameplay code asking what is near
+	// a point, the view center here, and reads its answer back a frame or more later instead of waiting for it
+	ClSpatialGrid spatialGrid(gpuContext, deviceId, commandQueue);
+	ClSpatialQuery focusQuery;
+	bool focusQueryPending = false;
+	cl_uint focusCount = 0;
+	const float focusDistance = 30.f;
+	const float focusRadius = 5.f;
+	// the depth sort runs after the gather, over the positions of every device
+	ClDepthSort depthSorter(gpuContext, deviceId, commandQueue);
+	// only this device's particles are reordered, the others keep the order they spawned in
+	ClMortonOrder mortonOrder(gpuContext, deviceId, commandQueue);
+	if (gridCellSize > 0.f || depthSort || mortonOrderInterval > 0)
+	{
+		cl_program sortProgram = programCache.getProgram({ readFile("cl/radix_sort.cl") }, "", &code, &buildLog);
+		cl_program gridProgram = code == CL_SUCCESS && gridCellSize > 0.f ? programCache.getProgram({ readFile("cl/spatial_grid.cl") }, "", &code, &buildLog) : nullptr;
+		cl_program depthSortProgram = code == CL_SUCCESS && depthSort ? programCache.getProgram({ readFile("cl/depth_sort.cl") }, "", &code, &buildLog) : nullptr;
+		cl_program mortonOrderProgram = code == CL_SUCCESS && mortonOrderInterval > 0 ? programCache.getProgram({ readFile("cl/morton_order.cl") }, "", &code, &buildLog) : nullptr;
+		if (code != CL_SUCCESS)
+		{
+			std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code)
+				<< " (line " << __LINE__ << ")" << std::endl
+				<< "Log:" << std::endl
+				<< buildLog << std::endl;
+			DEBUG_BREAK();
+			return EXIT_FAILURE;
+		}
+
+		if (gridProgram != nullptr)
+		{
+			code = spatialGrid.create(gridProgram, sortProgram, gridCellSize, simulation.getMaxNumParticles());
+			CHECK_ERROR_CODE(ClSpatialGrid::create);
+		}
+		if (depthSortProgram != nullptr)
+		{
+			code = depthSorter.create(depthSortProgram, sortProgram);
+			CHECK_ERROR_CODE(ClDepthSort::create);
+		}
+		if (mortonOrderProgram != nullptr)
+		{
+			code = mortonOrder.create(mortonOrderProgram, sortProgram);
+			CHECK_ERROR_CODE(ClMortonOrder::create);
+		}
+	}
+
+	// the culling runs after the gather and before the depth sort, over the positions of every device
+	ClFrustumCull frustumCull(gpuContext, deviceId, commandQueue);
+	if (culling)
+	{
+		cl_program cullProgram = programCache.getProgram({ readFile("cl/frustum_cull.cl") }, "", &code, &buildLog);
+		if (code != CL_SUCCESS)
+		{
+			std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code)
+				<< " (line " << __LINE__ << ")" << std::endl
+				<< "Log:" << std::endl
+				<< buildLog << std::endl;
+			DEBUG_BREAK();
+			return EXIT_FAILURE;
+		}
+
+		code = frustumCull.create(cullProgram);
+		CHECK_ERROR_CODE(ClFrustumCull::create);
+	}
+	// the culling or the depth sort pack every drawn position into the first draw command
+	const bool packedDraws = culling || depthSort;
+
+	// render positions are a single buffer shared with OpenCL, particles past its capacity are simulated but not drawn
+	if (deviceGroup.getMaxRenderCapacity() < simulation.getMaxNumParticles())
+		std::cout << "render positions capped to " << deviceGroup.getMaxRenderCapacity() << " by CL_DEVICE_MAX_MEM_ALLOC_SIZE" << std::endl;
+
+	// one render slot per frame in flight, OpenCL writes slot N % framesInFlight while GL draws an older one
+	// the draw commands are DrawArraysIndirectCommands, one per device, written by the device group, then one drawing
+	// the culled positions as instanced quads, written by the culling
+	std::vector<ClDrawArraysIndirectCommand> initialDrawCommands(deviceGroup.getNumDevices(), { 0, 1, 0, 0 });
+	initialDrawCommands.push_back({ 4, 0, 0, 0 });
+	const size_t numDrawCommands = initialDrawCommands.size();
+	std::vector<RenderSlot> renderSlots(framesInFlight);
+	for (RenderSlot& slot : renderSlots)
+	{
+		slot.positionVbo = createBuffer();
+		code = resizeRenderSlotPositions(slot, gpuContext, deviceGroup.getRenderCapacity(), hostTransfer);
+		CHECK_ERROR_CODE(resizeRenderSlotPositions);
+
+		slot.drawCommandVbo = createBuffer();
+		setBufferData(slot.drawCommandVbo, initialDrawCommands.size() * sizeof(ClDrawArraysIndirectCommand), initialDrawCommands.data(), GL_DYNAMIC_DRAW);
+
+		if (glSharing)
+		{
+			slot.drawCommandVboCl = clCreateFromGLBuffer(gpuContext, CL_MEM_READ_WRITE, slot.drawCommandVbo, &code);
+			CHECK_ERROR_CODE(clCreateFromGLBuffer);
+		}
+		else
+		{
+			slot.drawCommandVboCl = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE, initialDrawCommands.size() * sizeof(ClDrawArraysIndirectCommand), nullptr, &code);
+			CHECK_ERROR_CODE(clCreateBuffer);
+			slot.drawCommandStagingCl = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, initialDrawCommands.size() * sizeof(ClDrawArraysIndirectCommand), nullptr, &code);
+			CHECK_ERROR_CODE(clCreateBuffer);
+		}
+
+		if (profiling && GLEW_ARB_timer_query)
+		{
+			glGenQueries(1, &slot.drawTimeQuery);
+		}
+	}
+
+	double particleSpawnRemainder = 0.0;
+
+	// random numbers are keyed on the seed, the step index and the particle, a fixed --seed repeats a run's numbers
+	const cl_uint randomSeed = seedSet ? seed : static_cast<cl_uint>(rand());
+	cl_uint simulationStep = 0;
+
+	// render slots must be complete before OpenCL first acquires them
+	glFinish();
+
+	// with cl_khr_gl_event OpenCL waits on the GL fence of a render slot itself, otherwise the host does
+	// without sharing OpenCL never writes the GL buffers, GL orders the host copies with its own draws
+	clCreateEventFromGLsyncKHR_fn createEventFromGLsync = nullptr;
+	if (glSharing && GLEW_ARB_sync && hasDeviceExtension(deviceId, GL_EVENT_EXTENSION))
+	{
+		createEventFromGLsync = reinterpret_cast<clCreateEventFromGLsyncKHR_fn>(clGetExtensionFunctionAddress("clCreateEventFromGLsyncKHR"));
+	}
+
+	std::cout << "Frames in flight: " << framesInFlight
+		<< (hostTransfer == HostTransfer::Persistent ? " (host copies, persistent mapping)"
+			: hostTransfer == HostTransfer::Orphan ? " (host copies, orphaned buffers)"
+			: createEventFromGLsync != nullptr ? " (" GL_EVENT_EXTENSION ")" : GLEW_ARB_sync ? " (GL fences)" : " (glFinish)") << std::endl;
+
+	// bytes copied from OpenCL to GL through the host, without sharing
+	size_t frameTransferBytes = 0;
+	double totalTransferBytes = 0.0;
+	size_t numTransferFrames = 0;
+
+	// the simulation runs at a fixed rate independent of the frame rate
+	FixedTimestep fixedTimestep(1.0 / simulationRate, maxSubsteps);
+
+	const double performanceFrequency = static_cast<double>(SDL_GetPerformanceFrequency());
+	Uint64 t1 = SDL_GetPerformanceCounter();
+
+	// host time spent waiting on either API, the rest of the frame overlaps with the GPU
+	Uint64 frameStallCounter = 0;
+
+	PhaseTimings timings;
+	auto getCounterMs = [performanceFrequency](Uint64 counter)
+	{
+		return static_cast<double>(counter) * 1000.0 / performanceFrequency;
+	};
+
+	char windowTitle[224];
+	cl_uint undrawnParticleCount = 0;
+
+	// main loop
+	double deltaTime = 0.0;
+	size_t frameIndex = 0;
+	bool loop = true;
+	while (loop)
+	{
+		//std::cout << "Frame start ===================================================" << std::endl;
+		const Uint64 frameStartCounter = SDL_GetPerformanceCounter();
+		const float deltaTimeSeconds = static_cast<float>(deltaTime);
+		const unsigned int numSubsteps = fixedTimestep.advance(deltaTime);
+
+		loop = handleInput(deltaTimeSeconds);
+
+		const Uint64 enqueueStartCounter = SDL_GetPerformanceCounter();
+		frameStallCounter = 0;
+
+		// simulate into the render slot GL drew framesInFlight frames ago
+		const unsigned int writeSlotIndex = static_cast<unsigned int>(frameIndex % framesInFlight);
+		RenderSlot& writeSlot = renderSlots[writeSlotIndex];
+		std::vector<ClProfilingEvent>* profilingEvents = profiling ? &writeSlot.profilingEvents : nullptr;
+
+		// one page of headroom for pages allocated by this frame's spawns, halving before shrinking avoids churn
+		// the slot was last drawn framesInFlight frames ago and OpenCL finished writing it before that
+		const size_t renderCapacity = deviceGroup.getRenderCapacity();
+		if (writeSlot.positionCapacity < renderCapacity || writeSlot.positionCapacity > 2 * renderCapacity)
+		{
+			code = resizeRenderSlotPositions(writeSlot, gpuContext, renderCapacity, hostTransfer);
+			CHECK_ERROR_CODE(resizeRenderSlotPositions);
+		}
+
+		// map OpenGL buffer object for writing from OpenCL once GL is done reading it
+		cl_event drawFenceEvent = nullptr;
+		if (writeSlot.drawFence != nullptr && createEventFromGLsync != nullptr)
+		{
+			drawFenceEvent = createEventFromGLsync(gpuContext, reinterpret_cast<cl_GLsync>(writeSlot.drawFence), &code);
+			CHECK_ERROR_CODE(clCreateEventFromGLsyncKHR);
+		}
+		else if (glSharing && writeSlot.drawFence != nullptr)
+		{
+			const Uint64 waitStart = SDL_GetPerformanceCounter();
+			GLenum waitResult;
+			do
+			{
+				waitResult = glClientWaitSync(writeSlot.drawFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while (waitResult == GL_TIMEOUT_EXPIRED);
+			frameStallCounter += SDL_GetPerformanceCounter() - waitStart;
+		}
+		else if (glSharing && !GLEW_ARB_sync)
+		{
+			const Uint64 waitStart = SDL_GetPerformanceCounter();
+			glFinish();
+			frameStallCounter += SDL_GetPerformanceCounter() - waitStart;
+		}
+
+		const cl_mem writeSlotGlObjects[] = { writeSlot.positionVboCl, writeSlot.drawCommandVboCl };
+		const cl_uint NUM_RENDER_SLOT_GL_OBJECTS = sizeof(writeSlotGlObjects) / sizeof(writeSlotGlObjects[0]);
+
+		if (glSharing)
+		{
+			code = clEnqueueAcquireGLObjects(commandQueue, NUM_RENDER_SLOT_GL_OBJECTS, writeSlotGlObjects, drawFenceEvent != nullptr ? 1 : 0, drawFenceEvent != nullptr ? &drawFenceEvent : nullptr, getProfilingEvent(profilingEvents, "cl/acquire"));
+			CHECK_ERROR_CODE(clEnqueueAcquireGLObjects);
+		}
+
+		if (drawFenceEvent != nullptr)
+		{
+			clReleaseEvent(drawFenceEvent);
+		}
+
+		// loaded fields replace the inert ones on every device, then a few bricks are streamed per frame
+		for (size_t i = 0; i < forceFieldLoads.size(); ++i)
+		{
+			if (forceFieldLoads[i].valid() && forceFieldLoads[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				const std::shared_ptr<const VectorField> field = forceFieldLoads[i].get();
+				for (size_t device = 0; device < deviceGroup.getNumDevices(); ++device)
+				{
+					code = deviceGroup.getSimulation(device).getForceFields().setField(i, field);
+					CHECK_ERROR_CODE(ClForceFields::setField);
+				}
+			}
+		}
+		for (size_t device = 0; device < deviceGroup.getNumDevices(); ++device)
+		{
+			ClParticleSimulation& deviceSimulation = deviceGroup.getSimulation(device);
+			if (!deviceSimulation.getForceFields().isComplete())
+			{
+				code = deviceSimulation.getForceFields().enqueueUploads(FORCE_FIELD_UPLOAD_BUDGET, &deviceSimulation == &simulation ? profilingEvents : nullptr);
+				CHECK_ERROR_CODE(ClForceFields::enqueueUploads);
+			}
+		}
+
+		// every substep of the frame is enqueued between the same acquire and release
+		// the alive list is rebuilt after each one so that particles spawned by a substep are simulated by the next,
+		// and at least once per frame; only the last rebuild gathers the render positions, for the new interpolation offset,
+		// so a frame catching up several substeps does not gather positions that are overwritten before the draw
+
+		const cl_float stepSeconds = static_cast<cl_float>(fixedTimestep.getStepSeconds());
+		const cl_float renderTimeOffset = interpolateRender
+			? static_cast<cl_float>((fixedTimestep.getInterpolationAlpha() - 1.0) * fixedTimestep.getStepSeconds())
+			: 0.f;
+
+		const unsigned int numCompactions = std::max(numSubsteps, 1u);
+		for (unsigned int substep = 0; substep < numCompactions; ++substep)
+		{
+			if (substep < numSubsteps)
+			{
+				fixedTimestep.step();
+				const cl_float currentTimeSeconds = static_cast<cl_float>(fixedTimestep.getSimulationTime());
+
+				// prepare particles to spawn, fractions are carried over so the rate does not depend on the step
+				particleSpawnRemainder += particleSpawnRate * fixedTimestep.getStepSeconds();
+				const cl_uint numParticlesToSpawn = static_cast<cl_uint>(particleSpawnRemainder);
+				particleSpawnRemainder -= numParticlesToSpawn;
+
+				code = deviceGroup.enqueueSubstep(writeSlotIndex, randomSeed, simulationStep++, currentTimeSeconds, stepSeconds, numParticlesToSpawn);
+				CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueSubstep);
+			}
+
+			// rebuild the alive list, then on the last substep gather the positions to draw into the render slot
+			const size_t renderCapacity = substep + 1 == numCompactions ? writeSlot.positionCapacity : 0;
+			code = deviceGroup.enqueueCompaction(writeSlotIndex, writeSlot.positionVboCl, renderCapacity, renderTimeOffset);
+			CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueCompaction);
+		}
+
+		// the alive lists of the last compaction are rewritten to the new order, the grid below builds from them
+		if (mortonOrderInterval > 0 && (frameIndex + 1) % mortonOrderInterval == 0)
+		{
+			code = mortonOrder.enqueueReorder(simulation, profilingEvents);
+			CHECK_ERROR_CODE(ClMortonOrder::enqueueReorder);
+		}
+
+		// the grid follows the last compaction, a new query is queued once the previous answer is back
+		if (gridCellSize > 0.f)
+		{
+			code = spatialGrid.enqueueBuild(simulation, profilingEvents);
+			CHECK_ERROR_CODE(ClSpatialGrid::enqueueBuild);
+
+			if (!focusQueryPending || focusQuery.isReady())
+			{
+				if (focusQueryPending)
+				{
+					focusCount = focusQuery.getCount();
+				}
+
+				const cl_float3 focusPoint = { {
+					cameraPosition.s[0] + cameraForward.s[0] * focusDistance,
+					cameraPosition.s[1] + cameraForward.s[1] * focusDistance,
+					cameraPosition.s[2] + cameraForward.s[2] * focusDistance,
+					0.f
+				} };
+				code = spatialGrid.enqueueCountInSphere(focusPoint, focusRadius, focusQuery);
+				CHECK_ERROR_CODE(ClSpatialGrid::enqueueCountInSphere);
+				focusQueryPending = true;
+			}
+		}
+
+		// the other devices' positions are copied after this device's, the host waits for them
+		const Uint64 gatherStart = SDL_GetPerformanceCounter();
+		code = deviceGroup.enqueueGather(writeSlotIndex, writeSlot.positionVboCl, writeSlot.drawCommandVboCl);
+		CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueGather);
+		if (deviceGroup.getNumDevices() > 1)
+		{
+			frameStallCounter += SDL_GetPerformanceCounter() - gatherStart;
+		}
+
+		// culled with this frame's camera like the sort below
+		if (culling)
+		{
+			const glm::mat4 viewProjectionMatrix = projectionMatrix * modelViewMatrix;
+			code = frustumCull.enqueueCull(writeSlot.positionVboCl, writeSlot.positionCapacity, writeSlot.drawCommandVboCl,
+				static_cast<cl_uint>(deviceGroup.getNumDevices()), glm::value_ptr(viewProjectionMatrix), PARTICLE_SIZE * 0.5f * glm::root_two<float>(),
+				projectionMatrix[1][1] * static_cast<float>(windowHeight) * 0.5f, minPixelSize, profilingEvents);
+			CHECK_ERROR_CODE(ClFrustumCull::enqueueCull);
+		}
+
+		// sorted with this frame's camera, GL draws the slot framesInFlight - 1 frames later, close enough for blending
+		if (depthSort)
+		{
+			code = depthSorter.enqueueSort(writeSlot.positionVboCl, writeSlot.positionCapacity, writeSlot.drawCommandVboCl,
+				static_cast<cl_uint>(deviceGroup.getNumDevices()), glm::value_ptr(modelViewMatrix), profilingEvents);
+			CHECK_ERROR_CODE(ClDepthSort::enqueueSort);
+		}
+
+		// completes before the release event, sizes the draw fallback
+		// the sorted positions are all drawn by the first draw command, whose count only exists on the device
+		code = clEnqueueReadBuffer(commandQueue, packedDraws ? writeSlot.drawCommandVboCl : simulation.getAliveCountBuffer(), CL_FALSE, 0, sizeof(cl_uint),
+			&writeSlot.aliveParticleCount, 0, 0, 0);
+		CHECK_ERROR_CODE(clEnqueueReadBuffer);
+
+		code = clEnqueueReadBuffer(commandQueue, simulation.getAliveCountBuffer(), CL_FALSE, sizeof(cl_uint), sizeof(cl_uint), &writeSlot.totalAliveCount, 0, 0, 0);
+		CHECK_ERROR_CODE(clEnqueueReadBuffer);
+
+		// unmap buffer objectS
+		if (glSharing)
+		{
+			code = clEnqueueReleaseGLObjects(commandQueue, NUM_RENDER_SLOT_GL_OBJECTS, writeSlotGlObjects, 0, 0, &writeSlot.releaseEvent);
+			CHECK_ERROR_CODE(clEnqueueReleaseGLObjects);
+		}
+		else
+		{
+			// only the ranges that can hold drawn positions: the first device's are within its allocated pages
+			size_t numPositions = std::min(simulation.getCapacity(), writeSlot.positionCapacity);
+			const std::vector<ClDrawArraysIndirectCommand>& drawCommands = deviceGroup.getDrawCommands(writeSlotIndex);
+			for (size_t i = 1; i < drawCommands.size(); ++i)
+			{
+				numPositions = std::max(numPositions, static_cast<size_t>(drawCommands[i].first) + drawCommands[i].count);
+			}
+
+			code = enqueueRenderSlotDownload(writeSlot, commandQueue, numPositions, numDrawCommands, profilingEvents, &writeSlot.releaseEvent);
+			CHECK_ERROR_CODE(enqueueRenderSlotDownload);
+		}
+
+		if (profilingEvents != nullptr && glSharing)
+		{
+			clRetainEvent(writeSlot.releaseEvent);
+			profilingEvents->push_back({ "cl/release", writeSlot.releaseEvent });
+		}
+
+		code = clFlush(commandQueue);
+		CHECK_ERROR_CODE(clFlush);
+
+		const Uint64 drawStartCounter = SDL_GetPerformanceCounter();
+
+		// opengl render
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		// the oldest render slot, the one written this frame when running a single frame in flight
+		if (frameIndex + 1 >= framesInFlight)
+		{
+			const unsigned int drawSlotIndex = static_cast<unsigned int>((frameIndex + 1) % framesInFlight);
+			RenderSlot& drawSlot = renderSlots[drawSlotIndex];
+
+			const Uint64 waitStart = SDL_GetPerformanceCounter();
+			code = clWaitForEvents(1, &drawSlot.releaseEvent);
+			CHECK_ERROR_CODE(clWaitForEvents);
+			frameStallCounter += SDL_GetPerformanceCounter() - waitStart;
+
+			clReleaseEvent(drawSlot.releaseEvent);
+			drawSlot.releaseEvent = nullptr;
+			undrawnParticleCount = drawSlot.totalAliveCount - drawSlot.aliveParticleCount + static_cast<cl_uint>(deviceGroup.getNumUndrawnParticles(drawSlotIndex));
+
+			if (profiling)
+			{
+				addProfilingSamples(drawSlot.profilingEvents, timings, "cl/frame");
+			}
+			// also rebalances the devices from their kernel times
+			deviceGroup.collectFrame(drawSlotIndex, profiling ? &timings : nullptr);
+
+			// the staging buffers were mapped with the release event, the next frame keeps OpenCL busy meanwhile
+			if (hostTransfer != HostTransfer::None)
+			{
+				const Uint64 uploadStart = SDL_GetPerformanceCounter();
+				code = uploadRenderSlot(drawSlot, commandQueue, numDrawCommands, hostTransfer, &frameTransferBytes);
+				CHECK_ERROR_CODE(uploadRenderSlot);
+				totalTransferBytes += static_cast<double>(frameTransferBytes);
+				++numTransferFrames;
+				if (profiling)
+				{
+					timings.addSample("host/upload", getCounterMs(SDL_GetPerformanceCounter() - uploadStart));
+				}
+			}
+
+			const bool instanced = billboardMode == BillboardMode::Instanced;
+			beginParticleDraw(drawSlot, instanced);
+
+			// the previous draw of this slot finished before OpenCL could write it again
+			if (drawSlot.drawTimeQuery != 0)
+			{
+				if (drawSlot.drawTimeQueryPending)
+				{
+					GLuint64 drawTimeNs = 0;
+					glGetQueryObjectui64v(drawSlot.drawTimeQuery, GL_QUERY_RESULT, &drawTimeNs);
+					timings.addSample(drawSlot.drawTimePhase, static_cast<double>(drawTimeNs) * 1e-6);
+				}
+				drawSlot.drawTimePhase = instanced ? "gl/drawInstanced" : "gl/draw";
+				glBeginQuery(GL_TIME_ELAPSED, drawSlot.drawTimeQuery);
+			}
+
+			// positions are packed, only the alive particles are drawn
+			// the first device's count only exists on the device, it was read back with the frame
+			// the culling and the depth sort moved every position into the first draw
+			const std::vector<ClDrawArraysIndirectCommand>& drawCommands = deviceGroup.getDrawCommands(drawSlotIndex);
+			if (instanced && culling && GLEW_ARB_draw_indirect)
+			{
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawSlot.drawCommandVbo);
+				glDrawArraysIndirect(GL_TRIANGLE_STRIP, reinterpret_cast<const void*>(deviceGroup.getNumDevices() * sizeof(ClDrawArraysIndirectCommand)));
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			}
+			else if (instanced)
+			{
+				// the draw commands count points, instances start at the first position of a command through a base instance,
+				// or the attribute offset before GL 4.2
+				const bool baseInstance = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+				for (size_t i = 0; i < (packedDraws ? 1 : drawCommands.size()); ++i)
+				{
+					const GLsizei count = i == 0 ? drawSlot.aliveParticleCount : drawCommands[i].count;
+					if (count > 0 && baseInstance)
+					{
+						glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, count, drawCommands[i].first);
+					}
+					else if (count > 0)
+					{
+						glBindBuffer(GL_ARRAY_BUFFER, drawSlot.positionVbo);
+						glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0,
+							reinterpret_cast<const void*>(drawCommands[i].first * 3 * sizeof(cl_float)));
+						glBindBuffer(GL_ARRAY_BUFFER, 0);
+						glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+					}
+				}
+				if (!baseInstance && !packedDraws)
+				{
+					setPositionAttribute(drawSlot.instancedVertexArray, drawSlot.positionVbo, 1);
+				}
+			}
+			else if (GLEW_ARB_draw_indirect)
+			{
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawSlot.drawCommandVbo);
+				for (size_t i = 0; i < deviceGroup.getNumDevices(); ++i)
+				{
+					glDrawArraysIndirect(GL_POINTS, reinterpret_cast<const void*>(i * sizeof(ClDrawArraysIndirectCommand)));
+				}
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			}
+			else
+			{
+				for (size_t i = 0; i < (packedDraws ? 1 : drawCommands.size()); ++i)
+				{
+					glDrawArrays(GL_POINTS, drawCommands[i].first, i == 0 ? drawSlot.aliveParticleCount : drawCommands[i].count);
+				}
+			}
+
+			if (drawSlot.drawTimeQuery != 0)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				drawSlot.drawTimeQueryPending = true;
+			}
+
+			glBindVertexArray(0);
+			glUseProgram(0);
+
+			// OpenCL waited on the previous fence before the release event completed, or the next upload waits on it
+			if ((glSharing || hostTransfer == HostTransfer::Persistent) && GLEW_ARB_sync)
+			{
+				if (drawSlot.drawFence != nullptr)
+				{
+					glDeleteSync(drawSlot.drawFence);
+				}
+				drawSlot.drawFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				glFlush();
+			}
+		}
+
+		const Uint64 swapStartCounter = SDL_GetPerformanceCounter();
+
+		SDL_GL_SwapWindow(window);
+
+		++frameIndex;
+
+		Uint64 t2 = SDL_GetPerformanceCounter();
+		deltaTime = static_cast<double>(t2 - t1) / performanceFrequency;
+		t1 = t2;
+		const double frameStallMs = getCounterMs(frameStallCounter);
+
+		// stall time is also part of the enqueue and draw phases
+		if (profiling)
+		{
+			timings.addSample("host/input", getCounterMs(enqueueStartCounter - frameStartCounter));
+			timings.addSample("host/enqueue", getCounterMs(drawStartCounter - enqueueStartCounter));
+			timings.addSample("host/draw", getCounterMs(swapStartCounter - drawStartCounter));
+			timings.addSample("host/swap", getCounterMs(t2 - swapStartCounter));
+			timings.addSample("host/stall", frameStallMs);
+			timings.addSample("host/frame", getCounterMs(t2 - frameStartCounter));
+		}
+		int windowTitleLength = sprintf_s(windowTitle, "%.1f fps, %u substeps at %.0f Hz, %u frames in flight, %.1f ms stalled (%.0f%%), %u pages",
+			deltaTime > 0.0 ? 1.0 / deltaTime : 0.0, numSubsteps, simulationRate, framesInFlight, frameStallMs,
+			deltaTime > 0.0 ? 0.1 * frameStallMs / deltaTime : 0.0, static_cast<unsigned int>(simulation.getNumPages()));
+		if (hostTransfer != HostTransfer::None && windowTitleLength > 0)
+		{
+			windowTitleLength += std::max(0, sprintf_s(windowTitle + windowTitleLength, sizeof(windowTitle) - windowTitleLength, ", %.2f MB/frame copied", frameTransferBytes * 1e-6));
+		}
+		if (gridCellSize > 0.f && windowTitleLength > 0)
+		{
+			windowTitleLength += std::max(0, sprintf_s(windowTitle + windowTitleLength, sizeof(windowTitle) - windowTitleLength, ", %u particles near the view center", focusCount));
+		}
+		// particles past the render buffer, see the render positions capped message
+		if (undrawnParticleCount > 0 && windowTitleLength > 0)
+			windowTitleLength += std::max(0, sprintf_s(windowTitle + windowTitleLength, sizeof(windowTitle) - windowTitleLength, ", %u not drawn", undrawnParticleCount));
+		SDL_SetWindowTitle(window, windowTitle);
+	}
+
+	if (profiling)
+	{
+		timings.print(std::cout);
+		if (!timings.write(timingsPath))
+		{
+			std::cerr << "Could not write " << timingsPath << std::endl;
+		}
+	}
+
+	if (numTransferFrames > 0)
+	{
+		std::cout << "Host transfer: " << totalTransferBytes / static_cast<double>(numTransferFrames) * 1e-6 << " MB/frame on average" << std::endl;
+	}
+
+	// release opencl stuff
+	code = clFinish(commandQueue);
+	CHECK_ERROR_CODE(clFinish);
+	for (RenderSlot& slot : renderSlots)
+	{
+		if (slot.releaseEvent != nullptr)
+		{
+			clReleaseEvent(slot.releaseEvent);
+		}
+		releaseProfilingEvents(slot.profilingEvents);
+		clReleaseMemObject(slot.positionVboCl);
+		clReleaseMemObject(slot.drawCommandVboCl);
+		// the last frames were downloaded but never drawn
+		if (slot.mappedPositions != nullptr)
+		{
+			clEnqueueUnmapMemObject(commandQueue, slot.positionStagingCl, const_cast<cl_float*>(slot.mappedPositions), 0, nullptr, nullptr);
+			clEnqueueUnmapMemObject(commandQueue, slot.drawCommandStagingCl, const_cast<ClDrawArraysIndirectCommand*>(slot.mappedDrawCommands), 0, nullptr, nullptr);
+		}
+		if (slot.positionStagingCl != nullptr)
+		{
+			clReleaseMemObject(slot.positionStagingCl);
+		}
+		if (slot.drawCommandStagingCl != nullptr)
+		{
+			clReleaseMemObject(slot.drawCommandStagingCl);
+		}
+	}
+	for (size_t i = 0; i < deviceGroup.getNumDevices(); ++i)
+	{
+		std::cout << "Device " << i << " share: " << deviceGroup.getShare(i) * 100.0 << "% ("
+			<< getDeviceInfoString(deviceGroup.getDeviceId(i), CL_DEVICE_NAME) << ")" << std::endl;
+	}
+	focusQuery.release();
+	spatialGrid.release();
+	depthSorter.release();
+	frustumCull.release();
+	mortonOrder.release();
+	deviceGroup.release();
+	simulation.release();
+	clReleaseCommandQueue(commandQueue);
+	clReleaseContext(gpuContext);
+
+	// release opengl stuff
+	for (RenderSlot& slot : renderSlots)
+	{
+		if (slot.drawFence != nullptr)
+		{
+			glDeleteSync(slot.drawFence);
+		}
+		if (slot.drawTimeQuery != 0)
+		{
+			glDeleteQueries(1, &slot.drawTimeQuery);
+		}
+		glDeleteVertexArrays(1, &slot.pointVertexArray);
+		glDeleteVertexArrays(1, &slot.instancedVertexArray);
+		glDeleteBuffers(1, &slot.positionVbo);
+		glDeleteBuffers(1, &slot.drawCommandVbo);
+	}
+	releaseWindow();
+
+	return EXIT_SUCCESS;
+}
+
+// shaders
+GLuint loadProgram(BinaryCache& binaryCache, const std::vector<std::pair<GLenum, std::string>>& shaderSources)
+{
+	std::vector<std::string> sources;
+	for (const std::pair<GLenum, std::string>& shaderSource : shaderSources)
+	{
+		sources.push_back(shaderSource.second);
+	}
+
+	const std::string cacheKey = getGlProgramCacheKey(sources);
+	GLuint programId = loadCachedProgram(binaryCache, cacheKey);
+	if (programId != 0)
+	{
+		return programId;
+	}
+
+	std::vector<GLuint> shaderIds;
+	for (const std::pair<GLenum, std::string>& shaderSource : shaderSources)
+	{
+		GLuint shaderId = loadShader(shaderSource.first, shaderSource.second.c_str());
+		if (shaderId == 0)
+		{
+			break;
+		}
+		shaderIds.push_back(shaderId);
+	}
+
+	if (shaderIds.size() == shaderSources.size())
+	{
+		programId = compileProgram(shaderIds);
+	}
+	// the program keeps the shaders it was linked with
+	for (GLuint shaderId : shaderIds)
+	{
+		glDeleteShader(shaderId);
+	}
+
+	if (programId != 0)
+	{
+		storeCachedProgram(binaryCache, cacheKey, programId);
+	}
+	return programId;
+}
+
+GLuint compileProgram(const std::vector<GLuint>& shaderIds)
+{
+	GLuint programId = glCreateProgram();
+	if (GLEW_ARB_get_program_binary)
+	{
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	for (GLuint shaderId : shaderIds)
+	{
+		glAttachShader(programId, shaderId);
+	}
+	glLinkProgram(programId);
+	if (!checkProgram(programId))
+	{
+		glDeleteProgram(programId);
+		return 0;
+	}
+	return programId;
+}
+
+bool checkProgram(GLuint programId)
+{
+	GLint result = GL_FALSE;
+	glGetProgramiv(programId, GL_LINK_STATUS, &result);
+
+	if (!result)
+	{
+		GLint infoLogLength;
+		glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
+		GLchar* message = static_cast<GLchar*>(alloca(infoLogLength * sizeof(GLchar)));
+		glGetProgramInfoLog(programId, infoLogLength, NULL, message);
+		fprintf(stderr, "Warning: %s\n", message);
 		return false;
 	}
 
@@ -641,98 +1737,237 @@ bool checkShader(GLuint shaderId)
 	return true;
 }
 
-// from https://stackoverflow.com/questions/24326432/convenient-way-to-show-opencl-error-codes
-const char* getErrorString(cl_int error)
+cl_int resizeRenderSlotPositions(RenderSlot& slot, cl_context context, size_t capacity, HostTransfer hostTransfer)
 {
-	switch (error) {
-		// run-time and JIT compiler errors
-	case 0: return "CL_SUCCESS";
-	case -1: return "CL_DEVICE_NOT_FOUND";
-	case -2: return "CL_DEVICE_NOT_AVAILABLE";
-	case -3: return "CL_COMPILER_NOT_AVAILABLE";
-	case -4: return "CL_MEM_OBJECT_ALLOCATION_FAILURE";
-	case -5: return "CL_OUT_OF_RESOURCES";
-	case -6: return "CL_OUT_OF_HOST_MEMORY";
-	case -7: return "CL_PROFILING_INFO_NOT_AVAILABLE";
-	case -8: return "CL_MEM_COPY_OVERLAP";
-	case -9: return "CL_IMAGE_FORMAT_MISMATCH";
-	case -10: return "CL_IMAGE_FORMAT_NOT_SUPPORTED";
-	case -11: return "CL_BUILD_PROGRAM_FAILURE";
-	case -12: return "CL_MAP_FAILURE";
-	case -13: return "CL_MISALIGNED_SUB_BUFFER_OFFSET";
-	case -14: return "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
-	case -15: return "CL_COMPILE_PROGRAM_FAILURE";
-	case -16: return "CL_LINKER_NOT_AVAILABLE";
-	case -17: return "CL_LINK_PROGRAM_FAILURE";
-	case -18: return "CL_DEVICE_PARTITION_FAILED";
-	case -19: return "CL_KERNEL_ARG_INFO_NOT_AVAILABLE";
-
-		// compile-time errors
-	case -30: return "CL_INVALID_VALUE";
-	case -31: return "CL_INVALID_DEVICE_TYPE";
-	case -32: return "CL_INVALID_PLATFORM";
-	case -33: return "CL_INVALID_DEVICE";
-	case -34: return "CL_INVALID_CONTEXT";
-	case -35: return "CL_INVALID_QUEUE_PROPERTIES";
-	case -36: return "CL_INVALID_COMMAND_QUEUE";
-	case -37: return "CL_INVALID_HOST_PTR";
-	case -38: return "CL_INVALID_MEM_OBJECT";
-	case -39: return "CL_INVALID_IMAGE_FORMAT_DESCRIPTOR";
-	case -40: return "CL_INVALID_IMAGE_SIZE";
-	case -41: return "CL_INVALID_SAMPLER";
-	case -42: return "CL_INVALID_BINARY";
-	case -43: return "CL_INVALID_BUILD_OPTIONS";
-	case -44: return "CL_INVALID_PROGRAM";
-	case -45: return "CL_INVALID_PROGRAM_EXECUTABLE";
-	case -46: return "CL_INVALID_KERNEL_NAME";
-	case -47: return "CL_INVALID_KERNEL_DEFINITION";
-	case -48: return "CL_INVALID_KERNEL";
-	case -49: return "CL_INVALID_ARG_INDEX";
-	case -50: return "CL_INVALID_ARG_VALUE";
-	case -51: return "CL_INVALID_ARG_SIZE";
-	case -52: return "CL_INVALID_KERNEL_ARGS";
-	case -53: return "CL_INVALID_WORK_DIMENSION";
-	case -54: return "CL_INVALID_WORK_GROUP_SIZE";
-	case -55: return "CL_INVALID_WORK_ITEM_SIZE";
-	case -56: return "CL_INVALID_GLOBAL_OFFSET";
-	case -57: return "CL_INVALID_EVENT_WAIT_LIST";
-	case -58: return "CL_INVALID_EVENT";
-	case -59: return "CL_INVALID_OPERATION";
-	case -60: return "CL_INVALID_GL_OBJECT";
-	case -61: return "CL_INVALID_BUFFER_SIZE";
-	case -62: return "CL_INVALID_MIP_LEVEL";
-	case -63: return "CL_INVALID_GLOBAL_WORK_SIZE";
-	case -64: return "CL_INVALID_PROPERTY";
-	case -65: return "CL_INVALID_IMAGE_DESCRIPTOR";
-	case -66: return "CL_INVALID_COMPILER_OPTIONS";
-	case -67: return "CL_INVALID_LINKER_OPTIONS";
-	case -68: return "CL_INVALID_DEVICE_PARTITION_COUNT";
-
-		// extension errors
-	case -1000: return "CL_INVALID_GL_SHAREGROUP_REFERENCE_KHR";
-	case -1001: return "CL_PLATFORM_NOT_FOUND_KHR";
-	case -1002: return "CL_INVALID_D3D10_DEVICE_KHR";
-	case -1003: return "CL_INVALID_D3D10_RESOURCE_KHR";
-	case -1004: return "CL_D3D10_RESOURCE_ALREADY_ACQUIRED_KHR";
-	case -1005: return "CL_D3D10_RESOURCE_NOT_ACQUIRED_KHR";
-	default: return "Unknown OpenCL error";
+	if (slot.positionVboCl != nullptr)
+	{
+		clReleaseMemObject(slot.positionVboCl);
+		slot.positionVboCl = nullptr;
+	}
+	if (slot.positionStagingCl != nullptr)
+	{
+		clReleaseMemObject(slot.positionStagingCl);
+		slot.positionStagingCl = nullptr;
+	}
+
+	allocateRenderSlotPositions(slot, capacity, hostTransfer);
+	const size_t positionBytes = std::max(capacity, size_t(1)) * 3 * sizeof(cl_float);
+
+	cl_int code;
+	if (hostTransfer != HostTransfer::None)
+	{
+		slot.positionVboCl = clCreateBuffer(context, CL_MEM_READ_WRITE, positionBytes, nullptr, &code);
+		if (code != CL_SUCCESS)
+		{
+			return code;
+		}
+
+		// pinned host memory on most drivers, mapping it does not copy
+		slot.positionStagingCl = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, positionBytes, nullptr, &code);
+		return code;
 	}
+
+	// GL must be done with the buffer before OpenCL acquires it, the draw fence predates the reallocation
+	glFinish();
+
+	slot.positionVboCl = clCreateFromGLBuffer(context, CL_MEM_READ_WRITE, slot.positionVbo, &code);
+	return code;
 }
 
-std::string getErrorLog(cl_program program, cl_device_id deviceId)
+void allocateRenderSlotPositions(RenderSlot& slot, size_t capacity, HostTransfer hostTransfer)
 {
+	const size_t positionBytes = std::max(capacity, size_t(1)) * 3 * sizeof(cl_float);
+	slot.positionCapacity = capacity;
+
+	// immutable storage cannot be reallocated, the buffer is replaced
+	if (hostTransfer == HostTransfer::Persistent)
+	{
+		glDeleteBuffers(1, &slot.positionVbo);
+		slot.positionVbo = createBuffer();
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		if (hasDirectStateAccess())
+		{
+			glNamedBufferStorage(slot.positionVbo, positionBytes, nullptr, flags);
+			slot.persistentPositions = glMapNamedBufferRange(slot.positionVbo, 0, positionBytes, flags);
+		}
+		else
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, slot.positionVbo);
+			glBufferStorage(GL_ARRAY_BUFFER, positionBytes, nullptr, flags);
+			slot.persistentPositions = glMapBufferRange(GL_ARRAY_BUFFER, 0, positionBytes, flags);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+	else
+	{
+		setBufferData(slot.positionVbo, positionBytes, nullptr, hostTransfer == HostTransfer::None ? GL_DYNAMIC_DRAW : GL_STREAM_DRAW);
+	}
+
+	if (slot.pointVertexArray == 0)
+	{
+		if (hasDirectStateAccess())
+		{
+			glCreateVertexArrays(1, &slot.pointVertexArray);
+			glCreateVertexArrays(1, &slot.instancedVertexArray);
+		}
+		else
+		{
+			glGenVertexArrays(1, &slot.pointVertexArray);
+			glGenVertexArrays(1, &slot.instancedVertexArray);
+		}
+	}
+	setPositionAttribute(slot.pointVertexArray, slot.positionVbo, 0);
+	setPositionAttribute(slot.instancedVertexArray, slot.positionVbo, 1);
+}
+
+cl_int enqueueRenderSlotDownload(RenderSlot& slot, cl_command_queue commandQueue, size_t numPositions, size_t numDrawCommands,
+	std::vector<ClProfilingEvent>* profilingEvents, cl_event* event)
+{
+	slot.numStagedPositions = std::min(numPositions, slot.positionCapacity);
+
 	cl_int code;
-	size_t errorLogLength;
-	code = clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &errorLogLength);
-	assert(code == 0);
+	if (slot.numStagedPositions > 0)
+	{
+		code = clEnqueueCopyBuffer(commandQueue, slot.positionVboCl, slot.positionStagingCl, 0, 0, slot.numStagedPositions * 3 * sizeof(cl_float),
+			0, nullptr, getProfilingEvent(profilingEvents, "cl/downloadPositions"));
+		if (code != CL_SUCCESS)
+		{
+			return code;
+		}
+	}
+
+	const size_t drawCommandBytes = numDrawCommands * sizeof(ClDrawArraysIndirectCommand);
+	code = clEnqueueCopyBuffer(commandQueue, slot.drawCommandVboCl, slot.drawCommandStagingCl, 0, 0, drawCommandBytes, 0, nullptr, nullptr);
+	if (code != CL_SUCCESS)
+	{
+		return code;
+	}
+
+	// a mapping covers at least one position
+	slot.mappedPositions = static_cast<const cl_float*>(clEnqueueMapBuffer(commandQueue, slot.positionStagingCl, CL_FALSE, CL_MAP_READ,
+		0, std::max(slot.numStagedPositions, size_t(1)) * 3 * sizeof(cl_float), 0, nullptr, nullptr, &code));
+	if (code != CL_SUCCESS)
+	{
+		return code;
+	}
+
+	slot.mappedDrawCommands = static_cast<const ClDrawArraysIndirectCommand*>(clEnqueueMapBuffer(commandQueue, slot.drawCommandStagingCl, CL_FALSE, CL_MAP_READ,
+		0, drawCommandBytes, 0, nullptr, event, &code));
+	return code;
+}
+
+cl_int uploadRenderSlot(RenderSlot& slot, cl_command_queue commandQueue, size_t numDrawCommands, HostTransfer hostTransfer, size_t* numBytes)
+{
+	// only the positions the draw commands cover, the staged ranges also hold the headroom of every device
+	size_t numPositions = 0;
+	for (size_t i = 0; i < numDrawCommands; ++i)
+	{
+		numPositions = std::max(numPositions, static_cast<size_t>(slot.mappedDrawCommands[i].first) + slot.mappedDrawCommands[i].count);
+	}
+	numPositions = std::min(numPositions, slot.numStagedPositions);
+
+	const size_t positionBytes = numPositions * 3 * sizeof(cl_float);
+	const size_t drawCommandBytes = numDrawCommands * sizeof(ClDrawArraysIndirectCommand);
+
+	if (hostTransfer == HostTransfer::Persistent)
+	{
+		// the mapping is coherent, GL only has to be done drawing the previous contents
+		if (slot.drawFence != nullptr)
+		{
+			while (glClientWaitSync(slot.drawFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			{
+			}
+		}
+		memcpy(slot.persistentPositions, slot.mappedPositions, positionBytes);
+	}
+	else
+	{
+		// a new allocation every upload, the previous one lives on until GL is done drawing it
+		setBufferData(slot.positionVbo, std::max(slot.positionCapacity, size_t(1)) * 3 * sizeof(cl_float), nullptr, GL_STREAM_DRAW);
+		setBufferSubData(slot.positionVbo, 0, positionBytes, slot.mappedPositions);
+	}
+
+	setBufferSubData(slot.drawCommandVbo, 0, drawCommandBytes, slot.mappedDrawCommands);
+
+	*numBytes = positionBytes + drawCommandBytes;
 
-	std::string errorLog;
-	errorLog.resize(errorLogLength);
+	cl_int code = clEnqueueUnmapMemObject(commandQueue, slot.positionStagingCl, const_cast<cl_float*>(slot.mappedPositions), 0, nullptr, nullptr);
+	if (code == CL_SUCCESS)
+	{
+		code = clEnqueueUnmapMemObject(commandQueue, slot.drawCommandStagingCl, const_cast<ClDrawArraysIndirectCommand*>(slot.mappedDrawCommands), 0, nullptr, nullptr);
+	}
+	slot.mappedPositions = nullptr;
+	slot.mappedDrawCommands = nullptr;
+	return code;
+}
 
-	code = clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, errorLogLength, (void*)errorLog.data(), NULL);
-	assert(code == 0);
+bool hasDirectStateAccess()
+{
+	return GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access;
+}
 
-	return errorLog;
+GLuint createBuffer()
+{
+	GLuint buffer = 0;
+	if (hasDirectStateAccess())
+	{
+		glCreateBuffers(1, &buffer);
+	}
+	else
+	{
+		glGenBuffers(1, &buffer);
+	}
+	return buffer;
+}
+
+void setBufferData(GLuint buffer, size_t size, const void* data, GLenum usage)
+{
+	if (hasDirectStateAccess())
+	{
+		glNamedBufferData(buffer, size, data, usage);
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+void setBufferSubData(GLuint buffer, size_t offset, size_t size, const void* data)
+{
+	if (hasDirectStateAccess())
+	{
+		glNamedBufferSubData(buffer, offset, size, data);
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+void setPositionAttribute(GLuint vertexArray, GLuint buffer, GLuint divisor)
+{
+	if (hasDirectStateAccess())
+	{
+		glVertexArrayVertexBuffer(vertexArray, 0, buffer, 0, 3 * sizeof(GLfloat));
+		glVertexArrayAttribFormat(vertexArray, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribBinding(vertexArray, POSITION_ATTRIBUTE, 0);
+		glVertexArrayBindingDivisor(vertexArray, 0, divisor);
+		glEnableVertexArrayAttrib(vertexArray, POSITION_ATTRIBUTE);
+	}
+	else
+	{
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glVertexAttribDivisor(POSITION_ATTRIBUTE, divisor);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 }
 
 std::string readFile(const std::string& filePath)
@@ -760,20 +1995,40 @@ GLuint loadImage(const std::string& filePath)
 	}
 
 	GLuint textureId = 0;
-	glGenTextures(1, &textureId);
+	if (hasDirectStateAccess())
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &textureId);
+	}
+	else
+	{
+		glGenTextures(1, &textureId);
+	}
 	if (textureId == 0)
 	{
 		std::cerr << "glGenTextures failed" << std::endl;
 		return 0;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// a single level, the particles never get small enough for mipmaps to matter
+	if (hasDirectStateAccess())
+	{
+		glTextureStorage2D(textureId, 1, GL_RGBA8, surface->w, surface->h);
+		glTextureSubImage2D(textureId, 0, 0, 0, surface->w, surface->h, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+		glTextureParameteri(textureId, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(textureId, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureParameteri(textureId, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(textureId, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, textureId);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, surface->w, surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
 
 	SDL_FreeSurface(surface);
 
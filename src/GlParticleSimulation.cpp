@@ -0,0 +1,265 @@
+#include "GlParticleSimulation.h"
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+const char* KERNEL_DEFINES[NUM_GL_PARTICLE_KERNELS] =
+{
+	"INIT_PARTICLE_STATE",
+	"SPAWN_PARTICLE",
+	"SIMULATE_PARTICLES",
+	"COUNT_ALIVE_PARTICLES",
+	"SCAN_BLOCK_COUNTS",
+	"COMPACT_ALIVE_PARTICLES",
+};
+
+// layout(location) of the uniforms of shaders/particle.comp, each program only has those its kernel reads
+const GLint SEED_LOCATION = 0;
+const GLint STEP_INDEX_LOCATION = 1;
+const GLint CURRENT_TIME_LOCATION = 2;
+const GLint DELTA_TIME_LOCATION = 3;
+const GLint NUM_PARTICLES_TO_SPAWN_LOCATION = 4;
+const GLint NUM_PARTICLES_LOCATION = 5;
+const GLint RENDER_TIME_OFFSET_LOCATION = 6;
+const GLint RENDER_CAPACITY_LOCATION = 7;
+const GLint FIRST_SPAWN_ID_LOCATION = 8;
+
+std::string getArrayElementName(const char* name, size_t index)
+{
+	return std::string(name) + "[" + std::to_string(index) + "]";
+}
+}
+
+std::string getGlParticleKernelSource(GlParticleKernel kernel, const std::vector<std::string>& sources)
+{
+	std::string source = "#version 430 core\n#define ";
+	source += KERNEL_DEFINES[static_cast<size_t>(kernel)];
+	source += "\n";
+	for (const std::string& part : sources)
+	{
+		source += part;
+		source += "\n";
+	}
+	return source;
+}
+
+GlParticleSimulation::GlParticleSimulation() :
+	m_buffers(),
+	m_maxNumParticles(0),
+	m_nextSpawnId(0)
+{
+}
+
+GlParticleSimulation::~GlParticleSimulation()
+{
+	release();
+}
+
+bool GlParticleSimulation::create(const std::vector<GLuint>& programs, size_t maxNumParticles)
+{
+	release();
+	m_programs = programs;
+	m_maxNumParticles = maxNumParticles;
+	m_nextSpawnId = 0;
+
+	// the count and compaction kernels are dispatched over every particle
+	GLint maxNumGroups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxNumGroups);
+	if (m_programs.size() != NUM_GL_PARTICLE_KERNELS || maxNumParticles == 0 || getNumGroups(maxNumParticles) > static_cast<GLuint>(maxNumGroups))
+	{
+		return false;
+	}
+
+	const GLsizeiptr sizes[NumStorageBuffers] =
+	{
+		static_cast<GLsizeiptr>(maxNumParticles * 3 * sizeof(GLfloat)),
+		static_cast<GLsizeiptr>(maxNumParticles * 3 * sizeof(GLfloat)),
+		static_cast<GLsizeiptr>(maxNumParticles * sizeof(GLfloat)),
+		static_cast<GLsizeiptr>(maxNumParticles * sizeof(GLuint)),
+		static_cast<GLsizeiptr>(maxNumParticles * sizeof(GLuint)),
+		static_cast<GLsizeiptr>(getNumGroups(maxNumParticles) * sizeof(GLuint)),
+		static_cast<GLsizeiptr>(maxNumParticles * sizeof(GLuint)),
+		// freeCount, aliveCount and the three simulateGroups
+		static_cast<GLsizeiptr>(5 * sizeof(GLuint)),
+		static_cast<GLsizeiptr>(maxNumParticles * sizeof(GLuint)),
+	};
+	glGenBuffers(NumStorageBuffers, m_buffers);
+	for (int i = 0; i < NumStorageBuffers; ++i)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffers[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], nullptr, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (glGetError() != GL_NO_ERROR)
+	{
+		release();
+		return false;
+	}
+
+	for (GLuint program : m_programs)
+	{
+		glProgramUniform1ui(program, NUM_PARTICLES_LOCATION, static_cast<GLuint>(maxNumParticles));
+	}
+
+	// every field the modifiers sample pushes nothing until set
+	const GLuint simulateProgram = getProgram(GlParticleKernel::SimulateParticles);
+	while (glGetUniformLocation(simulateProgram, getArrayElementName("forceFields", m_forceFieldTextures.size()).c_str()) != -1)
+	{
+		m_forceFieldTextures.push_back(0);
+	}
+	for (size_t i = 0; i < m_forceFieldTextures.size(); ++i)
+	{
+		glProgramUniform1i(simulateProgram, glGetUniformLocation(simulateProgram, getArrayElementName("forceFields", i).c_str()),
+			static_cast<GLint>(FORCE_FIELD_TEXTURE_UNIT + i));
+		setForceField(i, nullptr);
+	}
+
+	bindStorageBuffers();
+	glUseProgram(getProgram(GlParticleKernel::InitParticleState));
+	glDispatchCompute(getNumGroups(maxNumParticles), 1, 1);
+	glUseProgram(0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	return true;
+}
+
+void GlParticleSimulation::dispatchSubstep(uint32_t seed, uint32_t step, float currentTime, float deltaTime, uint32_t numParticlesToSpawn)
+{
+	bindStorageBuffers();
+
+	// the group count was written by the last compaction, the barrier after it made it visible to the command
+	const GLuint simulateProgram = getProgram(GlParticleKernel::SimulateParticles);
+	glProgramUniform1ui(simulateProgram, SEED_LOCATION, seed);
+	glProgramUniform1ui(simulateProgram, STEP_INDEX_LOCATION, step);
+	glProgramUniform1f(simulateProgram, CURRENT_TIME_LOCATION, currentTime);
+	glProgramUniform1f(simulateProgram, DELTA_TIME_LOCATION, deltaTime);
+	glUseProgram(simulateProgram);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_buffers[Counters]);
+	glDispatchComputeIndirect(SIMULATE_GROUPS_OFFSET);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+	// the free list pushed by the deaths above is popped by the spawns
+	// spawn ids count the requested particles like on OpenCL, dropped ones included
+	const uint32_t firstSpawnId = m_nextSpawnId;
+	m_nextSpawnId += numParticlesToSpawn;
+	numParticlesToSpawn = static_cast<uint32_t>(std::min<size_t>(numParticlesToSpawn, m_maxNumParticles));
+	if (numParticlesToSpawn > 0)
+	{
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		const GLuint spawnProgram = getProgram(GlParticleKernel::SpawnParticle);
+		glProgramUniform1ui(spawnProgram, SEED_LOCATION, seed);
+		glProgramUniform1ui(spawnProgram, STEP_INDEX_LOCATION, step);
+		glProgramUniform1f(spawnProgram, CURRENT_TIME_LOCATION, currentTime);
+		glProgramUniform1ui(spawnProgram, NUM_PARTICLES_TO_SPAWN_LOCATION, numParticlesToSpawn);
+		glProgramUniform1ui(spawnProgram, FIRST_SPAWN_ID_LOCATION, firstSpawnId);
+		glUseProgram(spawnProgram);
+		glDispatchCompute(getNumGroups(numParticlesToSpawn), 1, 1);
+	}
+
+	glUseProgram(0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GlParticleSimulation::dispatchCompaction(GLuint renderPositions, size_t renderCapacity, GLuint drawCommands, float renderTimeOffset)
+{
+	bindStorageBuffers();
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDER_POSITIONS_BINDING, renderPositions);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_BINDING, drawCommands);
+
+	const GLuint numBlocks = getNumGroups(m_maxNumParticles);
+	glUseProgram(getProgram(GlParticleKernel::CountAliveParticles));
+	glDispatchCompute(numBlocks, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	const GLuint scanProgram = getProgram(GlParticleKernel::ScanBlockCounts);
+	glProgramUniform1ui(scanProgram, RENDER_CAPACITY_LOCATION, static_cast<GLuint>(renderCapacity));
+	glUseProgram(scanProgram);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	const GLuint compactProgram = getProgram(GlParticleKernel::CompactAliveParticles);
+	glProgramUniform1ui(compactProgram, RENDER_CAPACITY_LOCATION, static_cast<GLuint>(renderCapacity));
+	glProgramUniform1f(compactProgram, RENDER_TIME_OFFSET_LOCATION, renderTimeOffset);
+	glUseProgram(compactProgram);
+	glDispatchCompute(numBlocks, 1, 1);
+	glUseProgram(0);
+
+	// the positions are pulled as vertices, the commands read by the draws and the next simulate dispatch
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void GlParticleSimulation::setForceField(size_t fieldIndex, std::shared_ptr<const VectorField> field)
+{
+	if (fieldIndex >= m_forceFieldTextures.size())
+	{
+		return;
+	}
+
+	GLuint& texture = m_forceFieldTextures[fieldIndex];
+	if (texture != 0)
+	{
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+
+	// a bounds w of zero pushes nothing, the sampler then reads an incomplete texture
+	GLfloat bounds[8] = {};
+	if (field != nullptr && field->getNumVoxels() > 0)
+	{
+		// uploaded in one go, the driver copies the field before returning
+		const GLfloat border[4] = {};
+		glGenTextures(1, &texture);
+		glActiveTexture(GL_TEXTURE0 + FORCE_FIELD_TEXTURE_UNIT + static_cast<GLuint>(fieldIndex));
+		glBindTexture(GL_TEXTURE_3D, texture);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, field->width, field->height, field->depth, 0, GL_RGBA, GL_FLOAT, field->vectors.data());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, border);
+		glActiveTexture(GL_TEXTURE0);
+
+		const glm::vec3 scale = 1.f / (field->boundsMax - field->boundsMin);
+		const GLfloat fieldBounds[8] = { field->boundsMin.x, field->boundsMin.y, field->boundsMin.z, 0.f, scale.x, scale.y, scale.z, 1.f };
+		std::copy(fieldBounds, fieldBounds + 8, bounds);
+	}
+
+	const GLuint simulateProgram = getProgram(GlParticleKernel::SimulateParticles);
+	glProgramUniform4fv(simulateProgram, glGetUniformLocation(simulateProgram, getArrayElementName("forceFieldBounds", fieldIndex * 2).c_str()), 2, bounds);
+}
+
+void GlParticleSimulation::bindStorageBuffers() const
+{
+	for (GLuint i = 0; i < NumStorageBuffers; ++i)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, m_buffers[i]);
+	}
+}
+
+void GlParticleSimulation::release()
+{
+	for (GLuint program : m_programs)
+	{
+		glDeleteProgram(program);
+	}
+	m_programs.clear();
+
+	if (m_buffers[0] != 0)
+	{
+		glDeleteBuffers(NumStorageBuffers, m_buffers);
+		std::fill(m_buffers, m_buffers + NumStorageBuffers, 0);
+	}
+
+	for (GLuint texture : m_forceFieldTextures)
+	{
+		if (texture != 0)
+		{
+			glDeleteTextures(1, &texture);
+		}
+	}
+	m_forceFieldTextures.clear();
+	m_maxNumParticles = 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "engine/VectorField.h"
+
+// the kernels of shaders/particle.comp, one compute program each
+enum class GlParticleKernel
+{
+	InitParticleState,
+	SpawnParticle,
+	SimulateParticles,
+	CountAliveParticles,
+	ScanBlockCounts,
+	CompactAliveParticles,
+};
+
+const size_t NUM_GL_PARTICLE_KERNELS = 6;
+
+// the #version line and the define selecting the kernel, then the sources in order
+std::string getGlParticleKernelSource(GlParticleKernel kernel, const std::vector<std::string>& sources);
+
+// the particle simulation of ClParticleSimulation as GL 4.3 compute shaders over shader storage buffers, for drivers
+// where sharing buffers with OpenCL is slow or missing, and for GPU-less machines running Mesa llvmpipe
+// the dispatches are ordered by glMemoryBarrier only and write the vertex buffer and draw commands GL draws from,
+// nothing is read back: simulateParticles is dispatched indirectly over the alive count of the last compaction
+// the storage of maxNumParticles particles is allocated up front, there is no paging
+class GlParticleSimulation
+{
+public:
+	// the shader storage buffers of shaders/particle.comp, bound at these indices
+	enum StorageBuffer
+	{
+		Positions,
+		Velocities,
+		SpawnTimes,
+		IsAlive,
+		AliveIndices,
+		BlockCounts,
+		FreeIndices,
+		Counters,
+		SpawnIds,
+		NumStorageBuffers
+	};
+
+	GlParticleSimulation();
+	~GlParticleSimulation();
+
+	GlParticleSimulation(const GlParticleSimulation&) = delete;
+	GlParticleSimulation& operator=(const GlParticleSimulation&) = delete;
+
+	// takes the programs, indexed by GlParticleKernel, allocates the particle state and dispatches initParticleState
+	// false if the buffers cannot be allocated
+	bool create(const std::vector<GLuint>& programs, size_t maxNumParticles);
+
+	// simulates the alive list then spawns numParticlesToSpawn particles, like ClParticleSimulation::enqueueSubstep
+	// including its spawn ids
+	void dispatchSubstep(uint32_t seed, uint32_t step, float currentTime, float deltaTime, uint32_t numParticlesToSpawn);
+
+	// rebuilds the alive list and writes the alive positions, moved by renderTimeOffset seconds of velocity, into the first
+	// renderCapacity positions of renderPositions, then the point and instanced quad DrawArraysIndirectCommands of
+	// those positions into drawCommands, a renderCapacity of 0 only rebuilds the alive list
+	void dispatchCompaction(GLuint renderPositions, size_t renderCapacity, GLuint drawCommands, float renderTimeOffset);
+
+	// uploads the field for the ForceField modifiers with its index, a field the programs were not built for is ignored
+	void setForceField(size_t fieldIndex, std::shared_ptr<const VectorField> field);
+
+	size_t getMaxNumParticles() const { return m_maxNumParticles; }
+	// for reading the particle state back, the dispatches never need it
+	GLuint getStorageBuffer(StorageBuffer buffer) const { return m_buffers[buffer]; }
+
+	// deletes the programs, buffers and textures, also done by the destructor
+	void release();
+
+	// local_size_x of every kernel, WORK_GROUP_SIZE in shaders/particle.comp
+	static constexpr GLuint WORK_GROUP_SIZE = 256;
+	// the force fields are bound from this texture unit on, unit 0 holds the particle texture
+	static constexpr GLuint FORCE_FIELD_TEXTURE_UNIT = 1;
+
+private:
+	// shader storage bindings 9 and 10 of shaders/particle.comp
+	static constexpr GLuint RENDER_POSITIONS_BINDING = 9;
+	static constexpr GLuint DRAW_COMMANDS_BINDING = 10;
+	// the glDispatchComputeIndirect arguments of simulateParticles in the counters buffer
+	static constexpr GLintptr SIMULATE_GROUPS_OFFSET = 2 * sizeof(GLuint);
+
+	GLuint getProgram(GlParticleKernel kernel) const { return m_programs[static_cast<size_t>(kernel)]; }
+	GLuint getNumGroups(size_t numWorkItems) const { return static_cast<GLuint>((numWorkItems + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE); }
+	void bindStorageBuffers() const;
+
+	std::vector<GLuint> m_programs;
+	GLuint m_buffers[NumStorageBuffers];
+	size_t m_maxNumParticles;
+	// spawn id of the next particle to spawn
+	uint32_t m_nextSpawnId;
+
+	// one texture per field index of the simulateParticles program, 0 until set
+	std::vector<GLuint> m_forceFieldTextures;
+};
@@ -0,0 +1,92 @@
+#include "GlProgramCache.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "engine/BinaryCache.h"
+
+namespace
+{
+std::string getGlString(GLenum name)
+{
+	const GLubyte* value = glGetString(name);
+	return value != nullptr ? reinterpret_cast<const char*>(value) : "";
+}
+}
+
+std::string getGlProgramCacheKey(const std::vector<std::string>& sources)
+{
+	std::string key = "opengl\n"
+		+ getGlString(GL_VENDOR) + "\n"
+		+ getGlString(GL_RENDERER) + "\n"
+		+ getGlString(GL_VERSION) + "\n";
+	for (const std::string& source : sources)
+	{
+		key += '\0';
+		key += source;
+	}
+	return key;
+}
+
+GLuint loadCachedProgram(BinaryCache& binaryCache, const std::string& key)
+{
+	if (!GLEW_ARB_get_program_binary)
+	{
+		return 0;
+	}
+
+	// the binary format is stored in front of the binary
+	std::vector<unsigned char> data;
+	if (!binaryCache.load(key, data))
+	{
+		if (binaryCache.isEnabled())
+		{
+			std::cout << "OpenGL program cache: miss, building from source" << std::endl;
+		}
+		return 0;
+	}
+
+	GLenum binaryFormat = 0;
+	if (data.size() > sizeof(binaryFormat))
+	{
+		memcpy(&binaryFormat, data.data(), sizeof(binaryFormat));
+
+		GLuint programId = glCreateProgram();
+		glProgramBinary(programId, binaryFormat, data.data() + sizeof(binaryFormat), static_cast<GLsizei>(data.size() - sizeof(binaryFormat)));
+
+		GLint result = GL_FALSE;
+		glGetProgramiv(programId, GL_LINK_STATUS, &result);
+		if (result)
+		{
+			std::cout << "OpenGL program cache: hit" << std::endl;
+			return programId;
+		}
+		glDeleteProgram(programId);
+	}
+
+	std::cout << "OpenGL program cache: binary rejected by the driver, rebuilding from source" << std::endl;
+	binaryCache.invalidate(key);
+	return 0;
+}
+
+void storeCachedProgram(BinaryCache& binaryCache, const std::string& key, GLuint programId)
+{
+	if (!GLEW_ARB_get_program_binary || !binaryCache.isEnabled())
+	{
+		return;
+	}
+
+	GLint binaryLength = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+	if (binaryLength <= 0)
+	{
+		return;
+	}
+
+	GLenum binaryFormat = 0;
+	std::vector<unsigned char> data(sizeof(binaryFormat) + binaryLength);
+	glGetProgramBinary(programId, binaryLength, nullptr, &binaryFormat, data.data() + sizeof(binaryFormat));
+	memcpy(data.data(), &binaryFormat, sizeof(binaryFormat));
+
+	binaryCache.store(key, data);
+}
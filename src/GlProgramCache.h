@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+class BinaryCache;
+
+// linked GL programs persisted with glGetProgramBinary/glProgramBinary (ARB_get_program_binary)
+
+// identifies the driver and the shader sources
+std::string getGlProgramCacheKey(const std::vector<std::string>& sources);
+
+// returns 0 on a miss or when the driver rejects the stored binary
+GLuint loadCachedProgram(BinaryCache& binaryCache, const std::string& key);
+
+// the program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+void storeCachedProgram(BinaryCache& binaryCache, const std::string& key, GLuint programId);
@@ -0,0 +1,305 @@
+#include "ClAutotuner.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "ClDevice.h"
+#include "ClProgramCache.h"
+#include "engine/BinaryCache.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/PhaseTimings.h"
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+// -cl-fast-relaxed-math implies the other two, it also allows results to differ from the CPU engine
+const char* const CANDIDATE_BUILD_OPTIONS[] =
+{
+	"",
+	"-cl-mad-enable",
+	"-cl-no-signed-zeros",
+	"-cl-mad-enable -cl-no-signed-zeros",
+	"-cl-fast-relaxed-math",
+};
+
+const size_t MAX_TUNING_PARTICLES = 1 << 20;
+// a sixteenth of the particles die and respawn every frame, the population is steady after the warmup
+const unsigned int NUM_STEPS_PER_LIFETIME = 16;
+const unsigned int NUM_WARMUP_FRAMES = NUM_STEPS_PER_LIFETIME + 2;
+const unsigned int NUM_MEASURED_FRAMES = 8;
+
+struct TuningScore
+{
+	ClParticleWorkSizes workSizes;
+	double simulateMs = -1.0;
+	double spawnMs = -1.0;
+	double compactMs = -1.0;
+
+	double getTotalMs() const { return simulateMs + spawnMs + compactMs; }
+};
+
+class TuningRun
+{
+public:
+	TuningRun(ClParticleSimulation& simulation, cl_command_queue commandQueue, cl_mem renderPositions, size_t renderCapacity, float maxAge) :
+		m_simulation(simulation),
+		m_commandQueue(commandQueue),
+		m_renderPositions(renderPositions),
+		m_renderCapacity(renderCapacity),
+		m_deltaTime(maxAge / NUM_STEPS_PER_LIFETIME),
+		m_currentTime(0.f),
+		m_frame(0)
+	{
+	}
+
+	// samples every kernel once per frame into timings if not nullptr
+	cl_int runFrames(unsigned int numFrames, PhaseTimings* timings)
+	{
+		const cl_uint numParticlesToSpawn = static_cast<cl_uint>(m_renderCapacity / NUM_STEPS_PER_LIFETIME);
+		std::vector<ClProfilingEvent> profilingEvents;
+		for (unsigned int i = 0; i < numFrames; ++i)
+		{
+			m_currentTime += m_deltaTime;
+			++m_frame;
+
+			cl_int code = m_simulation.enqueueSubstep(0, m_frame, m_currentTime, m_deltaTime, numParticlesToSpawn, &profilingEvents);
+			if (code == CL_SUCCESS)
+			{
+				code = m_simulation.enqueueCompaction(m_renderPositions, m_renderCapacity, 0.f, &profilingEvents);
+			}
+			if (code == CL_SUCCESS)
+			{
+				code = clFinish(m_commandQueue);
+			}
+
+			if (code != CL_SUCCESS || timings == nullptr)
+			{
+				clFinish(m_commandQueue);
+				releaseProfilingEvents(profilingEvents);
+				RETURN_ON_ERROR(code);
+				continue;
+			}
+			addProfilingSamples(profilingEvents, *timings, nullptr);
+		}
+		return CL_SUCCESS;
+	}
+
+private:
+	ClParticleSimulation& m_simulation;
+	cl_command_queue m_commandQueue;
+	cl_mem m_renderPositions;
+	size_t m_renderCapacity;
+	cl_float m_deltaTime;
+	cl_float m_currentTime;
+	cl_uint m_frame;
+};
+
+double getMedianMs(const std::vector<PhaseTimings::Summary>& summaries, const char* phase)
+{
+	for (const PhaseTimings::Summary& summary : summaries)
+	{
+		if (summary.phase == phase)
+		{
+			return summary.p50;
+		}
+	}
+	return 0.0;
+}
+
+// best local work size of every kernel for a program, each kernel is scored independently
+cl_int tuneWorkSizes(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue, cl_program program,
+	size_t numParticles, float maxAge, TuningScore* bestScore)
+{
+	ClParticleSimulation simulation(context, deviceId, commandQueue);
+	cl_int code = simulation.create(program, numParticles);
+	RETURN_ON_ERROR(code);
+
+	cl_mem renderPositions = clCreateBuffer(context, CL_MEM_WRITE_ONLY, numParticles * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	TuningRun run(simulation, commandQueue, renderPositions, numParticles, maxAge);
+	code = run.runFrames(NUM_WARMUP_FRAMES, nullptr);
+
+	// 0 is the driver's choice, the compaction kernels then use their default size
+	std::vector<size_t> candidateSizes = { 0 };
+	for (size_t size = simulation.getPreferredWorkGroupSizeMultiple(); size <= simulation.getMaxWorkGroupSize(); size *= 2)
+	{
+		candidateSizes.push_back(size);
+	}
+
+	for (size_t candidateSize : candidateSizes)
+	{
+		if (code != CL_SUCCESS)
+		{
+			break;
+		}
+
+		ClParticleWorkSizes workSizes;
+		workSizes.simulate = candidateSize;
+		workSizes.spawn = candidateSize;
+		workSizes.scan = candidateSize;
+		code = simulation.setWorkSizes(workSizes);
+		if (code != CL_SUCCESS)
+		{
+			break;
+		}
+
+		PhaseTimings timings;
+		code = run.runFrames(NUM_MEASURED_FRAMES, &timings);
+		if (code != CL_SUCCESS)
+		{
+			break;
+		}
+
+		const std::vector<PhaseTimings::Summary> summaries = timings.summarize();
+		const double simulateMs = getMedianMs(summaries, "cl/simulateParticles");
+		const double spawnMs = getMedianMs(summaries, "cl/spawnParticle");
+		const double compactMs = getMedianMs(summaries, "cl/countAliveParticles")
+			+ getMedianMs(summaries, "cl/scanBlockCounts")
+			+ getMedianMs(summaries, "cl/scanPageAliveCounts")
+			+ getMedianMs(summaries, "cl/compactAliveParticles");
+
+		if (bestScore->simulateMs < 0.0 || simulateMs < bestScore->simulateMs)
+		{
+			bestScore->simulateMs = simulateMs;
+			bestScore->workSizes.simulate = candidateSize;
+		}
+		if (bestScore->spawnMs < 0.0 || spawnMs < bestScore->spawnMs)
+		{
+			bestScore->spawnMs = spawnMs;
+			bestScore->workSizes.spawn = candidateSize;
+		}
+		if (bestScore->compactMs < 0.0 || compactMs < bestScore->compactMs)
+		{
+			bestScore->compactMs = compactMs;
+			bestScore->workSizes.scan = simulation.getScanWorkGroupSize();
+		}
+	}
+
+	clReleaseMemObject(renderPositions);
+	return code;
+}
+
+std::string serializeTuning(const ClParticleTuning& tuning)
+{
+	std::ostringstream stream;
+	stream << tuning.buildOptions << '\n'
+		<< tuning.workSizes.simulate << ' ' << tuning.workSizes.spawn << ' ' << tuning.workSizes.scan << '\n';
+	return stream.str();
+}
+
+bool deserializeTuning(const std::string& data, ClParticleTuning* tuning)
+{
+	std::istringstream stream(data);
+	std::string buildOptions;
+	ClParticleWorkSizes workSizes;
+	if (!std::getline(stream, buildOptions) || !(stream >> workSizes.simulate >> workSizes.spawn >> workSizes.scan))
+	{
+		return false;
+	}
+
+	tuning->buildOptions = buildOptions;
+	tuning->workSizes = workSizes;
+	return true;
+}
+}
+
+cl_int getParticleTuning(cl_context context, cl_device_id deviceId, ClProgramCache& programCache, BinaryCache& binaryCache,
+	const std::string& clProgramSource, const ParticleSimulationConfig& config, bool forceTuning, ClParticleTuning* tuning)
+{
+	*tuning = ClParticleTuning();
+
+	const std::vector<std::string> sources = { generateParticleModifierSource(config), clProgramSource };
+	const std::string buildOptions = getParticleModifierBuildOptions(config);
+
+	std::string tuningKey = "autotune\n" + getDeviceCacheKey(deviceId) + buildOptions;
+	for (const std::string& source : sources)
+	{
+		tuningKey += '\0';
+		tuningKey += source;
+	}
+
+	std::vector<unsigned char> data;
+	if (!forceTuning && binaryCache.load(tuningKey, data))
+	{
+		if (deserializeTuning(std::string(data.begin(), data.end()), tuning))
+		{
+			return CL_SUCCESS;
+		}
+		binaryCache.invalidate(tuningKey);
+	}
+
+	cl_ulong maxAllocSize = 0;
+	clGetDeviceInfo(deviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAllocSize, nullptr);
+	const size_t numParticles = std::min(MAX_TUNING_PARTICLES, static_cast<size_t>(maxAllocSize / (3 * sizeof(cl_float))));
+
+	cl_int code;
+	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceId, CL_QUEUE_PROFILING_ENABLE, &code);
+	RETURN_ON_ERROR(code);
+
+	std::cout << "Autotuning the particle kernels on " << getDeviceInfoString(deviceId, CL_DEVICE_NAME) << "..." << std::endl;
+
+	TuningScore bestScore;
+	std::string bestBuildOptions;
+	for (const char* candidateBuildOptions : CANDIDATE_BUILD_OPTIONS)
+	{
+		std::string buildLog;
+		cl_program program = programCache.getProgram(sources, appendBuildOptions(buildOptions, candidateBuildOptions), &code, &buildLog);
+		if (code != CL_SUCCESS)
+		{
+			// not an error of the tuning, which only fails below if no candidate built
+			std::cout << "  [" << candidateBuildOptions << "] build failed, skipped" << std::endl;
+			code = CL_SUCCESS;
+			continue;
+		}
+
+		TuningScore score;
+		code = tuneWorkSizes(context, deviceId, commandQueue, program, numParticles, config.maxAge, &score);
+		if (code != CL_SUCCESS)
+		{
+			break;
+		}
+
+		std::cout << "  [" << candidateBuildOptions << "]"
+			<< " simulate " << score.simulateMs << " ms (" << score.workSizes.simulate << ")"
+			<< ", spawn " << score.spawnMs << " ms (" << score.workSizes.spawn << ")"
+			<< ", compact " << score.compactMs << " ms (" << score.workSizes.scan << ")" << std::endl;
+
+		if (bestScore.simulateMs < 0.0 || score.getTotalMs() < bestScore.getTotalMs())
+		{
+			bestScore = score;
+			bestBuildOptions = candidateBuildOptions;
+		}
+	}
+
+	clReleaseCommandQueue(commandQueue);
+	RETURN_ON_ERROR(code);
+
+	if (bestScore.simulateMs < 0.0)
+	{
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+
+	tuning->buildOptions = bestBuildOptions;
+	tuning->workSizes = bestScore.workSizes;
+
+	const std::string serializedTuning = serializeTuning(*tuning);
+	binaryCache.store(tuningKey, std::vector<unsigned char>(serializedTuning.begin(), serializedTuning.end()));
+	return CL_SUCCESS;
+}
+
+std::string appendBuildOptions(const std::string& buildOptions, const std::string& extraBuildOptions)
+{
+	if (buildOptions.empty() || extraBuildOptions.empty())
+	{
+		return buildOptions + extraBuildOptions;
+	}
+	return buildOptions + " " + extraBuildOptions;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <CL/opencl.h>
+
+#include "ClParticleSimulation.h"
+
+class BinaryCache;
+class ClProgramCache;
+struct ParticleSimulationConfig;
+
+// extra build options and local work sizes the particle kernels run fastest with on a device
+struct ClParticleTuning
+{
+	std::string buildOptions;
+	ClParticleWorkSizes workSizes;
+};
+
+// returns the tuning persisted in binaryCache for this device, program source and config, or benchmarks
+// every candidate and persists the winner when there is none yet or when forceTuning is set
+// on failure the error is returned and tuning is left to the driver defaults
+cl_int getParticleTuning(cl_context context, cl_device_id deviceId, ClProgramCache& programCache, BinaryCache& binaryCache,
+	const std::string& clProgramSource, const ParticleSimulationConfig& config, bool forceTuning, ClParticleTuning* tuning);
+
+// appends extra options to the options of a build
+std::string appendBuildOptions(const std::string& buildOptions, const std::string& extraBuildOptions);
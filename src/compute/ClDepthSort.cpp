@@ -0,0 +1,258 @@
+#include "ClDepthSort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+// keys span this until the first readback
+const cl_float INITIAL_FAR_DISTANCE = 256.f;
+// the range grows by this fraction of itself on both ends so that particles moving apart stay in it
+const cl_float DISTANCE_MARGIN = 1.f / 16.f;
+const cl_float MIN_DISTANCE_RANGE = 1.f;
+// readbacks are skipped while this many are pending
+const size_t MAX_PENDING_READBACKS = 4;
+
+const cl_float MAX_KEY = static_cast<cl_float>((1u << ClDepthSort::KEY_BITS) - 1);
+
+ClRadixSort::PhaseNames getDepthSortPhaseNames()
+{
+	ClRadixSort::PhaseNames phaseNames;
+	phaseNames.histogram = "cl/depthSortHistogram";
+	phaseNames.scan = "cl/depthSortScan";
+	phaseNames.scatter = "cl/depthSortScatter";
+	return phaseNames;
+}
+
+bool isEventComplete(cl_event event)
+{
+	cl_int status = CL_QUEUED;
+	cl_int code = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+	return code == CL_SUCCESS && status == CL_COMPLETE;
+}
+}
+
+ClDepthSort::ClDepthSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_sort(context, deviceId, commandQueue, getDepthSortPhaseNames()),
+	m_nearDistance(0.f),
+	m_farDistance(INITIAL_FAR_DISTANCE),
+	m_capacity(0),
+	m_unsortedPositionsBuffer(nullptr),
+	m_stateBuffer(nullptr),
+	m_prepareDepthSortKernel(nullptr),
+	m_computeDepthKeysKernel(nullptr),
+	m_scatterDepthSortedKernel(nullptr)
+{
+}
+
+ClDepthSort::~ClDepthSort()
+{
+	release();
+}
+
+cl_int ClDepthSort::create(cl_program program, cl_program sortProgram)
+{
+	release();
+
+	cl_int code = m_sort.create(sortProgram);
+	RETURN_ON_ERROR(code);
+
+	m_prepareDepthSortKernel = clCreateKernel(program, "prepareDepthSort", &code);
+	RETURN_ON_ERROR(code);
+	m_computeDepthKeysKernel = clCreateKernel(program, "computeDepthKeys", &code);
+	RETURN_ON_ERROR(code);
+	m_scatterDepthSortedKernel = clCreateKernel(program, "scatterDepthSorted", &code);
+	RETURN_ON_ERROR(code);
+
+	m_stateBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, 3 * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(m_prepareDepthSortKernel, 2, sizeof(cl_mem), &m_stateBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 8, sizeof(cl_mem), &m_stateBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 1, sizeof(cl_mem), &m_stateBuffer);
+	RETURN_ON_ERROR(code);
+
+	m_nearDistance = 0.f;
+	m_farDistance = INITIAL_FAR_DISTANCE;
+	return CL_SUCCESS;
+}
+
+cl_int ClDepthSort::reserve(size_t maxNumPositions)
+{
+	if (maxNumPositions <= m_capacity)
+	{
+		return CL_SUCCESS;
+	}
+
+	releaseBuffers();
+
+	cl_int code = m_sort.reserve(maxNumPositions);
+	RETURN_ON_ERROR(code);
+
+	m_unsortedPositionsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumPositions * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	cl_mem keys = m_sort.getKeys();
+	cl_mem values = m_sort.getValues();
+	code = clSetKernelArg(m_computeDepthKeysKernel, 5, sizeof(cl_mem), &keys);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 6, sizeof(cl_mem), &values);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 7, sizeof(cl_mem), &m_unsortedPositionsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 2, sizeof(cl_mem), &m_unsortedPositionsBuffer);
+	RETURN_ON_ERROR(code);
+
+	m_capacity = maxNumPositions;
+	return CL_SUCCESS;
+}
+
+void ClDepthSort::updateDistanceRange()
+{
+	bool updated = false;
+	cl_uint distanceBits[2] = { 0, 0 };
+	while (!m_readbacks.empty() && isEventComplete(m_readbacks.front().event))
+	{
+		// a frame without positions leaves the range as it was
+		if (m_readbacks.front().distanceBits[0] <= m_readbacks.front().distanceBits[1])
+		{
+			distanceBits[0] = m_readbacks.front().distanceBits[0];
+			distanceBits[1] = m_readbacks.front().distanceBits[1];
+			updated = true;
+		}
+		clReleaseEvent(m_readbacks.front().event);
+		m_readbacks.pop_front();
+	}
+
+	if (updated)
+	{
+		cl_float distances[2];
+		memcpy(distances, distanceBits, sizeof(distances));
+		const cl_float margin = std::max((distances[1] - distances[0]) * DISTANCE_MARGIN, MIN_DISTANCE_RANGE);
+		m_nearDistance = std::max(distances[0] - margin, 0.f);
+		m_farDistance = distances[1] + margin;
+	}
+}
+
+cl_int ClDepthSort::enqueueSort(cl_mem positions, size_t positionCapacity, cl_mem drawCommands, cl_uint numDrawCommands,
+	const cl_float modelViewMatrix[16], std::vector<ClProfilingEvent>* profilingEvents)
+{
+	if (positionCapacity == 0 || numDrawCommands == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	cl_int code = reserve(positionCapacity);
+	RETURN_ON_ERROR(code);
+
+	updateDistanceRange();
+
+	// view z is the third row, the camera looks down -z
+	const cl_float4 depthRow = { { modelViewMatrix[2], modelViewMatrix[6], modelViewMatrix[10], modelViewMatrix[14] } };
+	const cl_float2 depthRange = { { m_nearDistance, MAX_KEY / std::max(m_farDistance - m_nearDistance, MIN_DISTANCE_RANGE) } };
+
+	code = clSetKernelArg(m_prepareDepthSortKernel, 0, sizeof(cl_mem), &drawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_prepareDepthSortKernel, 1, sizeof(cl_uint), &numDrawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 0, sizeof(cl_mem), &positions);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 1, sizeof(cl_mem), &drawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 2, sizeof(cl_uint), &numDrawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 3, sizeof(cl_float4), &depthRow);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeDepthKeysKernel, 4, sizeof(cl_float2), &depthRange);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 3, sizeof(cl_mem), &positions);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 4, sizeof(cl_mem), &drawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 5, sizeof(cl_uint), &numDrawCommands);
+	RETURN_ON_ERROR(code);
+
+	code = clEnqueueTask(m_commandQueue, m_prepareDepthSortKernel, 0, nullptr, getProfilingEvent(profilingEvents, "cl/prepareDepthSort"));
+	RETURN_ON_ERROR(code);
+
+	size_t globalWorkSize[] = { positionCapacity };
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_computeDepthKeysKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/computeDepthKeys"));
+	RETURN_ON_ERROR(code);
+
+	// the distances of this frame narrow the keys of a later one
+	if (m_readbacks.size() < MAX_PENDING_READBACKS)
+	{
+		m_readbacks.push_back({ { 0, 0 }, nullptr });
+		DistanceReadback& readback = m_readbacks.back();
+		code = clEnqueueReadBuffer(m_commandQueue, m_stateBuffer, CL_FALSE, sizeof(cl_uint), sizeof(readback.distanceBits),
+			readback.distanceBits, 0, nullptr, &readback.event);
+		if (code != CL_SUCCESS)
+		{
+			m_readbacks.pop_back();
+			return code;
+		}
+	}
+
+	code = m_sort.enqueueSort(positionCapacity, m_stateBuffer, 0, KEY_BITS, profilingEvents);
+	RETURN_ON_ERROR(code);
+
+	// the sorted values are in one of the sort's buffers depending on the number of passes
+	cl_mem sortedValues = m_sort.getSortedValues();
+	code = clSetKernelArg(m_scatterDepthSortedKernel, 0, sizeof(cl_mem), &sortedValues);
+	RETURN_ON_ERROR(code);
+
+	size_t scatterGlobalWorkSize[] = { std::max(positionCapacity, static_cast<size_t>(numDrawCommands)) };
+	return clEnqueueNDRangeKernel(m_commandQueue, m_scatterDepthSortedKernel, 1, nullptr, scatterGlobalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/scatterDepthSorted"));
+}
+
+void ClDepthSort::releaseBuffers()
+{
+	if (m_unsortedPositionsBuffer != nullptr)
+	{
+		clReleaseMemObject(m_unsortedPositionsBuffer);
+		m_unsortedPositionsBuffer = nullptr;
+	}
+	m_capacity = 0;
+}
+
+void ClDepthSort::release()
+{
+	for (DistanceReadback& readback : m_readbacks)
+	{
+		clWaitForEvents(1, &readback.event);
+		clReleaseEvent(readback.event);
+	}
+	m_readbacks.clear();
+
+	releaseBuffers();
+	m_sort.release();
+
+	if (m_stateBuffer != nullptr)
+	{
+		clReleaseMemObject(m_stateBuffer);
+		m_stateBuffer = nullptr;
+	}
+
+	for (cl_kernel* kernel : { &m_prepareDepthSortKernel, &m_computeDepthKeysKernel, &m_scatterDepthSortedKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+#include "ClRadixSort.h"
+
+// orders the render positions of a frame from the farthest to the nearest to the camera for alpha blending,
+// the kernels of cl/depth_sort.cl
+// the positions of every draw command are sorted together into the range of the first one, which is rewritten to draw
+// them all while the others draw none
+// keys are view distances quantized to KEY_BITS over the distances of an earlier frame, read back without blocking:
+// the particles move little from one frame to the next, so the range stays tight and the sort needs half the passes
+// of full float keys, particles outside the range are clamped to its ends
+class ClDepthSort
+{
+public:
+	ClDepthSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClDepthSort();
+
+	ClDepthSort(const ClDepthSort&) = delete;
+	ClDepthSort& operator=(const ClDepthSort&) = delete;
+
+	// program is built from cl/depth_sort.cl and sortProgram from cl/radix_sort.cl, returns the first error
+	cl_int create(cl_program program, cl_program sortProgram);
+
+	// sorts the positions drawn by the numDrawCommands ClDrawArraysIndirectCommands of drawCommands, to be queued after
+	// ClParticleDeviceGroup::enqueueGather, positions holds positionCapacity positions
+	// modelViewMatrix is column-major as GL takes it
+	cl_int enqueueSort(cl_mem positions, size_t positionCapacity, cl_mem drawCommands, cl_uint numDrawCommands,
+		const cl_float modelViewMatrix[16], std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	// view distances the keys span
+	cl_float getNearDistance() const { return m_nearDistance; }
+	cl_float getFarDistance() const { return m_farDistance; }
+
+	// releases the buffers and kernels, also done by the destructor, waits for pending readbacks
+	void release();
+
+	static constexpr unsigned int KEY_BITS = 16;
+
+private:
+	// smallest and largest view distance bits of a frame, read back into the entry itself
+	struct DistanceReadback
+	{
+		cl_uint distanceBits[2];
+		cl_event event;
+	};
+
+	cl_int reserve(size_t maxNumPositions);
+	void releaseBuffers();
+	// narrows the key range to the last completed readback
+	void updateDistanceRange();
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+	ClRadixSort m_sort;
+
+	cl_float m_nearDistance;
+	cl_float m_farDistance;
+	// entries stay in place until popped, one per frame in flight at most
+	std::deque<DistanceReadback> m_readbacks;
+
+	size_t m_capacity;
+	cl_mem m_unsortedPositionsBuffer;
+	// three cl_uint, see prepareDepthSort
+	cl_mem m_stateBuffer;
+
+	cl_kernel m_prepareDepthSortKernel;
+	cl_kernel m_computeDepthKeysKernel;
+	cl_kernel m_scatterDepthSortedKernel;
+};
@@ -0,0 +1,73 @@
+#include "ClDevice.h"
+
+#include <sstream>
+
+std::string getDeviceInfoString(cl_device_id deviceId, cl_device_info param)
+{
+	size_t size = 0;
+	if (clGetDeviceInfo(deviceId, param, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+	{
+		return "";
+	}
+
+	std::string value(size, '\0');
+	clGetDeviceInfo(deviceId, param, size, &value[0], nullptr);
+	value.resize(value.find('\0'));
+	return value;
+}
+
+bool hasDeviceExtension(cl_device_id deviceId, const char* extension)
+{
+	std::istringstream extensions(getDeviceInfoString(deviceId, CL_DEVICE_EXTENSIONS));
+	std::string name;
+	while (extensions >> name)
+	{
+		if (name == extension)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string getDeviceCacheKey(cl_device_id deviceId)
+{
+	return getDeviceInfoString(deviceId, CL_DEVICE_NAME) + "\n"
+		+ getDeviceInfoString(deviceId, CL_DEVICE_VENDOR) + "\n"
+		+ getDeviceInfoString(deviceId, CL_DEVICE_VERSION) + "\n"
+		+ getDeviceInfoString(deviceId, CL_DRIVER_VERSION) + "\n";
+}
+
+std::vector<cl_device_id> getDevices(cl_device_type deviceType)
+{
+	std::vector<cl_device_id> deviceIds;
+
+	cl_uint numPlatforms = 0;
+	if (clGetPlatformIDs(0, nullptr, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+	{
+		return deviceIds;
+	}
+
+	std::vector<cl_platform_id> platformIds(numPlatforms);
+	clGetPlatformIDs(numPlatforms, platformIds.data(), nullptr);
+	for (cl_platform_id platformId : platformIds)
+	{
+		cl_uint numDevices = 0;
+		if (clGetDeviceIDs(platformId, deviceType, 0, nullptr, &numDevices) != CL_SUCCESS || numDevices == 0)
+		{
+			continue;
+		}
+
+		std::vector<cl_device_id> platformDeviceIds(numDevices);
+		clGetDeviceIDs(platformId, deviceType, numDevices, platformDeviceIds.data(), nullptr);
+		deviceIds.insert(deviceIds.end(), platformDeviceIds.begin(), platformDeviceIds.end());
+	}
+	return deviceIds;
+}
+
+cl_platform_id getDevicePlatform(cl_device_id deviceId)
+{
+	cl_platform_id platformId = nullptr;
+	clGetDeviceInfo(deviceId, CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &platformId, nullptr);
+	return platformId;
+}
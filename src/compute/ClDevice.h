@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+std::string getDeviceInfoString(cl_device_id deviceId, cl_device_info param);
+
+// extensions are matched as whole space delimited names
+bool hasDeviceExtension(cl_device_id deviceId, const char* extension);
+
+// identifies the device and its compiler, part of every cache key derived from a build on this device
+std::string getDeviceCacheKey(cl_device_id deviceId);
+
+// every device of the type on every platform, in platform order
+std::vector<cl_device_id> getDevices(cl_device_type deviceType);
+
+cl_platform_id getDevicePlatform(cl_device_id deviceId);
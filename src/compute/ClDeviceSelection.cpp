@@ -0,0 +1,301 @@
+#include "ClDeviceSelection.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "ClDevice.h"
+#include "ClErrors.h"
+#include "ClParticleSimulation.h"
+#include "ClProgramCache.h"
+#include "engine/BinaryCache.h"
+#include "engine/ParticleModifiers.h"
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+#define GL_SHARING_EXTENSION "cl_khr_gl_sharing"
+
+namespace
+{
+// a single page, short enough to run on every device at startup
+const size_t NUM_CALIBRATION_PARTICLES = 1 << 18;
+const unsigned int NUM_CALIBRATION_WARMUP_FRAMES = 2;
+const unsigned int NUM_CALIBRATION_FRAMES = 8;
+
+// every particle is spawned by the first substep and stays alive for the whole run
+cl_int runCalibration(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue, cl_program program, double* particlesPerMs)
+{
+	ClParticleSimulation simulation(context, deviceId, commandQueue);
+	cl_int code = simulation.create(program, NUM_CALIBRATION_PARTICLES);
+	RETURN_ON_ERROR(code);
+
+	cl_mem renderPositions = clCreateBuffer(context, CL_MEM_WRITE_ONLY, NUM_CALIBRATION_PARTICLES * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	const cl_float deltaTime = 1.f / 120.f;
+	double measuredMs = 0.0;
+	std::vector<ClProfilingEvent> profilingEvents;
+	for (unsigned int frame = 0; frame < NUM_CALIBRATION_WARMUP_FRAMES + NUM_CALIBRATION_FRAMES && code == CL_SUCCESS; ++frame)
+	{
+		const cl_uint numParticlesToSpawn = frame == 0 ? static_cast<cl_uint>(NUM_CALIBRATION_PARTICLES) : 0;
+		code = simulation.enqueueSubstep(0, frame, frame * deltaTime, deltaTime, numParticlesToSpawn, &profilingEvents);
+		if (code == CL_SUCCESS)
+		{
+			code = simulation.enqueueCompaction(renderPositions, NUM_CALIBRATION_PARTICLES, 0.f, &profilingEvents);
+		}
+		if (code == CL_SUCCESS)
+		{
+			code = clFinish(commandQueue);
+		}
+		if (code == CL_SUCCESS && frame >= NUM_CALIBRATION_WARMUP_FRAMES)
+		{
+			measuredMs += getProfilingEventsMs(profilingEvents);
+		}
+		clFinish(commandQueue);
+		releaseProfilingEvents(profilingEvents);
+	}
+
+	simulation.release();
+	clReleaseMemObject(renderPositions);
+	RETURN_ON_ERROR(code);
+
+	*particlesPerMs = measuredMs > 0.0 ? NUM_CALIBRATION_PARTICLES * NUM_CALIBRATION_FRAMES / measuredMs : 0.0;
+	return CL_SUCCESS;
+}
+
+cl_int calibrateDevice(ClDeviceScore& score, BinaryCache& binaryCache, const std::vector<std::string>& sources, const std::string& buildOptions)
+{
+	cl_int code;
+	cl_context_properties props[] =
+	{
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(score.platformId),
+		0
+	};
+	cl_context context = clCreateContext(props, 1, &score.deviceId, nullptr, nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	cl_command_queue commandQueue = clCreateCommandQueue(context, score.deviceId, CL_QUEUE_PROFILING_ENABLE, &code);
+	if (code == CL_SUCCESS)
+	{
+		// the program cache releases its programs before the context
+		ClProgramCache programCache(context, score.deviceId, &binaryCache);
+		std::string buildLog;
+		cl_program program = programCache.getProgram(sources, buildOptions, &code, &buildLog);
+		if (code == CL_SUCCESS)
+		{
+			code = runCalibration(context, score.deviceId, commandQueue, program, &score.particlesPerMs);
+		}
+		clReleaseCommandQueue(commandQueue);
+	}
+
+	clReleaseContext(context);
+	return code;
+}
+
+const char* getDeviceTypeString(cl_device_type deviceType)
+{
+	if (deviceType & CL_DEVICE_TYPE_GPU)
+	{
+		return "GPU";
+	}
+	if (deviceType & CL_DEVICE_TYPE_CPU)
+	{
+		return "CPU";
+	}
+	if (deviceType & CL_DEVICE_TYPE_ACCELERATOR)
+	{
+		return "accelerator";
+	}
+	return "other";
+}
+
+bool isFasterScore(const ClDeviceScore& a, const ClDeviceScore& b)
+{
+	return a.particlesPerMs > b.particlesPerMs;
+}
+}
+
+std::vector<ClDeviceScore> scoreDevices(BinaryCache& binaryCache, const std::string& clProgramSource,
+	const ParticleSimulationConfig& config, bool forceScoring)
+{
+	std::vector<ClDeviceScore> scores;
+
+	cl_uint numPlatforms = 0;
+	if (clGetPlatformIDs(0, nullptr, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+	{
+		return scores;
+	}
+
+	std::vector<cl_platform_id> platformIds(numPlatforms);
+	clGetPlatformIDs(numPlatforms, platformIds.data(), nullptr);
+	for (cl_uint platformIndex = 0; platformIndex < numPlatforms; ++platformIndex)
+	{
+		cl_uint numDevices = 0;
+		if (clGetDeviceIDs(platformIds[platformIndex], CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices) != CL_SUCCESS || numDevices == 0)
+		{
+			continue;
+		}
+
+		std::vector<cl_device_id> deviceIds(numDevices);
+		clGetDeviceIDs(platformIds[platformIndex], CL_DEVICE_TYPE_ALL, numDevices, deviceIds.data(), nullptr);
+		for (cl_uint deviceIndex = 0; deviceIndex < numDevices; ++deviceIndex)
+		{
+			ClDeviceScore score;
+			score.platformId = platformIds[platformIndex];
+			score.deviceId = deviceIds[deviceIndex];
+			score.platformIndex = platformIndex;
+			score.deviceIndex = deviceIndex;
+			clGetDeviceInfo(score.deviceId, CL_DEVICE_TYPE, sizeof(cl_device_type), &score.deviceType, nullptr);
+			score.name = getDeviceInfoString(score.deviceId, CL_DEVICE_NAME);
+			score.glSharing = hasDeviceExtension(score.deviceId, GL_SHARING_EXTENSION);
+			scores.push_back(score);
+		}
+	}
+
+	// the tuned build options are left out, scores compare devices and not their best configuration
+	const std::vector<std::string> sources = { generateParticleModifierSource(config), clProgramSource };
+	const std::string buildOptions = getParticleModifierBuildOptions(config);
+
+	for (ClDeviceScore& score : scores)
+	{
+		std::string scoreKey = "devicescore\n" + getDeviceCacheKey(score.deviceId) + buildOptions;
+		for (const std::string& source : sources)
+		{
+			scoreKey += '\0';
+			scoreKey += source;
+		}
+
+		std::vector<unsigned char> data;
+		if (!forceScoring && binaryCache.load(scoreKey, data))
+		{
+			std::istringstream stream(std::string(data.begin(), data.end()));
+			if (stream >> score.particlesPerMs && score.particlesPerMs > 0.0)
+			{
+				score.cached = true;
+				continue;
+			}
+			binaryCache.invalidate(scoreKey);
+		}
+
+		std::cout << "Calibrating " << score.name << "..." << std::endl;
+		score.particlesPerMs = 0.0;
+		score.error = calibrateDevice(score, binaryCache, sources, buildOptions);
+		if (score.error != CL_SUCCESS || score.particlesPerMs <= 0.0)
+		{
+			continue;
+		}
+
+		std::ostringstream stream;
+		stream << score.particlesPerMs << '\n';
+		const std::string serializedScore = stream.str();
+		binaryCache.store(scoreKey, std::vector<unsigned char>(serializedScore.begin(), serializedScore.end()));
+	}
+	return scores;
+}
+
+std::vector<size_t> rankDeviceScores(const std::vector<ClDeviceScore>& scores, bool requireGlSharing)
+{
+	// 0 shares the GL context, 1 is a CPU fallback, 2 is anything else
+	auto getTier = [requireGlSharing](const ClDeviceScore& score)
+	{
+		if (!requireGlSharing || score.glSharing)
+		{
+			return 0;
+		}
+		return (score.deviceType & CL_DEVICE_TYPE_CPU) ? 1 : 2;
+	};
+
+	std::vector<size_t> ranking;
+	for (size_t i = 0; i < scores.size(); ++i)
+	{
+		if (scores[i].error == CL_SUCCESS && scores[i].particlesPerMs > 0.0)
+		{
+			ranking.push_back(i);
+		}
+	}
+
+	std::stable_sort(ranking.begin(), ranking.end(), [&scores, &getTier](size_t a, size_t b)
+	{
+		const int tierA = getTier(scores[a]);
+		const int tierB = getTier(scores[b]);
+		return tierA != tierB ? tierA < tierB : isFasterScore(scores[a], scores[b]);
+	});
+	return ranking;
+}
+
+std::vector<size_t> findDeviceScores(const std::vector<ClDeviceScore>& scores, const std::string& deviceOverride)
+{
+	unsigned int platformIndex = 0;
+	unsigned int deviceIndex = 0;
+	char separator = 0;
+	std::istringstream stream(deviceOverride);
+	const bool isIndexPair = (stream >> platformIndex >> separator >> deviceIndex) && separator == ':' && stream.eof();
+
+	// a forced device is used even if its calibration failed, the error then comes from the caller
+	std::vector<size_t> matches;
+	for (size_t i = 0; i < scores.size(); ++i)
+	{
+		const ClDeviceScore& score = scores[i];
+		bool matched;
+		if (isIndexPair)
+		{
+			matched = score.platformIndex == platformIndex && score.deviceIndex == deviceIndex;
+		}
+		else if (deviceOverride == "cpu")
+		{
+			matched = (score.deviceType & CL_DEVICE_TYPE_CPU) != 0;
+		}
+		else if (deviceOverride == "gpu")
+		{
+			matched = (score.deviceType & CL_DEVICE_TYPE_GPU) != 0;
+		}
+		else
+		{
+			matched = !deviceOverride.empty() && score.name.find(deviceOverride) != std::string::npos;
+		}
+
+		if (matched)
+		{
+			matches.push_back(i);
+		}
+	}
+
+	std::stable_sort(matches.begin(), matches.end(), [&scores](size_t a, size_t b)
+	{
+		return isFasterScore(scores[a], scores[b]);
+	});
+	return matches;
+}
+
+void printDeviceScores(std::ostream& stream, const std::vector<ClDeviceScore>& scores, int selectedIndex, const std::string& reason)
+{
+	stream << "OpenCL devices:" << std::endl;
+	for (size_t i = 0; i < scores.size(); ++i)
+	{
+		const ClDeviceScore& score = scores[i];
+		stream << (static_cast<int>(i) == selectedIndex ? "  * " : "    ")
+			<< score.platformIndex << ":" << score.deviceIndex << " " << score.name
+			<< " (" << getDeviceTypeString(score.deviceType) << (score.glSharing ? ", " GL_SHARING_EXTENSION : "") << ")";
+		if (score.error != CL_SUCCESS)
+		{
+			stream << ", calibration failed: " << getErrorString(score.error);
+		}
+		else
+		{
+			stream << ", " << score.particlesPerMs * 1e-3 << " M particles/s" << (score.cached ? " (cached)" : "");
+		}
+		stream << std::endl;
+	}
+	stream << "Selected: " << reason << std::endl;
+}
+
+std::string getDefaultDeviceOverride()
+{
+	const char* deviceOverride = getenv("CLGLPARTICLES_DEVICE");
+	return deviceOverride != nullptr ? deviceOverride : "";
+}
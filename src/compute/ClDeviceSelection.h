@@ -0,0 +1,48 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+class BinaryCache;
+struct ParticleSimulationConfig;
+
+// one platform/device pair and how fast it ran a short calibration run of the particle kernels
+struct ClDeviceScore
+{
+	cl_platform_id platformId = nullptr;
+	cl_device_id deviceId = nullptr;
+	// the override names devices as platformIndex:deviceIndex
+	unsigned int platformIndex = 0;
+	unsigned int deviceIndex = 0;
+	cl_device_type deviceType = 0;
+	std::string name;
+	bool glSharing = false;
+
+	// particles per millisecond of substeps, simulate, spawn and compaction, 0 if the calibration failed
+	double particlesPerMs = 0.0;
+	cl_int error = CL_SUCCESS;
+	// loaded from the binary cache instead of measured
+	bool cached = false;
+};
+
+// every device of every platform, in platform order
+// scores are persisted in binaryCache per device, program source and config, and measured again when there
+// is none yet or when forceScoring is set
+std::vector<ClDeviceScore> scoreDevices(BinaryCache& binaryCache, const std::string& clProgramSource,
+	const ParticleSimulationConfig& config, bool forceScoring);
+
+// indices of the scores from the first choice to the last, failed calibrations are left out
+// the fastest devices with cl_khr_gl_sharing come first when requireGlSharing is set,
+// then the fastest CPU devices as the fallback, then the rest
+std::vector<size_t> rankDeviceScores(const std::vector<ClDeviceScore>& scores, bool requireGlSharing);
+
+// indices of the scores matching an override, fastest first: "cpu", "gpu", "platform:device" or part of a device name
+std::vector<size_t> findDeviceScores(const std::vector<ClDeviceScore>& scores, const std::string& deviceOverride);
+
+// one line per device, the selected one marked, then the reason of the choice
+void printDeviceScores(std::ostream& stream, const std::vector<ClDeviceScore>& scores, int selectedIndex, const std::string& reason);
+
+// CLGLPARTICLES_DEVICE, empty if not set
+std::string getDefaultDeviceOverride();
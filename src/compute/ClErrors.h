@@ -0,0 +1,6 @@
+#pragma once
+
+#include <CL/opencl.h>
+
+// name of an OpenCL error code, for messages
+const char* getErrorString(cl_int error);
@@ -0,0 +1,251 @@
+#include "ClForceFields.h"
+
+#include <algorithm>
+#include <utility>
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+const cl_image_format FORCE_FIELD_FORMAT = { CL_RGBA, CL_FLOAT };
+const size_t TEXEL_SIZE = 4 * sizeof(cl_float);
+
+// written to the bounds of a field to stop it pushing, must outlive the non-blocking write
+const cl_float4 INERT_BOUNDS[2] = {};
+}
+
+ClForceFields::ClForceFields(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_emptyImage(nullptr),
+	m_boundsBuffer(nullptr)
+{
+}
+
+ClForceFields::~ClForceFields()
+{
+	release();
+}
+
+cl_int ClForceFields::create(size_t numFields)
+{
+	release();
+	if (numFields == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	cl_bool imageSupport = CL_FALSE;
+	cl_int code = clGetDeviceInfo(m_deviceId, CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &imageSupport, nullptr);
+	RETURN_ON_ERROR(code);
+	if (!imageSupport)
+	{
+		return CL_IMAGE_FORMAT_NOT_SUPPORTED;
+	}
+
+	const float zeros[2 * 2 * 2 * 4] = {};
+	m_emptyImage = clCreateImage3D(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &FORCE_FIELD_FORMAT, 2, 2, 2, 0, 0,
+		const_cast<float*>(zeros), &code);
+	RETURN_ON_ERROR(code);
+
+	const std::vector<cl_float4> bounds(2 * numFields, cl_float4());
+	m_boundsBuffer = clCreateBuffer(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bounds.size() * sizeof(cl_float4),
+		const_cast<cl_float4*>(bounds.data()), &code);
+	RETURN_ON_ERROR(code);
+
+	m_fields = std::vector<Field>(numFields);
+	return CL_SUCCESS;
+}
+
+cl_int ClForceFields::setField(size_t fieldIndex, std::shared_ptr<const VectorField> field)
+{
+	if (fieldIndex >= m_fields.size())
+	{
+		return CL_INVALID_ARG_INDEX;
+	}
+
+	Field& entry = m_fields[fieldIndex];
+	cl_int code;
+	if (entry.data != nullptr)
+	{
+		code = clFinish(m_commandQueue);
+		RETURN_ON_ERROR(code);
+	}
+	releaseField(entry);
+
+	code = clEnqueueWriteBuffer(m_commandQueue, m_boundsBuffer, CL_FALSE, fieldIndex * sizeof(INERT_BOUNDS), sizeof(INERT_BOUNDS), INERT_BOUNDS,
+		0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	if (field == nullptr || field->getNumVoxels() == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	size_t maxSizes[3] = { 0, 0, 0 };
+	const cl_device_info maxSizeInfos[3] = { CL_DEVICE_IMAGE3D_MAX_WIDTH, CL_DEVICE_IMAGE3D_MAX_HEIGHT, CL_DEVICE_IMAGE3D_MAX_DEPTH };
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		code = clGetDeviceInfo(m_deviceId, maxSizeInfos[axis], sizeof(size_t), &maxSizes[axis], nullptr);
+		RETURN_ON_ERROR(code);
+	}
+	const size_t sizes[3] = { field->width, field->height, field->depth };
+	if (sizes[0] > maxSizes[0] || sizes[1] > maxSizes[1] || sizes[2] > maxSizes[2] || sizes[2] < 2)
+	{
+		return CL_INVALID_IMAGE_SIZE;
+	}
+
+	// allocating does not upload anything, the bricks follow
+	entry.image = clCreateImage3D(m_context, CL_MEM_READ_ONLY, &FORCE_FIELD_FORMAT, sizes[0], sizes[1], sizes[2], 0, 0, nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	entry.data = std::move(field);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		entry.numBricks[axis] = (sizes[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	entry.nextBrick = 0;
+
+	const glm::vec3 scale = 1.f / (entry.data->boundsMax - entry.data->boundsMin);
+	entry.bounds[0] = { { entry.data->boundsMin.x, entry.data->boundsMin.y, entry.data->boundsMin.z, 0.f } };
+	entry.bounds[1] = { { scale.x, scale.y, scale.z, 1.f } };
+	return CL_SUCCESS;
+}
+
+cl_int ClForceFields::enqueueUploads(size_t maxBytes, std::vector<ClProfilingEvent>* profilingEvents)
+{
+	size_t numBytes = 0;
+	for (size_t i = 0; i < m_fields.size(); ++i)
+	{
+		Field& field = m_fields[i];
+		if (field.data == nullptr)
+		{
+			continue;
+		}
+
+		const size_t numBricks = getNumBricks(field);
+		while (field.nextBrick < numBricks)
+		{
+			if (numBytes > 0 && numBytes >= maxBytes)
+			{
+				return CL_SUCCESS;
+			}
+
+			const size_t brick = field.nextBrick;
+			const size_t origin[3] =
+			{
+				brick % field.numBricks[0] * BRICK_SIZE,
+				brick / field.numBricks[0] % field.numBricks[1] * BRICK_SIZE,
+				brick / (field.numBricks[0] * field.numBricks[1]) * BRICK_SIZE
+			};
+			const size_t region[3] =
+			{
+				std::min(BRICK_SIZE, field.data->width - origin[0]),
+				std::min(BRICK_SIZE, field.data->height - origin[1]),
+				std::min(BRICK_SIZE, field.data->depth - origin[2])
+			};
+
+			// the pitches of the whole field, the brick is read in place from the host copy
+			const size_t rowPitch = field.data->width * TEXEL_SIZE;
+			const size_t slicePitch = rowPitch * field.data->height;
+			const cl_float* brickData = field.data->vectors.data() + (origin[2] * field.data->height + origin[1]) * field.data->width * 4 + origin[0] * 4;
+			cl_int code = clEnqueueWriteImage(m_commandQueue, field.image, CL_FALSE, origin, region, rowPitch, slicePitch, brickData, 0, nullptr,
+				getProfilingEvent(profilingEvents, "cl/uploadForceField"));
+			RETURN_ON_ERROR(code);
+
+			numBytes += region[0] * region[1] * region[2] * TEXEL_SIZE;
+			++field.nextBrick;
+		}
+
+		// queued after the last brick, the in-order queue completes them first
+		if (field.nextBrick == numBricks && field.bounds[1].s[3] > 0.f)
+		{
+			cl_int code = clEnqueueWriteBuffer(m_commandQueue, m_boundsBuffer, CL_FALSE, i * sizeof(field.bounds), sizeof(field.bounds), field.bounds,
+				0, nullptr, nullptr);
+			RETURN_ON_ERROR(code);
+			// the bricks are done, only the bounds write is pending
+			field.nextBrick = numBricks + 1;
+		}
+	}
+	return CL_SUCCESS;
+}
+
+bool ClForceFields::isComplete() const
+{
+	for (const Field& field : m_fields)
+	{
+		if (field.data != nullptr && field.nextBrick <= getNumBricks(field))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t ClForceFields::getNumPendingBytes() const
+{
+	size_t numBytes = 0;
+	for (const Field& field : m_fields)
+	{
+		const size_t numBricks = getNumBricks(field);
+		if (field.data != nullptr && field.nextBrick < numBricks)
+		{
+			// bricks are uploaded in order, the partial ones are counted whole
+			numBytes += (numBricks - field.nextBrick) * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE * TEXEL_SIZE;
+		}
+	}
+	return numBytes;
+}
+
+cl_int ClForceFields::setKernelArgs(cl_kernel kernel, cl_uint firstIndex) const
+{
+	cl_int code = clSetKernelArg(kernel, firstIndex, sizeof(cl_mem), &m_boundsBuffer);
+	RETURN_ON_ERROR(code);
+	for (size_t i = 0; i < m_fields.size(); ++i)
+	{
+		const cl_mem image = m_fields[i].image != nullptr ? m_fields[i].image : m_emptyImage;
+		code = clSetKernelArg(kernel, firstIndex + 1 + static_cast<cl_uint>(i), sizeof(cl_mem), &image);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+void ClForceFields::releaseField(Field& field)
+{
+	if (field.image != nullptr)
+	{
+		clReleaseMemObject(field.image);
+		field.image = nullptr;
+	}
+	field.data.reset();
+	field.nextBrick = 0;
+	field.numBricks[0] = field.numBricks[1] = field.numBricks[2] = 0;
+}
+
+void ClForceFields::release()
+{
+	// pending uploads read the host copies of the fields
+	if (!m_fields.empty())
+	{
+		clFinish(m_commandQueue);
+	}
+	for (Field& field : m_fields)
+	{
+		releaseField(field);
+	}
+	m_fields.clear();
+
+	for (cl_mem* buffer : { &m_emptyImage, &m_boundsBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+}
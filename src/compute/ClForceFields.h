@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+#include "engine/VectorField.h"
+
+// the force fields sampled by the ForceField modifiers of a ClParticleSimulation, one 3D image per field index so that
+// simulateParticles gets trilinear filtering from the texture units
+// fields are uploaded in bricks of BRICK_SIZE voxels per axis under a byte budget per call, a large field reaches the
+// device over several frames without stalling one, and pushes nothing until its last brick is queued
+class ClForceFields
+{
+public:
+	ClForceFields(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClForceFields();
+
+	ClForceFields(const ClForceFields&) = delete;
+	ClForceFields& operator=(const ClForceFields&) = delete;
+
+	// numFields fields pushing nothing, CL_IMAGE_FORMAT_NOT_SUPPORTED without 3D float images, returns the first error
+	cl_int create(size_t numFields);
+
+	// replaces field fieldIndex, the previous one stops pushing right away, the new one once enqueueUploads sent it all
+	// waits for the queue when a field is replaced, the uploads read its host memory
+	cl_int setField(size_t fieldIndex, std::shared_ptr<const VectorField> field);
+
+	// queues the next bricks until maxBytes were queued, at least one if any is left, returns the first error
+	cl_int enqueueUploads(size_t maxBytes, std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+	bool isComplete() const;
+	size_t getNumPendingBytes() const;
+
+	// sets the FORCE_FIELD_PARAMS of simulateParticles from firstIndex on: the bounds then an image per field
+	cl_int setKernelArgs(cl_kernel kernel, cl_uint firstIndex) const;
+	size_t getNumFields() const { return m_fields.size(); }
+
+	// releases the images and buffers, also done by the destructor
+	void release();
+
+	// 512 KB of CL_RGBA CL_FLOAT texels
+	static constexpr size_t BRICK_SIZE = 32;
+
+private:
+	struct Field
+	{
+		std::shared_ptr<const VectorField> data;
+		cl_mem image = nullptr;
+		size_t numBricks[3] = { 0, 0, 0 };
+		size_t nextBrick = 0;
+		// the entry of the bounds buffer written after the last brick, left untouched while the write is pending
+		cl_float4 bounds[2];
+	};
+
+	size_t getNumBricks(const Field& field) const { return field.numBricks[0] * field.numBricks[1] * field.numBricks[2]; }
+	void releaseField(Field& field);
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+
+	// bound to the fields without data, a 2x2x2 image of zeros
+	cl_mem m_emptyImage;
+	// two cl_float4 per field, see applyForceField in cl/particle.cl
+	cl_mem m_boundsBuffer;
+	// sized once by create, the bounds writes point into the entries
+	std::vector<Field> m_fields;
+};
@@ -0,0 +1,196 @@
+#include "ClFrustumCull.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <initializer_list>
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+// argument index of the first plane of cullParticles
+const cl_uint FIRST_PLANE_ARG = 3;
+const cl_uint NUM_PLANES = 6;
+
+// zero written to the kept count of every frame, must outlive the non-blocking write
+const cl_uint ZERO_COUNT = 0;
+
+// row of a column-major matrix
+cl_float4 getRow(const cl_float matrix[16], int row)
+{
+	return { { matrix[row], matrix[row + 4], matrix[row + 8], matrix[row + 12] } };
+}
+
+// the plane of clip space row +- the w row, normalized so that dot(plane, position) is a distance
+cl_float4 getPlane(const cl_float4& wRow, const cl_float4& row, cl_float sign)
+{
+	cl_float4 plane;
+	for (int i = 0; i < 4; ++i)
+	{
+		plane.s[i] = wRow.s[i] + sign * row.s[i];
+	}
+	const cl_float length = std::sqrt(plane.s[0] * plane.s[0] + plane.s[1] * plane.s[1] + plane.s[2] * plane.s[2]);
+	if (length > 0.f)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			plane.s[i] /= length;
+		}
+	}
+	return plane;
+}
+}
+
+ClFrustumCull::ClFrustumCull(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_capacity(0),
+	m_culledPositionsBuffer(nullptr),
+	m_stateBuffer(nullptr),
+	m_cullParticlesKernel(nullptr),
+	m_writeCulledPositionsKernel(nullptr)
+{
+}
+
+ClFrustumCull::~ClFrustumCull()
+{
+	release();
+}
+
+cl_int ClFrustumCull::create(cl_program program)
+{
+	release();
+
+	cl_int code;
+	m_cullParticlesKernel = clCreateKernel(program, "cullParticles", &code);
+	RETURN_ON_ERROR(code);
+	m_writeCulledPositionsKernel = clCreateKernel(program, "writeCulledPositions", &code);
+	RETURN_ON_ERROR(code);
+
+	m_stateBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + NUM_PLANES + 4, sizeof(cl_mem), &m_stateBuffer);
+	RETURN_ON_ERROR(code);
+	return clSetKernelArg(m_writeCulledPositionsKernel, 1, sizeof(cl_mem), &m_stateBuffer);
+}
+
+cl_int ClFrustumCull::reserve(size_t maxNumPositions)
+{
+	if (maxNumPositions <= m_capacity)
+	{
+		return CL_SUCCESS;
+	}
+
+	releaseBuffers();
+
+	cl_int code;
+	m_culledPositionsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumPositions * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + NUM_PLANES + 3, sizeof(cl_mem), &m_culledPositionsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_writeCulledPositionsKernel, 0, sizeof(cl_mem), &m_culledPositionsBuffer);
+	RETURN_ON_ERROR(code);
+
+	m_capacity = maxNumPositions;
+	return CL_SUCCESS;
+}
+
+cl_int ClFrustumCull::enqueueCull(cl_mem positions, size_t positionCapacity, cl_mem drawCommands, cl_uint numDrawCommands,
+	const cl_float viewProjectionMatrix[16], cl_float radius, cl_float pixelsPerUnit, cl_float minPixelSize,
+	std::vector<ClProfilingEvent>* profilingEvents)
+{
+	if (positionCapacity == 0 || numDrawCommands == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	cl_int code = reserve(positionCapacity);
+	RETURN_ON_ERROR(code);
+
+	// Gribb and Hartmann: the frustum planes are sums and differences of the rows of the view projection matrix
+	const cl_float4 rows[] = { getRow(viewProjectionMatrix, 0), getRow(viewProjectionMatrix, 1), getRow(viewProjectionMatrix, 2) };
+	const cl_float4 wRow = getRow(viewProjectionMatrix, 3);
+	const cl_float4 planes[NUM_PLANES] =
+	{
+		getPlane(wRow, rows[0], 1.f), getPlane(wRow, rows[0], -1.f),
+		getPlane(wRow, rows[1], 1.f), getPlane(wRow, rows[1], -1.f),
+		getPlane(wRow, rows[2], 1.f), getPlane(wRow, rows[2], -1.f),
+	};
+	// clip w is the view distance of a perspective projection, a quad covers 2 * radius * pixelsPerUnit / w pixels
+	const cl_float maxDistance = minPixelSize > 0.f ? 2.f * radius * pixelsPerUnit / minPixelSize : FLT_MAX;
+
+	code = clSetKernelArg(m_cullParticlesKernel, 0, sizeof(cl_mem), &positions);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_cullParticlesKernel, 1, sizeof(cl_mem), &drawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_cullParticlesKernel, 2, sizeof(cl_uint), &numDrawCommands);
+	RETURN_ON_ERROR(code);
+	for (cl_uint i = 0; i < NUM_PLANES; ++i)
+	{
+		code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + i, sizeof(cl_float4), &planes[i]);
+		RETURN_ON_ERROR(code);
+	}
+	code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + NUM_PLANES, sizeof(cl_float4), &wRow);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + NUM_PLANES + 1, sizeof(cl_float), &radius);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_cullParticlesKernel, FIRST_PLANE_ARG + NUM_PLANES + 2, sizeof(cl_float), &maxDistance);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_writeCulledPositionsKernel, 2, sizeof(cl_mem), &positions);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_writeCulledPositionsKernel, 3, sizeof(cl_mem), &drawCommands);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_writeCulledPositionsKernel, 4, sizeof(cl_uint), &numDrawCommands);
+	RETURN_ON_ERROR(code);
+
+	code = clEnqueueWriteBuffer(m_commandQueue, m_stateBuffer, CL_FALSE, 0, sizeof(cl_uint), &ZERO_COUNT, 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	size_t globalWorkSize[] = { positionCapacity };
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_cullParticlesKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/cullParticles"));
+	RETURN_ON_ERROR(code);
+
+	// one more work-item than commands for the instanced command
+	size_t writeGlobalWorkSize[] = { std::max(positionCapacity, static_cast<size_t>(numDrawCommands) + 1) };
+	return clEnqueueNDRangeKernel(m_commandQueue, m_writeCulledPositionsKernel, 1, nullptr, writeGlobalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/writeCulledPositions"));
+}
+
+void ClFrustumCull::releaseBuffers()
+{
+	if (m_culledPositionsBuffer != nullptr)
+	{
+		clReleaseMemObject(m_culledPositionsBuffer);
+		m_culledPositionsBuffer = nullptr;
+	}
+	m_capacity = 0;
+}
+
+void ClFrustumCull::release()
+{
+	releaseBuffers();
+
+	if (m_stateBuffer != nullptr)
+	{
+		clReleaseMemObject(m_stateBuffer);
+		m_stateBuffer = nullptr;
+	}
+
+	for (cl_kernel* kernel : { &m_cullParticlesKernel, &m_writeCulledPositionsKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
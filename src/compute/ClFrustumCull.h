@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+
+// drops the render positions of a frame that are outside the view frustum or too small on screen to matter,
+// the kernels of cl/frustum_cull.cl
+// the kept positions of every draw command are packed into the range of the first one, which is rewritten to draw
+// them all while the others draw none, and the command after the last one is rewritten to draw them as instanced
+// quads of 4 vertices, so both the point and the instanced draws can go through glDrawArraysIndirect
+// queued before ClDepthSort, which then only sorts what is drawn
+class ClFrustumCull
+{
+public:
+	ClFrustumCull(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClFrustumCull();
+
+	ClFrustumCull(const ClFrustumCull&) = delete;
+	ClFrustumCull& operator=(const ClFrustumCull&) = delete;
+
+	// program is built from cl/frustum_cull.cl, returns the first error
+	cl_int create(cl_program program);
+
+	// culls the positions drawn by the numDrawCommands ClDrawArraysIndirectCommands of drawCommands, followed by room
+	// for the instanced command, to be queued after ClParticleDeviceGroup::enqueueGather
+	// positions holds positionCapacity positions, each the center of a quad of the given radius
+	// viewProjectionMatrix is column-major as GL takes it, pixelsPerUnit is the size in pixels of a unit at distance 1
+	// (the projection's y scale times half the viewport height), quads covering less than minPixelSize pixels are dropped
+	cl_int enqueueCull(cl_mem positions, size_t positionCapacity, cl_mem drawCommands, cl_uint numDrawCommands,
+		const cl_float viewProjectionMatrix[16], cl_float radius, cl_float pixelsPerUnit, cl_float minPixelSize,
+		std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	// releases the buffers and kernels, also done by the destructor
+	void release();
+
+private:
+	cl_int reserve(size_t maxNumPositions);
+	void releaseBuffers();
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+
+	size_t m_capacity;
+	cl_mem m_culledPositionsBuffer;
+	// one cl_uint, the kept positions
+	cl_mem m_stateBuffer;
+
+	cl_kernel m_cullParticlesKernel;
+	cl_kernel m_writeCulledPositionsKernel;
+};
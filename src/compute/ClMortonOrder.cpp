@@ -0,0 +1,200 @@
+#include "ClMortonOrder.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "ClParticleSimulation.h"
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+ClRadixSort::PhaseNames getMortonSortPhaseNames()
+{
+	ClRadixSort::PhaseNames phaseNames;
+	phaseNames.histogram = "cl/mortonSortHistogram";
+	phaseNames.scan = "cl/mortonSortScan";
+	phaseNames.scatter = "cl/mortonSortScatter";
+	return phaseNames;
+}
+
+cl_int setKernelBufferArgs(cl_kernel kernel, cl_uint firstIndex, std::initializer_list<cl_mem> buffers)
+{
+	cl_uint index = firstIndex;
+	for (cl_mem buffer : buffers)
+	{
+		cl_int code = clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffer);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+}
+
+ClMortonOrder::ClMortonOrder(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_sort(context, deviceId, commandQueue, getMortonSortPhaseNames()),
+	m_cellSize(DEFAULT_CELL_SIZE),
+	m_capacity(0),
+	m_orderedPositionsBuffer(nullptr),
+	m_orderedVelocitiesBuffer(nullptr),
+	m_orderedSpawnTimesBuffer(nullptr),
+	m_orderedSpawnIdsBuffer(nullptr),
+	m_computeMortonKeysKernel(nullptr),
+	m_gatherMortonOrderKernel(nullptr),
+	m_writeMortonOrderKernel(nullptr)
+{
+}
+
+ClMortonOrder::~ClMortonOrder()
+{
+	release();
+}
+
+cl_int ClMortonOrder::create(cl_program program, cl_program sortProgram, cl_float cellSize)
+{
+	release();
+
+	m_cellSize = cellSize;
+
+	cl_int code = m_sort.create(sortProgram);
+	RETURN_ON_ERROR(code);
+
+	m_computeMortonKeysKernel = clCreateKernel(program, "computeMortonKeys", &code);
+	RETURN_ON_ERROR(code);
+	m_gatherMortonOrderKernel = clCreateKernel(program, "gatherMortonOrder", &code);
+	RETURN_ON_ERROR(code);
+	m_writeMortonOrderKernel = clCreateKernel(program, "writeMortonOrder", &code);
+	RETURN_ON_ERROR(code);
+
+	return clSetKernelArg(m_computeMortonKeysKernel, 4, sizeof(cl_float), &m_cellSize);
+}
+
+cl_int ClMortonOrder::reserve(size_t pageSize)
+{
+	if (pageSize <= m_capacity)
+	{
+		return CL_SUCCESS;
+	}
+
+	releaseBuffers();
+
+	cl_int code = m_sort.reserve(pageSize);
+	RETURN_ON_ERROR(code);
+
+	m_orderedPositionsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, pageSize * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_orderedVelocitiesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, pageSize * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_orderedSpawnTimesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, pageSize * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_orderedSpawnIdsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, pageSize * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = setKernelBufferArgs(m_computeMortonKeysKernel, 5, { m_sort.getKeys(), m_sort.getValues() });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_gatherMortonOrderKernel, 7,
+		{ m_orderedPositionsBuffer, m_orderedVelocitiesBuffer, m_orderedSpawnTimesBuffer, m_orderedSpawnIdsBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_writeMortonOrderKernel, 10,
+		{ m_orderedPositionsBuffer, m_orderedVelocitiesBuffer, m_orderedSpawnTimesBuffer, m_orderedSpawnIdsBuffer });
+	RETURN_ON_ERROR(code);
+
+	m_capacity = pageSize;
+	return CL_SUCCESS;
+}
+
+cl_int ClMortonOrder::enqueueReorder(const ClParticleSimulation& simulation, std::vector<ClProfilingEvent>* profilingEvents)
+{
+	cl_int code = reserve(simulation.getPageSize());
+	RETURN_ON_ERROR(code);
+
+	cl_mem pageAliveCounts = simulation.getPageAliveCountsBuffer();
+	code = setKernelBufferArgs(m_computeMortonKeysKernel, 2, { pageAliveCounts });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_gatherMortonOrderKernel, 1, { pageAliveCounts });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_writeMortonOrderKernel, 6, { pageAliveCounts });
+	RETURN_ON_ERROR(code);
+
+	for (size_t i = 0; i < simulation.getNumPages(); ++i)
+	{
+		const ClParticlePage& page = simulation.getPage(i);
+		if (page.aliveCountUpperBound == 0)
+		{
+			continue;
+		}
+
+		// the sort reads the page's alive count on the device, the upper bound only sizes the launches
+		const cl_uint pageIndex = static_cast<cl_uint>(i);
+		const size_t maxAliveCount = std::min(static_cast<size_t>(page.aliveCountUpperBound), simulation.getPageSize());
+
+		code = setKernelBufferArgs(m_computeMortonKeysKernel, 0, { page.positionBuffer, page.aliveIndicesBuffer });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_computeMortonKeysKernel, 3, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+		size_t aliveGlobalWorkSize[] = { maxAliveCount };
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_computeMortonKeysKernel, 1, nullptr, aliveGlobalWorkSize, nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/computeMortonKeys"));
+		RETURN_ON_ERROR(code);
+
+		code = m_sort.enqueueSort(maxAliveCount, pageAliveCounts, pageIndex, KEY_BITS, profilingEvents);
+		RETURN_ON_ERROR(code);
+
+		code = setKernelBufferArgs(m_gatherMortonOrderKernel, 0, { m_sort.getSortedValues() });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_gatherMortonOrderKernel, 2, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(m_gatherMortonOrderKernel, 3, { page.positionBuffer, page.velocityBuffer, page.spawnTimeBuffer, page.spawnIdBuffer });
+		RETURN_ON_ERROR(code);
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_gatherMortonOrderKernel, 1, nullptr, aliveGlobalWorkSize, nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/gatherMortonOrder"));
+		RETURN_ON_ERROR(code);
+
+		code = setKernelBufferArgs(m_writeMortonOrderKernel, 0,
+			{ page.positionBuffer, page.velocityBuffer, page.spawnTimeBuffer, page.spawnIdBuffer, page.isAliveBuffer, page.aliveIndicesBuffer });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_writeMortonOrderKernel, 7, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(m_writeMortonOrderKernel, 8, { page.freeIndicesBuffer, page.freeCountBuffer });
+		RETURN_ON_ERROR(code);
+		size_t pageGlobalWorkSize[] = { simulation.getPageSize() };
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_writeMortonOrderKernel, 1, nullptr, pageGlobalWorkSize, nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/writeMortonOrder"));
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+void ClMortonOrder::releaseBuffers()
+{
+	for (cl_mem* buffer : { &m_orderedPositionsBuffer, &m_orderedVelocitiesBuffer, &m_orderedSpawnTimesBuffer, &m_orderedSpawnIdsBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+	m_capacity = 0;
+}
+
+void ClMortonOrder::release()
+{
+	releaseBuffers();
+	m_sort.release();
+
+	for (cl_kernel* kernel : { &m_computeMortonKeysKernel, &m_gatherMortonOrderKernel, &m_writeMortonOrderKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+#include "ClRadixSort.h"
+
+class ClParticleSimulation;
+
+// reorders the particle storage of a ClParticleSimulation by the Morton code of each particle's cell, the kernels of
+// cl/morton_order.cl
+// spawns take whatever slot is free, so after a few lifetimes particles close in space are scattered over their page;
+// the pass moves the alive particles of every page to its front in Morton order, points the alive lists at them and
+// rebuilds the free lists from the other slots, so that the passes reading particles through the alive lists and the
+// render positions they gather follow space again
+// particles keep their spawn ids, and so their random numbers, through the move
+// a maintenance pass, queued every few frames right after a compaction, particle references from before it are stale
+class ClMortonOrder
+{
+public:
+	ClMortonOrder(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClMortonOrder();
+
+	ClMortonOrder(const ClMortonOrder&) = delete;
+	ClMortonOrder& operator=(const ClMortonOrder&) = delete;
+
+	// program is built from cl/morton_order.cl and sortProgram from cl/radix_sort.cl
+	// cells wrap every 1024 on each axis, returns the first error
+	cl_int create(cl_program program, cl_program sortProgram, cl_float cellSize = DEFAULT_CELL_SIZE);
+
+	// reorders every allocated page of the simulation, to be queued after its compaction
+	cl_int enqueueReorder(const ClParticleSimulation& simulation, std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	cl_float getCellSize() const { return m_cellSize; }
+
+	// releases the buffers and kernels, also done by the destructor
+	void release();
+
+	// three 10 bit cell coordinates interleaved
+	static constexpr unsigned int KEY_BITS = 30;
+	// a 256 units wide cube before cells wrap, wider than the demo's particles spread
+	static constexpr cl_float DEFAULT_CELL_SIZE = 0.25f;
+
+private:
+	cl_int reserve(size_t pageSize);
+	void releaseBuffers();
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+	ClRadixSort m_sort;
+
+	cl_float m_cellSize;
+	// particles of a page, the buffers are reused page after page
+	size_t m_capacity;
+
+	cl_mem m_orderedPositionsBuffer;
+	cl_mem m_orderedVelocitiesBuffer;
+	cl_mem m_orderedSpawnTimesBuffer;
+	cl_mem m_orderedSpawnIdsBuffer;
+
+	cl_kernel m_computeMortonKeysKernel;
+	cl_kernel m_gatherMortonOrderKernel;
+	cl_kernel m_writeMortonOrderKernel;
+};
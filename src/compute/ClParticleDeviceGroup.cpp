@@ -0,0 +1,408 @@
+#include "ClParticleDeviceGroup.h"
+
+#include <algorithm>
+
+#include "ClAutotuner.h"
+#include "ClDevice.h"
+#include "ClProgramCache.h"
+#include "engine/BinaryCache.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/PhaseTimings.h"
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+// devices number their spawns from 0 and would draw the same numbers, the first one keeps the seed as it is
+cl_uint getDeviceSeed(cl_uint seed, size_t device)
+{
+	return seed ^ (static_cast<cl_uint>(device) * 0x9E3779B9u);
+}
+
+size_t getMaxAllocRenderCapacity(cl_device_id deviceId)
+{
+	cl_ulong maxAllocSize = 0;
+	clGetDeviceInfo(deviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAllocSize, nullptr);
+	return static_cast<size_t>(maxAllocSize / (3 * sizeof(cl_float)));
+}
+}
+
+ClParticleDeviceGroup::ClParticleDeviceGroup(cl_device_id primaryDeviceId, cl_command_queue primaryCommandQueue, ClParticleSimulation& primarySimulation,
+	unsigned int numFrames) :
+	m_numFrames(std::max(numFrames, 1u)),
+	m_frames(m_numFrames),
+	m_loadBalancer(1),
+	m_maxRenderCapacity(getMaxAllocRenderCapacity(primaryDeviceId))
+{
+	cl_command_queue_properties properties = 0;
+	clGetCommandQueueInfo(primaryCommandQueue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, nullptr);
+
+	Device device;
+	device.deviceId = primaryDeviceId;
+	device.commandQueue = primaryCommandQueue;
+	device.simulation = &primarySimulation;
+	device.profiling = (properties & CL_QUEUE_PROFILING_ENABLE) != 0;
+	device.frames.resize(m_numFrames);
+	m_devices.push_back(std::move(device));
+
+	for (Frame& frame : m_frames)
+	{
+		frame.drawCommands.assign(1, { 0, 1, 0, 0 });
+	}
+}
+
+ClParticleDeviceGroup::~ClParticleDeviceGroup()
+{
+	release();
+}
+
+cl_int ClParticleDeviceGroup::addDevice(cl_device_id deviceId, BinaryCache& binaryCache, const std::string& clProgramSource, const ParticleSimulationConfig& config,
+	bool autotune, size_t maxNumParticles, size_t pageSize, std::string* buildLog)
+{
+	Device device;
+	device.deviceId = deviceId;
+	device.profiling = true;
+	device.frames.resize(m_numFrames);
+
+	// released with the device on failure
+	auto releaseDevice = [&device]()
+	{
+		device.ownedSimulation.reset();
+		device.programCache.reset();
+		if (device.commandQueue != nullptr)
+		{
+			clReleaseCommandQueue(device.commandQueue);
+		}
+		if (device.context != nullptr)
+		{
+			clReleaseContext(device.context);
+		}
+	};
+
+	cl_int code;
+	cl_context_properties props[] =
+	{
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(getDevicePlatform(deviceId)),
+		0
+	};
+	device.context = clCreateContext(props, 1, &deviceId, nullptr, nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	device.commandQueue = clCreateCommandQueue(device.context, deviceId, CL_QUEUE_PROFILING_ENABLE, &code);
+	if (code != CL_SUCCESS)
+	{
+		releaseDevice();
+		return code;
+	}
+
+	device.programCache.reset(new ClProgramCache(device.context, deviceId, &binaryCache));
+
+	ClParticleTuning tuning;
+	if (autotune && getParticleTuning(device.context, deviceId, *device.programCache, binaryCache, clProgramSource, config, false, &tuning) != CL_SUCCESS)
+	{
+		// not fatal, the driver picks the work sizes
+		tuning = ClParticleTuning();
+	}
+
+	cl_program program = device.programCache->getProgram(
+		{ generateParticleModifierSource(config), clProgramSource },
+		appendBuildOptions(getParticleModifierBuildOptions(config), tuning.buildOptions),
+		&code,
+		buildLog
+	);
+	if (code == CL_SUCCESS)
+	{
+		device.ownedSimulation.reset(new ClParticleSimulation(device.context, deviceId, device.commandQueue));
+		code = device.ownedSimulation->create(program, maxNumParticles, tuning.workSizes, pageSize);
+	}
+	if (code != CL_SUCCESS)
+	{
+		releaseDevice();
+		return code;
+	}
+
+	device.simulation = device.ownedSimulation.get();
+	m_devices.push_back(std::move(device));
+
+	// measurements start over with the new device
+	m_loadBalancer = LoadBalancer(m_devices.size());
+	for (Frame& frame : m_frames)
+	{
+		frame.drawCommands.assign(m_devices.size(), { 0, 1, 0, 0 });
+	}
+	return CL_SUCCESS;
+}
+
+size_t ClParticleDeviceGroup::getRenderCapacity() const
+{
+	size_t renderCapacity = 0;
+	for (const Device& device : m_devices)
+	{
+		renderCapacity += device.simulation->getCapacity() + device.simulation->getPageSize();
+	}
+	return std::min(renderCapacity, m_maxRenderCapacity);
+}
+
+std::vector<ClProfilingEvent>* ClParticleDeviceGroup::getProfilingEvents(Device& device, unsigned int frame)
+{
+	return device.profiling ? &device.frames[frame].profilingEvents : nullptr;
+}
+
+cl_int ClParticleDeviceGroup::enqueueSubstep(unsigned int frame, cl_uint seed, cl_uint step, cl_float currentTime, cl_float deltaTime,
+	cl_uint numParticlesToSpawn)
+{
+	// every device may hold the whole budget since the balancer can move most particles to one of them,
+	// the group keeps their sum under it
+	if (m_devices.size() > 1)
+	{
+		size_t aliveCountUpperBound = 0;
+		for (const Device& device : m_devices)
+		{
+			aliveCountUpperBound += device.simulation->getAliveCountUpperBound();
+		}
+		const size_t maxNumParticles = m_devices[0].simulation->getMaxNumParticles();
+		const size_t freeRoom = maxNumParticles > aliveCountUpperBound ? maxNumParticles - aliveCountUpperBound : 0;
+		numParticlesToSpawn = static_cast<cl_uint>(std::min<size_t>(numParticlesToSpawn, freeRoom));
+	}
+
+	m_loadBalancer.split(numParticlesToSpawn, m_numParticlesToSpawn);
+
+	for (size_t i = 0; i < m_devices.size(); ++i)
+	{
+		Device& device = m_devices[i];
+		cl_int code = device.simulation->enqueueSubstep(getDeviceSeed(seed, i), step, currentTime, deltaTime,
+			m_numParticlesToSpawn[i], getProfilingEvents(device, frame));
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+cl_int ClParticleDeviceGroup::consumeGather(Device& device, DeviceFrame& deviceFrame)
+{
+	if (deviceFrame.mapEvent == nullptr)
+	{
+		return CL_SUCCESS;
+	}
+
+	cl_int code = clWaitForEvents(1, &deviceFrame.mapEvent);
+	clReleaseEvent(deviceFrame.mapEvent);
+	deviceFrame.mapEvent = nullptr;
+	RETURN_ON_ERROR(code);
+
+	// the alive counts were read before the mapping on the same queue
+	deviceFrame.gatheredDrawCount = static_cast<cl_uint>(std::min<size_t>(deviceFrame.aliveCounts[0], deviceFrame.renderRange));
+	deviceFrame.gatheredPositions.resize(deviceFrame.gatheredDrawCount * 3);
+	std::copy_n(static_cast<const float*>(deviceFrame.mappedPositions), deviceFrame.gatheredPositions.size(), deviceFrame.gatheredPositions.data());
+	deviceFrame.completedAliveCount = deviceFrame.aliveCounts[1];
+
+	releaseProfilingEvents(deviceFrame.completedProfilingEvents);
+	std::swap(deviceFrame.completedProfilingEvents, deviceFrame.pendingProfilingEvents);
+
+	code = clEnqueueUnmapMemObject(device.commandQueue, deviceFrame.renderPositions, deviceFrame.mappedPositions, 0, nullptr, nullptr);
+	deviceFrame.mappedPositions = nullptr;
+	return code;
+}
+
+cl_int ClParticleDeviceGroup::enqueueCompaction(unsigned int frame, cl_mem renderPositions, size_t renderCapacity, cl_float renderTimeOffset)
+{
+	if (renderCapacity == 0)
+	{
+		for (Device& device : m_devices)
+		{
+			cl_int code = device.simulation->enqueueCompaction(nullptr, 0, 0.f, getProfilingEvents(device, frame));
+			RETURN_ON_ERROR(code);
+		}
+		return CL_SUCCESS;
+	}
+
+	// each device gets the positions it may need in order, the last ones are not drawn if the buffer is too small
+	std::vector<ClDrawArraysIndirectCommand>& drawCommands = m_frames[frame].drawCommands;
+	size_t first = 0;
+	for (size_t i = 0; i < m_devices.size(); ++i)
+	{
+		Device& device = m_devices[i];
+		DeviceFrame& deviceFrame = device.frames[frame];
+		ClParticleSimulation& simulation = *device.simulation;
+		const size_t deviceRenderCapacity = std::min(simulation.getCapacity() + simulation.getPageSize(), renderCapacity - first);
+
+		cl_int code;
+		if (i == 0)
+		{
+			code = simulation.enqueueCompaction(renderPositions, deviceRenderCapacity, renderTimeOffset, getProfilingEvents(device, frame));
+			RETURN_ON_ERROR(code);
+		}
+		else
+		{
+			// the frame's buffer is free again once the positions mapped when the frame last came around are copied out
+			code = consumeGather(device, deviceFrame);
+			RETURN_ON_ERROR(code);
+
+			// grown ahead of the capacity, halving before shrinking avoids churn
+			if (deviceFrame.renderPositionsCapacity < deviceRenderCapacity || deviceFrame.renderPositionsCapacity > 2 * deviceRenderCapacity)
+			{
+				if (deviceFrame.renderPositions != nullptr)
+				{
+					clReleaseMemObject(deviceFrame.renderPositions);
+				}
+				deviceFrame.renderPositionsCapacity = std::max(deviceRenderCapacity, size_t(1));
+				deviceFrame.renderPositions = clCreateBuffer(device.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+					deviceFrame.renderPositionsCapacity * 3 * sizeof(cl_float), nullptr, &code);
+				if (code != CL_SUCCESS)
+				{
+					deviceFrame.renderPositions = nullptr;
+					deviceFrame.renderPositionsCapacity = 0;
+					return code;
+				}
+			}
+
+			code = simulation.enqueueCompaction(deviceFrame.renderPositions, deviceRenderCapacity, renderTimeOffset, getProfilingEvents(device, frame));
+			RETURN_ON_ERROR(code);
+
+			// the other devices start working while the first one is being fed
+			code = clFlush(device.commandQueue);
+			RETURN_ON_ERROR(code);
+		}
+
+		drawCommands[i].first = static_cast<cl_uint>(first);
+		deviceFrame.renderRange = deviceRenderCapacity;
+		first += deviceRenderCapacity;
+	}
+	return CL_SUCCESS;
+}
+
+cl_int ClParticleDeviceGroup::enqueueGather(unsigned int frame, cl_mem renderPositions, cl_mem drawCommands)
+{
+	Device& primaryDevice = m_devices[0];
+	std::vector<ClDrawArraysIndirectCommand>& frameDrawCommands = m_frames[frame].drawCommands;
+
+	// read for the load balancer, complete once the caller is done with the frame
+	cl_int code = clEnqueueReadBuffer(primaryDevice.commandQueue, primaryDevice.simulation->getAliveCountBuffer(), CL_FALSE, 0,
+		sizeof(primaryDevice.frames[frame].aliveCounts), primaryDevice.frames[frame].aliveCounts, 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	for (size_t i = 1; i < m_devices.size(); ++i)
+	{
+		Device& device = m_devices[i];
+		DeviceFrame& deviceFrame = device.frames[frame];
+
+		// the events of the frame are complete with its mapping, the copy below is counted with the next one
+		releaseProfilingEvents(deviceFrame.pendingProfilingEvents);
+		std::swap(deviceFrame.pendingProfilingEvents, deviceFrame.profilingEvents);
+
+		// positions copied out by the compaction, the frame's range may have shrunk since they were written
+		// host memory of the frame is not touched again until the caller is done with the frame
+		// the copy is timed with the device it comes from, its cost is part of giving that device particles
+		frameDrawCommands[i].count = static_cast<cl_uint>(std::min<size_t>(deviceFrame.gatheredDrawCount, deviceFrame.renderRange));
+		if (frameDrawCommands[i].count > 0)
+		{
+			code = clEnqueueWriteBuffer(primaryDevice.commandQueue, renderPositions, CL_FALSE, frameDrawCommands[i].first * 3 * sizeof(cl_float),
+				frameDrawCommands[i].count * 3 * sizeof(cl_float), deviceFrame.gatheredPositions.data(), 0, nullptr,
+				getProfilingEvent(getProfilingEvents(device, frame), "cl/gatherPositions"));
+			RETURN_ON_ERROR(code);
+		}
+
+		// alive counts first so that the mapping completes after them, consumed when the frame comes around again
+		code = clEnqueueReadBuffer(device.commandQueue, device.simulation->getAliveCountBuffer(), CL_FALSE, 0, sizeof(deviceFrame.aliveCounts),
+			deviceFrame.aliveCounts, 0, nullptr, nullptr);
+		RETURN_ON_ERROR(code);
+		deviceFrame.mappedPositions = clEnqueueMapBuffer(device.commandQueue, deviceFrame.renderPositions, CL_FALSE, CL_MAP_READ, 0,
+			std::max(deviceFrame.renderRange, size_t(1)) * 3 * sizeof(cl_float), 0, nullptr, &deviceFrame.mapEvent, &code);
+		RETURN_ON_ERROR(code);
+		code = clFlush(device.commandQueue);
+		RETURN_ON_ERROR(code);
+	}
+
+	code = clEnqueueWriteBuffer(primaryDevice.commandQueue, drawCommands, CL_FALSE, 0, frameDrawCommands.size() * sizeof(ClDrawArraysIndirectCommand),
+		frameDrawCommands.data(), 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	code = clEnqueueCopyBuffer(primaryDevice.commandQueue, primaryDevice.simulation->getAliveCountBuffer(), drawCommands, 0, 0, sizeof(cl_uint), 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	return clFlush(primaryDevice.commandQueue);
+}
+
+size_t ClParticleDeviceGroup::getNumUndrawnParticles(unsigned int frame) const
+{
+	size_t numUndrawnParticles = 0;
+	for (size_t i = 1; i < m_devices.size(); ++i)
+	{
+		// the alive counts of the frame may still be read back, those of the positions the gather copied are kept
+		numUndrawnParticles += m_devices[i].frames[frame].completedAliveCount - m_frames[frame].drawCommands[i].count;
+	}
+	return numUndrawnParticles;
+}
+
+void ClParticleDeviceGroup::collectFrame(unsigned int frame, PhaseTimings* timings, const char* framePhase)
+{
+	for (size_t i = 0; i < m_devices.size(); ++i)
+	{
+		DeviceFrame& deviceFrame = m_devices[i].frames[frame];
+		// the other devices' frame is the one consumed by the last compaction, empty until the frames came around once
+		std::vector<ClProfilingEvent>& profilingEvents = i == 0 ? deviceFrame.profilingEvents : deviceFrame.completedProfilingEvents;
+		const cl_uint aliveCount = i == 0 ? deviceFrame.aliveCounts[1] : deviceFrame.completedAliveCount;
+		if (m_devices.size() > 1 && !profilingEvents.empty())
+		{
+			m_loadBalancer.addSample(i, static_cast<double>(aliveCount), getProfilingEventsMs(profilingEvents));
+		}
+
+		if (timings != nullptr)
+		{
+			addProfilingSamples(profilingEvents, *timings, framePhase, i > 0 ? "device" + std::to_string(i) + "/" : std::string());
+		}
+		else
+		{
+			releaseProfilingEvents(profilingEvents);
+		}
+	}
+}
+
+void ClParticleDeviceGroup::release()
+{
+	for (Device& device : m_devices)
+	{
+		for (DeviceFrame& deviceFrame : device.frames)
+		{
+			if (deviceFrame.mapEvent != nullptr)
+			{
+				clWaitForEvents(1, &deviceFrame.mapEvent);
+				clReleaseEvent(deviceFrame.mapEvent);
+				deviceFrame.mapEvent = nullptr;
+				clEnqueueUnmapMemObject(device.commandQueue, deviceFrame.renderPositions, deviceFrame.mappedPositions, 0, nullptr, nullptr);
+				deviceFrame.mappedPositions = nullptr;
+			}
+		}
+		if (device.context != nullptr)
+		{
+			clFinish(device.commandQueue);
+		}
+		for (DeviceFrame& deviceFrame : device.frames)
+		{
+			releaseProfilingEvents(deviceFrame.profilingEvents);
+			releaseProfilingEvents(deviceFrame.pendingProfilingEvents);
+			releaseProfilingEvents(deviceFrame.completedProfilingEvents);
+			if (deviceFrame.renderPositions != nullptr)
+			{
+				clReleaseMemObject(deviceFrame.renderPositions);
+				deviceFrame.renderPositions = nullptr;
+				deviceFrame.renderPositionsCapacity = 0;
+			}
+		}
+	}
+
+	// the first device is owned by the caller
+	while (m_devices.size() > 1)
+	{
+		Device& device = m_devices.back();
+		device.ownedSimulation.reset();
+		device.programCache.reset();
+		clReleaseCommandQueue(device.commandQueue);
+		clReleaseContext(device.context);
+		m_devices.pop_back();
+	}
+	m_loadBalancer = LoadBalancer(m_devices.size());
+}
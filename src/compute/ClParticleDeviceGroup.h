@@ -0,0 +1,144 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClParticleSimulation.h"
+#include "ClProfiling.h"
+#include "engine/LoadBalancer.h"
+
+class BinaryCache;
+class ClProgramCache;
+class PhaseTimings;
+struct ParticleSimulationConfig;
+
+// layout of GL's DrawArraysIndirectCommand, the group writes one per device
+struct ClDrawArraysIndirectCommand
+{
+	cl_uint count;
+	cl_uint instanceCount;
+	cl_uint first;
+	cl_uint baseInstance;
+};
+
+// partitions the particles between several OpenCL devices, each running a ClParticleSimulation on its own slice
+// the first device, the one sharing the render buffers, is owned by the caller, the group adds the others with their own
+// context and queue since they may come from other platforms
+// their render positions are mapped without blocking and written after the first device's positions the next time the
+// frame comes around, so the other devices' particles are drawn numFrames frames late and no device waits for another
+// each device gets its own draw command so the packed ranges do not need to be contiguous
+// new particles are split between devices from the kernel times of each, the populations follow within a lifetime
+// the first device's maximum particle count bounds the particles of the whole group, not of each device
+class ClParticleDeviceGroup
+{
+public:
+	// numFrames is the number of frames in flight, frame indices passed below are in [0, numFrames)
+	// the primary queue needs CL_QUEUE_PROFILING_ENABLE once a device is added
+	ClParticleDeviceGroup(cl_device_id primaryDeviceId, cl_command_queue primaryCommandQueue, ClParticleSimulation& primarySimulation,
+		unsigned int numFrames);
+	~ClParticleDeviceGroup();
+
+	ClParticleDeviceGroup(const ClParticleDeviceGroup&) = delete;
+	ClParticleDeviceGroup& operator=(const ClParticleDeviceGroup&) = delete;
+
+	// creates a context, queue, program and simulation on the device, tuned if autotune is set
+	// on failure the device is not added, buildLog is set if the program did not build
+	cl_int addDevice(cl_device_id deviceId, BinaryCache& binaryCache, const std::string& clProgramSource, const ParticleSimulationConfig& config,
+		bool autotune, size_t maxNumParticles, size_t pageSize, std::string* buildLog);
+
+	size_t getNumDevices() const { return m_devices.size(); }
+	cl_device_id getDeviceId(size_t device) const { return m_devices[device].deviceId; }
+	ClParticleSimulation& getSimulation(size_t device) const { return *m_devices[device].simulation; }
+	double getShare(size_t device) const { return m_loadBalancer.getShare(device); }
+
+	// render positions needed by every device, the first allocated page of headroom each
+	// capped by the first device's CL_DEVICE_MAX_MEM_ALLOC_SIZE since they are one buffer, the particles past it are not drawn
+	size_t getRenderCapacity() const;
+	size_t getMaxRenderCapacity() const { return m_maxRenderCapacity; }
+
+	// one substep on every device, numParticlesToSpawn is split with the load balancer
+	// spawns past what the group surely has room for, from the alive count upper bounds of every device, are dropped
+	cl_int enqueueSubstep(unsigned int frame, cl_uint seed, cl_uint step, cl_float currentTime, cl_float deltaTime,
+		cl_uint numParticlesToSpawn);
+
+	// rebuilds the alive lists, the first device writes its positions to the front of renderPositions,
+	// the others to their own buffer once the positions they mapped numFrames frames ago were copied out of it
+	// a renderCapacity of 0 only rebuilds the alive lists, for substeps whose positions are not drawn
+	cl_int enqueueCompaction(unsigned int frame, cl_mem renderPositions, size_t renderCapacity, cl_float renderTimeOffset);
+
+	// queues the copy of the other devices' positions of numFrames frames ago to renderPositions, maps their positions of
+	// this frame and writes one draw command per device to drawCommands, the first one's count is copied from its alive
+	// count buffer; never waits for a device
+	cl_int enqueueGather(unsigned int frame, cl_mem renderPositions, cl_mem drawCommands);
+
+	// draw commands written by the last gather of the frame, the first device's count is only known on the device
+	const std::vector<ClDrawArraysIndirectCommand>& getDrawCommands(unsigned int frame) const { return m_frames[frame].drawCommands; }
+
+	// alive particles of the other devices left out of the positions copied by the last gather of the frame, simulated
+	// but not drawn, the first device's are only known on the device
+	size_t getNumUndrawnParticles(unsigned int frame) const;
+
+	// to be called once the first device is done with the frame: feeds the alive counts and kernel times to the load balancer
+	// and adds the times to timings if not nullptr, prefixed with "device<index>/" except for the first device, with
+	// framePhase if not nullptr; the other devices' are those of the frame numFrames frames earlier
+	void collectFrame(unsigned int frame, PhaseTimings* timings, const char* framePhase = nullptr);
+
+	void release();
+
+private:
+	struct DeviceFrame
+	{
+		std::vector<ClProfilingEvent> profilingEvents;
+		// drawn and alive counts read back by the gather, the alive count is the load balancer's work measure
+		cl_uint aliveCounts[2] = { 0, 0 };
+		// render positions the device was given in the frame's range
+		size_t renderRange = 0;
+
+		// other devices only
+		// where the device compacts its positions, mapped by the gather until the frame comes around again
+		cl_mem renderPositions = nullptr;
+		size_t renderPositionsCapacity = 0;
+		void* mappedPositions = nullptr;
+		cl_event mapEvent = nullptr;
+		// the events of the mapped frame, complete with the mapping
+		std::vector<ClProfilingEvent> pendingProfilingEvents;
+		// copied out of the mapping by consumeGather, written to the render positions by the next gather
+		std::vector<float> gatheredPositions;
+		cl_uint gatheredDrawCount = 0;
+		// the events and alive count of the consumed frame, for collectFrame
+		std::vector<ClProfilingEvent> completedProfilingEvents;
+		cl_uint completedAliveCount = 0;
+	};
+
+	struct Device
+	{
+		cl_device_id deviceId = nullptr;
+		// owned for every device but the first
+		cl_context context = nullptr;
+		cl_command_queue commandQueue = nullptr;
+		std::unique_ptr<ClProgramCache> programCache;
+		std::unique_ptr<ClParticleSimulation> ownedSimulation;
+		ClParticleSimulation* simulation = nullptr;
+		bool profiling = false;
+
+		std::vector<DeviceFrame> frames;
+	};
+
+	struct Frame
+	{
+		std::vector<ClDrawArraysIndirectCommand> drawCommands;
+	};
+
+	std::vector<ClProfilingEvent>* getProfilingEvents(Device& device, unsigned int frame);
+	// waits for the mapping of the frame's previous gather, usually long complete, copies the positions out and unmaps
+	cl_int consumeGather(Device& device, DeviceFrame& deviceFrame);
+
+	unsigned int m_numFrames;
+	std::vector<Device> m_devices;
+	std::vector<Frame> m_frames;
+	LoadBalancer m_loadBalancer;
+	std::vector<uint32_t> m_numParticlesToSpawn;
+	size_t m_maxRenderCapacity;
+};
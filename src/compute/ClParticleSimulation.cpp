@@ -0,0 +1,565 @@
+#include "ClParticleSimulation.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <initializer_list>
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+const cl_uint NUM_PARTICLE_STATE_BUFFERS = 5;
+// the FORCE_FIELD_PARAMS of simulateParticles follow its own arguments: the bounds, then one image per field
+const cl_uint FORCE_FIELD_ARG = NUM_PARTICLE_STATE_BUFFERS + 9;
+
+const char* const PAGE_KERNEL_NAMES[] =
+{
+	"spawnParticle",
+	"simulateParticles",
+	"countAliveParticles",
+	"scanBlockCounts",
+	"compactAliveParticles",
+};
+
+// zero written to the alive count of a new page, must outlive the non-blocking write
+const cl_uint ZERO_COUNT = 0;
+
+cl_int setKernelBufferArgs(cl_kernel kernel, cl_uint firstIndex, std::initializer_list<cl_mem> buffers)
+{
+	cl_uint index = firstIndex;
+	for (cl_mem buffer : buffers)
+	{
+		cl_int code = clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffer);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+// OpenCL 1.x needs the global size to be a multiple of the local size
+size_t roundUpWorkSize(size_t globalWorkSize, size_t localWorkSize)
+{
+	return localWorkSize > 0 ? (globalWorkSize + localWorkSize - 1) / localWorkSize * localWorkSize : globalWorkSize;
+}
+}
+
+ClParticleSimulation::ClParticleSimulation(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_program(nullptr),
+	m_pageSize(DEFAULT_PAGE_SIZE),
+	m_maxNumPages(0),
+	m_maxWorkGroupSize(0),
+	m_preferredWorkGroupSizeMultiple(1),
+	m_numScanBlocks(0),
+	m_nextSpawnId(0),
+	m_pageAliveCountsBuffer(nullptr),
+	m_pageOffsetsBuffer(nullptr),
+	m_aliveCountBuffer(nullptr),
+	m_scanPageAliveCountsKernel(nullptr),
+	m_forceFields(context, deviceId, commandQueue)
+{
+}
+
+ClParticleSimulation::~ClParticleSimulation()
+{
+	release();
+}
+
+cl_int ClParticleSimulation::create(cl_program program, size_t maxNumParticles, const ClParticleWorkSizes& workSizes, size_t pageSize)
+{
+	release();
+
+	m_program = program;
+	clRetainProgram(m_program);
+	m_pageSize = std::max(pageSize, size_t(1));
+	m_nextSpawnId = 0;
+	m_maxNumPages = std::max((maxNumParticles + m_pageSize - 1) / m_pageSize, size_t(1));
+
+	cl_int code;
+	m_pageAliveCountsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_maxNumPages * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_pageOffsetsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_maxNumPages * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_aliveCountBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	m_scanPageAliveCountsKernel = clCreateKernel(program, "scanPageAliveCounts", &code);
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_scanPageAliveCountsKernel, 0, { m_pageAliveCountsBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_scanPageAliveCountsKernel, 2, { m_pageOffsetsBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_scanPageAliveCountsKernel, 4, { m_aliveCountBuffer });
+	RETURN_ON_ERROR(code);
+
+	// work-group limits of the per page kernels, queried on throwaway instances since no page exists yet
+	m_maxWorkGroupSize = ~size_t(0);
+	for (const char* kernelName : PAGE_KERNEL_NAMES)
+	{
+		cl_kernel kernel = clCreateKernel(program, kernelName, &code);
+		RETURN_ON_ERROR(code);
+
+		size_t kernelWorkGroupSize = 0;
+		code = clGetKernelWorkGroupInfo(kernel, m_deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelWorkGroupSize, nullptr);
+		m_maxWorkGroupSize = std::min(m_maxWorkGroupSize, kernelWorkGroupSize);
+		if (code == CL_SUCCESS && strcmp(kernelName, "simulateParticles") == 0)
+		{
+			code = clGetKernelWorkGroupInfo(kernel, m_deviceId, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &m_preferredWorkGroupSizeMultiple, nullptr);
+
+			// the program declares the force fields of its modifiers as extra arguments
+			cl_uint numArgs = 0;
+			if (code == CL_SUCCESS)
+			{
+				code = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &numArgs, nullptr);
+			}
+			if (code == CL_SUCCESS && numArgs > FORCE_FIELD_ARG + 1)
+			{
+				code = m_forceFields.create(numArgs - FORCE_FIELD_ARG - 1);
+			}
+		}
+		clReleaseKernel(kernel);
+		RETURN_ON_ERROR(code);
+	}
+
+	// block counts and scratch memory depend on the compaction work-group size
+	m_workSizes.scan = 0;
+	code = setWorkSizes(workSizes);
+	RETURN_ON_ERROR(code);
+
+	const cl_uint zeroCounts[] = { 0, 0 };
+	return clEnqueueWriteBuffer(m_commandQueue, m_aliveCountBuffer, CL_TRUE, 0, sizeof(zeroCounts), zeroCounts, 0, nullptr, nullptr);
+}
+
+cl_int ClParticleSimulation::setWorkSizes(const ClParticleWorkSizes& workSizes)
+{
+	const size_t previousScanWorkGroupSize = m_workSizes.scan;
+
+	m_workSizes.simulate = std::min(workSizes.simulate, m_maxWorkGroupSize);
+	m_workSizes.spawn = std::min(workSizes.spawn, m_maxWorkGroupSize);
+	m_workSizes.scan = std::min(workSizes.scan > 0 ? workSizes.scan : size_t(256), m_maxWorkGroupSize);
+	if (m_workSizes.scan == previousScanWorkGroupSize)
+	{
+		return CL_SUCCESS;
+	}
+
+	m_numScanBlocks = static_cast<cl_uint>((m_pageSize + m_workSizes.scan - 1) / m_workSizes.scan);
+	for (ClParticlePage& page : m_pages)
+	{
+		cl_int code = setPageWorkSizes(page);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+cl_int ClParticleSimulation::setPageWorkSizes(ClParticlePage& page)
+{
+	if (page.blockCountsBuffer != nullptr)
+	{
+		clReleaseMemObject(page.blockCountsBuffer);
+		page.blockCountsBuffer = nullptr;
+	}
+
+	cl_int code;
+	page.blockCountsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_numScanBlocks * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	const size_t scratchSize = m_workSizes.scan * sizeof(cl_uint);
+
+	code = clSetKernelArg(page.countAliveParticlesKernel, 1, sizeof(cl_mem), &page.blockCountsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(page.countAliveParticlesKernel, 3, scratchSize, nullptr);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(page.scanBlockCountsKernel, 0, sizeof(cl_mem), &page.blockCountsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(page.scanBlockCountsKernel, 1, sizeof(cl_uint), &m_numScanBlocks);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(page.scanBlockCountsKernel, 4, scratchSize, nullptr);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(page.compactAliveParticlesKernel, 1, sizeof(cl_mem), &page.blockCountsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(page.compactAliveParticlesKernel, 11, scratchSize, nullptr);
+	return code;
+}
+
+cl_int ClParticleSimulation::allocatePage()
+{
+	const cl_uint pageIndex = static_cast<cl_uint>(m_pages.size());
+	const cl_uint pageSizeArg = static_cast<cl_uint>(m_pageSize);
+
+	m_pages.emplace_back();
+	ClParticlePage& page = m_pages.back();
+
+	auto createPage = [&]() -> cl_int
+	{
+		cl_int code;
+		page.positionBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * 3 * sizeof(cl_float), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.velocityBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * 3 * sizeof(cl_float), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.spawnTimeBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * sizeof(cl_float), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.isAliveBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * sizeof(cl_uchar), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.spawnIdBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * sizeof(cl_uint), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.aliveIndicesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * sizeof(cl_uint), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.freeIndicesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_pageSize * sizeof(cl_uint), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		page.freeCountBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_int), nullptr, &code);
+		RETURN_ON_ERROR(code);
+
+		page.initParticleStateKernel = clCreateKernel(m_program, "initParticleState", &code);
+		RETURN_ON_ERROR(code);
+		page.spawnParticleKernel = clCreateKernel(m_program, "spawnParticle", &code);
+		RETURN_ON_ERROR(code);
+		page.simulateParticlesKernel = clCreateKernel(m_program, "simulateParticles", &code);
+		RETURN_ON_ERROR(code);
+		page.countAliveParticlesKernel = clCreateKernel(m_program, "countAliveParticles", &code);
+		RETURN_ON_ERROR(code);
+		page.scanBlockCountsKernel = clCreateKernel(m_program, "scanBlockCounts", &code);
+		RETURN_ON_ERROR(code);
+		page.compactAliveParticlesKernel = clCreateKernel(m_program, "compactAliveParticles", &code);
+		RETURN_ON_ERROR(code);
+
+		for (cl_kernel kernel : { page.initParticleStateKernel, page.spawnParticleKernel, page.simulateParticlesKernel })
+		{
+			code = setKernelBufferArgs(kernel, 0, { page.positionBuffer, page.velocityBuffer, page.spawnTimeBuffer, page.isAliveBuffer, page.spawnIdBuffer });
+			RETURN_ON_ERROR(code);
+		}
+		code = setKernelBufferArgs(page.initParticleStateKernel, NUM_PARTICLE_STATE_BUFFERS, { page.freeIndicesBuffer, page.freeCountBuffer });
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS, { page.freeIndicesBuffer, page.freeCountBuffer });
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS, { page.aliveIndicesBuffer, m_pageAliveCountsBuffer });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 2, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 3, { page.freeIndicesBuffer, page.freeCountBuffer });
+		RETURN_ON_ERROR(code);
+
+		code = clSetKernelArg(page.countAliveParticlesKernel, 0, sizeof(cl_mem), &page.isAliveBuffer);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.countAliveParticlesKernel, 2, sizeof(cl_uint), &pageSizeArg);
+		RETURN_ON_ERROR(code);
+
+		code = clSetKernelArg(page.scanBlockCountsKernel, 2, sizeof(cl_mem), &m_pageAliveCountsBuffer);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.scanBlockCountsKernel, 3, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+
+		// arguments 7 to 9 are the render positions, their time offset and capacity, set by enqueueCompaction
+		code = setKernelBufferArgs(page.compactAliveParticlesKernel, 0, { page.isAliveBuffer });
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(page.compactAliveParticlesKernel, 2, { page.aliveIndicesBuffer, page.positionBuffer, page.velocityBuffer, m_pageOffsetsBuffer });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.compactAliveParticlesKernel, 6, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.compactAliveParticlesKernel, 10, sizeof(cl_uint), &pageSizeArg);
+		RETURN_ON_ERROR(code);
+
+		code = setPageWorkSizes(page);
+		RETURN_ON_ERROR(code);
+
+		// init particle state, the in-order queue runs it before any other kernel of the page
+		size_t globalWorkSize[] = { m_pageSize };
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.initParticleStateKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+		RETURN_ON_ERROR(code);
+
+		return clEnqueueWriteBuffer(m_commandQueue, m_pageAliveCountsBuffer, CL_FALSE, pageIndex * sizeof(cl_uint), sizeof(cl_uint), &ZERO_COUNT, 0, nullptr, nullptr);
+	};
+
+	cl_int code = createPage();
+	if (code != CL_SUCCESS)
+	{
+		releasePage(page);
+		m_pages.pop_back();
+		return code;
+	}
+
+	if (m_pageSpawnTotals.size() < m_pages.size())
+	{
+		m_pageSpawnTotals.resize(m_pages.size(), 0);
+	}
+	return CL_SUCCESS;
+}
+
+void ClParticleSimulation::releasePage(ClParticlePage& page)
+{
+	// commands already queued on the page keep its buffers and kernels alive until they complete
+	for (cl_mem* buffer : { &page.positionBuffer, &page.velocityBuffer, &page.spawnTimeBuffer, &page.isAliveBuffer, &page.spawnIdBuffer,
+		&page.aliveIndicesBuffer, &page.blockCountsBuffer, &page.freeIndicesBuffer, &page.freeCountBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+
+	for (cl_kernel* kernel : { &page.initParticleStateKernel, &page.spawnParticleKernel, &page.simulateParticlesKernel,
+		&page.countAliveParticlesKernel, &page.scanBlockCountsKernel, &page.compactAliveParticlesKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
+
+cl_int ClParticleSimulation::updatePages()
+{
+	// readbacks complete in queue order, stop at the first one still running
+	while (!m_pendingReadbacks.empty())
+	{
+		PageCountReadback& readback = m_pendingReadbacks.front();
+
+		cl_int status = CL_QUEUED;
+		cl_int code = clGetEventInfo(readback.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+		RETURN_ON_ERROR(code);
+		if (status < 0)
+		{
+			return status;
+		}
+		if (status != CL_COMPLETE)
+		{
+			break;
+		}
+
+		// pages allocated after the readback was queued keep counting their spawns
+		const size_t numPages = std::min(m_pages.size(), readback.pageAliveCounts.size());
+		for (size_t i = 0; i < numPages; ++i)
+		{
+			const uint64_t spawnedSince = m_pageSpawnTotals[i] - readback.pageSpawnTotals[i];
+			m_pages[i].aliveCountUpperBound = static_cast<cl_uint>(std::min<uint64_t>(readback.pageAliveCounts[i] + spawnedSince, m_pageSize));
+		}
+
+		clReleaseEvent(readback.event);
+		m_pendingReadbacks.pop_front();
+	}
+
+	// spawns fill the lowest pages first so the top ones drain, one empty page is kept above the last used one
+	// to avoid reallocating it every frame
+	while (!m_pages.empty()
+		&& m_pages.back().aliveCountUpperBound == 0
+		&& (m_pages.size() == 1 || m_pages[m_pages.size() - 2].aliveCountUpperBound == 0))
+	{
+		releasePage(m_pages.back());
+		m_pages.pop_back();
+	}
+
+	return CL_SUCCESS;
+}
+
+size_t ClParticleSimulation::getAliveCountUpperBound() const
+{
+	size_t aliveCountUpperBound = 0;
+	for (const ClParticlePage& page : m_pages)
+	{
+		aliveCountUpperBound += page.aliveCountUpperBound;
+	}
+	return aliveCountUpperBound;
+}
+
+cl_int ClParticleSimulation::enqueueSubstep(cl_uint seed, cl_uint step, cl_float currentTime, cl_float deltaTime,
+	cl_uint numParticlesToSpawn, std::vector<ClProfilingEvent>* profilingEvents)
+{
+	cl_int code = updatePages();
+	RETURN_ON_ERROR(code);
+
+	// simulate the previous alive lists first so that dead particles' slots can be reused right away,
+	// particles spawned below get their first update next substep
+	for (ClParticlePage& page : m_pages)
+	{
+		if (page.aliveCountUpperBound == 0)
+		{
+			continue;
+		}
+
+		size_t aliveGlobalWorkSize[] = { roundUpWorkSize(page.aliveCountUpperBound, m_workSizes.simulate) };
+		size_t aliveLocalWorkSize[] = { m_workSizes.simulate };
+
+		code = clSetKernelArg(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 5, sizeof(cl_uint), &seed);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 6, sizeof(cl_uint), &step);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 7, sizeof(cl_float), &currentTime);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.simulateParticlesKernel, NUM_PARTICLE_STATE_BUFFERS + 8, sizeof(cl_float), &deltaTime);
+		RETURN_ON_ERROR(code);
+		if (m_forceFields.getNumFields() > 0)
+		{
+			// set every launch, a field's image is only created once it is set
+			code = m_forceFields.setKernelArgs(page.simulateParticlesKernel, FORCE_FIELD_ARG);
+			RETURN_ON_ERROR(code);
+		}
+
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.simulateParticlesKernel, 1, nullptr, aliveGlobalWorkSize, m_workSizes.simulate > 0 ? aliveLocalWorkSize : nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/simulateParticles"));
+		RETURN_ON_ERROR(code);
+	}
+
+	// spawn new particles, one work-item per particle to spawn, never more than a page surely has free
+	// deaths only free slots once a readback saw them, so a page may be added while lower ones have room
+	// spawn ids follow the pages in order, those of dropped spawns are skipped
+	cl_uint numParticlesLeftToSpawn = numParticlesToSpawn;
+	cl_uint firstSpawnId = m_nextSpawnId;
+	m_nextSpawnId += numParticlesToSpawn;
+	for (size_t i = 0; numParticlesLeftToSpawn > 0; ++i)
+	{
+		if (i == m_pages.size())
+		{
+			if (m_pages.size() == m_maxNumPages)
+			{
+				break;
+			}
+			code = allocatePage();
+			RETURN_ON_ERROR(code);
+		}
+
+		ClParticlePage& page = m_pages[i];
+		const cl_uint numPageParticlesToSpawn = static_cast<cl_uint>(std::min<size_t>(numParticlesLeftToSpawn, m_pageSize - page.aliveCountUpperBound));
+		if (numPageParticlesToSpawn == 0)
+		{
+			continue;
+		}
+
+		size_t spawnGlobalWorkSize[] = { roundUpWorkSize(numPageParticlesToSpawn, m_workSizes.spawn) };
+		size_t spawnLocalWorkSize[] = { m_workSizes.spawn };
+
+		code = clSetKernelArg(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS + 2, sizeof(cl_uint), &seed);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS + 3, sizeof(cl_uint), &step);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS + 4, sizeof(cl_float), &currentTime);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS + 5, sizeof(cl_uint), &numPageParticlesToSpawn);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.spawnParticleKernel, NUM_PARTICLE_STATE_BUFFERS + 6, sizeof(cl_uint), &firstSpawnId);
+		RETURN_ON_ERROR(code);
+
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.spawnParticleKernel, 1, nullptr, spawnGlobalWorkSize, m_workSizes.spawn > 0 ? spawnLocalWorkSize : nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/spawnParticle"));
+		RETURN_ON_ERROR(code);
+
+		page.aliveCountUpperBound += numPageParticlesToSpawn;
+		m_pageSpawnTotals[i] += numPageParticlesToSpawn;
+		numParticlesLeftToSpawn -= numPageParticlesToSpawn;
+		firstSpawnId += numPageParticlesToSpawn;
+	}
+
+	return CL_SUCCESS;
+}
+
+cl_int ClParticleSimulation::enqueueCompaction(cl_mem renderPositions, size_t renderCapacity, cl_float renderTimeOffset,
+	std::vector<ClProfilingEvent>* profilingEvents)
+{
+	size_t scanGlobalWorkSize[] = { m_numScanBlocks * m_workSizes.scan };
+	size_t scanLocalWorkSize[] = { m_workSizes.scan };
+	const cl_uint numPages = static_cast<cl_uint>(m_pages.size());
+	const cl_uint renderCapacityArg = static_cast<cl_uint>(std::min<size_t>(renderCapacity, UINT_MAX));
+
+	cl_int code;
+	for (ClParticlePage& page : m_pages)
+	{
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.countAliveParticlesKernel, 1, nullptr, scanGlobalWorkSize, scanLocalWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/countAliveParticles"));
+		RETURN_ON_ERROR(code);
+
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.scanBlockCountsKernel, 1, nullptr, scanLocalWorkSize, scanLocalWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/scanBlockCounts"));
+		RETURN_ON_ERROR(code);
+	}
+
+	// also runs without pages so that the alive count drops to zero
+	size_t singleWorkSize[] = { 1 };
+	code = clSetKernelArg(m_scanPageAliveCountsKernel, 1, sizeof(cl_uint), &numPages);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scanPageAliveCountsKernel, 3, sizeof(cl_uint), &renderCapacityArg);
+	RETURN_ON_ERROR(code);
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_scanPageAliveCountsKernel, 1, nullptr, singleWorkSize, singleWorkSize, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/scanPageAliveCounts"));
+	RETURN_ON_ERROR(code);
+
+	for (ClParticlePage& page : m_pages)
+	{
+		code = clSetKernelArg(page.compactAliveParticlesKernel, 7, sizeof(cl_mem), &renderPositions);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.compactAliveParticlesKernel, 8, sizeof(cl_float), &renderTimeOffset);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(page.compactAliveParticlesKernel, 9, sizeof(cl_uint), &renderCapacityArg);
+		RETURN_ON_ERROR(code);
+
+		code = clEnqueueNDRangeKernel(m_commandQueue, page.compactAliveParticlesKernel, 1, nullptr, scanGlobalWorkSize, scanLocalWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/compactAliveParticles"));
+		RETURN_ON_ERROR(code);
+	}
+
+	if (m_pages.empty())
+	{
+		return CL_SUCCESS;
+	}
+
+	// the page alive counts come back a few frames later to tighten the upper bounds, see updatePages
+	m_pendingReadbacks.emplace_back();
+	PageCountReadback& readback = m_pendingReadbacks.back();
+	readback.pageAliveCounts.resize(m_pages.size());
+	readback.pageSpawnTotals.assign(m_pageSpawnTotals.begin(), m_pageSpawnTotals.begin() + m_pages.size());
+
+	code = clEnqueueReadBuffer(m_commandQueue, m_pageAliveCountsBuffer, CL_FALSE, 0, m_pages.size() * sizeof(cl_uint), readback.pageAliveCounts.data(),
+		0, nullptr, &readback.event);
+	if (code != CL_SUCCESS)
+	{
+		m_pendingReadbacks.pop_back();
+	}
+	return code;
+}
+
+void ClParticleSimulation::release()
+{
+	// the readbacks write into host memory owned by this object
+	for (PageCountReadback& readback : m_pendingReadbacks)
+	{
+		clWaitForEvents(1, &readback.event);
+		clReleaseEvent(readback.event);
+	}
+	m_pendingReadbacks.clear();
+
+	for (ClParticlePage& page : m_pages)
+	{
+		releasePage(page);
+	}
+	m_pages.clear();
+	m_pageSpawnTotals.clear();
+	m_forceFields.release();
+
+	for (cl_mem* buffer : { &m_pageAliveCountsBuffer, &m_pageOffsetsBuffer, &m_aliveCountBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+
+	if (m_scanPageAliveCountsKernel != nullptr)
+	{
+		clReleaseKernel(m_scanPageAliveCountsKernel);
+		m_scanPageAliveCountsKernel = nullptr;
+	}
+
+	if (m_program != nullptr)
+	{
+		clReleaseProgram(m_program);
+		m_program = nullptr;
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClForceFields.h"
+#include "ClProfiling.h"
+
+// local work sizes of the particle kernels
+// 0 lets the driver choose, except for the three compaction kernels which share an explicit size (256 or less by default)
+struct ClParticleWorkSizes
+{
+	size_t simulate = 0;
+	size_t spawn = 0;
+	size_t scan = 0;
+};
+
+// one page of particle storage, allocated on demand, see ClParticleSimulation
+struct ClParticlePage
+{
+	// structure of arrays, kernel arguments 0 to 4 of every particle kernel
+	cl_mem positionBuffer = nullptr;
+	cl_mem velocityBuffer = nullptr;
+	cl_mem spawnTimeBuffer = nullptr;
+	cl_mem isAliveBuffer = nullptr;
+	// the ordinal of each particle's spawn, which keys its random numbers
+	cl_mem spawnIdBuffer = nullptr;
+
+	// alive list, rebuilt every frame so that update, death and draw only touch alive particles
+	cl_mem aliveIndicesBuffer = nullptr;
+	cl_mem blockCountsBuffer = nullptr;
+
+	// stack of dead particle indices, pushed by simulateParticles and popped by spawnParticle
+	cl_mem freeIndicesBuffer = nullptr;
+	cl_mem freeCountBuffer = nullptr;
+
+	// kernels are created per page so that buffer arguments are only set once
+	cl_kernel initParticleStateKernel = nullptr;
+	cl_kernel spawnParticleKernel = nullptr;
+	cl_kernel simulateParticlesKernel = nullptr;
+	cl_kernel countAliveParticlesKernel = nullptr;
+	cl_kernel scanBlockCountsKernel = nullptr;
+	cl_kernel compactAliveParticlesKernel = nullptr;
+
+	// at least the alive count of the page, from the last completed readback plus what was spawned since
+	cl_uint aliveCountUpperBound = 0;
+};
+
+// device-side particle state and the kernels of cl/particle.cl, no window or GL involved
+// a frame is any number of substeps followed by a rebuild of the alive list,
+// which also gathers the positions to draw into a buffer owned by the caller
+// particles live in pages of a fixed size: pages are allocated when spawns do not fit in the free slots of
+// the existing ones and the trailing empty pages are released, so the capacity follows the alive count and can
+// exceed CL_DEVICE_MAX_MEM_ALLOC_SIZE
+// the render positions are not paged: they are one buffer of the caller, drawn as one range, so
+// CL_DEVICE_MAX_MEM_ALLOC_SIZE still caps how many particles are gathered and drawn, the others are simulated only
+class ClParticleSimulation
+{
+public:
+	ClParticleSimulation(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClParticleSimulation();
+
+	ClParticleSimulation(const ClParticleSimulation&) = delete;
+	ClParticleSimulation& operator=(const ClParticleSimulation&) = delete;
+
+	// creates the kernels and the page tables, no page is allocated until particles are spawned
+	// maxNumParticles is rounded up to a whole number of pages, returns the first error
+	cl_int create(cl_program program, size_t maxNumParticles, const ClParticleWorkSizes& workSizes = ClParticleWorkSizes(),
+		size_t pageSize = DEFAULT_PAGE_SIZE);
+
+	// sizes are clamped to what every kernel supports
+	cl_int setWorkSizes(const ClParticleWorkSizes& workSizes);
+	const ClParticleWorkSizes& getWorkSizes() const { return m_workSizes; }
+	// the smallest CL_KERNEL_WORK_GROUP_SIZE and the CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE of simulateParticles
+	size_t getMaxWorkGroupSize() const { return m_maxWorkGroupSize; }
+	size_t getPreferredWorkGroupSizeMultiple() const { return m_preferredWorkGroupSizeMultiple; }
+
+	// simulates the alive lists then spawns numParticlesToSpawn particles, first in the lowest pages
+	// OpenCL 1.2 has no indirect dispatch: simulateParticles is launched over the upper bound of each page's alive count,
+	// kept from readbacks of the page alive counts queued by enqueueCompaction, and clamps against the count itself
+	// spawns that do not fit in maxNumParticles are dropped
+	// random numbers are keyed on seed, the same for a whole run, step, the index of the substep, and the spawn id of the
+	// particle: the ordinal of its spawn among those requested since create, dropped ones included, so that they do not
+	// depend on which free slot a particle got; two runs draw the same numbers as long as no spawn is dropped
+	cl_int enqueueSubstep(cl_uint seed, cl_uint step, cl_float currentTime, cl_float deltaTime,
+		cl_uint numParticlesToSpawn, std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	// rebuilds the alive lists and writes the alive positions, moved by renderTimeOffset seconds of velocity,
+	// densely packed into the first renderCapacity positions of renderPositions
+	// a renderCapacity of 0 only rebuilds the alive lists, renderPositions may then be nullptr
+	cl_int enqueueCompaction(cl_mem renderPositions, size_t renderCapacity, cl_float renderTimeOffset,
+		std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	size_t getMaxNumParticles() const { return m_maxNumPages * m_pageSize; }
+	size_t getPageSize() const { return m_pageSize; }
+	size_t getNumPages() const { return m_pages.size(); }
+	// particles that fit in the allocated pages
+	size_t getCapacity() const { return m_pages.size() * m_pageSize; }
+	// particles the pages may hold at most, from the last readbacks and the spawns since
+	size_t getAliveCountUpperBound() const;
+	size_t getScanWorkGroupSize() const { return m_workSizes.scan; }
+	// two cl_uint written by the last compaction: the number of render positions written, then the alive count
+	cl_mem getAliveCountBuffer() const { return m_aliveCountBuffer; }
+	// for kernels reading the particles of other programs, the alive lists and offsets are those of the last compaction
+	const ClParticlePage& getPage(size_t index) const { return m_pages[index]; }
+	cl_mem getPageAliveCountsBuffer() const { return m_pageAliveCountsBuffer; }
+	cl_mem getPageOffsetsBuffer() const { return m_pageOffsetsBuffer; }
+	// one field per index used by the ForceField modifiers the program was built with, all pushing nothing after create
+	ClForceFields& getForceFields() { return m_forceFields; }
+
+	// releases the pages, buffers and kernels, also done by the destructor
+	void release();
+
+	// 256K particles, 10.5 MB of particle state and lists per page
+	static constexpr size_t DEFAULT_PAGE_SIZE = 1 << 18;
+
+private:
+	// a non-blocking read of the page alive counts, with the spawn totals of every page when it was queued
+	struct PageCountReadback
+	{
+		std::vector<uint32_t> pageAliveCounts;
+		std::vector<uint64_t> pageSpawnTotals;
+		cl_event event = nullptr;
+	};
+
+	cl_int allocatePage();
+	cl_int setPageWorkSizes(ClParticlePage& page);
+	void releasePage(ClParticlePage& page);
+	// applies the completed readbacks to the page upper bounds then releases the trailing empty pages
+	cl_int updatePages();
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+	cl_program m_program;
+
+	size_t m_pageSize;
+	size_t m_maxNumPages;
+	ClParticleWorkSizes m_workSizes;
+	size_t m_maxWorkGroupSize;
+	size_t m_preferredWorkGroupSizeMultiple;
+	cl_uint m_numScanBlocks;
+
+	std::vector<ClParticlePage> m_pages;
+	// particles ever spawned in each page index, never reset so that late readbacks stay correct
+	std::vector<uint64_t> m_pageSpawnTotals;
+	// spawn id of the next particle to spawn
+	cl_uint m_nextSpawnId;
+	std::deque<PageCountReadback> m_pendingReadbacks;
+
+	// one entry per page index up to m_maxNumPages
+	cl_mem m_pageAliveCountsBuffer;
+	cl_mem m_pageOffsetsBuffer;
+	cl_mem m_aliveCountBuffer;
+
+	cl_kernel m_scanPageAliveCountsKernel;
+
+	ClForceFields m_forceFields;
+};
@@ -0,0 +1,81 @@
+#include "ClProfiling.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "engine/PhaseTimings.h"
+
+cl_event* getProfilingEvent(std::vector<ClProfilingEvent>* profilingEvents, const char* phase)
+{
+	if (profilingEvents == nullptr)
+	{
+		return nullptr;
+	}
+
+	profilingEvents->push_back({ phase, nullptr });
+	return &profilingEvents->back().event;
+}
+
+void addProfilingSamples(std::vector<ClProfilingEvent>& profilingEvents, PhaseTimings& timings, const char* framePhase,
+	const std::string& phasePrefix)
+{
+	// substeps launch the same kernels several times, one sample per phase and per frame
+	std::vector<std::pair<std::string, double>> frameTimes;
+	cl_ulong frameStart = CL_ULONG_MAX;
+	cl_ulong frameEnd = 0;
+	for (ClProfilingEvent& profilingEvent : profilingEvents)
+	{
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+		clGetEventProfilingInfo(profilingEvent.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+		clGetEventProfilingInfo(profilingEvent.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+		clReleaseEvent(profilingEvent.event);
+
+		frameStart = std::min(frameStart, start);
+		frameEnd = std::max(frameEnd, end);
+
+		auto it = std::find_if(frameTimes.begin(), frameTimes.end(),
+			[&profilingEvent](const std::pair<std::string, double>& frameTime) { return frameTime.first == profilingEvent.phase; });
+		if (it == frameTimes.end())
+		{
+			it = frameTimes.insert(frameTimes.end(), { profilingEvent.phase, 0.0 });
+		}
+		it->second += static_cast<double>(end - start) * 1e-6;
+	}
+	profilingEvents.clear();
+
+	for (const std::pair<std::string, double>& frameTime : frameTimes)
+	{
+		timings.addSample(phasePrefix + frameTime.first, frameTime.second);
+	}
+
+	// includes the idle gaps between commands
+	if (framePhase != nullptr && frameEnd > frameStart)
+	{
+		timings.addSample(phasePrefix + framePhase, static_cast<double>(frameEnd - frameStart) * 1e-6);
+	}
+}
+
+double getProfilingEventsMs(const std::vector<ClProfilingEvent>& profilingEvents)
+{
+	cl_ulong totalTime = 0;
+	for (const ClProfilingEvent& profilingEvent : profilingEvents)
+	{
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+		clGetEventProfilingInfo(profilingEvent.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+		clGetEventProfilingInfo(profilingEvent.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+		totalTime += end > start ? end - start : 0;
+	}
+	return static_cast<double>(totalTime) * 1e-6;
+}
+
+void releaseProfilingEvents(std::vector<ClProfilingEvent>& profilingEvents)
+{
+	for (ClProfilingEvent& profilingEvent : profilingEvents)
+	{
+		clReleaseEvent(profilingEvent.event);
+	}
+	profilingEvents.clear();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+class PhaseTimings;
+
+// an OpenCL command timed with CL_QUEUE_PROFILING_ENABLE
+struct ClProfilingEvent
+{
+	const char* phase;
+	cl_event event;
+};
+
+// returns where to store the event of the command being enqueued, nullptr when profilingEvents is nullptr
+cl_event* getProfilingEvent(std::vector<ClProfilingEvent>* profilingEvents, const char* phase);
+
+// adds the durations of completed commands, summed per phase, and releases their events
+// also adds framePhase, from the first start to the last end, if not nullptr
+// phasePrefix is prepended to every phase, to tell devices apart
+void addProfilingSamples(std::vector<ClProfilingEvent>& profilingEvents, PhaseTimings& timings, const char* framePhase,
+	const std::string& phasePrefix = std::string());
+
+// sum of the durations of completed commands in milliseconds, the events are kept
+double getProfilingEventsMs(const std::vector<ClProfilingEvent>& profilingEvents);
+
+// releases the events without reading them
+void releaseProfilingEvents(std::vector<ClProfilingEvent>& profilingEvents);
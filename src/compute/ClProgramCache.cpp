@@ -0,0 +1,161 @@
+#include "ClProgramCache.h"
+
+#include <iostream>
+
+#include "ClDevice.h"
+#include "engine/BinaryCache.h"
+
+ClProgramCache::ClProgramCache(cl_context context, cl_device_id deviceId, BinaryCache* binaryCache) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_binaryCache(binaryCache)
+{
+	m_deviceKey = "opencl\n" + getDeviceCacheKey(deviceId);
+}
+
+ClProgramCache::~ClProgramCache()
+{
+	for (std::pair<const std::string, cl_program>& program : m_programs)
+	{
+		clReleaseProgram(program.second);
+	}
+}
+
+cl_program ClProgramCache::getProgram(const std::vector<std::string>& sources, const std::string& options, cl_int* code, std::string* buildLog)
+{
+	// sources are separated by a character that cannot appear in OpenCL C or build options
+	std::string key = options;
+	for (const std::string& source : sources)
+	{
+		key += '\0';
+		key += source;
+	}
+
+	std::map<std::string, cl_program>::iterator it = m_programs.find(key);
+	if (it != m_programs.end())
+	{
+		*code = CL_SUCCESS;
+		return it->second;
+	}
+
+	const std::string binaryKey = m_deviceKey + key;
+	cl_program program = buildProgramFromBinary(binaryKey, options);
+	if (program == nullptr)
+	{
+		program = buildProgramFromSource(sources, options, code, buildLog);
+		if (program == nullptr)
+		{
+			return nullptr;
+		}
+		storeProgramBinary(binaryKey, program);
+	}
+
+	*code = CL_SUCCESS;
+	m_programs[key] = program;
+	return program;
+}
+
+cl_program ClProgramCache::buildProgramFromBinary(const std::string& binaryKey, const std::string& options)
+{
+	std::vector<unsigned char> binary;
+	if (m_binaryCache == nullptr || !m_binaryCache->load(binaryKey, binary))
+	{
+		return nullptr;
+	}
+
+	const unsigned char* binaryData = binary.data();
+	const size_t binarySize = binary.size();
+	cl_int binaryStatus;
+	cl_int code;
+	cl_program program = clCreateProgramWithBinary(m_context, 1, &m_deviceId, &binarySize, &binaryData, &binaryStatus, &code);
+	if (code == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+	{
+		code = clBuildProgram(program, 1, &m_deviceId, options.c_str(), nullptr, nullptr);
+		if (code == CL_SUCCESS)
+		{
+			std::cout << "OpenCL program cache: hit" << std::endl;
+			return program;
+		}
+	}
+
+	if (program != nullptr)
+	{
+		clReleaseProgram(program);
+	}
+	std::cout << "OpenCL program cache: binary rejected by the driver, rebuilding from source" << std::endl;
+	m_binaryCache->invalidate(binaryKey);
+	return nullptr;
+}
+
+cl_program ClProgramCache::buildProgramFromSource(const std::vector<std::string>& sources, const std::string& options, cl_int* code, std::string* buildLog)
+{
+	if (m_binaryCache != nullptr && m_binaryCache->isEnabled())
+	{
+		std::cout << "OpenCL program cache: miss, building from source" << std::endl;
+	}
+
+	std::vector<const char*> sourceStrings;
+	std::vector<size_t> sourceLengths;
+	for (const std::string& source : sources)
+	{
+		sourceStrings.push_back(source.c_str());
+		sourceLengths.push_back(source.size());
+	}
+
+	cl_program program = clCreateProgramWithSource(m_context, static_cast<cl_uint>(sources.size()), sourceStrings.data(), sourceLengths.data(), code);
+	if (*code != CL_SUCCESS)
+	{
+		return nullptr;
+	}
+
+	*code = clBuildProgram(program, 1, &m_deviceId, options.c_str(), nullptr, nullptr);
+	if (*code != CL_SUCCESS)
+	{
+		if (buildLog != nullptr)
+		{
+			*buildLog = getProgramBuildLog(program, m_deviceId);
+		}
+		clReleaseProgram(program);
+		return nullptr;
+	}
+
+	return program;
+}
+
+void ClProgramCache::storeProgramBinary(const std::string& binaryKey, cl_program program)
+{
+	if (m_binaryCache == nullptr || !m_binaryCache->isEnabled())
+	{
+		return;
+	}
+
+	// the program is built for a single device
+	size_t binarySize = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, nullptr) != CL_SUCCESS || binarySize == 0)
+	{
+		return;
+	}
+
+	std::vector<unsigned char> binary(binarySize);
+	unsigned char* binaryData = binary.data();
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binaryData, nullptr) != CL_SUCCESS)
+	{
+		return;
+	}
+
+	m_binaryCache->store(binaryKey, binary);
+}
+
+std::string getProgramBuildLog(cl_program program, cl_device_id deviceId)
+{
+	size_t buildLogLength = 0;
+	if (clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, 0, nullptr, &buildLogLength) != CL_SUCCESS)
+	{
+		return "";
+	}
+
+	std::string buildLog;
+	buildLog.resize(buildLogLength);
+	clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG, buildLogLength, &buildLog[0], nullptr);
+	return buildLog;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+class BinaryCache;
+
+// built OpenCL programs keyed by their sources and build options
+// effects that share a simulation config share a single program
+// with a BinaryCache, device binaries are also persisted across runs and rebuilt from source when rejected
+class ClProgramCache
+{
+public:
+	ClProgramCache(cl_context context, cl_device_id deviceId, BinaryCache* binaryCache = nullptr);
+	~ClProgramCache();
+
+	ClProgramCache(const ClProgramCache&) = delete;
+	ClProgramCache& operator=(const ClProgramCache&) = delete;
+
+	// returns a built program owned by the cache, or nullptr with code and buildLog set on failure
+	cl_program getProgram(const std::vector<std::string>& sources, const std::string& options, cl_int* code, std::string* buildLog);
+
+	size_t getNumPrograms() const { return m_programs.size(); }
+
+private:
+	cl_program buildProgramFromBinary(const std::string& binaryKey, const std::string& options);
+	cl_program buildProgramFromSource(const std::vector<std::string>& sources, const std::string& options, cl_int* code, std::string* buildLog);
+	void storeProgramBinary(const std::string& binaryKey, cl_program program);
+
+private:
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	BinaryCache* m_binaryCache;
+	// identifies the compiler, part of every binary cache key
+	std::string m_deviceKey;
+	std::map<std::string, cl_program> m_programs;
+};
+
+std::string getProgramBuildLog(cl_program program, cl_device_id deviceId);
@@ -0,0 +1,209 @@
+#include "ClRadixSort.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+const cl_uint RADIX = 1 << ClRadixSort::RADIX_BITS;
+}
+
+ClRadixSort::ClRadixSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	ClRadixSort(context, deviceId, commandQueue, PhaseNames())
+{
+}
+
+ClRadixSort::ClRadixSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue, const PhaseNames& phaseNames) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_phaseNames(phaseNames),
+	m_workGroupSize(0),
+	m_capacity(0),
+	m_numPasses(0),
+	m_keyBuffers{ nullptr, nullptr },
+	m_valueBuffers{ nullptr, nullptr },
+	m_blockHistogramsBuffer(nullptr),
+	m_histogramKernel(nullptr),
+	m_scanKernel(nullptr),
+	m_scatterKernel(nullptr)
+{
+}
+
+ClRadixSort::~ClRadixSort()
+{
+	release();
+}
+
+cl_int ClRadixSort::create(cl_program program)
+{
+	release();
+
+	cl_int code;
+	m_histogramKernel = clCreateKernel(program, "radixSortHistogram", &code);
+	RETURN_ON_ERROR(code);
+	m_scanKernel = clCreateKernel(program, "radixSortScan", &code);
+	RETURN_ON_ERROR(code);
+	m_scatterKernel = clCreateKernel(program, "radixSortScatter", &code);
+	RETURN_ON_ERROR(code);
+
+	// 256 like the compaction kernels, every work-group needs at least a work-item per digit
+	m_workGroupSize = 256;
+	for (cl_kernel kernel : { m_histogramKernel, m_scanKernel, m_scatterKernel })
+	{
+		size_t kernelWorkGroupSize = 0;
+		code = clGetKernelWorkGroupInfo(kernel, m_deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelWorkGroupSize, nullptr);
+		RETURN_ON_ERROR(code);
+		m_workGroupSize = std::min(m_workGroupSize, kernelWorkGroupSize);
+	}
+	if (m_workGroupSize < RADIX)
+	{
+		return CL_INVALID_WORK_GROUP_SIZE;
+	}
+
+	const size_t scratchSize = m_workGroupSize * sizeof(cl_uint);
+	code = clSetKernelArg(m_histogramKernel, 5, RADIX * sizeof(cl_uint), nullptr);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scanKernel, 2, scratchSize, nullptr);
+	RETURN_ON_ERROR(code);
+	for (cl_uint index = 8; index <= 11; ++index)
+	{
+		code = clSetKernelArg(m_scatterKernel, index, index == 10 ? RADIX * sizeof(cl_uint) : scratchSize, nullptr);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+cl_int ClRadixSort::reserve(size_t maxNumElements)
+{
+	if (maxNumElements <= m_capacity)
+	{
+		return CL_SUCCESS;
+	}
+
+	releaseBuffers();
+
+	cl_int code;
+	for (int i = 0; i < 2; ++i)
+	{
+		m_keyBuffers[i] = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumElements * sizeof(cl_uint), nullptr, &code);
+		RETURN_ON_ERROR(code);
+		m_valueBuffers[i] = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumElements * sizeof(cl_uint), nullptr, &code);
+		RETURN_ON_ERROR(code);
+	}
+
+	const size_t numBlocks = (maxNumElements + m_workGroupSize - 1) / m_workGroupSize;
+	m_blockHistogramsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, RADIX * numBlocks * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	m_capacity = maxNumElements;
+	m_numPasses = 0;
+	return CL_SUCCESS;
+}
+
+cl_int ClRadixSort::enqueueSort(size_t maxNumElements, cl_mem numElementsBuffer, cl_uint numElementsIndex, unsigned int keyBits,
+	std::vector<ClProfilingEvent>* profilingEvents)
+{
+	m_numPasses = 0;
+
+	const size_t numBlocks = (std::min(maxNumElements, m_capacity) + m_workGroupSize - 1) / m_workGroupSize;
+	if (numBlocks == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	size_t globalWorkSize[] = { numBlocks * m_workGroupSize };
+	size_t localWorkSize[] = { m_workGroupSize };
+	const cl_uint numEntries = static_cast<cl_uint>(RADIX * numBlocks);
+
+	cl_int code;
+	code = clSetKernelArg(m_histogramKernel, 1, sizeof(cl_mem), &numElementsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_histogramKernel, 2, sizeof(cl_uint), &numElementsIndex);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_histogramKernel, 4, sizeof(cl_mem), &m_blockHistogramsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scanKernel, 0, sizeof(cl_mem), &m_blockHistogramsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scanKernel, 1, sizeof(cl_uint), &numEntries);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterKernel, 4, sizeof(cl_mem), &numElementsBuffer);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterKernel, 5, sizeof(cl_uint), &numElementsIndex);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_scatterKernel, 7, sizeof(cl_mem), &m_blockHistogramsBuffer);
+	RETURN_ON_ERROR(code);
+
+	const unsigned int numPasses = (std::min(keyBits, 32u) + RADIX_BITS - 1) / RADIX_BITS;
+	for (unsigned int pass = 0; pass < numPasses; ++pass)
+	{
+		const cl_uint shift = pass * RADIX_BITS;
+		cl_mem* in = &m_keyBuffers[pass % 2];
+		cl_mem* out = &m_keyBuffers[1 - pass % 2];
+		cl_mem* valuesIn = &m_valueBuffers[pass % 2];
+		cl_mem* valuesOut = &m_valueBuffers[1 - pass % 2];
+
+		code = clSetKernelArg(m_histogramKernel, 0, sizeof(cl_mem), in);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_histogramKernel, 3, sizeof(cl_uint), &shift);
+		RETURN_ON_ERROR(code);
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_histogramKernel, 1, nullptr, globalWorkSize, localWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, m_phaseNames.histogram));
+		RETURN_ON_ERROR(code);
+
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_scanKernel, 1, nullptr, localWorkSize, localWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, m_phaseNames.scan));
+		RETURN_ON_ERROR(code);
+
+		code = clSetKernelArg(m_scatterKernel, 0, sizeof(cl_mem), in);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_scatterKernel, 1, sizeof(cl_mem), valuesIn);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_scatterKernel, 2, sizeof(cl_mem), out);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_scatterKernel, 3, sizeof(cl_mem), valuesOut);
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_scatterKernel, 6, sizeof(cl_uint), &shift);
+		RETURN_ON_ERROR(code);
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_scatterKernel, 1, nullptr, globalWorkSize, localWorkSize, 0, nullptr,
+			getProfilingEvent(profilingEvents, m_phaseNames.scatter));
+		RETURN_ON_ERROR(code);
+
+		m_numPasses = pass + 1;
+	}
+	return CL_SUCCESS;
+}
+
+void ClRadixSort::releaseBuffers()
+{
+	for (cl_mem* buffer : { &m_keyBuffers[0], &m_keyBuffers[1], &m_valueBuffers[0], &m_valueBuffers[1], &m_blockHistogramsBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+	m_capacity = 0;
+}
+
+void ClRadixSort::release()
+{
+	releaseBuffers();
+	m_numPasses = 0;
+
+	for (cl_kernel* kernel : { &m_histogramKernel, &m_scanKernel, &m_scatterKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+
+// stable sort of uint key/value pairs by the low bits of the keys on the device, the kernels of cl/radix_sort.cl
+// the number of pairs is read on the device, from a counter such as ClParticleSimulation's alive count, so that a sort
+// can follow the kernels producing the pairs without a readback, the host only knows an upper bound
+// callers write the pairs to getKeys() and getValues() and find them sorted in getSortedKeys() and getSortedValues()
+class ClRadixSort
+{
+public:
+	// profiling phases of the three kernels, so that the sorts of different users can be told apart
+	struct PhaseNames
+	{
+		const char* histogram = "cl/radixSortHistogram";
+		const char* scan = "cl/radixSortScan";
+		const char* scatter = "cl/radixSortScatter";
+	};
+
+	ClRadixSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	ClRadixSort(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue, const PhaseNames& phaseNames);
+	~ClRadixSort();
+
+	ClRadixSort(const ClRadixSort&) = delete;
+	ClRadixSort& operator=(const ClRadixSort&) = delete;
+
+	// creates the kernels, the buffers are allocated by reserve, returns the first error
+	cl_int create(cl_program program);
+
+	// reallocates the buffers if they cannot hold maxNumElements pairs, their content is lost
+	cl_int reserve(size_t maxNumElements);
+	size_t getCapacity() const { return m_capacity; }
+
+	cl_mem getKeys() const { return m_keyBuffers[0]; }
+	cl_mem getValues() const { return m_valueBuffers[0]; }
+
+	// sorts the first numElementsBuffer[numElementsIndex] pairs, at most maxNumElements, by the low keyBits bits of their keys
+	// one pass of three kernels per 4 bits, the other bits are ignored
+	cl_int enqueueSort(size_t maxNumElements, cl_mem numElementsBuffer, cl_uint numElementsIndex, unsigned int keyBits,
+		std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	// the pairs end up in one buffer or the other depending on the number of passes of the last sort
+	cl_mem getSortedKeys() const { return m_keyBuffers[m_numPasses % 2]; }
+	cl_mem getSortedValues() const { return m_valueBuffers[m_numPasses % 2]; }
+
+	// releases the buffers and kernels, also done by the destructor
+	void release();
+
+	static constexpr unsigned int RADIX_BITS = 4;
+
+private:
+	void releaseBuffers();
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+	PhaseNames m_phaseNames;
+
+	// one work-item per pair and the same local size in every kernel
+	size_t m_workGroupSize;
+	size_t m_capacity;
+	unsigned int m_numPasses;
+
+	// pairs ping-pong between the two buffers, one pass each way
+	cl_mem m_keyBuffers[2];
+	cl_mem m_valueBuffers[2];
+	cl_mem m_blockHistogramsBuffer;
+
+	cl_kernel m_histogramKernel;
+	cl_kernel m_scanKernel;
+	cl_kernel m_scatterKernel;
+};
@@ -0,0 +1,423 @@
+#include "ClSpatialGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+#include "ClParticleSimulation.h"
+
+#define RETURN_ON_ERROR(code) \
+	if ((code) != CL_SUCCESS) \
+	{ \
+		return (code); \
+	}
+
+namespace
+{
+const size_t MIN_NUM_CELLS = 1 << 10;
+
+ClRadixSort::PhaseNames getGridSortPhaseNames()
+{
+	ClRadixSort::PhaseNames phaseNames;
+	phaseNames.histogram = "cl/gridSortHistogram";
+	phaseNames.scan = "cl/gridSortScan";
+	phaseNames.scatter = "cl/gridSortScatter";
+	return phaseNames;
+}
+
+// argument indices after SPATIAL_GRID_PARAMS, see cl/spatial_grid.cl
+const cl_uint NUM_GRID_ARGS = 6;
+const cl_uint FIRST_CELL_ARG = NUM_GRID_ARGS + 1;
+const cl_uint NUM_CELLS_ARG = NUM_GRID_ARGS + 2;
+const cl_uint SCAN_ALL_ARG = NUM_GRID_ARGS + 3;
+const cl_uint RESULTS_ARG = NUM_GRID_ARGS + 4;
+const cl_uint FIRST_QUERY_ARG = NUM_GRID_ARGS + 5;
+
+// cells past this on any axis are clamped, regions that large are scanned particle by particle anyway
+const double MAX_CELL_COORDINATE = 1 << 30;
+
+cl_int setKernelBufferArgs(cl_kernel kernel, cl_uint firstIndex, std::initializer_list<cl_mem> buffers)
+{
+	cl_uint index = firstIndex;
+	for (cl_mem buffer : buffers)
+	{
+		cl_int code = clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffer);
+		RETURN_ON_ERROR(code);
+	}
+	return CL_SUCCESS;
+}
+
+cl_uint getFloatBits(cl_float value)
+{
+	cl_uint bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+}
+
+ClSpatialQuery::~ClSpatialQuery()
+{
+	release();
+}
+
+bool ClSpatialQuery::isReady() const
+{
+	if (m_event == nullptr)
+	{
+		return false;
+	}
+
+	cl_int status = CL_QUEUED;
+	cl_int code = clGetEventInfo(m_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+	return code == CL_SUCCESS && status == CL_COMPLETE;
+}
+
+cl_int ClSpatialQuery::wait()
+{
+	return m_event != nullptr ? clWaitForEvents(1, &m_event) : CL_INVALID_EVENT;
+}
+
+float ClSpatialQuery::getNearestDistance() const
+{
+	cl_float distanceSquared;
+	memcpy(&distanceSquared, &m_result[0], sizeof(distanceSquared));
+	return std::sqrt(distanceSquared);
+}
+
+void ClSpatialQuery::release()
+{
+	if (m_event != nullptr)
+	{
+		clWaitForEvents(1, &m_event);
+		clReleaseEvent(m_event);
+		m_event = nullptr;
+	}
+}
+
+ClSpatialGrid::ClSpatialGrid(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue) :
+	m_context(context),
+	m_deviceId(deviceId),
+	m_commandQueue(commandQueue),
+	m_sort(context, deviceId, commandQueue, getGridSortPhaseNames()),
+	m_cellSize(1.f),
+	m_cellMask(0),
+	m_keyBits(0),
+	m_capacity(0),
+	m_cellStartsBuffer(nullptr),
+	m_cellEndsBuffer(nullptr),
+	m_numParticlesBuffer(nullptr),
+	m_unsortedPositionsBuffer(nullptr),
+	m_unsortedParticlesBuffer(nullptr),
+	m_gridPositionsBuffer(nullptr),
+	m_gridParticlesBuffer(nullptr),
+	m_resultsBuffer(nullptr),
+	m_clearGridCellsKernel(nullptr),
+	m_computeGridKeysKernel(nullptr),
+	m_buildGridCellsKernel(nullptr),
+	m_initGridQueryKernel(nullptr),
+	m_countGridRegionKernel(nullptr),
+	m_findGridNearestKernel(nullptr)
+{
+}
+
+ClSpatialGrid::~ClSpatialGrid()
+{
+	release();
+}
+
+cl_int ClSpatialGrid::create(cl_program program, cl_program sortProgram, cl_float cellSize, size_t maxNumParticles)
+{
+	release();
+
+	size_t numCells = MIN_NUM_CELLS;
+	m_keyBits = 10;
+	while (numCells < std::min(maxNumParticles, MAX_NUM_CELLS))
+	{
+		numCells <<= 1;
+		++m_keyBits;
+	}
+	m_cellMask = static_cast<cl_uint>(numCells - 1);
+	m_cellSize = cellSize;
+
+	cl_int code = m_sort.create(sortProgram);
+	RETURN_ON_ERROR(code);
+
+	m_clearGridCellsKernel = clCreateKernel(program, "clearGridCells", &code);
+	RETURN_ON_ERROR(code);
+	m_computeGridKeysKernel = clCreateKernel(program, "computeGridKeys", &code);
+	RETURN_ON_ERROR(code);
+	m_buildGridCellsKernel = clCreateKernel(program, "buildGridCells", &code);
+	RETURN_ON_ERROR(code);
+	m_initGridQueryKernel = clCreateKernel(program, "initGridQuery", &code);
+	RETURN_ON_ERROR(code);
+	m_countGridRegionKernel = clCreateKernel(program, "countGridRegion", &code);
+	RETURN_ON_ERROR(code);
+	m_findGridNearestKernel = clCreateKernel(program, "findGridNearest", &code);
+	RETURN_ON_ERROR(code);
+
+	m_cellStartsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, numCells * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_cellEndsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, numCells * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_numParticlesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_resultsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = setKernelBufferArgs(m_clearGridCellsKernel, 0, { m_cellStartsBuffer });
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeGridKeysKernel, 6, sizeof(cl_float), &m_cellSize);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeGridKeysKernel, 7, sizeof(cl_uint), &m_cellMask);
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_buildGridCellsKernel, 2, { m_numParticlesBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_buildGridCellsKernel, 5, { m_cellStartsBuffer, m_cellEndsBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_initGridQueryKernel, 0, { m_resultsBuffer });
+	RETURN_ON_ERROR(code);
+	for (cl_kernel kernel : { m_countGridRegionKernel, m_findGridNearestKernel })
+	{
+		code = setKernelBufferArgs(kernel, NUM_GRID_ARGS, { m_numParticlesBuffer });
+		RETURN_ON_ERROR(code);
+		code = setKernelBufferArgs(kernel, RESULTS_ARG, { m_resultsBuffer });
+		RETURN_ON_ERROR(code);
+	}
+
+	// an empty grid until the first build, so that queries can be queued right away
+	size_t globalWorkSize[] = { numCells };
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_clearGridCellsKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	const cl_uint zeroCount = 0;
+	return clEnqueueWriteBuffer(m_commandQueue, m_numParticlesBuffer, CL_TRUE, 0, sizeof(cl_uint), &zeroCount, 0, nullptr, nullptr);
+}
+
+cl_int ClSpatialGrid::reserve(size_t maxNumParticles)
+{
+	if (maxNumParticles <= m_capacity)
+	{
+		return CL_SUCCESS;
+	}
+
+	releaseBuffers();
+
+	cl_int code = m_sort.reserve(maxNumParticles);
+	RETURN_ON_ERROR(code);
+
+	m_unsortedPositionsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumParticles * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_unsortedParticlesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumParticles * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_gridPositionsBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumParticles * 3 * sizeof(cl_float), nullptr, &code);
+	RETURN_ON_ERROR(code);
+	m_gridParticlesBuffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, maxNumParticles * sizeof(cl_uint), nullptr, &code);
+	RETURN_ON_ERROR(code);
+
+	code = setKernelBufferArgs(m_computeGridKeysKernel, 8, { m_sort.getKeys(), m_sort.getValues(), m_unsortedPositionsBuffer, m_unsortedParticlesBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_buildGridCellsKernel, 3, { m_unsortedPositionsBuffer, m_unsortedParticlesBuffer });
+	RETURN_ON_ERROR(code);
+	code = setKernelBufferArgs(m_buildGridCellsKernel, 7, { m_gridPositionsBuffer, m_gridParticlesBuffer });
+	RETURN_ON_ERROR(code);
+	for (cl_kernel kernel : { m_countGridRegionKernel, m_findGridNearestKernel })
+	{
+		code = setGridArgs(kernel, 0);
+		RETURN_ON_ERROR(code);
+	}
+
+	m_capacity = maxNumParticles;
+	return CL_SUCCESS;
+}
+
+cl_int ClSpatialGrid::enqueueBuild(const ClParticleSimulation& simulation, std::vector<ClProfilingEvent>* profilingEvents)
+{
+	// the buffers grow with the pages of the simulation, the grid holds every particle they can hold
+	cl_int code = reserve(simulation.getCapacity());
+	RETURN_ON_ERROR(code);
+
+	// the sort and cell bounds read the alive count of the compaction on the device
+	code = clEnqueueCopyBuffer(m_commandQueue, simulation.getAliveCountBuffer(), m_numParticlesBuffer, sizeof(cl_uint), 0, sizeof(cl_uint), 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/copyGridCount"));
+	RETURN_ON_ERROR(code);
+
+	size_t cellsGlobalWorkSize[] = { getNumCells() };
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_clearGridCellsKernel, 1, nullptr, cellsGlobalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/clearGridCells"));
+	RETURN_ON_ERROR(code);
+
+	const cl_uint pageSize = static_cast<cl_uint>(simulation.getPageSize());
+	code = setKernelBufferArgs(m_computeGridKeysKernel, 2, { simulation.getPageAliveCountsBuffer(), simulation.getPageOffsetsBuffer() });
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_computeGridKeysKernel, 5, sizeof(cl_uint), &pageSize);
+	RETURN_ON_ERROR(code);
+	for (size_t i = 0; i < simulation.getNumPages(); ++i)
+	{
+		const ClParticlePage& page = simulation.getPage(i);
+		if (page.aliveCountUpperBound == 0)
+		{
+			continue;
+		}
+
+		const cl_uint pageIndex = static_cast<cl_uint>(i);
+		code = setKernelBufferArgs(m_computeGridKeysKernel, 0, { page.positionBuffer, page.aliveIndicesBuffer });
+		RETURN_ON_ERROR(code);
+		code = clSetKernelArg(m_computeGridKeysKernel, 4, sizeof(cl_uint), &pageIndex);
+		RETURN_ON_ERROR(code);
+
+		size_t globalWorkSize[] = { page.aliveCountUpperBound };
+		code = clEnqueueNDRangeKernel(m_commandQueue, m_computeGridKeysKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr,
+			getProfilingEvent(profilingEvents, "cl/computeGridKeys"));
+		RETURN_ON_ERROR(code);
+	}
+
+	if (m_capacity == 0)
+	{
+		return CL_SUCCESS;
+	}
+
+	code = m_sort.enqueueSort(m_capacity, m_numParticlesBuffer, 0, m_keyBits, profilingEvents);
+	RETURN_ON_ERROR(code);
+
+	code = setKernelBufferArgs(m_buildGridCellsKernel, 0, { m_sort.getSortedKeys(), m_sort.getSortedValues() });
+	RETURN_ON_ERROR(code);
+	size_t globalWorkSize[] = { m_capacity };
+	return clEnqueueNDRangeKernel(m_commandQueue, m_buildGridCellsKernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr,
+		getProfilingEvent(profilingEvents, "cl/buildGridCells"));
+}
+
+cl_int ClSpatialGrid::enqueueCountInBox(const cl_float3& boxMin, const cl_float3& boxMax, ClSpatialQuery& query)
+{
+	cl_float4 sphere = { { 0.f, 0.f, 0.f, -1.f } };
+	cl_int code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG, sizeof(cl_float4), &boxMin);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG + 1, sizeof(cl_float4), &boxMax);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG + 2, sizeof(cl_float4), &sphere);
+	RETURN_ON_ERROR(code);
+	return enqueueQuery(m_countGridRegionKernel, 1, 0, 0, 0, boxMin, boxMax, query);
+}
+
+cl_int ClSpatialGrid::enqueueCountInSphere(const cl_float3& center, cl_float radius, ClSpatialQuery& query)
+{
+	cl_float4 boxMin = { { center.s[0] - radius, center.s[1] - radius, center.s[2] - radius, 0.f } };
+	cl_float4 boxMax = { { center.s[0] + radius, center.s[1] + radius, center.s[2] + radius, 0.f } };
+	cl_float4 sphere = { { center.s[0], center.s[1], center.s[2], radius } };
+	cl_int code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG, sizeof(cl_float4), &boxMin);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG + 1, sizeof(cl_float4), &boxMax);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_countGridRegionKernel, FIRST_QUERY_ARG + 2, sizeof(cl_float4), &sphere);
+	RETURN_ON_ERROR(code);
+	return enqueueQuery(m_countGridRegionKernel, 1, 0, 0, 0, boxMin, boxMax, query);
+}
+
+cl_int ClSpatialGrid::enqueueFindNearest(const cl_float3& point, cl_float maxDistance, ClSpatialQuery& query)
+{
+	cl_float4 boxMin = { { point.s[0] - maxDistance, point.s[1] - maxDistance, point.s[2] - maxDistance, 0.f } };
+	cl_float4 boxMax = { { point.s[0] + maxDistance, point.s[1] + maxDistance, point.s[2] + maxDistance, 0.f } };
+	cl_int code = clSetKernelArg(m_findGridNearestKernel, FIRST_QUERY_ARG, sizeof(cl_float4), &point);
+	RETURN_ON_ERROR(code);
+	return enqueueQuery(m_findGridNearestKernel, 2, FIRST_QUERY_ARG + 1, getFloatBits(maxDistance * maxDistance), ClSpatialQuery::NO_PARTICLE,
+		boxMin, boxMax, query);
+}
+
+cl_int ClSpatialGrid::enqueueQuery(cl_kernel kernel, cl_uint numPasses, cl_uint passArgIndex, cl_uint initialValue0, cl_uint initialValue1,
+	const cl_float3& boxMin, const cl_float3& boxMax, ClSpatialQuery& query)
+{
+	query.release();
+
+	// one work-item per cell of the box, or per particle if the box has more cells than the grid has room for particles
+	cl_int4 firstCell = { { 0, 0, 0, 0 } };
+	cl_int4 numCells = { { 0, 0, 0, 0 } };
+	double numRegionCells = 1.0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const double first = std::max(std::floor(static_cast<double>(boxMin.s[axis]) / m_cellSize), -MAX_CELL_COORDINATE);
+		const double last = std::min(std::floor(static_cast<double>(boxMax.s[axis]) / m_cellSize), MAX_CELL_COORDINATE);
+		firstCell.s[axis] = static_cast<cl_int>(first);
+		numCells.s[axis] = static_cast<cl_int>(std::max(last - first + 1.0, 0.0));
+		numRegionCells *= numCells.s[axis];
+	}
+	const cl_uint scanAll = numRegionCells > m_capacity ? 1 : 0;
+	const size_t numWorkItems = scanAll ? m_capacity : static_cast<size_t>(numRegionCells);
+
+	cl_int code;
+	code = clSetKernelArg(m_initGridQueryKernel, 1, sizeof(cl_uint), &initialValue0);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(m_initGridQueryKernel, 2, sizeof(cl_uint), &initialValue1);
+	RETURN_ON_ERROR(code);
+	size_t singleWorkSize[] = { 1 };
+	code = clEnqueueNDRangeKernel(m_commandQueue, m_initGridQueryKernel, 1, nullptr, singleWorkSize, singleWorkSize, 0, nullptr, nullptr);
+	RETURN_ON_ERROR(code);
+
+	code = clSetKernelArg(kernel, FIRST_CELL_ARG, sizeof(cl_int4), &firstCell);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(kernel, NUM_CELLS_ARG, sizeof(cl_int4), &numCells);
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(kernel, SCAN_ALL_ARG, sizeof(cl_uint), &scanAll);
+	RETURN_ON_ERROR(code);
+
+	for (cl_uint pass = 0; pass < numPasses && numWorkItems > 0; ++pass)
+	{
+		if (numPasses > 1)
+		{
+			code = clSetKernelArg(kernel, passArgIndex, sizeof(cl_uint), &pass);
+			RETURN_ON_ERROR(code);
+		}
+
+		size_t globalWorkSize[] = { numWorkItems };
+		code = clEnqueueNDRangeKernel(m_commandQueue, kernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+		RETURN_ON_ERROR(code);
+	}
+
+	return clEnqueueReadBuffer(m_commandQueue, m_resultsBuffer, CL_FALSE, 0, sizeof(query.m_result), query.m_result, 0, nullptr, &query.m_event);
+}
+
+cl_int ClSpatialGrid::setGridArgs(cl_kernel kernel, cl_uint firstIndex) const
+{
+	cl_int code = setKernelBufferArgs(kernel, firstIndex, { m_cellStartsBuffer, m_cellEndsBuffer, m_gridPositionsBuffer, m_gridParticlesBuffer });
+	RETURN_ON_ERROR(code);
+	code = clSetKernelArg(kernel, firstIndex + 4, sizeof(cl_float), &m_cellSize);
+	RETURN_ON_ERROR(code);
+	return clSetKernelArg(kernel, firstIndex + 5, sizeof(cl_uint), &m_cellMask);
+}
+
+void ClSpatialGrid::releaseBuffers()
+{
+	for (cl_mem* buffer : { &m_unsortedPositionsBuffer, &m_unsortedParticlesBuffer, &m_gridPositionsBuffer, &m_gridParticlesBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+	m_capacity = 0;
+}
+
+void ClSpatialGrid::release()
+{
+	releaseBuffers();
+	m_sort.release();
+
+	for (cl_mem* buffer : { &m_cellStartsBuffer, &m_cellEndsBuffer, &m_numParticlesBuffer, &m_resultsBuffer })
+	{
+		if (*buffer != nullptr)
+		{
+			clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+	}
+
+	for (cl_kernel* kernel : { &m_clearGridCellsKernel, &m_computeGridKeysKernel, &m_buildGridCellsKernel,
+		&m_initGridQueryKernel, &m_countGridRegionKernel, &m_findGridNearestKernel })
+	{
+		if (*kernel != nullptr)
+		{
+			clReleaseKernel(*kernel);
+			*kernel = nullptr;
+		}
+	}
+}
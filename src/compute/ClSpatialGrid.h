@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <CL/opencl.h>
+
+#include "ClProfiling.h"
+#include "ClRadixSort.h"
+
+class ClParticleSimulation;
+
+// result of a ClSpatialGrid query, read back without blocking
+// the readback writes into the query itself, which must stay alive and in place until it is ready or released
+class ClSpatialQuery
+{
+public:
+	ClSpatialQuery() = default;
+	~ClSpatialQuery();
+
+	ClSpatialQuery(const ClSpatialQuery&) = delete;
+	ClSpatialQuery& operator=(const ClSpatialQuery&) = delete;
+
+	// false until the result was read back and while no query was queued, never blocks
+	bool isReady() const;
+	// blocks until the result was read back, returns the first error
+	cl_int wait();
+
+	// particles in the region of a count query
+	cl_uint getCount() const { return m_result[0]; }
+	// particle found by a nearest query, pageIndex * pageSize + index in the page, NO_PARTICLE if none was close enough
+	cl_uint getNearestParticle() const { return m_result[1]; }
+	float getNearestDistance() const;
+
+	// waits for the pending readback if any
+	void release();
+
+	static constexpr cl_uint NO_PARTICLE = 0xFFFFFFFFu;
+
+private:
+	friend class ClSpatialGrid;
+
+	cl_uint m_result[2] = { 0, 0 };
+	cl_event m_event = nullptr;
+};
+
+// uniform grid over the alive particles of a ClParticleSimulation, the kernels of cl/spatial_grid.cl
+// rebuilt on the device after each compaction: particles are hashed by cell, sorted by hash with ClRadixSort and every
+// hash table entry gets the range of its particles, so particles can find their neighbours without reading the whole
+// pool back and the host can ask what is near a point with a readback of two numbers
+// only the particles of one simulation are in the grid, with ClParticleDeviceGroup those of the first device
+class ClSpatialGrid
+{
+public:
+	ClSpatialGrid(cl_context context, cl_device_id deviceId, cl_command_queue commandQueue);
+	~ClSpatialGrid();
+
+	ClSpatialGrid(const ClSpatialGrid&) = delete;
+	ClSpatialGrid& operator=(const ClSpatialGrid&) = delete;
+
+	// program is built from cl/spatial_grid.cl and sortProgram from cl/radix_sort.cl
+	// the hash table gets a power of two entries, at least maxNumParticles up to MAX_NUM_CELLS, returns the first error
+	cl_int create(cl_program program, cl_program sortProgram, cl_float cellSize, size_t maxNumParticles);
+
+	// rebuilds the grid from the alive lists and positions of the simulation, to be queued after its compaction
+	cl_int enqueueBuild(const ClParticleSimulation& simulation, std::vector<ClProfilingEvent>* profilingEvents = nullptr);
+
+	// queries of the last build, each replaces what the query held before
+	// particles in the box, or in the sphere
+	cl_int enqueueCountInBox(const cl_float3& boxMin, const cl_float3& boxMax, ClSpatialQuery& query);
+	cl_int enqueueCountInSphere(const cl_float3& center, cl_float radius, ClSpatialQuery& query);
+	// particle closest to point within maxDistance, ties go to the lowest particle reference
+	cl_int enqueueFindNearest(const cl_float3& point, cl_float maxDistance, ClSpatialQuery& query);
+
+	// sets the SPATIAL_GRID_PARAMS of a kernel from a program built with cl/spatial_grid.cl, from firstIndex on
+	// the buffers are reallocated when the grid grows, to be set again after every build
+	cl_int setGridArgs(cl_kernel kernel, cl_uint firstIndex) const;
+
+	cl_float getCellSize() const { return m_cellSize; }
+	size_t getNumCells() const { return m_cellMask + size_t(1); }
+	// bits of the sorted keys, the log2 of the number of cells
+	unsigned int getKeyBits() const { return m_keyBits; }
+	// one cl_uint, the number of particles in the grid
+	cl_mem getNumParticlesBuffer() const { return m_numParticlesBuffer; }
+
+	// releases the buffers and kernels, also done by the destructor, pending queries are not waited for
+	void release();
+
+	// 4M entries, 32 MB of cell bounds
+	static constexpr size_t MAX_NUM_CELLS = 1 << 22;
+
+private:
+	cl_int reserve(size_t maxNumParticles);
+	void releaseBuffers();
+	// queues the initialization of the results, the query kernel over the cells of the box and the readback of the results
+	// the kernel's own arguments are set by the caller, with more than one pass passArgIndex gets the index of the pass
+	cl_int enqueueQuery(cl_kernel kernel, cl_uint numPasses, cl_uint passArgIndex, cl_uint initialValue0, cl_uint initialValue1,
+		const cl_float3& boxMin, const cl_float3& boxMax, ClSpatialQuery& query);
+
+	cl_context m_context;
+	cl_device_id m_deviceId;
+	cl_command_queue m_commandQueue;
+	ClRadixSort m_sort;
+
+	cl_float m_cellSize;
+	cl_uint m_cellMask;
+	unsigned int m_keyBits;
+	// particles the buffers hold, all the pages of the simulation at the last build
+	size_t m_capacity;
+
+	cl_mem m_cellStartsBuffer;
+	cl_mem m_cellEndsBuffer;
+	cl_mem m_numParticlesBuffer;
+	cl_mem m_unsortedPositionsBuffer;
+	cl_mem m_unsortedParticlesBuffer;
+	cl_mem m_gridPositionsBuffer;
+	cl_mem m_gridParticlesBuffer;
+	// two cl_uint, the in-order queue reads them back before the next query overwrites them
+	cl_mem m_resultsBuffer;
+
+	cl_kernel m_clearGridCellsKernel;
+	cl_kernel m_computeGridKeysKernel;
+	cl_kernel m_buildGridCellsKernel;
+	cl_kernel m_initGridQueryKernel;
+	cl_kernel m_countGridRegionKernel;
+	cl_kernel m_findGridNearestKernel;
+};
@@ -0,0 +1,154 @@
+#include "BinaryCache.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+const char entryMagic[8] = { 'C', 'L', 'G', 'L', 'B', 'I', 'N', '1' };
+
+// FNV-1a
+uint64_t hashKey(const std::string& key)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : key)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool readSize(std::ifstream& file, uint64_t& size)
+{
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(&size), sizeof(size)));
+}
+
+void writeSize(std::ofstream& file, uint64_t size)
+{
+	file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+}
+}
+
+BinaryCache::BinaryCache(const std::string& directory) :
+	m_directory(directory),
+	m_numHits(0),
+	m_numMisses(0),
+	m_numInvalidations(0)
+{
+	if (isEnabled())
+	{
+		std::error_code error;
+		std::filesystem::create_directories(m_directory, error);
+		if (error)
+		{
+			std::cerr << "Warning: unable to create cache directory '" << m_directory << "', caching disabled" << std::endl;
+			m_directory.clear();
+		}
+	}
+}
+
+bool BinaryCache::load(const std::string& key, std::vector<unsigned char>& data)
+{
+	if (!isEnabled())
+	{
+		return false;
+	}
+
+	std::ifstream file(getEntryPath(key), std::ifstream::binary);
+	if (!file.is_open())
+	{
+		++m_numMisses;
+		return false;
+	}
+
+	char magic[sizeof(entryMagic)];
+	uint64_t keySize = 0;
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, entryMagic, sizeof(entryMagic)) != 0
+		|| !readSize(file, keySize) || keySize != key.size())
+	{
+		invalidate(key);
+		return false;
+	}
+
+	std::string storedKey(keySize, '\0');
+	uint64_t dataSize = 0;
+	if (!file.read(&storedKey[0], keySize) || storedKey != key || !readSize(file, dataSize))
+	{
+		invalidate(key);
+		return false;
+	}
+
+	data.resize(dataSize);
+	if (!file.read(reinterpret_cast<char*>(data.data()), dataSize))
+	{
+		invalidate(key);
+		return false;
+	}
+
+	++m_numHits;
+	return true;
+}
+
+void BinaryCache::store(const std::string& key, const std::vector<unsigned char>& data)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+
+	// written aside then renamed so a concurrent reader never sees a partial entry
+	const std::string path = getEntryPath(key);
+	const std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ofstream::binary | std::ofstream::trunc);
+		if (!file.is_open())
+		{
+			std::cerr << "Warning: unable to write cache entry '" << temporaryPath << "'" << std::endl;
+			return;
+		}
+		file.write(entryMagic, sizeof(entryMagic));
+		writeSize(file, key.size());
+		file.write(key.data(), key.size());
+		writeSize(file, data.size());
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+	{
+		std::cerr << "Warning: unable to write cache entry '" << path << "'" << std::endl;
+		std::filesystem::remove(temporaryPath, error);
+	}
+}
+
+void BinaryCache::invalidate(const std::string& key)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+
+	++m_numInvalidations;
+	std::error_code error;
+	std::filesystem::remove(getEntryPath(key), error);
+}
+
+std::string BinaryCache::getEntryPath(const std::string& key) const
+{
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bin", static_cast<unsigned long long>(hashKey(key)));
+	return (std::filesystem::path(m_directory) / fileName).string();
+}
+
+std::string getDefaultCacheDirectory()
+{
+	const char* directory = getenv("CLGLPARTICLES_CACHE_DIR");
+	return directory != nullptr ? directory : "cache";
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// on-disk cache of compiled program binaries
+// entries are stored under a hash of their key, the full key is stored along with the data
+// so a collision or a stale entry is detected and reported as an invalidation
+class BinaryCache
+{
+public:
+	// an empty directory disables the cache
+	explicit BinaryCache(const std::string& directory);
+
+	bool isEnabled() const { return !m_directory.empty(); }
+
+	// returns false on a miss
+	bool load(const std::string& key, std::vector<unsigned char>& data);
+	void store(const std::string& key, const std::vector<unsigned char>& data);
+	// drops an entry whose data was rejected by the driver
+	void invalidate(const std::string& key);
+
+	unsigned int getNumHits() const { return m_numHits; }
+	unsigned int getNumMisses() const { return m_numMisses; }
+	unsigned int getNumInvalidations() const { return m_numInvalidations; }
+
+private:
+	std::string getEntryPath(const std::string& key) const;
+
+private:
+	std::string m_directory;
+	unsigned int m_numHits;
+	unsigned int m_numMisses;
+	unsigned int m_numInvalidations;
+};
+
+// CLGLPARTICLES_CACHE_DIR if set (empty disables caching), "cache" otherwise
+std::string getDefaultCacheDirectory();
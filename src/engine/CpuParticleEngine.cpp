@@ -0,0 +1,276 @@
+#include "CpuParticleEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <utility>
+#include <glm/gtc/constants.hpp>
+
+#include "Philox.h"
+
+namespace
+{
+const glm::vec3 initialPosition(0.f, 20.f, 0.f);
+const glm::vec3 initialVelocity(0.f, 0.f, 0.f);
+
+// uniform cylinder distribution
+glm::vec3 initRandomOnCylinder(float radius, float height, Rng rng)
+{
+	float randomAngle = random(rng, 0.f, glm::pi<float>() * 2.f);
+	float randomRadius = std::sqrt(random(rng, 0.f, 1.f)) * radius;
+	float randomY = random(rng, height * -0.5f, height * 0.5f);
+	return glm::vec3(std::cos(randomAngle) * randomRadius, randomY, std::sin(randomAngle) * randomRadius);
+}
+
+glm::vec3 rotateVector(const glm::vec3& v, const glm::vec3& k, float theta)
+{
+	float cos_theta = std::cos(theta);
+	float sin_theta = std::sin(theta);
+
+	return (v * cos_theta) + (glm::cross(k, v) * sin_theta) + (k * glm::dot(k, v)) * (1 - cos_theta);
+}
+
+float remap(float value, float min1, float max1, float min2, float max2)
+{
+	return min2 + (value - min1) * (max2 - min2) / (max1 - min1);
+}
+
+void updateVortex(glm::vec3& position, float minRadius, float minRadiusAngularSpeed, float maxRadius, float maxRadiusAngularSpeed, float deltaTime)
+{
+	const float radius = std::sqrt(position.x * position.x + position.z * position.z);
+	float angularSpeed = remap(radius, minRadius, maxRadius, minRadiusAngularSpeed, maxRadiusAngularSpeed);
+	float angle = angularSpeed * deltaTime;
+	position = rotateVector(position, glm::vec3(0.f, 1.f, 0.f), angle);
+}
+
+void updateRadial(glm::vec3& position, float minRadius, float minRadiusSpeed, float maxRadius, float maxRadiusSpeed, float deltaTime)
+{
+	const float radius = std::sqrt(position.x * position.x + position.z * position.z);
+	float speed = remap(radius, minRadius, maxRadius, minRadiusSpeed, maxRadiusSpeed);
+	glm::vec3 velocity = position * speed;
+	position += velocity * deltaTime;
+}
+
+void accelerate(glm::vec3& velocity, const glm::vec3& direction, float deltaTime)
+{
+	velocity += direction * deltaTime;
+}
+
+void randomAccelerate(glm::vec3& velocity, Rng rng, float minX, float maxX, float minY, float maxY, float minZ, float maxZ, float deltaTime)
+{
+	float accelerationX = random(rng, minX, maxX);
+	float accelerationY = random(rng, minY, maxY);
+	float accelerationZ = random(rng, minZ, maxZ);
+	accelerate(velocity, glm::vec3(accelerationX, accelerationY, accelerationZ), deltaTime);
+}
+
+void applyForceField(const glm::vec3& position, glm::vec3& velocity, const VectorField* field, float strength, const glm::vec3& center,
+	float scale, float yaw, float deltaTime)
+{
+	if (field == nullptr)
+	{
+		return;
+	}
+	const glm::vec3 local = rotateVector((position - center) / scale, glm::vec3(0.f, 1.f, 0.f), -yaw);
+	accelerate(velocity, rotateVector(field->sample(local), glm::vec3(0.f, 1.f, 0.f), yaw) * strength, deltaTime);
+}
+
+// interpreted counterpart of the APPLY_PARTICLE_MODIFIERS source generated for the device
+void applyModifiers(const std::vector<ParticleModifier>& modifiers, const std::vector<std::shared_ptr<const VectorField>>& forceFields,
+	glm::vec3& position, glm::vec3& velocity, Rng rng, float deltaTime)
+{
+	for (const ParticleModifier& modifier : modifiers)
+	{
+		const float* p = modifier.params;
+		switch (modifier.type)
+		{
+		case ParticleModifier::Type::Vortex:
+			updateVortex(position, p[0], p[1], p[2], p[3], deltaTime);
+			break;
+		case ParticleModifier::Type::Radial:
+			updateRadial(position, p[0], p[1], p[2], p[3], deltaTime);
+			break;
+		case ParticleModifier::Type::Accelerate:
+			accelerate(velocity, glm::vec3(p[0], p[1], p[2]), deltaTime);
+			break;
+		case ParticleModifier::Type::RandomAccelerate:
+			randomAccelerate(velocity, rng, p[0], p[1], p[2], p[3], p[4], p[5], deltaTime);
+			break;
+		case ParticleModifier::Type::ForceField:
+		{
+			const size_t fieldIndex = static_cast<size_t>(p[0]);
+			applyForceField(position, velocity, fieldIndex < forceFields.size() ? forceFields[fieldIndex].get() : nullptr,
+				p[1], glm::vec3(p[2], p[3], p[4]), p[5], p[6], deltaTime);
+			break;
+		}
+		}
+	}
+}
+
+void applyVelocity(glm::vec3& position, const glm::vec3& velocity, float deltaTime)
+{
+	position += velocity * deltaTime;
+}
+
+bool checkAge(float spawnTime, float currentTime, float maxAge)
+{
+	return currentTime - spawnTime >= maxAge;
+}
+}
+
+CpuParticleEngine::CpuParticleEngine(size_t numParticles, const ParticleSimulationConfig& config, unsigned int numThreads) :
+	m_config(config),
+	m_positions(numParticles),
+	m_velocities(numParticles),
+	m_spawnTimes(numParticles),
+	m_isAlive(numParticles),
+	m_spawnIds(numParticles),
+	m_freeIndices(numParticles),
+	m_freeCount(0),
+	m_numThreads(numThreads > 0 ? numThreads : std::max(std::thread::hardware_concurrency(), 1u)),
+	m_nextSpawnId(0)
+{
+	m_aliveIndices.reserve(numParticles);
+}
+
+void CpuParticleEngine::initParticleState()
+{
+	const size_t numParticles = getNumParticles();
+	parallelFor(numParticles, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t id = begin; id < end; ++id)
+		{
+			m_positions[id] = initialPosition;
+			m_velocities[id] = initialVelocity;
+			m_spawnTimes[id] = 0.f;
+			m_isAlive[id] = 0;
+
+			// the top of the stack is the last entry, lowest indices are handed out first
+			m_freeIndices[id] = static_cast<uint32_t>(numParticles - 1 - id);
+		}
+	});
+	m_freeCount = static_cast<uint32_t>(numParticles);
+	m_aliveIndices.clear();
+	m_nextSpawnId = 0;
+}
+
+uint32_t CpuParticleEngine::spawnParticle(uint32_t numParticlesToSpawn, uint32_t seed, uint32_t step, float currentTime)
+{
+	// pop the whole budget at once, the device does one atomic pop per work-item
+	// spawn ids of dropped spawns are skipped like on the device
+	const uint32_t freeCount = m_freeCount;
+	const uint32_t numSpawnedParticles = std::min(numParticlesToSpawn, freeCount);
+	const uint32_t newFreeCount = freeCount - numSpawnedParticles;
+	const uint32_t firstSpawnId = m_nextSpawnId;
+	m_nextSpawnId += numParticlesToSpawn;
+
+	parallelFor(numSpawnedParticles, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const size_t id = m_freeIndices[newFreeCount + i];
+			const uint32_t spawnId = firstSpawnId + static_cast<uint32_t>(i);
+
+			RngValue rng;
+			randomInit(&rng, seed, step, RNG_STREAM_SPAWN, spawnId);
+
+			m_velocities[id] = glm::vec3(0.f, 0.f, 0.f);
+			m_spawnTimes[id] = currentTime;
+			m_isAlive[id] = 1;
+			m_spawnIds[id] = spawnId;
+
+			m_positions[id] = initRandomOnCylinder(45.f, 0.f, &rng);
+		}
+	});
+
+	m_freeCount = newFreeCount;
+	return numSpawnedParticles;
+}
+
+void CpuParticleEngine::simulateParticles(uint32_t seed, uint32_t step, float currentTime, float deltaTime)
+{
+	parallelFor(m_aliveIndices.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t aliveId = begin; aliveId < end; ++aliveId)
+		{
+			const size_t id = m_aliveIndices[aliveId];
+
+			if (checkAge(m_spawnTimes[id], currentTime, m_config.maxAge))
+			{
+				m_isAlive[id] = 0;
+				m_positions[id] = initialPosition;
+				m_freeIndices[m_freeCount.fetch_add(1)] = static_cast<uint32_t>(id);
+				continue;
+			}
+
+			glm::vec3 position = m_positions[id];
+			glm::vec3 velocity = m_velocities[id];
+
+			RngValue rng;
+			randomInit(&rng, seed, step, RNG_STREAM_SIMULATE, m_spawnIds[id]);
+
+			applyModifiers(m_config.modifiers, m_forceFields, position, velocity, &rng, deltaTime);
+
+			applyVelocity(position, velocity, deltaTime);
+
+			m_positions[id] = position;
+			m_velocities[id] = velocity;
+		}
+	});
+}
+
+void CpuParticleEngine::compactAliveParticles()
+{
+	m_aliveIndices.clear();
+	const size_t numParticles = getNumParticles();
+	for (size_t id = 0; id < numParticles; ++id)
+	{
+		if (m_isAlive[id])
+		{
+			m_aliveIndices.push_back(static_cast<uint32_t>(id));
+		}
+	}
+}
+
+void CpuParticleEngine::setForceField(size_t fieldIndex, std::shared_ptr<const VectorField> field)
+{
+	if (fieldIndex >= m_forceFields.size())
+	{
+		m_forceFields.resize(fieldIndex + 1);
+	}
+	m_forceFields[fieldIndex] = std::move(field);
+}
+
+size_t CpuParticleEngine::countAliveParticles() const
+{
+	return std::count_if(m_isAlive.begin(), m_isAlive.end(), [](uint8_t isAlive) { return isAlive != 0; });
+}
+
+template <class Function>
+void CpuParticleEngine::parallelFor(size_t count, size_t grain, Function function)
+{
+	const size_t numChunks = (count + grain - 1) / grain;
+	const size_t numThreads = std::min<size_t>(m_numThreads, numChunks);
+	if (numThreads <= 1)
+	{
+		function(0, count);
+		return;
+	}
+
+	const size_t chunksPerThread = (numChunks + numThreads - 1) / numThreads;
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads);
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		const size_t begin = std::min(i * chunksPerThread * grain, count);
+		const size_t end = std::min(begin + chunksPerThread * grain, count);
+		if (begin < end)
+		{
+			threads.emplace_back(function, begin, end);
+		}
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
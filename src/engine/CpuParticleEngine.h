@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "ParticleModifiers.h"
+#include "VectorField.h"
+
+// host implementation of the kernels in cl/particle.cl
+// used as a reference for the OpenCL path and as a fallback when no OpenCL device is available
+
+class CpuParticleEngine
+{
+public:
+	// numThreads == 0 uses every hardware thread
+	CpuParticleEngine(size_t numParticles, const ParticleSimulationConfig& config, unsigned int numThreads = 0);
+
+	// kernels
+	void initParticleState();
+	// spawns exactly numParticlesToSpawn particles unless the pool is full, returns the number spawned
+	// random numbers are keyed on seed, the same for a whole run, step, the index of the substep, and the spawn id of the
+	// particle, numbered like in ClParticleSimulation: a particle draws the same numbers as the one with the same spawn id
+	// on the device whatever slot either got, as long as neither pool dropped spawns
+	uint32_t spawnParticle(uint32_t numParticlesToSpawn, uint32_t seed, uint32_t step, float currentTime);
+	// death test, modifiers and integration over the alive list
+	void simulateParticles(uint32_t seed, uint32_t step, float currentTime, float deltaTime);
+	// rebuilds the alive list, simulateParticles only visits listed particles
+	void compactAliveParticles();
+
+	// the field sampled by the ForceField modifiers of index fieldIndex, none pushes nothing
+	void setForceField(size_t fieldIndex, std::shared_ptr<const VectorField> field);
+
+	size_t getNumParticles() const { return m_isAlive.size(); }
+	size_t getNumFreeParticles() const { return m_freeCount; }
+	unsigned int getNumThreads() const { return m_numThreads; }
+	size_t countAliveParticles() const;
+
+	// same structure of arrays layout as the OpenCL buffers
+	const std::vector<glm::vec3>& getPositions() const { return m_positions; }
+	const std::vector<glm::vec3>& getVelocities() const { return m_velocities; }
+	const std::vector<float>& getSpawnTimes() const { return m_spawnTimes; }
+	const std::vector<uint8_t>& getIsAlive() const { return m_isAlive; }
+	const std::vector<uint32_t>& getSpawnIds() const { return m_spawnIds; }
+	const std::vector<uint32_t>& getAliveIndices() const { return m_aliveIndices; }
+
+private:
+	// calls function(begin, end) on contiguous ranges of [0, count), ranges are multiples of grain
+	template <class Function>
+	void parallelFor(size_t count, size_t grain, Function function);
+
+private:
+	ParticleSimulationConfig m_config;
+	std::vector<std::shared_ptr<const VectorField>> m_forceFields;
+	std::vector<glm::vec3> m_positions;
+	std::vector<glm::vec3> m_velocities;
+	std::vector<float> m_spawnTimes;
+	std::vector<uint8_t> m_isAlive;
+	std::vector<uint32_t> m_spawnIds;
+	std::vector<uint32_t> m_aliveIndices;
+	// stack of dead particle indices, same as freeIndices/freeCount on the device
+	std::vector<uint32_t> m_freeIndices;
+	std::atomic<uint32_t> m_freeCount;
+	unsigned int m_numThreads;
+	// spawn id of the next particle to spawn
+	uint32_t m_nextSpawnId;
+};
@@ -0,0 +1,34 @@
+#include "FixedTimestep.h"
+
+#include <cmath>
+
+FixedTimestep::FixedTimestep(double stepSeconds, unsigned int maxSubsteps) :
+	m_stepSeconds(stepSeconds),
+	m_maxSubsteps(maxSubsteps),
+	m_accumulator(0.0),
+	m_simulationTime(0.0),
+	m_droppedSeconds(0.0)
+{
+}
+
+unsigned int FixedTimestep::advance(double frameSeconds)
+{
+	m_accumulator += frameSeconds;
+
+	unsigned int numSubsteps = 0;
+	while (m_accumulator >= m_stepSeconds && numSubsteps < m_maxSubsteps)
+	{
+		m_accumulator -= m_stepSeconds;
+		++numSubsteps;
+	}
+
+	// falling behind, drop whole steps but keep the partial one so interpolation stays continuous
+	if (m_accumulator >= m_stepSeconds)
+	{
+		const double excess = std::floor(m_accumulator / m_stepSeconds) * m_stepSeconds;
+		m_accumulator -= excess;
+		m_droppedSeconds += excess;
+	}
+
+	return numSubsteps;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// splits variable frame times into fixed simulation steps
+// the time left over after the last step is carried to the next frame and used to blend
+// the last two simulated states when rendering
+class FixedTimestep
+{
+public:
+	// maxSubsteps bounds the work done after a long frame, the excess simulated time is dropped
+	FixedTimestep(double stepSeconds, unsigned int maxSubsteps);
+
+	// adds the frame time and returns the number of steps to simulate, 0 to maxSubsteps
+	unsigned int advance(double frameSeconds);
+
+	double getStepSeconds() const { return m_stepSeconds; }
+	// time simulated so far, the start of the next step
+	double getSimulationTime() const { return m_simulationTime; }
+	// in [0, 1), how far rendering is between the state before and after the last step
+	double getInterpolationAlpha() const { return m_accumulator / m_stepSeconds; }
+	double getDroppedSeconds() const { return m_droppedSeconds; }
+
+	// moves the simulation time forward by one step, called once per simulated step
+	void step() { m_simulationTime += m_stepSeconds; }
+
+private:
+	double m_stepSeconds;
+	unsigned int m_maxSubsteps;
+	double m_accumulator;
+	double m_simulationTime;
+	double m_droppedSeconds;
+};
@@ -0,0 +1,62 @@
+#include "LoadBalancer.h"
+
+#include <algorithm>
+#include <cmath>
+
+LoadBalancer::LoadBalancer(size_t numDevices, double smoothing, double minShare) :
+	m_smoothing(smoothing),
+	m_minShare(minShare),
+	m_throughputs(numDevices, 0.0),
+	m_shares(numDevices, numDevices > 0 ? 1.0 / static_cast<double>(numDevices) : 0.0),
+	m_remainders(numDevices, 0.0)
+{
+}
+
+void LoadBalancer::addSample(size_t device, double numItems, double milliseconds)
+{
+	if (numItems <= 0.0 || milliseconds <= 0.0)
+	{
+		return;
+	}
+
+	const double throughput = numItems / milliseconds;
+	m_throughputs[device] = m_throughputs[device] > 0.0 ? m_throughputs[device] + (throughput - m_throughputs[device]) * m_smoothing : throughput;
+	updateShares();
+}
+
+void LoadBalancer::updateShares()
+{
+	// even split until every device has been measured
+	double totalThroughput = 0.0;
+	for (double throughput : m_throughputs)
+	{
+		if (throughput <= 0.0)
+		{
+			return;
+		}
+		totalThroughput += throughput;
+	}
+
+	const double minShare = m_minShare / static_cast<double>(m_shares.size());
+	double totalShare = 0.0;
+	for (size_t i = 0; i < m_shares.size(); ++i)
+	{
+		m_shares[i] = std::max(m_throughputs[i] / totalThroughput, minShare);
+		totalShare += m_shares[i];
+	}
+	for (double& share : m_shares)
+	{
+		share /= totalShare;
+	}
+}
+
+void LoadBalancer::split(uint32_t numItems, std::vector<uint32_t>& counts)
+{
+	counts.resize(m_shares.size());
+	for (size_t i = 0; i < m_shares.size(); ++i)
+	{
+		m_remainders[i] += static_cast<double>(numItems) * m_shares[i];
+		counts[i] = static_cast<uint32_t>(std::floor(m_remainders[i]));
+		m_remainders[i] -= counts[i];
+	}
+}
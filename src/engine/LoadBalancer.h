@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// splits work between devices in proportion to their measured throughput
+// every device keeps a minimum share so that its throughput keeps being measured
+class LoadBalancer
+{
+public:
+	// smoothing is the weight of a new sample in the running throughput, minShare is a fraction of an even split
+	LoadBalancer(size_t numDevices, double smoothing = 0.2, double minShare = 0.1);
+
+	size_t getNumDevices() const { return m_shares.size(); }
+	// fraction of the work given to the device, the shares sum to 1
+	double getShare(size_t device) const { return m_shares[device]; }
+	// items per millisecond, 0 until the first sample
+	double getThroughput(size_t device) const { return m_throughputs[device]; }
+
+	// the device processed numItems in milliseconds, ignored if either is 0
+	void addSample(size_t device, double numItems, double milliseconds);
+
+	// splits numItems between the devices, fractions are carried over to later splits
+	void split(uint32_t numItems, std::vector<uint32_t>& counts);
+
+private:
+	void updateShares();
+
+	double m_smoothing;
+	double m_minShare;
+	std::vector<double> m_throughputs;
+	std::vector<double> m_shares;
+	std::vector<double> m_remainders;
+};
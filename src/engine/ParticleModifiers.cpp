@@ -0,0 +1,213 @@
+#include "ParticleModifiers.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace
+{
+// shortest literal that reads back as the same float, always with a decimal point so the f suffix is valid
+std::string toFloatLiteral(float value)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%.9g", value);
+	std::string literal = buffer;
+	if (literal.find_first_of(".e") == std::string::npos)
+	{
+		literal += ".0";
+	}
+	return literal + "f";
+}
+
+std::string getParamName(size_t modifierIndex, int paramIndex)
+{
+	std::ostringstream name;
+	name << "MODIFIER_" << modifierIndex << "_PARAM_" << paramIndex;
+	return name.str();
+}
+
+// the APPLY_PARTICLE_MODIFIERS define, the calls are the same in both languages but for the vector literals and
+// how a force field is passed: an image parameter and the bounds in OpenCL, an element of the forceFields array in GLSL
+void appendApplyModifiers(std::ostringstream& source, const ParticleSimulationConfig& config, bool glsl)
+{
+	const char* vectorType = glsl ? "vec3" : "(float3)";
+	source << "#define APPLY_PARTICLE_MODIFIERS(position, velocity, rng, deltaTime)";
+	for (size_t i = 0; i < config.modifiers.size(); ++i)
+	{
+		const ParticleModifier& modifier = config.modifiers[i];
+		source << " \\\n\t";
+		switch (modifier.type)
+		{
+		case ParticleModifier::Type::Vortex: source << "updateVortex(position"; break;
+		case ParticleModifier::Type::Radial: source << "updateRadial(position"; break;
+		case ParticleModifier::Type::Accelerate: source << "accelerate(velocity, " << vectorType; break;
+		case ParticleModifier::Type::RandomAccelerate: source << "randomAccelerate(velocity, rng"; break;
+		case ParticleModifier::Type::ForceField: source << "applyForceField(position, velocity"; break;
+		}
+
+		if (modifier.type == ParticleModifier::Type::Accelerate)
+		{
+			source << "(" << getParamName(i, 0) << ", " << getParamName(i, 1) << ", " << getParamName(i, 2) << ")";
+		}
+		else if (modifier.type == ParticleModifier::Type::ForceField)
+		{
+			// the image is a kernel parameter or a sampler array element, picked by index
+			const size_t fieldIndex = static_cast<size_t>(modifier.params[0]);
+			if (glsl)
+			{
+				source << ", forceFields[" << fieldIndex << "], ";
+			}
+			else
+			{
+				source << ", forceField" << fieldIndex << ", forceFieldBounds, ";
+			}
+			source << fieldIndex << "u, " << getParamName(i, 1)
+				<< ", " << vectorType << "(" << getParamName(i, 2) << ", " << getParamName(i, 3) << ", " << getParamName(i, 4) << "), "
+				<< getParamName(i, 5) << ", " << getParamName(i, 6);
+		}
+		else
+		{
+			for (int j = 0; j < modifier.getNumParams(); ++j)
+			{
+				source << ", " << getParamName(i, j);
+			}
+		}
+		source << ", deltaTime);";
+	}
+	source << "\n";
+}
+}
+
+ParticleModifier ParticleModifier::vortex(float minRadius, float minRadiusAngularSpeed, float maxRadius, float maxRadiusAngularSpeed)
+{
+	return ParticleModifier{ Type::Vortex, { minRadius, minRadiusAngularSpeed, maxRadius, maxRadiusAngularSpeed } };
+}
+
+ParticleModifier ParticleModifier::radial(float minRadius, float minRadiusSpeed, float maxRadius, float maxRadiusSpeed)
+{
+	return ParticleModifier{ Type::Radial, { minRadius, minRadiusSpeed, maxRadius, maxRadiusSpeed } };
+}
+
+ParticleModifier ParticleModifier::accelerate(const glm::vec3& acceleration)
+{
+	return ParticleModifier{ Type::Accelerate, { acceleration.x, acceleration.y, acceleration.z } };
+}
+
+ParticleModifier ParticleModifier::randomAccelerate(const glm::vec3& minAcceleration, const glm::vec3& maxAcceleration)
+{
+	return ParticleModifier{
+		Type::RandomAccelerate,
+		{ minAcceleration.x, maxAcceleration.x, minAcceleration.y, maxAcceleration.y, minAcceleration.z, maxAcceleration.z }
+	};
+}
+
+ParticleModifier ParticleModifier::forceField(unsigned int fieldIndex, float strength, const glm::vec3& center, float scale, float yaw)
+{
+	return ParticleModifier{
+		Type::ForceField,
+		{ static_cast<float>(fieldIndex), strength, center.x, center.y, center.z, scale, yaw }
+	};
+}
+
+int ParticleModifier::getNumParams() const
+{
+	switch (type)
+	{
+	case Type::Vortex: return 4;
+	case Type::Radial: return 4;
+	case Type::Accelerate: return 3;
+	case Type::RandomAccelerate: return 6;
+	case Type::ForceField: return 7;
+	}
+	return 0;
+}
+
+ParticleSimulationConfig getDefaultParticleSimulationConfig()
+{
+	ParticleSimulationConfig config;
+	config.modifiers = {
+		//ParticleModifier::vortex(0.f, -2.f, 50.f, 0.f),
+		//ParticleModifier::radial(0.f, -0.6f, 50.f, 0.f),
+		ParticleModifier::randomAccelerate(glm::vec3(-50.f, -5.f, -50.f), glm::vec3(50.f, -10.f, 50.f)),
+		//ParticleModifier::accelerate(glm::vec3(0.f, -10.f, 0.f)),
+	};
+	config.maxAge = 5.f;
+	return config;
+}
+
+size_t getNumForceFields(const ParticleSimulationConfig& config)
+{
+	size_t numForceFields = 0;
+	for (const ParticleModifier& modifier : config.modifiers)
+	{
+		if (modifier.type == ParticleModifier::Type::ForceField)
+		{
+			numForceFields = std::max(numForceFields, static_cast<size_t>(modifier.params[0]) + 1);
+		}
+	}
+	return numForceFields;
+}
+
+bool hasPositionModifiers(const ParticleSimulationConfig& config)
+{
+	return std::any_of(config.modifiers.begin(), config.modifiers.end(), [](const ParticleModifier& modifier)
+	{
+		return modifier.type == ParticleModifier::Type::Vortex || modifier.type == ParticleModifier::Type::Radial;
+	});
+}
+
+std::string generateParticleModifierSource(const ParticleSimulationConfig& config)
+{
+	std::ostringstream source;
+	const size_t numForceFields = getNumForceFields(config);
+	if (numForceFields > 0)
+	{
+		source << "#define FORCE_FIELD_PARAMS , __constant float4* forceFieldBounds";
+		for (size_t i = 0; i < numForceFields; ++i)
+		{
+			source << ", __read_only image3d_t forceField" << i;
+		}
+		source << "\n";
+	}
+
+	appendApplyModifiers(source, config, false);
+	return source.str();
+}
+
+std::string generateParticleModifierGlslSource(const ParticleSimulationConfig& config)
+{
+	std::ostringstream source;
+	source << "#define MAX_AGE " << toFloatLiteral(config.maxAge) << "\n";
+	for (size_t i = 0; i < config.modifiers.size(); ++i)
+	{
+		const ParticleModifier& modifier = config.modifiers[i];
+		for (int j = 0; j < modifier.getNumParams(); ++j)
+		{
+			source << "#define " << getParamName(i, j) << " " << toFloatLiteral(modifier.params[j]) << "\n";
+		}
+	}
+
+	const size_t numForceFields = getNumForceFields(config);
+	if (numForceFields > 0)
+	{
+		source << "#define NUM_FORCE_FIELDS " << numForceFields << "\n";
+	}
+
+	appendApplyModifiers(source, config, true);
+	return source.str();
+}
+
+std::string getParticleModifierBuildOptions(const ParticleSimulationConfig& config)
+{
+	std::ostringstream options;
+	options << "-D MAX_AGE=" << toFloatLiteral(config.maxAge);
+	for (size_t i = 0; i < config.modifiers.size(); ++i)
+	{
+		const ParticleModifier& modifier = config.modifiers[i];
+		for (int j = 0; j < modifier.getNumParams(); ++j)
+		{
+			options << " -D " << getParamName(i, j) << "=" << toFloatLiteral(modifier.params[j]);
+		}
+	}
+	return options.str();
+}
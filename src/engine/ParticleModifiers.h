@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+// per-frame modifiers applied to alive particles, in order, before the velocity is integrated
+// the OpenCL and compute shader paths compile the list into simulateParticles, the CPU engine interprets it
+struct ParticleModifier
+{
+	enum class Type
+	{
+		Vortex,				// minRadius, minRadiusAngularSpeed, maxRadius, maxRadiusAngularSpeed
+		Radial,				// minRadius, minRadiusSpeed, maxRadius, maxRadiusSpeed
+		Accelerate,			// x, y, z
+		RandomAccelerate,	// minX, maxX, minY, maxY, minZ, maxZ
+		ForceField,			// fieldIndex, strength, centerX, centerY, centerZ, scale, yaw
+	};
+
+	static const int MAX_PARAMS = 7;
+
+	Type type;
+	float params[MAX_PARAMS];
+
+	static ParticleModifier vortex(float minRadius, float minRadiusAngularSpeed, float maxRadius, float maxRadiusAngularSpeed);
+	static ParticleModifier radial(float minRadius, float minRadiusSpeed, float maxRadius, float maxRadiusSpeed);
+	static ParticleModifier accelerate(const glm::vec3& acceleration);
+	static ParticleModifier randomAccelerate(const glm::vec3& minAcceleration, const glm::vec3& maxAcceleration);
+	// accelerates by strength times the vector of force field fieldIndex, a VectorField placed in the world by scaling
+	// its box then turning it by yaw radians around y and moving it to center, nothing outside the box
+	// the fields are bound at run time, see ClForceFields and CpuParticleEngine::setForceField, they push nothing until then
+	static ParticleModifier forceField(unsigned int fieldIndex, float strength, const glm::vec3& center = glm::vec3(0.f),
+		float scale = 1.f, float yaw = 0.f);
+
+	int getNumParams() const;
+};
+
+struct ParticleSimulationConfig
+{
+	std::vector<ParticleModifier> modifiers;
+	float maxAge;
+};
+
+// the simulation the demo has always run
+ParticleSimulationConfig getDefaultParticleSimulationConfig();
+
+// force fields the modifiers sample, one past the highest field index
+size_t getNumForceFields(const ParticleSimulationConfig& config);
+
+// true if a Vortex or Radial modifier moves the positions directly, rendering between two steps then cannot
+// extrapolate along the velocity alone and the latest state is drawn as it is
+bool hasPositionModifiers(const ParticleSimulationConfig& config);
+
+// source defining APPLY_PARTICLE_MODIFIERS, to be compiled in front of cl/particle.cl
+// with force fields, also FORCE_FIELD_PARAMS, the extra parameters of simulateParticles: the field bounds then an
+// image3d_t per field
+std::string generateParticleModifierSource(const ParticleSimulationConfig& config);
+
+// -D defines for every constant referenced by the generated source
+std::string getParticleModifierBuildOptions(const ParticleSimulationConfig& config);
+
+// the same for shaders/particle.comp, GLSL has no build options so the constants are #defines of the source
+// with force fields, also NUM_FORCE_FIELDS, the size of the forceFields sampler array
+std::string generateParticleModifierGlslSource(const ParticleSimulationConfig& config);
@@ -0,0 +1,113 @@
+#include "PhaseTimings.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+
+namespace
+{
+// nearest-rank percentile of sorted samples
+double getPercentile(const std::vector<double>& sortedSamples, double percentile)
+{
+	const size_t rank = static_cast<size_t>(std::ceil(percentile * 0.01 * static_cast<double>(sortedSamples.size())));
+	return sortedSamples[std::min(std::max(rank, size_t(1)), sortedSamples.size()) - 1];
+}
+}
+
+void PhaseTimings::addSample(const std::string& phase, double milliseconds)
+{
+	std::vector<double>& samples = m_samples[phase];
+	if (samples.empty())
+	{
+		m_phases.push_back(phase);
+	}
+	samples.push_back(milliseconds);
+}
+
+std::vector<PhaseTimings::Summary> PhaseTimings::summarize() const
+{
+	std::vector<Summary> summaries;
+	summaries.reserve(m_phases.size());
+	for (const std::string& phase : m_phases)
+	{
+		std::vector<double> samples = m_samples.at(phase);
+		std::sort(samples.begin(), samples.end());
+
+		Summary summary;
+		summary.phase = phase;
+		summary.numSamples = samples.size();
+		summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / static_cast<double>(samples.size());
+		summary.p50 = getPercentile(samples, 50.0);
+		summary.p95 = getPercentile(samples, 95.0);
+		summary.p99 = getPercentile(samples, 99.0);
+		summary.max = samples.back();
+		summaries.push_back(summary);
+	}
+	return summaries;
+}
+
+bool PhaseTimings::writeCsv(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		return false;
+	}
+
+	file << "phase,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms" << std::endl;
+	for (const Summary& summary : summarize())
+	{
+		file << summary.phase << ',' << summary.numSamples << ','
+			<< summary.mean << ',' << summary.p50 << ',' << summary.p95 << ',' << summary.p99 << ',' << summary.max << std::endl;
+	}
+	return static_cast<bool>(file);
+}
+
+bool PhaseTimings::writeJson(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		return false;
+	}
+
+	// phase names are plain identifiers, no escaping needed
+	const std::vector<Summary> summaries = summarize();
+	file << "{" << std::endl << "\t\"phases\": [" << std::endl;
+	for (size_t i = 0; i < summaries.size(); ++i)
+	{
+		const Summary& summary = summaries[i];
+		file << "\t\t{ \"phase\": \"" << summary.phase << "\", \"samples\": " << summary.numSamples
+			<< ", \"mean_ms\": " << summary.mean << ", \"p50_ms\": " << summary.p50
+			<< ", \"p95_ms\": " << summary.p95 << ", \"p99_ms\": " << summary.p99
+			<< ", \"max_ms\": " << summary.max << " }" << (i + 1 < summaries.size() ? "," : "") << std::endl;
+	}
+	file << "\t]" << std::endl << "}" << std::endl;
+	return static_cast<bool>(file);
+}
+
+bool PhaseTimings::write(const std::string& path) const
+{
+	const std::string jsonExtension = ".json";
+	if (path.size() >= jsonExtension.size() && path.compare(path.size() - jsonExtension.size(), jsonExtension.size(), jsonExtension) == 0)
+	{
+		return writeJson(path);
+	}
+	return writeCsv(path);
+}
+
+void PhaseTimings::print(std::ostream& out) const
+{
+	const std::streamsize precision = out.precision();
+	out << std::left << std::setw(32) << "phase" << std::right
+		<< std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "p99 ms" << std::endl;
+	for (const Summary& summary : summarize())
+	{
+		out << std::left << std::setw(32) << summary.phase << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(10) << summary.p50 << std::setw(10) << summary.p95 << std::setw(10) << summary.p99 << std::endl;
+	}
+	out << std::defaultfloat << std::setprecision(precision);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// per-phase duration samples, typically one per frame, summarized as percentiles
+// phases are reported in the order they were first recorded
+class PhaseTimings
+{
+public:
+	struct Summary
+	{
+		std::string phase;
+		size_t numSamples;
+		double mean;
+		double p50;
+		double p95;
+		double p99;
+		double max;
+	};
+
+public:
+	void addSample(const std::string& phase, double milliseconds);
+
+	bool isEmpty() const { return m_phases.empty(); }
+	std::vector<Summary> summarize() const;
+
+	// one row or object per phase, all durations in milliseconds, returns false if the file cannot be written
+	bool writeCsv(const std::string& path) const;
+	bool writeJson(const std::string& path) const;
+	// picks the format from the extension, CSV unless it ends with .json
+	bool write(const std::string& path) const;
+
+	void print(std::ostream& out) const;
+
+private:
+	std::vector<std::string> m_phases;
+	std::unordered_map<std::string, std::vector<double>> m_samples;
+};
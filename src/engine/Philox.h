@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+// host port of the random helpers in cl/particle.cl, must stay bit-identical to the device version
+
+// Philox4x32-10 counter-based generator, Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC11
+// stateless: the numbers of a particle are a function of its counter and key, there is no seeding step
+
+struct PhiloxBlock { uint32_t x, y, z, w; };
+
+inline PhiloxBlock philox4x32_10(PhiloxBlock counter, uint32_t key0, uint32_t key1)
+{
+	for (int round = 0; round < 10; ++round)
+	{
+		const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * counter.x;
+		const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * counter.z;
+		counter = {
+			static_cast<uint32_t>(product1 >> 32) ^ counter.y ^ key0,
+			static_cast<uint32_t>(product1),
+			static_cast<uint32_t>(product0 >> 32) ^ counter.w ^ key1,
+			static_cast<uint32_t>(product0)
+		};
+		key0 += 0x9E3779B9u;
+		key1 += 0xBB67AE85u;
+	}
+	return counter;
+}
+
+//////
+
+// one stream per kernel drawing numbers, a particle spawned and simulated in the same step gets different ones
+const uint32_t RNG_STREAM_SIMULATE = 0;
+const uint32_t RNG_STREAM_SPAWN = 1;
+
+// the key is the run seed and the step index, the counter the particle's spawn id, the stream and the block of four
+// numbers
+struct RngValue
+{
+	PhiloxBlock counter;
+	uint32_t key0;
+	uint32_t key1;
+	// numbers left in the current block, next one in x
+	PhiloxBlock block;
+	uint32_t numLeft;
+};
+typedef RngValue* Rng;
+
+inline void randomInit(Rng rng, uint32_t seed, uint32_t step, uint32_t stream, uint32_t spawnId)
+{
+	rng->counter = { spawnId, 0u, stream, 0u };
+	rng->key0 = seed;
+	rng->key1 = step;
+	rng->numLeft = 0;
+}
+
+inline uint32_t randomUint(Rng rng)
+{
+	if (rng->numLeft == 0)
+	{
+		rng->block = philox4x32_10(rng->counter, rng->key0, rng->key1);
+		rng->counter.w++;
+		rng->numLeft = 4;
+	}
+	const uint32_t value = rng->block.x;
+	rng->block = { rng->block.y, rng->block.z, rng->block.w, rng->block.x };
+	rng->numLeft--;
+	return value;
+}
+
+// in [0, 1), the top 24 bits scaled by 2^-24 are exact in single precision
+inline float random01(Rng rng)
+{
+	return static_cast<float>(randomUint(rng) >> 8) * (1.f / 16777216.f);
+}
+
+inline float random(Rng rng, float min, float max)
+{
+	float randomFloat = random01(rng);
+	return min + randomFloat * (max - min);
+}
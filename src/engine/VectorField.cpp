@@ -0,0 +1,122 @@
+#include "VectorField.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace
+{
+// fields larger than this are rejected as corrupt rather than allocated, 1G voxels
+const size_t MAX_NUM_VOXELS = size_t(1) << 30;
+
+// next number of a comma or whitespace separated list, false at the end of the text or on anything else
+bool readNumber(const char*& cursor, float* value)
+{
+	while (*cursor == ',' || *cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+	{
+		++cursor;
+	}
+
+	char* end = nullptr;
+	*value = std::strtof(cursor, &end);
+	if (end == cursor)
+	{
+		return false;
+	}
+	cursor = end;
+	return true;
+}
+}
+
+glm::vec3 VectorField::sample(const glm::vec3& position) const
+{
+	const glm::vec3 extent = boundsMax - boundsMin;
+	if (vectors.empty() || extent.x <= 0.f || extent.y <= 0.f || extent.z <= 0.f)
+	{
+		return glm::vec3(0.f);
+	}
+
+	// voxel coordinates with centers on integers, like unnormalized image coordinates minus one half
+	const glm::vec3 size(static_cast<float>(width), static_cast<float>(height), static_cast<float>(depth));
+	const glm::vec3 coords = (position - boundsMin) / extent * size - 0.5f;
+	const glm::vec3 base = glm::floor(coords);
+	const glm::vec3 fraction = coords - base;
+
+	glm::vec3 result(0.f);
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const int x = static_cast<int>(base.x) + (corner & 1);
+		const int y = static_cast<int>(base.y) + ((corner >> 1) & 1);
+		const int z = static_cast<int>(base.z) + ((corner >> 2) & 1);
+		if (x < 0 || y < 0 || z < 0 || x >= static_cast<int>(width) || y >= static_cast<int>(height) || z >= static_cast<int>(depth))
+		{
+			continue;
+		}
+
+		const float weight = ((corner & 1) ? fraction.x : 1.f - fraction.x)
+			* (((corner >> 1) & 1) ? fraction.y : 1.f - fraction.y)
+			* (((corner >> 2) & 1) ? fraction.z : 1.f - fraction.z);
+		const size_t index = ((static_cast<size_t>(z) * height + y) * width + x) * 4;
+		result += glm::vec3(vectors[index], vectors[index + 1], vectors[index + 2]) * weight;
+	}
+	return result;
+}
+
+bool loadVectorFieldFga(const std::string& path, VectorField* field, std::string* error)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		*error = "cannot open " + path;
+		return false;
+	}
+	std::ostringstream text;
+	text << file.rdbuf();
+	const std::string content = text.str();
+	const char* cursor = content.c_str();
+
+	float header[9];
+	for (float& value : header)
+	{
+		if (!readNumber(cursor, &value))
+		{
+			*error = path + ": truncated header";
+			return false;
+		}
+	}
+
+	if (header[0] < 1.f || header[1] < 1.f || header[2] < 1.f
+		|| static_cast<double>(header[0]) * header[1] * header[2] > static_cast<double>(MAX_NUM_VOXELS))
+	{
+		*error = path + ": invalid voxel counts";
+		return false;
+	}
+
+	VectorField loaded;
+	loaded.width = static_cast<uint32_t>(header[0]);
+	loaded.height = static_cast<uint32_t>(header[1]);
+	loaded.depth = static_cast<uint32_t>(header[2]);
+	loaded.boundsMin = glm::vec3(header[3], header[4], header[5]);
+	loaded.boundsMax = glm::vec3(header[6], header[7], header[8]);
+	if (!(loaded.boundsMax.x > loaded.boundsMin.x && loaded.boundsMax.y > loaded.boundsMin.y && loaded.boundsMax.z > loaded.boundsMin.z))
+	{
+		*error = path + ": empty bounds";
+		return false;
+	}
+
+	const size_t numVoxels = loaded.getNumVoxels();
+	loaded.vectors.resize(numVoxels * 4, 0.f);
+	for (size_t i = 0; i < numVoxels; ++i)
+	{
+		if (!readNumber(cursor, &loaded.vectors[i * 4]) || !readNumber(cursor, &loaded.vectors[i * 4 + 1]) || !readNumber(cursor, &loaded.vectors[i * 4 + 2]))
+		{
+			*error = path + ": truncated vectors";
+			return false;
+		}
+	}
+
+	*field = std::move(loaded);
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+// a 3D grid of vectors over a box, the force volumes sampled by ParticleModifier::Type::ForceField
+// vectors are padded to four floats with x varying fastest then y then z, the layout of a CL_RGBA CL_FLOAT image
+struct VectorField
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t depth = 0;
+	// the box the grid covers in field space, the centers of the outer voxels are half a voxel inside it
+	glm::vec3 boundsMin = glm::vec3(0.f);
+	glm::vec3 boundsMax = glm::vec3(1.f);
+	std::vector<float> vectors;
+
+	size_t getNumVoxels() const { return static_cast<size_t>(width) * height * depth; }
+
+	// trilinear filtering between voxel centers with a zero border outside the box, the same as the image sampler
+	// of cl/particle.cl
+	glm::vec3 sample(const glm::vec3& position) const;
+};
+
+// reads an FGA file, the vector field format of most engines and DCC exporters:
+// comma separated text, the voxel counts, the bounds minimum and maximum, then one vector per voxel
+// returns false and sets error if the file cannot be read or is not a valid field
+bool loadVectorFieldFga(const std::string& path, VectorField* field, std::string* error);
@@ -0,0 +1,377 @@
+#include "VulkanContext.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#define RETURN_ON_ERROR(result) \
+	if ((result) != VK_SUCCESS) \
+	{ \
+		return (result); \
+	}
+
+namespace
+{
+const char* VALIDATION_LAYER_NAME = "VK_LAYER_KHRONOS_validation";
+
+bool hasInstanceLayer(const char* layerName)
+{
+	uint32_t numLayers = 0;
+	vkEnumerateInstanceLayerProperties(&numLayers, nullptr);
+	std::vector<VkLayerProperties> layers(numLayers);
+	vkEnumerateInstanceLayerProperties(&numLayers, layers.data());
+	return std::any_of(layers.begin(), layers.end(), [layerName](const VkLayerProperties& layer) { return strcmp(layer.layerName, layerName) == 0; });
+}
+
+bool isGpu(const VkPhysicalDeviceProperties& properties)
+{
+	return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+}
+
+bool matchesDeviceOverride(const VkPhysicalDeviceProperties& properties, const std::string& deviceOverride)
+{
+	if (deviceOverride == "cpu")
+	{
+		return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+	}
+	if (deviceOverride == "gpu")
+	{
+		return isGpu(properties);
+	}
+	return std::string(properties.deviceName).find(deviceOverride) != std::string::npos;
+}
+
+// the first family with both graphics and compute, then the first compute family without graphics if any,
+// false if there is no graphics and compute family
+bool findQueueFamilies(VkPhysicalDevice physicalDevice, uint32_t* graphicsQueueFamily, uint32_t* computeQueueFamily,
+	std::vector<VkQueueFamilyProperties>* queueFamilies)
+{
+	uint32_t numQueueFamilies = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &numQueueFamilies, nullptr);
+	queueFamilies->resize(numQueueFamilies);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &numQueueFamilies, queueFamilies->data());
+
+	const VkQueueFlags graphicsAndCompute = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+	bool found = false;
+	for (uint32_t i = 0; i < numQueueFamilies && !found; ++i)
+	{
+		if (((*queueFamilies)[i].queueFlags & graphicsAndCompute) == graphicsAndCompute)
+		{
+			*graphicsQueueFamily = i;
+			*computeQueueFamily = i;
+			found = true;
+		}
+	}
+	for (uint32_t i = 0; i < numQueueFamilies && found; ++i)
+	{
+		if (((*queueFamilies)[i].queueFlags & graphicsAndCompute) == VK_QUEUE_COMPUTE_BIT)
+		{
+			*computeQueueFamily = i;
+			break;
+		}
+	}
+	return found;
+}
+
+bool hasTimelineSemaphores(VkPhysicalDevice physicalDevice)
+{
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &vulkan12Features;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+	return vulkan12Features.timelineSemaphore == VK_TRUE;
+}
+}
+
+VulkanContext::VulkanContext() :
+	m_instance(VK_NULL_HANDLE),
+	m_messenger(VK_NULL_HANDLE),
+	m_numValidationMessages(0),
+	m_physicalDevice(VK_NULL_HANDLE),
+	m_properties(),
+	m_memoryProperties(),
+	m_device(VK_NULL_HANDLE),
+	m_graphicsQueueFamily(0),
+	m_computeQueueFamily(0),
+	m_graphicsQueue(VK_NULL_HANDLE),
+	m_computeQueue(VK_NULL_HANDLE),
+	m_commandPool(VK_NULL_HANDLE)
+{
+}
+
+VulkanContext::~VulkanContext()
+{
+	release();
+}
+
+VkResult VulkanContext::create(const std::string& deviceOverride, bool validation)
+{
+	release();
+	m_numValidationMessages = 0;
+	if (validation && !hasInstanceLayer(VALIDATION_LAYER_NAME))
+	{
+		return VK_ERROR_LAYER_NOT_PRESENT;
+	}
+
+	VkApplicationInfo applicationInfo = {};
+	applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	applicationInfo.pApplicationName = "CLGLParticles";
+	applicationInfo.apiVersion = VK_API_VERSION_1_2;
+
+	// also chained to the instance so that vkCreateInstance and vkDestroyInstance are reported
+	VkDebugUtilsMessengerCreateInfoEXT messengerInfo = {};
+	messengerInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	messengerInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	messengerInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+		| VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	messengerInfo.pfnUserCallback = onValidationMessage;
+	messengerInfo.pUserData = this;
+	const char* extensionName = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+
+	VkInstanceCreateInfo instanceInfo = {};
+	instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceInfo.pApplicationInfo = &applicationInfo;
+	if (validation)
+	{
+		instanceInfo.pNext = &messengerInfo;
+		instanceInfo.enabledLayerCount = 1;
+		instanceInfo.ppEnabledLayerNames = &VALIDATION_LAYER_NAME;
+		instanceInfo.enabledExtensionCount = 1;
+		instanceInfo.ppEnabledExtensionNames = &extensionName;
+	}
+	VkResult result = vkCreateInstance(&instanceInfo, nullptr, &m_instance);
+	RETURN_ON_ERROR(result);
+
+	if (validation)
+	{
+		// an extension function, the loader does not export it
+		PFN_vkCreateDebugUtilsMessengerEXT createMessenger =
+			reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(vkGetInstanceProcAddr(m_instance, "vkCreateDebugUtilsMessengerEXT"));
+		if (createMessenger == nullptr)
+		{
+			return VK_ERROR_EXTENSION_NOT_PRESENT;
+		}
+		result = createMessenger(m_instance, &messengerInfo, nullptr, &m_messenger);
+		RETURN_ON_ERROR(result);
+	}
+
+	uint32_t numPhysicalDevices = 0;
+	result = vkEnumeratePhysicalDevices(m_instance, &numPhysicalDevices, nullptr);
+	RETURN_ON_ERROR(result);
+	std::vector<VkPhysicalDevice> physicalDevices(numPhysicalDevices);
+	result = vkEnumeratePhysicalDevices(m_instance, &numPhysicalDevices, physicalDevices.data());
+	RETURN_ON_ERROR(result);
+
+	// the first supported device matching the override, without one the first GPU and the first device otherwise
+	std::vector<VkQueueFamilyProperties> queueFamilies;
+	bool selectedIsGpu = false;
+	for (VkPhysicalDevice physicalDevice : physicalDevices)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+		uint32_t graphicsQueueFamily = 0;
+		uint32_t computeQueueFamily = 0;
+		if (properties.apiVersion < VK_API_VERSION_1_2 || !hasTimelineSemaphores(physicalDevice)
+			|| !findQueueFamilies(physicalDevice, &graphicsQueueFamily, &computeQueueFamily, &queueFamilies))
+		{
+			continue;
+		}
+
+		const bool selected = deviceOverride.empty()
+			? m_physicalDevice == VK_NULL_HANDLE || (isGpu(properties) && !selectedIsGpu)
+			: m_physicalDevice == VK_NULL_HANDLE && matchesDeviceOverride(properties, deviceOverride);
+		if (selected)
+		{
+			m_physicalDevice = physicalDevice;
+			m_properties = properties;
+			m_graphicsQueueFamily = graphicsQueueFamily;
+			m_computeQueueFamily = computeQueueFamily;
+			selectedIsGpu = isGpu(properties);
+		}
+	}
+	if (m_physicalDevice == VK_NULL_HANDLE)
+	{
+		return VK_ERROR_INCOMPATIBLE_DRIVER;
+	}
+	vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memoryProperties);
+	findQueueFamilies(m_physicalDevice, &m_graphicsQueueFamily, &m_computeQueueFamily, &queueFamilies);
+
+	// a second queue of the graphics family when there is no compute-only family, the same queue without one
+	const float queuePriorities[2] = { 1.f, 1.f };
+	std::vector<VkDeviceQueueCreateInfo> queueInfos;
+	uint32_t computeQueueIndex = 0;
+	VkDeviceQueueCreateInfo queueInfo = {};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.queueFamilyIndex = m_graphicsQueueFamily;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = queuePriorities;
+	if (m_computeQueueFamily == m_graphicsQueueFamily)
+	{
+		queueInfo.queueCount = std::min(queueFamilies[m_graphicsQueueFamily].queueCount, 2u);
+		computeQueueIndex = queueInfo.queueCount - 1;
+		queueInfos.push_back(queueInfo);
+		m_queueFamilies = { m_graphicsQueueFamily };
+	}
+	else
+	{
+		queueInfos.push_back(queueInfo);
+		queueInfo.queueFamilyIndex = m_computeQueueFamily;
+		queueInfos.push_back(queueInfo);
+		m_queueFamilies = { m_graphicsQueueFamily, m_computeQueueFamily };
+	}
+
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.timelineSemaphore = VK_TRUE;
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.pNext = &vulkan12Features;
+	deviceInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
+	deviceInfo.pQueueCreateInfos = queueInfos.data();
+	result = vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device);
+	RETURN_ON_ERROR(result);
+
+	vkGetDeviceQueue(m_device, m_graphicsQueueFamily, 0, &m_graphicsQueue);
+	vkGetDeviceQueue(m_device, m_computeQueueFamily, computeQueueIndex, &m_computeQueue);
+
+	VkCommandPoolCreateInfo commandPoolInfo = {};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	commandPoolInfo.queueFamilyIndex = m_graphicsQueueFamily;
+	return vkCreateCommandPool(m_device, &commandPoolInfo, nullptr, &m_commandPool);
+}
+
+int VulkanContext::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	int found = -1;
+	for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i)
+	{
+		const VkMemoryPropertyFlags flags = m_memoryProperties.memoryTypes[i].propertyFlags;
+		if ((typeBits & (1u << i)) == 0 || (flags & required) != required)
+		{
+			continue;
+		}
+		if ((flags & preferred) == preferred)
+		{
+			return static_cast<int>(i);
+		}
+		if (found == -1)
+		{
+			found = static_cast<int>(i);
+		}
+	}
+	return found;
+}
+
+VkResult VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+	VkBuffer* buffer, VkDeviceMemory* memory) const
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = m_queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(m_queueFamilies.size());
+	bufferInfo.pQueueFamilyIndices = m_queueFamilies.data();
+	VkResult result = vkCreateBuffer(m_device, &bufferInfo, nullptr, buffer);
+	RETURN_ON_ERROR(result);
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_device, *buffer, &requirements);
+	const int memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	if (memoryType < 0)
+	{
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = requirements.size;
+	allocateInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+	result = vkAllocateMemory(m_device, &allocateInfo, nullptr, memory);
+	RETURN_ON_ERROR(result);
+
+	return vkBindBufferMemory(m_device, *buffer, *memory, 0);
+}
+
+VkResult VulkanContext::runCommands(const std::function<void(VkCommandBuffer)>& record) const
+{
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = m_commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkResult result = vkAllocateCommandBuffers(m_device, &allocateInfo, &commandBuffer);
+	RETURN_ON_ERROR(result);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (result == VK_SUCCESS)
+	{
+		record(commandBuffer);
+		result = vkEndCommandBuffer(commandBuffer);
+	}
+
+	if (result == VK_SUCCESS)
+	{
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		result = vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+	if (result == VK_SUCCESS)
+	{
+		result = vkQueueWaitIdle(m_graphicsQueue);
+	}
+
+	vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+	return result;
+}
+
+void VulkanContext::release()
+{
+	if (m_device != VK_NULL_HANDLE)
+	{
+		vkDeviceWaitIdle(m_device);
+		vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+		vkDestroyDevice(m_device, nullptr);
+	}
+	if (m_messenger != VK_NULL_HANDLE)
+	{
+		PFN_vkDestroyDebugUtilsMessengerEXT destroyMessenger =
+			reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(vkGetInstanceProcAddr(m_instance, "vkDestroyDebugUtilsMessengerEXT"));
+		destroyMessenger(m_instance, m_messenger, nullptr);
+	}
+	if (m_instance != VK_NULL_HANDLE)
+	{
+		vkDestroyInstance(m_instance, nullptr);
+	}
+
+	m_instance = VK_NULL_HANDLE;
+	m_messenger = VK_NULL_HANDLE;
+	m_physicalDevice = VK_NULL_HANDLE;
+	m_device = VK_NULL_HANDLE;
+	m_graphicsQueue = VK_NULL_HANDLE;
+	m_computeQueue = VK_NULL_HANDLE;
+	m_commandPool = VK_NULL_HANDLE;
+	m_queueFamilies.clear();
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL VulkanContext::onValidationMessage(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+	VkDebugUtilsMessageTypeFlagsEXT types, const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData)
+{
+	VulkanContext* context = static_cast<VulkanContext*>(userData);
+	++context->m_numValidationMessages;
+	std::cerr << (severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ? "Validation error: " : "Validation warning: ")
+		<< callbackData->pMessage << std::endl;
+	// the call that triggered the message goes on as if the layer was not there
+	return VK_FALSE;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// a Vulkan 1.2 instance and device without any surface, with timeline semaphores and two queues: one for graphics
+// and one for compute, from a compute-only family when the device has one so that simulation and rendering overlap
+// both are the same queue on devices with a single queue, lavapipe among them
+class VulkanContext
+{
+public:
+	VulkanContext();
+	~VulkanContext();
+
+	VulkanContext(const VulkanContext&) = delete;
+	VulkanContext& operator=(const VulkanContext&) = delete;
+
+	// deviceOverride is "cpu", "gpu" or part of a device name, empty picks the first discrete or integrated GPU, then
+	// any device, VK_ERROR_INCOMPATIBLE_DRIVER if none supports Vulkan 1.2 and timeline semaphores
+	// validation enables VK_LAYER_KHRONOS_validation, VK_ERROR_LAYER_NOT_PRESENT without it, whose warnings and errors
+	// are printed to std::cerr and counted
+	VkResult create(const std::string& deviceOverride, bool validation = false);
+
+	// index of a memory type among typeBits with the required properties, one with the preferred ones too if any,
+	// -1 if none
+	int findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+	// a buffer with a memory allocation of its own, shared by both queue families
+	VkResult createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkBuffer* buffer, VkDeviceMemory* memory) const;
+
+	// records commands into a new command buffer, runs them on the graphics queue and waits, for uploads and readbacks
+	VkResult runCommands(const std::function<void(VkCommandBuffer)>& record) const;
+
+	VkDevice getDevice() const { return m_device; }
+	VkPhysicalDevice getPhysicalDevice() const { return m_physicalDevice; }
+	const VkPhysicalDeviceProperties& getProperties() const { return m_properties; }
+	VkQueue getGraphicsQueue() const { return m_graphicsQueue; }
+	VkQueue getComputeQueue() const { return m_computeQueue; }
+	uint32_t getGraphicsQueueFamily() const { return m_graphicsQueueFamily; }
+	uint32_t getComputeQueueFamily() const { return m_computeQueueFamily; }
+	// the distinct families of both queues, the buffers they share are concurrent between them
+	const std::vector<uint32_t>& getQueueFamilies() const { return m_queueFamilies; }
+	bool hasSeparateComputeQueue() const { return m_computeQueue != m_graphicsQueue; }
+	// the validation warnings and errors since create, those of release included
+	uint32_t getNumValidationMessages() const { return m_numValidationMessages; }
+
+	// waits for the device to be idle then destroys it, also done by the destructor
+	void release();
+
+private:
+	static VKAPI_ATTR VkBool32 VKAPI_CALL onValidationMessage(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+		VkDebugUtilsMessageTypeFlagsEXT types, const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData);
+
+	VkInstance m_instance;
+	VkDebugUtilsMessengerEXT m_messenger;
+	// the layer may call back from threads of its own
+	std::atomic<uint32_t> m_numValidationMessages;
+	VkPhysicalDevice m_physicalDevice;
+	VkPhysicalDeviceProperties m_properties;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties;
+	VkDevice m_device;
+
+	uint32_t m_graphicsQueueFamily;
+	uint32_t m_computeQueueFamily;
+	std::vector<uint32_t> m_queueFamilies;
+	VkQueue m_graphicsQueue;
+	VkQueue m_computeQueue;
+
+	// for runCommands
+	VkCommandPool m_commandPool;
+};
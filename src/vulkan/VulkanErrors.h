@@ -0,0 +1,6 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+// name of a Vulkan result code, for messages
+const char* getVkResultString(VkResult result);
@@ -0,0 +1,552 @@
+#include "VulkanParticleRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "VulkanContext.h"
+#include "VulkanProfiling.h"
+
+#define RETURN_ON_ERROR(result) \
+	if ((result) != VK_SUCCESS) \
+	{ \
+		return (result); \
+	}
+
+namespace
+{
+const VkFormat COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const uint32_t PARTICLE_TEXTURE_SIZE = 64;
+
+// the std140 block of shaders/billboard.vert
+struct FrameUniforms
+{
+	glm::mat4 modelViewMatrix;
+	glm::mat4 projectionMatrix;
+	glm::mat4 modelViewProjectionMatrix;
+};
+
+void recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+	VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstAccessMask = dstAccessMask;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// white with an alpha falling off from the center, standing in for data/particle.png
+std::vector<uint8_t> generateParticleTexture(uint32_t size)
+{
+	std::vector<uint8_t> pixels(size * size * 4);
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			const float dx = (x + 0.5f) / size * 2.f - 1.f;
+			const float dy = (y + 0.5f) / size * 2.f - 1.f;
+			const float alpha = std::max(0.f, 1.f - std::sqrt(dx * dx + dy * dy));
+			uint8_t* pixel = &pixels[(y * size + x) * 4];
+			pixel[0] = 255;
+			pixel[1] = 255;
+			pixel[2] = 255;
+			pixel[3] = static_cast<uint8_t>(alpha * alpha * 255.f);
+		}
+	}
+	return pixels;
+}
+}
+
+VulkanParticleRenderer::VulkanParticleRenderer() :
+	m_device(VK_NULL_HANDLE),
+	m_width(0),
+	m_height(0),
+	m_colorImage(VK_NULL_HANDLE),
+	m_colorMemory(VK_NULL_HANDLE),
+	m_colorView(VK_NULL_HANDLE),
+	m_renderPass(VK_NULL_HANDLE),
+	m_framebuffer(VK_NULL_HANDLE),
+	m_textureImage(VK_NULL_HANDLE),
+	m_textureMemory(VK_NULL_HANDLE),
+	m_textureView(VK_NULL_HANDLE),
+	m_sampler(VK_NULL_HANDLE),
+	m_uniformBuffer(VK_NULL_HANDLE),
+	m_uniformMemory(VK_NULL_HANDLE),
+	m_uniformStride(0),
+	m_uniformData(nullptr),
+	m_descriptorSetLayout(VK_NULL_HANDLE),
+	m_descriptorPool(VK_NULL_HANDLE),
+	m_pipelineLayout(VK_NULL_HANDLE),
+	m_pipeline(VK_NULL_HANDLE)
+{
+}
+
+VulkanParticleRenderer::~VulkanParticleRenderer()
+{
+	release();
+}
+
+VkResult VulkanParticleRenderer::create(const VulkanContext& context, VkShaderModule vertexShader, VkShaderModule fragmentShader,
+	uint32_t width, uint32_t height, size_t numFrameSlots)
+{
+	release();
+	m_device = context.getDevice();
+	m_width = width;
+	m_height = height;
+
+	VkResult result = createImage(context, width, height, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		&m_colorImage, &m_colorMemory, &m_colorView);
+	RETURN_ON_ERROR(result);
+
+	// cleared every frame and left ready for readPixels
+	VkAttachmentDescription attachment = {};
+	attachment.format = COLOR_FORMAT;
+	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+
+	// the frames share the image: each waits for the writes of the previous one, the last one for readPixels
+	VkSubpassDependency dependencies[2] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &attachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.pDependencies = dependencies;
+	result = vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass);
+	RETURN_ON_ERROR(result);
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &m_colorView;
+	framebufferInfo.width = width;
+	framebufferInfo.height = height;
+	framebufferInfo.layers = 1;
+	result = vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_framebuffer);
+	RETURN_ON_ERROR(result);
+
+	result = createParticleTexture(context);
+	RETURN_ON_ERROR(result);
+
+	const VkDeviceSize alignment = std::max<VkDeviceSize>(context.getProperties().limits.minUniformBufferOffsetAlignment, 16);
+	m_uniformStride = (sizeof(FrameUniforms) + alignment - 1) / alignment * alignment;
+	result = context.createBuffer(m_uniformStride * numFrameSlots, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &m_uniformBuffer, &m_uniformMemory);
+	RETURN_ON_ERROR(result);
+	void* uniformData = nullptr;
+	result = vkMapMemory(m_device, m_uniformMemory, 0, VK_WHOLE_SIZE, 0, &uniformData);
+	RETURN_ON_ERROR(result);
+	m_uniformData = static_cast<unsigned char*>(uniformData);
+
+	// the bindings shaderc assigns to FrameUniforms and particleTexture, see VulkanShaders.h
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = 2;
+	descriptorSetLayoutInfo.pBindings = bindings;
+	result = vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutInfo, nullptr, &m_descriptorSetLayout);
+	RETURN_ON_ERROR(result);
+
+	VkDescriptorPoolSize poolSizes[2] =
+	{
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, static_cast<uint32_t>(numFrameSlots) },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, static_cast<uint32_t>(numFrameSlots) },
+	};
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolInfo.maxSets = static_cast<uint32_t>(numFrameSlots);
+	descriptorPoolInfo.poolSizeCount = 2;
+	descriptorPoolInfo.pPoolSizes = poolSizes;
+	result = vkCreateDescriptorPool(m_device, &descriptorPoolInfo, nullptr, &m_descriptorPool);
+	RETURN_ON_ERROR(result);
+
+	const std::vector<VkDescriptorSetLayout> setLayouts(numFrameSlots, m_descriptorSetLayout);
+	VkDescriptorSetAllocateInfo descriptorSetInfo = {};
+	descriptorSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetInfo.descriptorPool = m_descriptorPool;
+	descriptorSetInfo.descriptorSetCount = static_cast<uint32_t>(numFrameSlots);
+	descriptorSetInfo.pSetLayouts = setLayouts.data();
+	m_descriptorSets.resize(numFrameSlots);
+	result = vkAllocateDescriptorSets(m_device, &descriptorSetInfo, m_descriptorSets.data());
+	RETURN_ON_ERROR(result);
+
+	for (size_t i = 0; i < numFrameSlots; ++i)
+	{
+		const VkDescriptorBufferInfo bufferInfo = { m_uniformBuffer, i * m_uniformStride, sizeof(FrameUniforms) };
+		const VkDescriptorImageInfo imageInfo = { m_sampler, m_textureView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		VkWriteDescriptorSet writes[2] = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = m_descriptorSets[i];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		writes[0].pBufferInfo = &bufferInfo;
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = m_descriptorSets[i];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorCount = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[1].pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(m_device, 2, writes, 0, nullptr);
+	}
+
+	return createPipeline(vertexShader, fragmentShader);
+}
+
+void VulkanParticleRenderer::setFrameUniforms(size_t frameSlot, const glm::mat4& modelViewMatrix, const glm::mat4& projectionMatrix)
+{
+	FrameUniforms frameUniforms;
+	frameUniforms.modelViewMatrix = modelViewMatrix;
+	frameUniforms.projectionMatrix = projectionMatrix;
+	frameUniforms.modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
+	memcpy(m_uniformData + frameSlot * m_uniformStride, &frameUniforms, sizeof(frameUniforms));
+}
+
+void VulkanParticleRenderer::recordDraw(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, size_t frameSlot, VkBuffer buffer,
+	VkDeviceSize positionsOffset, VkDeviceSize drawCommandsOffset)
+{
+	if (timestamps != nullptr)
+	{
+		timestamps->begin(commandBuffer, "drawInstanced");
+	}
+
+	VkClearValue clearValue = {};
+	clearValue.color.float32[3] = 1.f;
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = m_renderPass;
+	renderPassBeginInfo.framebuffer = m_framebuffer;
+	renderPassBeginInfo.renderArea.extent = { m_width, m_height };
+	renderPassBeginInfo.clearValueCount = 1;
+	renderPassBeginInfo.pClearValues = &clearValue;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[frameSlot], 0, nullptr);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffer, &positionsOffset);
+	vkCmdDrawIndirect(commandBuffer, buffer, drawCommandsOffset + sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+
+	vkCmdEndRenderPass(commandBuffer);
+
+	if (timestamps != nullptr)
+	{
+		timestamps->end(commandBuffer);
+	}
+}
+
+VkResult VulkanParticleRenderer::readPixels(const VulkanContext& context, std::vector<uint8_t>& pixels)
+{
+	VkBuffer readbackBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory readbackMemory = VK_NULL_HANDLE;
+	const VkDeviceSize size = static_cast<VkDeviceSize>(m_width) * m_height * 4;
+	VkResult result = context.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &readbackBuffer, &readbackMemory);
+
+	if (result == VK_SUCCESS)
+	{
+		result = context.runCommands([this, readbackBuffer](VkCommandBuffer commandBuffer)
+		{
+			VkBufferImageCopy region = {};
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = { m_width, m_height, 1 };
+			vkCmdCopyImageToBuffer(commandBuffer, m_colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		});
+	}
+
+	void* data = nullptr;
+	if (result == VK_SUCCESS)
+	{
+		result = vkMapMemory(m_device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &data);
+	}
+	if (result == VK_SUCCESS)
+	{
+		pixels.resize(static_cast<size_t>(size));
+		memcpy(pixels.data(), data, pixels.size());
+		vkUnmapMemory(m_device, readbackMemory);
+	}
+
+	vkDestroyBuffer(m_device, readbackBuffer, nullptr);
+	vkFreeMemory(m_device, readbackMemory, nullptr);
+	return result;
+}
+
+VkResult VulkanParticleRenderer::createImage(const VulkanContext& context, uint32_t width, uint32_t height, VkImageUsageFlags usage,
+	VkImage* image, VkDeviceMemory* memory, VkImageView* imageView)
+{
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = COLOR_FORMAT;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkResult result = vkCreateImage(m_device, &imageInfo, nullptr, image);
+	RETURN_ON_ERROR(result);
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_device, *image, &requirements);
+	const int memoryType = context.findMemoryType(requirements.memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (memoryType < 0)
+	{
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = requirements.size;
+	allocateInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+	result = vkAllocateMemory(m_device, &allocateInfo, nullptr, memory);
+	RETURN_ON_ERROR(result);
+	result = vkBindImageMemory(m_device, *image, *memory, 0);
+	RETURN_ON_ERROR(result);
+
+	VkImageViewCreateInfo imageViewInfo = {};
+	imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	imageViewInfo.image = *image;
+	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	imageViewInfo.format = COLOR_FORMAT;
+	imageViewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	return vkCreateImageView(m_device, &imageViewInfo, nullptr, imageView);
+}
+
+VkResult VulkanParticleRenderer::createParticleTexture(const VulkanContext& context)
+{
+	VkResult result = createImage(context, PARTICLE_TEXTURE_SIZE, PARTICLE_TEXTURE_SIZE,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, &m_textureImage, &m_textureMemory, &m_textureView);
+	RETURN_ON_ERROR(result);
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	result = vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler);
+	RETURN_ON_ERROR(result);
+
+	// through a host-visible staging buffer, copied then dropped
+	const std::vector<uint8_t> pixels = generateParticleTexture(PARTICLE_TEXTURE_SIZE);
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	result = context.createBuffer(pixels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingMemory);
+
+	void* data = nullptr;
+	if (result == VK_SUCCESS)
+	{
+		result = vkMapMemory(m_device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &data);
+	}
+	if (result == VK_SUCCESS)
+	{
+		memcpy(data, pixels.data(), pixels.size());
+		vkUnmapMemory(m_device, stagingMemory);
+
+		result = context.runCommands([this, stagingBuffer](VkCommandBuffer commandBuffer)
+		{
+			recordImageBarrier(commandBuffer, m_textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+			VkBufferImageCopy region = {};
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = { PARTICLE_TEXTURE_SIZE, PARTICLE_TEXTURE_SIZE, 1 };
+			vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, m_textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+			recordImageBarrier(commandBuffer, m_textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		});
+	}
+
+	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	vkFreeMemory(m_device, stagingMemory, nullptr);
+	return result;
+}
+
+VkResult VulkanParticleRenderer::createPipeline(VkShaderModule vertexShader, VkShaderModule fragmentShader)
+{
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+	VkResult result = vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+	RETURN_ON_ERROR(result);
+
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = vertexShader;
+	stages[0].pName = "main";
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = fragmentShader;
+	stages[1].pName = "main";
+
+	// one tightly packed position per instance, w defaults to 1 like the GL vertex arrays
+	const VkVertexInputBindingDescription vertexBinding = { 0, 3 * sizeof(float), VK_VERTEX_INPUT_RATE_INSTANCE };
+	const VkVertexInputAttributeDescription positionAttribute = { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 };
+	VkPipelineVertexInputStateCreateInfo vertexInputState = {};
+	vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputState.vertexBindingDescriptionCount = 1;
+	vertexInputState.pVertexBindingDescriptions = &vertexBinding;
+	vertexInputState.vertexAttributeDescriptionCount = 1;
+	vertexInputState.pVertexAttributeDescriptions = &positionAttribute;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+
+	// flipped so that the GL projection keeps y up
+	const VkViewport viewport = { 0.f, static_cast<float>(m_height), static_cast<float>(m_width), -static_cast<float>(m_height), 0.f, 1.f };
+	const VkRect2D scissor = { { 0, 0 }, { m_width, m_height } };
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &scissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+	rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizationState.cullMode = VK_CULL_MODE_NONE;
+	rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizationState.lineWidth = 1.f;
+
+	VkPipelineMultisampleStateCreateInfo multisampleState = {};
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA), no depth test
+	VkPipelineColorBlendAttachmentState blendAttachment = {};
+	blendAttachment.blendEnable = VK_TRUE;
+	blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+	colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendState.attachmentCount = 1;
+	colorBlendState.pAttachments = &blendAttachment;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInputState;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyState;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizationState;
+	pipelineInfo.pMultisampleState = &multisampleState;
+	pipelineInfo.pColorBlendState = &colorBlendState;
+	pipelineInfo.layout = m_pipelineLayout;
+	pipelineInfo.renderPass = m_renderPass;
+	pipelineInfo.subpass = 0;
+	return vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_pipeline);
+}
+
+void VulkanParticleRenderer::release()
+{
+	if (m_device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyPipeline(m_device, m_pipeline, nullptr);
+	vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+	m_descriptorSets.clear();
+
+	if (m_uniformData != nullptr)
+	{
+		vkUnmapMemory(m_device, m_uniformMemory);
+	}
+	vkDestroyBuffer(m_device, m_uniformBuffer, nullptr);
+	vkFreeMemory(m_device, m_uniformMemory, nullptr);
+
+	vkDestroySampler(m_device, m_sampler, nullptr);
+	vkDestroyImageView(m_device, m_textureView, nullptr);
+	vkDestroyImage(m_device, m_textureImage, nullptr);
+	vkFreeMemory(m_device, m_textureMemory, nullptr);
+
+	vkDestroyFramebuffer(m_device, m_framebuffer, nullptr);
+	vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+	vkDestroyImageView(m_device, m_colorView, nullptr);
+	vkDestroyImage(m_device, m_colorImage, nullptr);
+	vkFreeMemory(m_device, m_colorMemory, nullptr);
+
+	m_pipeline = VK_NULL_HANDLE;
+	m_pipelineLayout = VK_NULL_HANDLE;
+	m_descriptorPool = VK_NULL_HANDLE;
+	m_descriptorSetLayout = VK_NULL_HANDLE;
+	m_uniformData = nullptr;
+	m_uniformBuffer = VK_NULL_HANDLE;
+	m_uniformMemory = VK_NULL_HANDLE;
+	m_sampler = VK_NULL_HANDLE;
+	m_textureView = VK_NULL_HANDLE;
+	m_textureImage = VK_NULL_HANDLE;
+	m_textureMemory = VK_NULL_HANDLE;
+	m_framebuffer = VK_NULL_HANDLE;
+	m_renderPass = VK_NULL_HANDLE;
+	m_colorView = VK_NULL_HANDLE;
+	m_colorImage = VK_NULL_HANDLE;
+	m_colorMemory = VK_NULL_HANDLE;
+	m_device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class VulkanContext;
+class VulkanTimestamps;
+
+// draws the render positions of VulkanParticleSimulation as instanced quads, shaders/billboard.vert and
+// shaders/shader.frag blended like the GL paths, into an offscreen color image: there is no window to present to
+// the particle texture is generated, data/particle.png needs SDL_image
+class VulkanParticleRenderer
+{
+public:
+	VulkanParticleRenderer();
+	~VulkanParticleRenderer();
+
+	VulkanParticleRenderer(const VulkanParticleRenderer&) = delete;
+	VulkanParticleRenderer& operator=(const VulkanParticleRenderer&) = delete;
+
+	// the shader modules are still owned by the caller, each of the numFrameSlots frames in flight has its own
+	// frame uniforms
+	VkResult create(const VulkanContext& context, VkShaderModule vertexShader, VkShaderModule fragmentShader,
+		uint32_t width, uint32_t height, size_t numFrameSlots);
+
+	// writes the FrameUniforms of shaders/billboard.vert, the commands of the last frame using the slot must have completed
+	void setFrameUniforms(size_t frameSlot, const glm::mat4& modelViewMatrix, const glm::mat4& projectionMatrix);
+
+	// clears the image then draws the positions at positionsOffset in buffer with the instanced quad command of the two
+	// at drawCommandsOffset, timestamps may be nullptr
+	void recordDraw(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, size_t frameSlot, VkBuffer buffer,
+		VkDeviceSize positionsOffset, VkDeviceSize drawCommandsOffset);
+
+	// RGBA rows from the top, once every draw completed
+	VkResult readPixels(const VulkanContext& context, std::vector<uint8_t>& pixels);
+
+	uint32_t getWidth() const { return m_width; }
+	uint32_t getHeight() const { return m_height; }
+
+	// also done by the destructor, the device must be done with the recorded commands
+	void release();
+
+private:
+	VkResult createImage(const VulkanContext& context, uint32_t width, uint32_t height, VkImageUsageFlags usage,
+		VkImage* image, VkDeviceMemory* memory, VkImageView* imageView);
+	VkResult createParticleTexture(const VulkanContext& context);
+	VkResult createPipeline(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+
+	VkDevice m_device;
+	uint32_t m_width;
+	uint32_t m_height;
+
+	VkImage m_colorImage;
+	VkDeviceMemory m_colorMemory;
+	VkImageView m_colorView;
+	VkRenderPass m_renderPass;
+	VkFramebuffer m_framebuffer;
+
+	VkImage m_textureImage;
+	VkDeviceMemory m_textureMemory;
+	VkImageView m_textureView;
+	VkSampler m_sampler;
+
+	// one range per frame slot, mapped for the lifetime of the renderer
+	VkBuffer m_uniformBuffer;
+	VkDeviceMemory m_uniformMemory;
+	VkDeviceSize m_uniformStride;
+	unsigned char* m_uniformData;
+
+	VkDescriptorSetLayout m_descriptorSetLayout;
+	VkDescriptorPool m_descriptorPool;
+	std::vector<VkDescriptorSet> m_descriptorSets;
+	VkPipelineLayout m_pipelineLayout;
+	VkPipeline m_pipeline;
+};
@@ -0,0 +1,357 @@
+#include "VulkanParticleSimulation.h"
+
+#include <algorithm>
+
+#include "VulkanContext.h"
+#include "VulkanProfiling.h"
+
+#define RETURN_ON_ERROR(result) \
+	if ((result) != VK_SUCCESS) \
+	{ \
+		return (result); \
+	}
+
+namespace
+{
+const char* KERNEL_DEFINES[NUM_VULKAN_PARTICLE_KERNELS] =
+{
+	"INIT_PARTICLE_STATE",
+	"SPAWN_PARTICLE",
+	"SIMULATE_PARTICLES",
+	"COUNT_ALIVE_PARTICLES",
+	"SCAN_BLOCK_COUNTS",
+	"COMPACT_ALIVE_PARTICLES",
+};
+
+const uint32_t RENDER_POSITIONS_BINDING = 9;
+const uint32_t DRAW_COMMANDS_BINDING = 10;
+const uint32_t NUM_BINDINGS = 11;
+
+VkDeviceSize alignOffset(VkDeviceSize offset, VkDeviceSize alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// the shader writes of the previous dispatches, made visible to the stages and accesses that follow
+void recordShaderWriteBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStageMask, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void recordComputeBarrier(VkCommandBuffer commandBuffer)
+{
+	recordShaderWriteBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+// the alive count and the indirect arguments of the next simulate dispatch
+void recordIndirectBarrier(VkCommandBuffer commandBuffer)
+{
+	recordShaderWriteBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+}
+}
+
+std::string getVulkanParticleKernelSource(VulkanParticleKernel kernel, const std::vector<std::string>& sources)
+{
+	std::string source = "#version 450\n#define ";
+	source += KERNEL_DEFINES[static_cast<size_t>(kernel)];
+	source += "\n";
+	for (const std::string& part : sources)
+	{
+		source += part;
+		source += "\n";
+	}
+	return source;
+}
+
+VulkanParticleSimulation::VulkanParticleSimulation() :
+	m_device(VK_NULL_HANDLE),
+	m_maxNumParticles(0),
+	m_pushConstants(),
+	m_nextSpawnId(0),
+	m_memory(VK_NULL_HANDLE),
+	m_buffer(VK_NULL_HANDLE),
+	m_storageBufferOffsets(),
+	m_storageBufferSizes(),
+	m_descriptorSetLayout(VK_NULL_HANDLE),
+	m_descriptorPool(VK_NULL_HANDLE),
+	m_pipelineLayout(VK_NULL_HANDLE)
+{
+}
+
+VulkanParticleSimulation::~VulkanParticleSimulation()
+{
+	release();
+}
+
+VkResult VulkanParticleSimulation::create(const VulkanContext& context, const std::vector<VkShaderModule>& shaderModules,
+	size_t maxNumParticles, size_t numRenderSlots)
+{
+	release();
+	m_device = context.getDevice();
+	m_maxNumParticles = maxNumParticles;
+
+	// the count and compaction kernels are dispatched over every particle
+	const VkPhysicalDeviceLimits& limits = context.getProperties().limits;
+	if (shaderModules.size() != NUM_VULKAN_PARTICLE_KERNELS || maxNumParticles == 0 || numRenderSlots == 0
+		|| getNumGroups(maxNumParticles) > limits.maxComputeWorkGroupCount[0])
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	m_pushConstants = PushConstants();
+	m_nextSpawnId = 0;
+	m_pushConstants.numParticles = static_cast<uint32_t>(maxNumParticles);
+	m_pushConstants.renderCapacity = static_cast<uint32_t>(maxNumParticles);
+
+	// the ranges of the single buffer, each at an offset storage buffer descriptors accept
+	const VkDeviceSize alignment = std::max<VkDeviceSize>(limits.minStorageBufferOffsetAlignment, 16);
+	const VkDeviceSize positionsSize = maxNumParticles * 3 * sizeof(float);
+	const VkDeviceSize sizes[NumStorageBuffers] =
+	{
+		positionsSize,
+		positionsSize,
+		maxNumParticles * sizeof(float),
+		maxNumParticles * sizeof(uint32_t),
+		maxNumParticles * sizeof(uint32_t),
+		getNumGroups(maxNumParticles) * sizeof(uint32_t),
+		maxNumParticles * sizeof(uint32_t),
+		// freeCount, aliveCount and the three simulateGroups
+		5 * sizeof(uint32_t),
+		maxNumParticles * sizeof(uint32_t),
+	};
+	VkDeviceSize size = 0;
+	for (int i = 0; i < NumStorageBuffers; ++i)
+	{
+		m_storageBufferOffsets[i] = size;
+		m_storageBufferSizes[i] = sizes[i];
+		size = alignOffset(size + sizes[i], alignment);
+	}
+	for (size_t i = 0; i < numRenderSlots; ++i)
+	{
+		RenderSlotOffsets offsets;
+		offsets.renderPositions = size;
+		offsets.drawCommands = alignOffset(size + positionsSize, alignment);
+		m_renderSlotOffsets.push_back(offsets);
+		size = alignOffset(offsets.drawCommands + 2 * sizeof(VkDrawIndirectCommand), alignment);
+	}
+
+	VkResult result = context.createBuffer(size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m_buffer, &m_memory);
+	RETURN_ON_ERROR(result);
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings(NUM_BINDINGS);
+	for (uint32_t i = 0; i < NUM_BINDINGS; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo = {};
+	descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptorSetLayoutInfo.bindingCount = NUM_BINDINGS;
+	descriptorSetLayoutInfo.pBindings = bindings.data();
+	result = vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutInfo, nullptr, &m_descriptorSetLayout);
+	RETURN_ON_ERROR(result);
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = static_cast<uint32_t>(NUM_BINDINGS * numRenderSlots);
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolInfo.maxSets = static_cast<uint32_t>(numRenderSlots);
+	descriptorPoolInfo.poolSizeCount = 1;
+	descriptorPoolInfo.pPoolSizes = &poolSize;
+	result = vkCreateDescriptorPool(m_device, &descriptorPoolInfo, nullptr, &m_descriptorPool);
+	RETURN_ON_ERROR(result);
+
+	const std::vector<VkDescriptorSetLayout> setLayouts(numRenderSlots, m_descriptorSetLayout);
+	VkDescriptorSetAllocateInfo descriptorSetInfo = {};
+	descriptorSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetInfo.descriptorPool = m_descriptorPool;
+	descriptorSetInfo.descriptorSetCount = static_cast<uint32_t>(numRenderSlots);
+	descriptorSetInfo.pSetLayouts = setLayouts.data();
+	m_descriptorSets.resize(numRenderSlots);
+	result = vkAllocateDescriptorSets(m_device, &descriptorSetInfo, m_descriptorSets.data());
+	RETURN_ON_ERROR(result);
+
+	// the same particle ranges in every set, the render slot ranges of its own slot
+	for (size_t slot = 0; slot < numRenderSlots; ++slot)
+	{
+		VkDescriptorBufferInfo bufferInfos[NUM_BINDINGS];
+		for (int i = 0; i < NumStorageBuffers; ++i)
+		{
+			bufferInfos[i] = { m_buffer, m_storageBufferOffsets[i], m_storageBufferSizes[i] };
+		}
+		bufferInfos[RENDER_POSITIONS_BINDING] = { m_buffer, m_renderSlotOffsets[slot].renderPositions, positionsSize };
+		bufferInfos[DRAW_COMMANDS_BINDING] = { m_buffer, m_renderSlotOffsets[slot].drawCommands, 2 * sizeof(VkDrawIndirectCommand) };
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_descriptorSets[slot];
+		write.dstBinding = 0;
+		write.descriptorCount = NUM_BINDINGS;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = bufferInfos;
+		vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.size = sizeof(PushConstants);
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	result = vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+	RETURN_ON_ERROR(result);
+
+	std::vector<VkComputePipelineCreateInfo> pipelineInfos(NUM_VULKAN_PARTICLE_KERNELS);
+	for (size_t i = 0; i < NUM_VULKAN_PARTICLE_KERNELS; ++i)
+	{
+		pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfos[i].stage.module = shaderModules[i];
+		pipelineInfos[i].stage.pName = "main";
+		pipelineInfos[i].layout = m_pipelineLayout;
+	}
+	m_pipelines.resize(NUM_VULKAN_PARTICLE_KERNELS, VK_NULL_HANDLE);
+	return vkCreateComputePipelines(m_device, VK_NULL_HANDLE, static_cast<uint32_t>(pipelineInfos.size()), pipelineInfos.data(),
+		nullptr, m_pipelines.data());
+}
+
+void VulkanParticleSimulation::recordInit(VkCommandBuffer commandBuffer)
+{
+	dispatch(commandBuffer, m_descriptorSets[0], VulkanParticleKernel::InitParticleState, getNumGroups(m_maxNumParticles));
+	recordIndirectBarrier(commandBuffer);
+}
+
+void VulkanParticleSimulation::recordSubstep(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, uint32_t seed, uint32_t step,
+	float currentTime, float deltaTime, uint32_t numParticlesToSpawn)
+{
+	m_pushConstants.seed = seed;
+	m_pushConstants.stepIndex = step;
+	m_pushConstants.currentTime = currentTime;
+	m_pushConstants.deltaTime = deltaTime;
+	m_pushConstants.numParticlesToSpawn = static_cast<uint32_t>(std::min<size_t>(numParticlesToSpawn, m_maxNumParticles));
+	// spawn ids count the requested particles like on OpenCL, dropped ones included
+	m_pushConstants.firstSpawnId = m_nextSpawnId;
+	m_nextSpawnId += numParticlesToSpawn;
+
+	// the group count was written by the last compaction, the barrier after it made it visible to the command
+	if (timestamps != nullptr)
+	{
+		timestamps->begin(commandBuffer, "simulateParticles");
+	}
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[static_cast<size_t>(VulkanParticleKernel::SimulateParticles)]);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSets[0], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &m_pushConstants);
+	vkCmdDispatchIndirect(commandBuffer, m_buffer, m_storageBufferOffsets[Counters] + SIMULATE_GROUPS_OFFSET);
+	if (timestamps != nullptr)
+	{
+		timestamps->end(commandBuffer);
+	}
+
+	// the free list pushed by the deaths above is popped by the spawns
+	if (m_pushConstants.numParticlesToSpawn > 0)
+	{
+		recordComputeBarrier(commandBuffer);
+		if (timestamps != nullptr)
+		{
+			timestamps->begin(commandBuffer, "spawnParticle");
+		}
+		dispatch(commandBuffer, m_descriptorSets[0], VulkanParticleKernel::SpawnParticle, getNumGroups(m_pushConstants.numParticlesToSpawn));
+		if (timestamps != nullptr)
+		{
+			timestamps->end(commandBuffer);
+		}
+	}
+
+	recordComputeBarrier(commandBuffer);
+}
+
+void VulkanParticleSimulation::recordCompaction(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, size_t renderSlot,
+	float renderTimeOffset)
+{
+	m_pushConstants.renderTimeOffset = renderTimeOffset;
+
+	const VkDescriptorSet descriptorSet = m_descriptorSets[renderSlot];
+	const uint32_t numBlocks = getNumGroups(m_maxNumParticles);
+	const struct
+	{
+		VulkanParticleKernel kernel;
+		const char* phase;
+		uint32_t numGroups;
+	} passes[3] =
+	{
+		{ VulkanParticleKernel::CountAliveParticles, "countAliveParticles", numBlocks },
+		{ VulkanParticleKernel::ScanBlockCounts, "scanBlockCounts", 1 },
+		{ VulkanParticleKernel::CompactAliveParticles, "compactAliveParticles", numBlocks },
+	};
+	for (size_t i = 0; i < 3; ++i)
+	{
+		if (i > 0)
+		{
+			recordComputeBarrier(commandBuffer);
+		}
+		if (timestamps != nullptr)
+		{
+			timestamps->begin(commandBuffer, passes[i].phase);
+		}
+		dispatch(commandBuffer, descriptorSet, passes[i].kernel, passes[i].numGroups);
+		if (timestamps != nullptr)
+		{
+			timestamps->end(commandBuffer);
+		}
+	}
+
+	// the draws of the slot wait on a semaphore signaled after these commands, which also makes the writes visible
+	recordIndirectBarrier(commandBuffer);
+}
+
+void VulkanParticleSimulation::dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, VulkanParticleKernel kernel,
+	uint32_t numGroups)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[static_cast<size_t>(kernel)]);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &m_pushConstants);
+	vkCmdDispatch(commandBuffer, numGroups, 1, 1);
+}
+
+void VulkanParticleSimulation::release()
+{
+	if (m_device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (VkPipeline pipeline : m_pipelines)
+	{
+		vkDestroyPipeline(m_device, pipeline, nullptr);
+	}
+	m_pipelines.clear();
+	vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+	m_descriptorSets.clear();
+	vkDestroyBuffer(m_device, m_buffer, nullptr);
+	vkFreeMemory(m_device, m_memory, nullptr);
+	m_renderSlotOffsets.clear();
+
+	m_pipelineLayout = VK_NULL_HANDLE;
+	m_descriptorPool = VK_NULL_HANDLE;
+	m_descriptorSetLayout = VK_NULL_HANDLE;
+	m_buffer = VK_NULL_HANDLE;
+	m_memory = VK_NULL_HANDLE;
+	m_maxNumParticles = 0;
+	m_device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class VulkanContext;
+class VulkanTimestamps;
+
+// the kernels of shaders/particle.comp, one compute pipeline each
+enum class VulkanParticleKernel
+{
+	InitParticleState,
+	SpawnParticle,
+	SimulateParticles,
+	CountAliveParticles,
+	ScanBlockCounts,
+	CompactAliveParticles,
+};
+
+const size_t NUM_VULKAN_PARTICLE_KERNELS = 6;
+
+// the #version line and the define selecting the kernel, then the sources in order
+std::string getVulkanParticleKernelSource(VulkanParticleKernel kernel, const std::vector<std::string>& sources);
+
+// the particle simulation of GlParticleSimulation recorded into Vulkan command buffers
+// all of its memory is one device-local allocation holding a single buffer, whose ranges are the particle state and
+// lists, then per render slot the positions to draw and their two VkDrawIndirectCommands, so that the compaction of
+// one frame can write a slot while the draws of the previous frame read another
+// the recorded commands are ordered by pipeline barriers, the caller orders the command buffers of both queues
+// the storage of maxNumParticles particles is allocated up front, there is no paging and no force field
+class VulkanParticleSimulation
+{
+public:
+	VulkanParticleSimulation();
+	~VulkanParticleSimulation();
+
+	VulkanParticleSimulation(const VulkanParticleSimulation&) = delete;
+	VulkanParticleSimulation& operator=(const VulkanParticleSimulation&) = delete;
+
+	// creates the pipelines from the shader modules, indexed by VulkanParticleKernel and still owned by the caller,
+	// then allocates the particles and numRenderSlots render slots of maxNumParticles positions each
+	VkResult create(const VulkanContext& context, const std::vector<VkShaderModule>& shaderModules, size_t maxNumParticles,
+		size_t numRenderSlots);
+
+	// initParticleState, recorded once before the first substep
+	void recordInit(VkCommandBuffer commandBuffer);
+
+	// simulates the alive list then spawns numParticlesToSpawn particles, like GlParticleSimulation::dispatchSubstep
+	// including its spawn ids, timestamps may be nullptr
+	void recordSubstep(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, uint32_t seed, uint32_t step,
+		float currentTime, float deltaTime, uint32_t numParticlesToSpawn);
+
+	// rebuilds the alive list and writes the alive positions, moved by renderTimeOffset seconds of velocity, and the
+	// draw commands of renderSlot
+	void recordCompaction(VkCommandBuffer commandBuffer, VulkanTimestamps* timestamps, size_t renderSlot, float renderTimeOffset);
+
+	size_t getMaxNumParticles() const { return m_maxNumParticles; }
+	// usable as a vertex and an indirect buffer
+	VkBuffer getBuffer() const { return m_buffer; }
+	// three floats per position, densely packed
+	VkDeviceSize getRenderPositionsOffset(size_t renderSlot) const { return m_renderSlotOffsets[renderSlot].renderPositions; }
+	// the point command, then the instanced quad command
+	VkDeviceSize getDrawCommandsOffset(size_t renderSlot) const { return m_renderSlotOffsets[renderSlot].drawCommands; }
+
+	// also done by the destructor, the device must be done with the recorded commands
+	void release();
+
+	// local_size_x of every kernel, WORK_GROUP_SIZE in shaders/particle.comp
+	static constexpr uint32_t WORK_GROUP_SIZE = 256;
+
+private:
+	// storage buffer bindings 0 to 8 of shaders/particle.comp
+	enum StorageBuffer
+	{
+		Positions,
+		Velocities,
+		SpawnTimes,
+		IsAlive,
+		AliveIndices,
+		BlockCounts,
+		FreeIndices,
+		Counters,
+		SpawnIds,
+		NumStorageBuffers
+	};
+
+	// bindings 9 and 10
+	struct RenderSlotOffsets
+	{
+		VkDeviceSize renderPositions;
+		VkDeviceSize drawCommands;
+	};
+
+	// the uniforms of shaders/particle.comp, in the order of its push constant block
+	struct PushConstants
+	{
+		uint32_t seed;
+		uint32_t stepIndex;
+		float currentTime;
+		float deltaTime;
+		uint32_t numParticlesToSpawn;
+		uint32_t numParticles;
+		float renderTimeOffset;
+		uint32_t renderCapacity;
+		uint32_t firstSpawnId;
+	};
+
+	// the dispatch arguments of simulateParticles in the counters
+	static constexpr VkDeviceSize SIMULATE_GROUPS_OFFSET = 2 * sizeof(uint32_t);
+
+	uint32_t getNumGroups(size_t numWorkItems) const { return static_cast<uint32_t>((numWorkItems + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE); }
+	void dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, VulkanParticleKernel kernel, uint32_t numGroups);
+
+	VkDevice m_device;
+	size_t m_maxNumParticles;
+	PushConstants m_pushConstants;
+	// spawn id of the next particle to spawn
+	uint32_t m_nextSpawnId;
+
+	VkDeviceMemory m_memory;
+	VkBuffer m_buffer;
+	VkDeviceSize m_storageBufferOffsets[NumStorageBuffers];
+	VkDeviceSize m_storageBufferSizes[NumStorageBuffers];
+	std::vector<RenderSlotOffsets> m_renderSlotOffsets;
+
+	VkDescriptorSetLayout m_descriptorSetLayout;
+	VkDescriptorPool m_descriptorPool;
+	// one per render slot, the substeps use the first
+	std::vector<VkDescriptorSet> m_descriptorSets;
+	VkPipelineLayout m_pipelineLayout;
+	std::vector<VkPipeline> m_pipelines;
+};
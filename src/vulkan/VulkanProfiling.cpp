@@ -0,0 +1,132 @@
+#include "VulkanProfiling.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "VulkanContext.h"
+#include "engine/PhaseTimings.h"
+
+VulkanTimestamps::VulkanTimestamps() :
+	m_device(VK_NULL_HANDLE),
+	m_queryPool(VK_NULL_HANDLE),
+	m_maxNumCommands(0),
+	m_timestampPeriod(0.0),
+	m_timing(false)
+{
+}
+
+VulkanTimestamps::~VulkanTimestamps()
+{
+	release();
+}
+
+VkResult VulkanTimestamps::create(const VulkanContext& context, uint32_t maxNumCommands)
+{
+	release();
+	m_device = context.getDevice();
+	m_maxNumCommands = maxNumCommands;
+
+	const VkPhysicalDeviceLimits& limits = context.getProperties().limits;
+	if (!limits.timestampComputeAndGraphics || maxNumCommands == 0)
+	{
+		return VK_SUCCESS;
+	}
+	m_timestampPeriod = limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * maxNumCommands;
+	return vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_queryPool);
+}
+
+void VulkanTimestamps::reset(VkCommandBuffer commandBuffer)
+{
+	m_phases.clear();
+	m_timing = false;
+	if (m_queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, m_queryPool, 0, 2 * m_maxNumCommands);
+	}
+}
+
+void VulkanTimestamps::begin(VkCommandBuffer commandBuffer, const char* phase)
+{
+	if (m_queryPool == VK_NULL_HANDLE || m_phases.size() >= m_maxNumCommands)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, static_cast<uint32_t>(2 * m_phases.size()));
+	m_phases.push_back(phase);
+	m_timing = true;
+}
+
+void VulkanTimestamps::end(VkCommandBuffer commandBuffer)
+{
+	if (!m_timing)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, static_cast<uint32_t>(2 * m_phases.size() - 1));
+	m_timing = false;
+}
+
+VkResult VulkanTimestamps::addSamples(PhaseTimings& timings, const char* framePhase, const std::string& phasePrefix)
+{
+	if (m_phases.empty())
+	{
+		return VK_SUCCESS;
+	}
+
+	std::vector<uint64_t> timestamps(2 * m_phases.size());
+	const VkResult result = vkGetQueryPoolResults(m_device, m_queryPool, 0, static_cast<uint32_t>(timestamps.size()),
+		timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	if (result != VK_SUCCESS)
+	{
+		return result;
+	}
+
+	// substeps record the same commands several times, one sample per phase and per recording
+	std::vector<std::pair<std::string, double>> frameTimes;
+	uint64_t frameStart = UINT64_MAX;
+	uint64_t frameEnd = 0;
+	for (size_t i = 0; i < m_phases.size(); ++i)
+	{
+		const uint64_t start = timestamps[2 * i];
+		const uint64_t end = std::max(timestamps[2 * i + 1], start);
+		frameStart = std::min(frameStart, start);
+		frameEnd = std::max(frameEnd, end);
+
+		const char* phase = m_phases[i];
+		auto it = std::find_if(frameTimes.begin(), frameTimes.end(),
+			[phase](const std::pair<std::string, double>& frameTime) { return frameTime.first == phase; });
+		if (it == frameTimes.end())
+		{
+			it = frameTimes.insert(frameTimes.end(), { phase, 0.0 });
+		}
+		it->second += static_cast<double>(end - start) * m_timestampPeriod * 1e-6;
+	}
+	m_phases.clear();
+
+	for (const std::pair<std::string, double>& frameTime : frameTimes)
+	{
+		timings.addSample(phasePrefix + frameTime.first, frameTime.second);
+	}
+
+	if (framePhase != nullptr && frameEnd > frameStart)
+	{
+		timings.addSample(phasePrefix + framePhase, static_cast<double>(frameEnd - frameStart) * m_timestampPeriod * 1e-6);
+	}
+	return VK_SUCCESS;
+}
+
+void VulkanTimestamps::release()
+{
+	if (m_queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+	}
+	m_queryPool = VK_NULL_HANDLE;
+	m_timestampPeriod = 0.0;
+	m_phases.clear();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class PhaseTimings;
+class VulkanContext;
+
+// timestamps around the commands of one command buffer, the Vulkan counterpart of ClProfilingEvent
+// every command buffer in flight needs its own, the queries are read once it completed
+class VulkanTimestamps
+{
+public:
+	VulkanTimestamps();
+	~VulkanTimestamps();
+
+	VulkanTimestamps(const VulkanTimestamps&) = delete;
+	VulkanTimestamps& operator=(const VulkanTimestamps&) = delete;
+
+	// room for maxNumCommands timed commands per recording, nothing is timed on devices without timestamps on
+	// every queue
+	VkResult create(const VulkanContext& context, uint32_t maxNumCommands);
+
+	// recorded first, outside of any render pass, forgets the commands of the last recording
+	void reset(VkCommandBuffer commandBuffer);
+
+	// timestamps once every previous command completed, so that the commands in between are timed even when they
+	// start before the barrier in front of them lets them run, commands past maxNumCommands are not timed
+	void begin(VkCommandBuffer commandBuffer, const char* phase);
+	void end(VkCommandBuffer commandBuffer);
+
+	// adds the durations of the last recording, summed per phase, then framePhase from the first begin to the last end
+	// if not nullptr, like addProfilingSamples, waits for the command buffer if it has not completed
+	VkResult addSamples(PhaseTimings& timings, const char* framePhase, const std::string& phasePrefix = std::string());
+
+	// also done by the destructor
+	void release();
+
+private:
+	VkDevice m_device;
+	VkQueryPool m_queryPool;
+	uint32_t m_maxNumCommands;
+	// nanoseconds per timestamp tick, 0 if timestamps are not supported
+	double m_timestampPeriod;
+	// of the commands recorded since the last reset, in order
+	std::vector<const char*> m_phases;
+	// between a begin that was recorded and its end
+	bool m_timing;
+};
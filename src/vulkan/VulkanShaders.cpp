@@ -0,0 +1,89 @@
+#include "VulkanShaders.h"
+
+#include <cstring>
+#include <shaderc/shaderc.h>
+
+#include "engine/BinaryCache.h"
+
+namespace
+{
+shaderc_shader_kind getShaderKind(VkShaderStageFlagBits stage)
+{
+	switch (stage)
+	{
+	case VK_SHADER_STAGE_VERTEX_BIT: return shaderc_vertex_shader;
+	case VK_SHADER_STAGE_GEOMETRY_BIT: return shaderc_geometry_shader;
+	case VK_SHADER_STAGE_FRAGMENT_BIT: return shaderc_fragment_shader;
+	default: return shaderc_compute_shader;
+	}
+}
+}
+
+bool compileSpirv(BinaryCache* binaryCache, VkShaderStageFlagBits stage, const std::vector<std::string>& sources,
+	std::vector<uint32_t>& spirv, std::string* log)
+{
+	std::string source;
+	for (const std::string& part : sources)
+	{
+		source += part;
+		source += "\n";
+	}
+
+	const std::string cacheKey = "spirv vulkan1.2\n" + std::to_string(static_cast<int>(stage)) + '\0' + source;
+	std::vector<unsigned char> data;
+	if (binaryCache != nullptr && binaryCache->load(cacheKey, data) && !data.empty() && data.size() % sizeof(uint32_t) == 0)
+	{
+		spirv.resize(data.size() / sizeof(uint32_t));
+		memcpy(spirv.data(), data.data(), data.size());
+		return true;
+	}
+
+	shaderc_compiler_t compiler = shaderc_compiler_initialize();
+	shaderc_compile_options_t options = shaderc_compile_options_initialize();
+	shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+	shaderc_compile_options_set_auto_bind_uniforms(options, true);
+	shaderc_compile_options_set_auto_map_locations(options, true);
+	shaderc_compile_options_set_binding_base_for_stage(options, shaderc_fragment_shader, shaderc_uniform_kind_texture, 1);
+
+	shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, source.c_str(), source.size(),
+		getShaderKind(stage), "particles", "main", options);
+	const bool compiled = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+	if (compiled)
+	{
+		spirv.resize(shaderc_result_get_length(result) / sizeof(uint32_t));
+		memcpy(spirv.data(), shaderc_result_get_bytes(result), spirv.size() * sizeof(uint32_t));
+	}
+	else if (log != nullptr)
+	{
+		*log = shaderc_result_get_error_message(result);
+	}
+
+	shaderc_result_release(result);
+	shaderc_compile_options_release(options);
+	shaderc_compiler_release(compiler);
+
+	if (compiled && binaryCache != nullptr && binaryCache->isEnabled())
+	{
+		data.resize(spirv.size() * sizeof(uint32_t));
+		memcpy(data.data(), spirv.data(), data.size());
+		binaryCache->store(cacheKey, data);
+	}
+	return compiled;
+}
+
+VkResult createShaderModule(VkDevice device, BinaryCache* binaryCache, VkShaderStageFlagBits stage,
+	const std::vector<std::string>& sources, VkShaderModule* shaderModule, std::string* log)
+{
+	std::vector<uint32_t> spirv;
+	if (!compileSpirv(binaryCache, stage, sources, spirv, log))
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkShaderModuleCreateInfo shaderModuleInfo = {};
+	shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+	shaderModuleInfo.pCode = spirv.data();
+	return vkCreateShaderModule(device, &shaderModuleInfo, nullptr, shaderModule);
+}
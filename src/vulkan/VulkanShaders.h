@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class BinaryCache;
+
+// GLSL compiled at run time to SPIR-V for Vulkan 1.2 with shaderc, with VULKAN defined so that the shaders the GL
+// paths use can declare what differs
+// locations and bindings left out of the source are assigned in order, the textures of fragment shaders from
+// binding 1 on so that they follow the uniform block of the vertex shader
+// SPIR-V does not depend on the driver: with a BinaryCache, modules are persisted under the stage and the sources
+
+// the sources are joined by newlines, returns false with log set when they do not compile
+bool compileSpirv(BinaryCache* binaryCache, VkShaderStageFlagBits stage, const std::vector<std::string>& sources,
+	std::vector<uint32_t>& spirv, std::string* log);
+
+// VK_ERROR_INITIALIZATION_FAILED with log set when the sources do not compile
+VkResult createShaderModule(VkDevice device, BinaryCache* binaryCache, VkShaderStageFlagBits stage,
+	const std::vector<std::string>& sources, VkShaderModule* shaderModule, std::string* log);
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "GlParticleSimulation.h"
+#include "engine/CpuParticleEngine.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/PhaseTimings.h"
+#include "engine/VectorField.h"
+
+// runs shaders/particle.comp through GlParticleSimulation on a surfaceless EGL context, without a window: the same
+// programs and dispatches as the compute shader backend of the demo, then reads the particles back
+// on Mesa without a GPU, or with LIBGL_ALWAYS_SOFTWARE=1, it runs on llvmpipe
+
+namespace
+{
+// relative to the magnitude of the CPU value plus one, covers the GL compiler contracting or reordering float math
+const float CPU_CHECK_TOLERANCE = 1e-3f;
+
+void printUsage(const char* programName)
+{
+	std::cerr << "usage: " << programName << " [--particles N] [--frames N] [--dt SECONDS] [--spawn-rate N] [--seed N]" << std::endl
+		<< "    [--force-field FILE]... [--check-cpu off|on] [--timings FILE.csv|FILE.json]" << std::endl
+		<< "--check-cpu runs the CPU engine alongside and fails if its particles differ, it needs no force field" << std::endl;
+}
+
+std::string readFile(const std::string& filePath)
+{
+	std::ifstream file(filePath.c_str(), std::ifstream::binary);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return buffer.str();
+}
+
+// a 4.3 core context without a surface, on the surfaceless platform of Mesa when the EGL library has it
+bool createContext(EGLDisplay* display, EGLContext* context)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	*display = getPlatformDisplay != nullptr ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr) : EGL_NO_DISPLAY;
+	if (*display == EGL_NO_DISPLAY)
+	{
+		*display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (*display == EGL_NO_DISPLAY || !eglInitialize(*display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API))
+	{
+		return false;
+	}
+
+	const EGLint contextAttributes[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	*context = eglCreateContext(*display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+	return *context != EGL_NO_CONTEXT && eglMakeCurrent(*display, EGL_NO_SURFACE, EGL_NO_SURFACE, *context);
+}
+
+// compiles and links one kernel, 0 with the log on std::cerr if either fails
+GLuint buildProgram(const std::string& source)
+{
+	const GLchar* sourceString = source.c_str();
+	const GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &sourceString, nullptr);
+	glCompileShader(shader);
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDetachShader(program, shader);
+
+	GLint compiled = GL_FALSE;
+	GLint linked = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!compiled || !linked)
+	{
+		GLint logLength = 0;
+		std::vector<GLchar> log;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		log.resize(logLength + 1);
+		glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), nullptr, log.data());
+		std::cerr << log.data() << std::endl;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+		log.resize(logLength + 1);
+		glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), nullptr, log.data());
+		std::cerr << log.data() << std::endl;
+		glDeleteProgram(program);
+		program = 0;
+	}
+	glDeleteShader(shader);
+	return program;
+}
+
+template <class T>
+std::vector<T> readBuffer(GLuint buffer, size_t count)
+{
+	std::vector<T> values(count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, static_cast<GLsizeiptr>(count * sizeof(T)), values.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return values;
+}
+
+// compares the alive particles of the simulation with those of the engine, matched by spawn id, like the OpenCL
+// benchmark, numMismatches counts the particles alive on one side only and those further apart than CPU_CHECK_TOLERANCE
+size_t compareWithCpuEngine(const GlParticleSimulation& simulation, const CpuParticleEngine& engine)
+{
+	auto isClose = [](const glm::vec3& value, const glm::vec3& expected)
+	{
+		const glm::vec3 difference = glm::abs(value - expected);
+		const glm::vec3 tolerance = (glm::abs(expected) + 1.f) * CPU_CHECK_TOLERANCE;
+		return difference.x <= tolerance.x && difference.y <= tolerance.y && difference.z <= tolerance.z;
+	};
+
+	// the buffers are written by shaders, make the writes visible to the reads
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	const size_t numParticles = simulation.getMaxNumParticles();
+	const std::vector<GLuint> isAlive = readBuffer<GLuint>(simulation.getStorageBuffer(GlParticleSimulation::IsAlive), numParticles);
+	const std::vector<GLuint> spawnIds = readBuffer<GLuint>(simulation.getStorageBuffer(GlParticleSimulation::SpawnIds), numParticles);
+	const std::vector<glm::vec3> positions = readBuffer<glm::vec3>(simulation.getStorageBuffer(GlParticleSimulation::Positions), numParticles);
+	const std::vector<glm::vec3> velocities = readBuffer<glm::vec3>(simulation.getStorageBuffer(GlParticleSimulation::Velocities), numParticles);
+
+	// position then velocity of every alive particle of the shaders
+	std::unordered_map<uint32_t, std::pair<glm::vec3, glm::vec3>> deviceParticles;
+	size_t numMismatches = 0;
+	for (size_t id = 0; id < numParticles; ++id)
+	{
+		// two alive particles with one spawn id cannot both match
+		if (isAlive[id] != 0 && !deviceParticles.emplace(spawnIds[id], std::make_pair(positions[id], velocities[id])).second)
+		{
+			++numMismatches;
+		}
+	}
+
+	for (uint32_t id : engine.getAliveIndices())
+	{
+		auto deviceParticle = deviceParticles.find(engine.getSpawnIds()[id]);
+		if (deviceParticle == deviceParticles.end())
+		{
+			++numMismatches;
+			continue;
+		}
+		if (!isClose(deviceParticle->second.first, engine.getPositions()[id]) || !isClose(deviceParticle->second.second, engine.getVelocities()[id]))
+		{
+			++numMismatches;
+		}
+		deviceParticles.erase(deviceParticle);
+	}
+	return numMismatches + deviceParticles.size();
+}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t numParticles = 1000000;
+	unsigned int numFrames = 600;
+	float deltaTimeSeconds = 1.f / 60.f;
+	float particleSpawnRate = 200000.f;
+	unsigned int seed = 0;
+	std::vector<std::shared_ptr<const VectorField>> forceFields;
+	bool checkCpu = false;
+	std::string timingsPath;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], "--particles") == 0)
+			numParticles = std::strtoull(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--frames") == 0)
+			numFrames = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--dt") == 0)
+			deltaTimeSeconds = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--spawn-rate") == 0)
+			particleSpawnRate = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--seed") == 0)
+			seed = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--force-field") == 0)
+		{
+			VectorField field;
+			std::string error;
+			if (!loadVectorFieldFga(value, &field, &error))
+			{
+				std::cerr << error << std::endl;
+				return EXIT_FAILURE;
+			}
+			forceFields.push_back(std::make_shared<const VectorField>(std::move(field)));
+		}
+		else if (strcmp(argv[i - 1], "--check-cpu") == 0 && strcmp(value, "off") == 0)
+			checkCpu = false;
+		else if (strcmp(argv[i - 1], "--check-cpu") == 0 && strcmp(value, "on") == 0)
+			checkCpu = true;
+		else if (strcmp(argv[i - 1], "--timings") == 0)
+			timingsPath = value;
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// the texture units filter the force fields with fewer bits than the CPU engine, the tolerance does not cover it
+	if (numParticles == 0 || (checkCpu && !forceFields.empty()))
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	if (!createContext(&display, &context))
+	{
+		std::cerr << "Could not create an OpenGL 4.3 core context, EGL error " << std::hex << eglGetError() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// GLEW built for GLX loads the functions then finds no GLX display, the version tells whether it got them
+	glewExperimental = GL_TRUE;
+	glewInit();
+	if (!GLEW_VERSION_4_3)
+	{
+		std::cerr << "Compute shaders need OpenGL 4.3" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "Renderer      : " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << std::endl;
+	std::cout << "Particles     : " << numParticles << std::endl;
+
+	ParticleSimulationConfig simulationConfig = getDefaultParticleSimulationConfig();
+	for (size_t i = 0; i < forceFields.size(); ++i)
+	{
+		simulationConfig.modifiers.push_back(ParticleModifier::forceField(static_cast<unsigned int>(i), 1.f));
+	}
+
+	const std::vector<std::string> computeSources = { generateParticleModifierGlslSource(simulationConfig), readFile("shaders/particle.comp") };
+	std::vector<GLuint> computePrograms;
+	for (size_t i = 0; i < NUM_GL_PARTICLE_KERNELS; ++i)
+	{
+		const GLuint computeProgramId = buildProgram(getGlParticleKernelSource(static_cast<GlParticleKernel>(i), computeSources));
+		if (computeProgramId == 0)
+		{
+			std::cerr << "Could not build kernel " << i << " of shaders/particle.comp" << std::endl;
+			return EXIT_FAILURE;
+		}
+		computePrograms.push_back(computeProgramId);
+	}
+
+	GlParticleSimulation simulation;
+	if (!simulation.create(computePrograms, numParticles))
+	{
+		std::cerr << "Could not allocate " << numParticles << " particles for the compute shaders" << std::endl;
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < forceFields.size(); ++i)
+	{
+		simulation.setForceField(i, forceFields[i]);
+	}
+
+	// the render positions and the point then instanced quad commands the demo draws from
+	GLuint renderBuffers[2] = {};
+	glGenBuffers(2, renderBuffers);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderBuffers[0]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(numParticles * 3 * sizeof(GLfloat)), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderBuffers[1]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(8 * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (glGetError() != GL_NO_ERROR)
+	{
+		std::cerr << "Could not allocate the render positions of " << numParticles << " particles" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// the same pool as the shaders so that neither drops spawns the other makes
+	std::unique_ptr<CpuParticleEngine> cpuEngine;
+	bool cpuPoolFilled = false;
+	if (checkCpu)
+	{
+		cpuEngine.reset(new CpuParticleEngine(numParticles, simulationConfig));
+		cpuEngine->initParticleState();
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	auto elapsedMs = [](Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	};
+
+	PhaseTimings timings;
+
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		// same scheduling as the headless CPU engine, time starts at the first frame
+		const float currentTimeSeconds = static_cast<float>(frame) * deltaTimeSeconds;
+		const uint32_t numParticlesToSpawn = static_cast<uint32_t>(std::ceil(particleSpawnRate * deltaTimeSeconds));
+
+		// nothing is read back, glFinish makes the host time cover the dispatches
+		Clock::time_point t0 = Clock::now();
+		simulation.dispatchSubstep(seed, frame, currentTimeSeconds, deltaTimeSeconds, numParticlesToSpawn);
+		simulation.dispatchCompaction(renderBuffers[0], numParticles, renderBuffers[1], 0.f);
+		glFinish();
+		Clock::time_point t1 = Clock::now();
+		timings.addSample("gl/frame", elapsedMs(t0, t1));
+
+		if (cpuEngine != nullptr)
+		{
+			cpuEngine->simulateParticles(seed, frame, currentTimeSeconds, deltaTimeSeconds);
+			cpuPoolFilled |= cpuEngine->spawnParticle(numParticlesToSpawn, seed, frame, currentTimeSeconds) < numParticlesToSpawn;
+			cpuEngine->compactAliveParticles();
+		}
+	}
+
+	timings.print(std::cout);
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	const std::vector<GLuint> drawCommands = readBuffer<GLuint>(renderBuffers[1], 8);
+	std::cout << "Alive         : " << drawCommands[5] << " particles drawn" << std::endl;
+
+	bool cpuCheckFailed = false;
+	if (cpuEngine != nullptr)
+	{
+		std::cout << "CPU check     : ";
+		if (cpuPoolFilled)
+		{
+			std::cout << "skipped, the pool filled up and the shaders drop spawns with their own timing" << std::endl;
+		}
+		else
+		{
+			const size_t numMismatches = compareWithCpuEngine(simulation, *cpuEngine);
+			std::cout << cpuEngine->getAliveIndices().size() - std::min(numMismatches, cpuEngine->getAliveIndices().size()) << " of "
+				<< cpuEngine->getAliveIndices().size() << " particles match the CPU engine, " << numMismatches << " mismatches";
+			if (numFrames * deltaTimeSeconds <= simulationConfig.maxAge)
+			{
+				std::cout << ", no particle died yet";
+			}
+			std::cout << std::endl;
+			cpuCheckFailed = numMismatches > 0 || drawCommands[5] != cpuEngine->getAliveIndices().size();
+		}
+	}
+
+	glDeleteBuffers(2, renderBuffers);
+	simulation.release();
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+
+	if (!timingsPath.empty() && !timings.write(timingsPath))
+	{
+		std::cerr << "Could not write " << timingsPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (cpuCheckFailed)
+	{
+		std::cerr << "The compute shaders and the CPU engine disagree" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
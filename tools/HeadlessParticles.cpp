@@ -0,0 +1,113 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+
+#include "engine/CpuParticleEngine.h"
+#include "engine/PhaseTimings.h"
+
+// runs the particle simulation on the host without a window or an OpenCL device
+
+void printUsage(const char* programName)
+{
+	std::cerr << "usage: " << programName << " [--particles N] [--frames N] [--dt SECONDS] [--spawn-rate N] [--seed N] [--threads N] [--timings FILE.csv|FILE.json]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t numParticles = 1000000;
+	unsigned int numFrames = 600;
+	float deltaTimeSeconds = 1.f / 60.f;
+	float particleSpawnRate = 200000.f;
+	unsigned int seed = 0;
+	unsigned int numThreads = 0;
+	std::string timingsPath;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], "--particles") == 0)
+			numParticles = std::strtoull(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--frames") == 0)
+			numFrames = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--dt") == 0)
+			deltaTimeSeconds = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--spawn-rate") == 0)
+			particleSpawnRate = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--seed") == 0)
+			seed = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--threads") == 0)
+			numThreads = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--timings") == 0)
+			timingsPath = value;
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (numParticles == 0)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	CpuParticleEngine engine(numParticles, getDefaultParticleSimulationConfig(), numThreads);
+	std::cout << "Particles     : " << engine.getNumParticles() << std::endl;
+	std::cout << "Threads       : " << engine.getNumThreads() << std::endl;
+
+	typedef std::chrono::steady_clock Clock;
+	auto elapsedMs = [](Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	};
+
+	engine.initParticleState();
+
+	PhaseTimings timings;
+
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		// same scheduling as the main loop, time starts at the first frame
+		const float currentTimeSeconds = static_cast<float>(frame) * deltaTimeSeconds;
+		const uint32_t numParticlesToSpawn = static_cast<uint32_t>(std::ceil(particleSpawnRate * deltaTimeSeconds));
+
+		Clock::time_point t0 = Clock::now();
+		engine.simulateParticles(seed, frame, currentTimeSeconds, deltaTimeSeconds);
+
+		Clock::time_point t1 = Clock::now();
+		if (numParticlesToSpawn > 0)
+		{
+			engine.spawnParticle(numParticlesToSpawn, seed, frame, currentTimeSeconds);
+		}
+
+		Clock::time_point t2 = Clock::now();
+		engine.compactAliveParticles();
+
+		Clock::time_point t3 = Clock::now();
+		timings.addSample("simulateParticles", elapsedMs(t0, t1));
+		timings.addSample("spawnParticle", elapsedMs(t1, t2));
+		timings.addSample("compactAliveParticles", elapsedMs(t2, t3));
+		timings.addSample("frame", elapsedMs(t0, t3));
+	}
+
+	std::cout << "Alive         : " << engine.getAliveIndices().size() << std::endl;
+	timings.print(std::cout);
+
+	if (!timingsPath.empty() && !timings.write(timingsPath))
+	{
+		std::cerr << "Could not write " << timingsPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,973 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <CL/opencl.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "compute/ClAutotuner.h"
+#include "compute/ClDepthSort.h"
+#include "compute/ClDevice.h"
+#include "compute/ClMortonOrder.h"
+#include "compute/ClDeviceSelection.h"
+#include "compute/ClErrors.h"
+#include "compute/ClFrustumCull.h"
+#include "compute/ClParticleDeviceGroup.h"
+#include "compute/ClParticleSimulation.h"
+#include "compute/ClProgramCache.h"
+#include "compute/ClSpatialGrid.h"
+#include "engine/BinaryCache.h"
+#include "engine/CpuParticleEngine.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/PhaseTimings.h"
+#include "engine/VectorField.h"
+
+// runs the OpenCL kernels of cl/particle.cl without a window or GL sharing, on any device including CPU
+// implementations such as pocl, and reports the throughput of every kernel for a sweep of workloads
+
+#define CHECK_ERROR_CODE(function)													\
+	if (code != CL_SUCCESS)															\
+	{																				\
+		std::cerr << #function " returned " << code << ": " << getErrorString(code)	\
+			<< " (line " << __LINE__ << ")" << std::endl;							\
+		return EXIT_FAILURE;														\
+	}
+
+namespace
+{
+// largest difference allowed between a position or velocity component of the device and of the CPU engine, relative to
+// the component: sqrt, cos and sin may be a few ulp off libm in OpenCL and contracted multiply-adds round differently,
+// a particle drawing the wrong random numbers is off by a whole random acceleration
+const float CPU_CHECK_TOLERANCE = 1e-3f;
+// distance of the depth sort camera to the origin, where the particles spawn
+const cl_float DEPTH_SORT_CAMERA_DISTANCE = 30.f;
+// the culling sees through the same camera with the demo's projection on a 1080p viewport and drops quads of the
+// demo's size under a pixel
+const float CULLING_FIELD_OF_VIEW = 75.f;
+const float CULLING_VIEWPORT_WIDTH = 1920.f;
+const float CULLING_VIEWPORT_HEIGHT = 1080.f;
+const cl_float PARTICLE_SIZE = 0.2f;
+const cl_float CULLING_MIN_PIXEL_SIZE = 1.f;
+
+// one workload of the sweep
+struct BenchmarkCase
+{
+	size_t numParticles;
+	float particleSpawnRate;
+	float maxAge;
+	// frames run before the measured ones
+	unsigned int numWarmupFrames;
+};
+
+// work done by one kernel over the measured frames
+// bytes are estimated from the global memory accesses in cl/particle.cl, not measured
+struct KernelWork
+{
+	double numParticles = 0.0;
+	double numBytes = 0.0;
+};
+
+void printUsage(const char* programName)
+{
+	std::cerr << "usage: " << programName << " [--particles N,N,...] [--spawn-rates N,N,...] [--lifetimes SECONDS,SECONDS,...]" << std::endl
+		<< "    [--frames N] [--warmup N] [--dt SECONDS] [--seed N] [--device-type all|cpu|gpu] [--platform N]" << std::endl
+		<< "    [--kernel FILE] [--csv FILE] [--autotune off|on|force] [--page-size N]" << std::endl
+		<< "    [--devices primary|all] [--device cpu|gpu|PLATFORM:DEVICE|NAME] [--spatial-grid CELL_SIZE]" << std::endl
+		<< "    [--depth-sort off|on] [--culling off|on] [--morton-order FRAMES] [--force-field FILE]..." << std::endl
+		<< "    [--check-cpu off|on]" << std::endl
+		<< "a spawn rate of 0, the default, spawns PARTICLES / LIFETIME per second, the warmup defaults to one lifetime" << std::endl
+		<< "--check-cpu runs the CPU engine alongside and fails if its particles differ, it needs a single device, no" << std::endl
+		<< "autotuning and no force field, with --morton-order it also checks that reordered particles keep their random numbers" << std::endl;
+}
+
+std::vector<double> parseList(const char* value)
+{
+	std::vector<double> values;
+	std::istringstream stream(value);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		values.push_back(std::strtod(item.c_str(), nullptr));
+	}
+	return values;
+}
+
+// mean distance between consecutive positions of the first numPositions, with a blocking read
+double getRenderPositionsSpread(cl_command_queue commandQueue, cl_mem renderPositions, size_t numPositions)
+{
+	if (numPositions < 2)
+	{
+		return 0.0;
+	}
+
+	std::vector<float> positions(numPositions * 3);
+	if (clEnqueueReadBuffer(commandQueue, renderPositions, CL_TRUE, 0, positions.size() * sizeof(float), positions.data(), 0, nullptr, nullptr) != CL_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	double totalDistance = 0.0;
+	for (size_t i = 1; i < numPositions; ++i)
+	{
+		const double dx = positions[i * 3] - positions[i * 3 - 3];
+		const double dy = positions[i * 3 + 1] - positions[i * 3 - 2];
+		const double dz = positions[i * 3 + 2] - positions[i * 3 - 1];
+		totalDistance += std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+	return totalDistance / static_cast<double>(numPositions - 1);
+}
+
+// compares the alive particles of the simulation with those of the engine, matched by spawn id, with blocking reads
+// numMismatches counts the particles alive on one side only and those further apart than CPU_CHECK_TOLERANCE
+cl_int compareWithCpuEngine(cl_command_queue commandQueue, const ClParticleSimulation& simulation, const CpuParticleEngine& engine,
+	size_t* numMismatches)
+{
+	auto isClose = [](const glm::vec3& value, const glm::vec3& expected)
+	{
+		const glm::vec3 difference = glm::abs(value - expected);
+		const glm::vec3 tolerance = (glm::abs(expected) + 1.f) * CPU_CHECK_TOLERANCE;
+		return difference.x <= tolerance.x && difference.y <= tolerance.y && difference.z <= tolerance.z;
+	};
+
+	// position then velocity of every alive particle of the device
+	std::unordered_map<uint32_t, std::pair<glm::vec3, glm::vec3>> deviceParticles;
+	*numMismatches = 0;
+
+	const size_t pageSize = simulation.getPageSize();
+	std::vector<cl_uchar> isAlive(pageSize);
+	std::vector<uint32_t> spawnIds(pageSize);
+	std::vector<glm::vec3> positions(pageSize);
+	std::vector<glm::vec3> velocities(pageSize);
+	for (size_t i = 0; i < simulation.getNumPages(); ++i)
+	{
+		const ClParticlePage& page = simulation.getPage(i);
+		cl_int code = clEnqueueReadBuffer(commandQueue, page.isAliveBuffer, CL_FALSE, 0, pageSize * sizeof(cl_uchar), isAlive.data(), 0, nullptr, nullptr);
+		if (code == CL_SUCCESS)
+		{
+			code = clEnqueueReadBuffer(commandQueue, page.spawnIdBuffer, CL_FALSE, 0, pageSize * sizeof(cl_uint), spawnIds.data(), 0, nullptr, nullptr);
+		}
+		if (code == CL_SUCCESS)
+		{
+			code = clEnqueueReadBuffer(commandQueue, page.positionBuffer, CL_FALSE, 0, pageSize * 3 * sizeof(cl_float), positions.data(), 0, nullptr, nullptr);
+		}
+		if (code == CL_SUCCESS)
+		{
+			code = clEnqueueReadBuffer(commandQueue, page.velocityBuffer, CL_TRUE, 0, pageSize * 3 * sizeof(cl_float), velocities.data(), 0, nullptr, nullptr);
+		}
+		if (code != CL_SUCCESS)
+		{
+			return code;
+		}
+
+		for (size_t id = 0; id < pageSize; ++id)
+		{
+			// two alive particles with one spawn id cannot both match
+			if (isAlive[id] && !deviceParticles.emplace(spawnIds[id], std::make_pair(positions[id], velocities[id])).second)
+			{
+				++*numMismatches;
+			}
+		}
+	}
+
+	for (uint32_t id : engine.getAliveIndices())
+	{
+		auto deviceParticle = deviceParticles.find(engine.getSpawnIds()[id]);
+		if (deviceParticle == deviceParticles.end())
+		{
+			++*numMismatches;
+			continue;
+		}
+		if (!isClose(deviceParticle->second.first, engine.getPositions()[id]) || !isClose(deviceParticle->second.second, engine.getVelocities()[id]))
+		{
+			++*numMismatches;
+		}
+		deviceParticles.erase(deviceParticle);
+	}
+	*numMismatches += deviceParticles.size();
+	return CL_SUCCESS;
+}
+
+std::string readFile(const std::string& filePath)
+{
+	std::ifstream file(filePath.c_str(), std::ifstream::binary);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return buffer.str();
+}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<double> particleCounts = { 1e5, 1e6, 1e7, 1e8 };
+	// 0 spawns count / lifetime particles per second, which keeps the case's particle count alive once a lifetime went by
+	std::vector<double> spawnRates = { 0.0 };
+	std::vector<double> lifetimes = { 5.0 };
+	unsigned int numFrames = 120;
+	// by default a whole lifetime, so that the measured frames run at the steady state alive count, deaths included
+	unsigned int numWarmupFrames = 0;
+	bool warmupSet = false;
+	float deltaTimeSeconds = 1.f / 60.f;
+	unsigned int seed = 0;
+	cl_device_type deviceType = CL_DEVICE_TYPE_ALL;
+	int platformIndex = -1;
+	std::string kernelPath = "cl/particle.cl";
+	std::string csvPath;
+	// off measures the driver defaults, on uses the persisted tuning of the demo, force tunes again
+	bool autotune = false;
+	bool forceAutotune = false;
+	size_t pageSize = ClParticleSimulation::DEFAULT_PAGE_SIZE;
+	// all partitions the particles between every device, the selected one first, each simulating up to the case's count
+	bool allDevices = false;
+	// runs the CPU engine with the same seed and schedule and compares the particles at the end of every case
+	bool checkCpu = false;
+	// the fastest calibrated device of the type and platform is benchmarked unless overridden, see ClDeviceSelection.h
+	std::string deviceOverride = getDefaultDeviceOverride();
+	// rebuilds a spatial grid of the selected device's particles every frame and queries it around the origin, 0 skips it
+	float gridCellSize = 0.f;
+	// sorts the gathered positions back to front every frame for a camera on the z axis, as the demo does for its view
+	bool depthSort = false;
+	// drops the gathered positions outside the view of that camera before the depth sort
+	bool culling = false;
+	// reorders the selected device's particle storage by Morton code every this many frames, 0 never does
+	unsigned long mortonOrderInterval = 0;
+	// FGA vector fields sampled by the update kernel, each through a ForceField modifier with its index
+	std::vector<std::shared_ptr<const VectorField>> forceFields;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], "--particles") == 0)
+			particleCounts = parseList(value);
+		else if (strcmp(argv[i - 1], "--spawn-rates") == 0)
+			spawnRates = parseList(value);
+		else if (strcmp(argv[i - 1], "--lifetimes") == 0)
+			lifetimes = parseList(value);
+		else if (strcmp(argv[i - 1], "--frames") == 0)
+			numFrames = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--warmup") == 0)
+		{
+			numWarmupFrames = std::strtoul(value, nullptr, 10);
+			warmupSet = true;
+		}
+		else if (strcmp(argv[i - 1], "--dt") == 0)
+			deltaTimeSeconds = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--seed") == 0)
+			seed = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--device-type") == 0 && strcmp(value, "cpu") == 0)
+			deviceType = CL_DEVICE_TYPE_CPU;
+		else if (strcmp(argv[i - 1], "--device-type") == 0 && strcmp(value, "gpu") == 0)
+			deviceType = CL_DEVICE_TYPE_GPU;
+		else if (strcmp(argv[i - 1], "--device-type") == 0 && strcmp(value, "all") == 0)
+			deviceType = CL_DEVICE_TYPE_ALL;
+		else if (strcmp(argv[i - 1], "--platform") == 0)
+			platformIndex = std::atoi(value);
+		else if (strcmp(argv[i - 1], "--kernel") == 0)
+			kernelPath = value;
+		else if (strcmp(argv[i - 1], "--csv") == 0)
+			csvPath = value;
+		else if (strcmp(argv[i - 1], "--autotune") == 0 && strcmp(value, "off") == 0)
+			autotune = false;
+		else if (strcmp(argv[i - 1], "--autotune") == 0 && strcmp(value, "on") == 0)
+			autotune = true;
+		else if (strcmp(argv[i - 1], "--autotune") == 0 && strcmp(value, "force") == 0)
+			autotune = forceAutotune = true;
+		else if (strcmp(argv[i - 1], "--page-size") == 0)
+			pageSize = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--devices") == 0 && strcmp(value, "primary") == 0)
+			allDevices = false;
+		else if (strcmp(argv[i - 1], "--devices") == 0 && strcmp(value, "all") == 0)
+			allDevices = true;
+		else if (strcmp(argv[i - 1], "--device") == 0)
+			deviceOverride = value;
+		else if (strcmp(argv[i - 1], "--spatial-grid") == 0)
+			gridCellSize = std::max(0.f, std::strtof(value, nullptr));
+		else if (strcmp(argv[i - 1], "--check-cpu") == 0 && strcmp(value, "off") == 0)
+			checkCpu = false;
+		else if (strcmp(argv[i - 1], "--check-cpu") == 0 && strcmp(value, "on") == 0)
+			checkCpu = true;
+		else if (strcmp(argv[i - 1], "--depth-sort") == 0 && strcmp(value, "off") == 0)
+			depthSort = false;
+		else if (strcmp(argv[i - 1], "--depth-sort") == 0 && strcmp(value, "on") == 0)
+			depthSort = true;
+		else if (strcmp(argv[i - 1], "--culling") == 0 && strcmp(value, "off") == 0)
+			culling = false;
+		else if (strcmp(argv[i - 1], "--culling") == 0 && strcmp(value, "on") == 0)
+			culling = true;
+		else if (strcmp(argv[i - 1], "--morton-order") == 0)
+			mortonOrderInterval = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--force-field") == 0)
+		{
+			VectorField field;
+			std::string error;
+			if (!loadVectorFieldFga(value, &field, &error))
+			{
+				std::cerr << error << std::endl;
+				return EXIT_FAILURE;
+			}
+			forceFields.push_back(std::make_shared<const VectorField>(std::move(field)));
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// the split between devices follows their timings, -cl-fast-relaxed-math may be tuned in and the texture units
+	// filter the force fields with fewer bits than the CPU engine, none of which the tolerance covers
+	if (checkCpu && (allDevices || autotune || !forceFields.empty()))
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::string clProgramSource = readFile(kernelPath);
+	if (clProgramSource.empty())
+	{
+		std::cerr << "Could not read " << kernelPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	BinaryCache binaryCache(getDefaultCacheDirectory());
+
+	// no GL here, every device is a candidate
+	const std::vector<ClDeviceScore> deviceScores = scoreDevices(binaryCache, clProgramSource, getDefaultParticleSimulationConfig(), false);
+	const std::vector<size_t> candidateDevices = deviceOverride.empty()
+		? rankDeviceScores(deviceScores, false)
+		: findDeviceScores(deviceScores, deviceOverride);
+
+	int selectedDevice = -1;
+	for (size_t candidate : candidateDevices)
+	{
+		const ClDeviceScore& score = deviceScores[candidate];
+		if ((score.deviceType & deviceType) != 0 && (platformIndex < 0 || score.platformIndex == static_cast<unsigned int>(platformIndex)))
+		{
+			selectedDevice = static_cast<int>(candidate);
+			break;
+		}
+	}
+
+	printDeviceScores(std::cout, deviceScores, selectedDevice,
+		selectedDevice < 0 ? "no matching device" : deviceOverride.empty() ? "fastest matching device" : "fastest device matching \"" + deviceOverride + "\"");
+	if (selectedDevice < 0)
+	{
+		std::cerr << "No OpenCL device found" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const cl_platform_id platformId = deviceScores[selectedDevice].platformId;
+	const cl_device_id deviceId = deviceScores[selectedDevice].deviceId;
+
+	std::cout << "Device name   : " << getDeviceInfoString(deviceId, CL_DEVICE_NAME) << std::endl;
+	std::cout << "Device vendor : " << getDeviceInfoString(deviceId, CL_DEVICE_VENDOR) << std::endl;
+	std::cout << "Device version: " << getDeviceInfoString(deviceId, CL_DRIVER_VERSION) << std::endl;
+
+	cl_ulong maxAllocSize = 0;
+	cl_ulong globalMemSize = 0;
+	clGetDeviceInfo(deviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAllocSize, nullptr);
+	clGetDeviceInfo(deviceId, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMemSize, nullptr);
+
+	cl_int code;
+	cl_context_properties props[] =
+	{
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platformId),
+		0
+	};
+	cl_context context = clCreateContext(props, 1, &deviceId, nullptr, nullptr, &code);
+	CHECK_ERROR_CODE(clCreateContext);
+
+	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceId, CL_QUEUE_PROFILING_ENABLE, &code);
+	CHECK_ERROR_CODE(clCreateCommandQueue);
+
+	ClProgramCache programCache(context, deviceId, &binaryCache);
+
+	// the grid, depth sort, Morton order and culling kernels do not depend on the case
+	cl_program cullProgram = nullptr;
+	if (culling)
+	{
+		std::string buildLog;
+		cullProgram = programCache.getProgram({ readFile("cl/frustum_cull.cl") }, "", &code, &buildLog);
+		if (code != CL_SUCCESS)
+		{
+			std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code) << std::endl
+				<< "Log:" << std::endl
+				<< buildLog << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	cl_program gridProgram = nullptr;
+	cl_program depthSortProgram = nullptr;
+	cl_program mortonOrderProgram = nullptr;
+	cl_program sortProgram = nullptr;
+	if (gridCellSize > 0.f || depthSort || mortonOrderInterval > 0)
+	{
+		std::string buildLog;
+		sortProgram = programCache.getProgram({ readFile("cl/radix_sort.cl") }, "", &code, &buildLog);
+		if (code == CL_SUCCESS && gridCellSize > 0.f)
+		{
+			gridProgram = programCache.getProgram({ readFile("cl/spatial_grid.cl") }, "", &code, &buildLog);
+		}
+		if (code == CL_SUCCESS && depthSort)
+		{
+			depthSortProgram = programCache.getProgram({ readFile("cl/depth_sort.cl") }, "", &code, &buildLog);
+		}
+		if (code == CL_SUCCESS && mortonOrderInterval > 0)
+		{
+			mortonOrderProgram = programCache.getProgram({ readFile("cl/morton_order.cl") }, "", &code, &buildLog);
+		}
+		if (code != CL_SUCCESS)
+		{
+			std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code) << std::endl
+				<< "Log:" << std::endl
+				<< buildLog << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<BenchmarkCase> benchmarkCases;
+	for (double lifetime : lifetimes)
+	{
+		for (double spawnRate : spawnRates)
+		{
+			for (double particleCount : particleCounts)
+			{
+				const double caseSpawnRate = spawnRate > 0.0 ? spawnRate : particleCount / lifetime;
+				const unsigned int caseWarmupFrames = warmupSet
+					? numWarmupFrames
+					: static_cast<unsigned int>(std::ceil(lifetime / deltaTimeSeconds)) + 1;
+				benchmarkCases.push_back({ static_cast<size_t>(particleCount), static_cast<float>(caseSpawnRate), static_cast<float>(lifetime), caseWarmupFrames });
+			}
+		}
+	}
+
+	std::ofstream csvFile;
+	if (!csvPath.empty())
+	{
+		csvFile.open(csvPath);
+		if (!csvFile)
+		{
+			std::cerr << "Could not write " << csvPath << std::endl;
+			return EXIT_FAILURE;
+		}
+		csvFile << "particles,spawn_rate,lifetime,kernel,samples,mean_ms,p50_ms,p95_ms,p99_ms,particles_per_s,bytes_per_s" << std::endl;
+	}
+
+	// positions, velocities, spawn times, alive flags, spawn ids, alive and free lists, then the render positions
+	const size_t bytesPerParticle = 3 * sizeof(cl_float) * 3 + sizeof(cl_float) + sizeof(cl_uchar) + 3 * sizeof(cl_uint);
+
+	bool cpuCheckFailed = false;
+	for (const BenchmarkCase& benchmarkCase : benchmarkCases)
+	{
+		std::cout << std::endl << "Particles " << benchmarkCase.numParticles
+			<< ", spawn rate " << benchmarkCase.particleSpawnRate << "/s"
+			<< ", lifetime " << benchmarkCase.maxAge << " s"
+			<< ", " << benchmarkCase.numWarmupFrames << " warmup frames" << std::endl;
+
+		if (benchmarkCase.numParticles == 0 || benchmarkCase.numParticles * bytesPerParticle > globalMemSize)
+		{
+			std::cout << "skipped, does not fit in device memory" << std::endl;
+			continue;
+		}
+
+		// particle state is paged, the render positions are not: they are a single buffer like the demo's vertex buffer,
+		// whose size CL_DEVICE_MAX_MEM_ALLOC_SIZE caps, the particles past it are simulated but not gathered
+		const size_t renderCapacity = std::min(benchmarkCase.numParticles, static_cast<size_t>(maxAllocSize / (3 * sizeof(cl_float))));
+		if (renderCapacity < benchmarkCase.numParticles)
+		{
+			std::cout << "render positions capped to " << renderCapacity << " by CL_DEVICE_MAX_MEM_ALLOC_SIZE" << std::endl;
+		}
+
+		ParticleSimulationConfig simulationConfig = getDefaultParticleSimulationConfig();
+		simulationConfig.maxAge = benchmarkCase.maxAge;
+		for (size_t i = 0; i < forceFields.size(); ++i)
+		{
+			simulationConfig.modifiers.push_back(ParticleModifier::forceField(static_cast<unsigned int>(i), 1.f));
+		}
+
+		ClParticleTuning tuning;
+		if (autotune)
+		{
+			code = getParticleTuning(context, deviceId, programCache, binaryCache, clProgramSource, simulationConfig, forceAutotune, &tuning);
+			CHECK_ERROR_CODE(getParticleTuning);
+			std::cout << "tuning: options \"" << tuning.buildOptions << "\", local sizes "
+				<< tuning.workSizes.simulate << " / " << tuning.workSizes.spawn << " / " << tuning.workSizes.scan << std::endl;
+		}
+
+		std::string buildLog;
+		cl_program program = programCache.getProgram(
+			{ generateParticleModifierSource(simulationConfig), clProgramSource },
+			appendBuildOptions(getParticleModifierBuildOptions(simulationConfig), tuning.buildOptions),
+			&code,
+			&buildLog
+		);
+		if (code != CL_SUCCESS)
+		{
+			std::cerr << "clBuildProgram returned " << code << ": " << getErrorString(code) << std::endl
+				<< "Log:" << std::endl
+				<< buildLog << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		ClParticleSimulation simulation(context, deviceId, commandQueue);
+		code = simulation.create(program, benchmarkCase.numParticles, tuning.workSizes, pageSize);
+		if (code == CL_MEM_OBJECT_ALLOCATION_FAILURE || code == CL_OUT_OF_RESOURCES || code == CL_OUT_OF_HOST_MEMORY)
+		{
+			std::cout << "skipped, " << getErrorString(code) << std::endl;
+			continue;
+		}
+		CHECK_ERROR_CODE(ClParticleSimulation::create);
+
+		cl_mem renderPositions = clCreateBuffer(context, CL_MEM_READ_WRITE, renderCapacity * 3 * sizeof(cl_float), nullptr, &code);
+		CHECK_ERROR_CODE(clCreateBuffer);
+
+		// frames are blocking, a single frame of gather buffers is enough
+		ClParticleDeviceGroup deviceGroup(deviceId, commandQueue, simulation, 1);
+		if (allDevices)
+		{
+			for (cl_device_id otherDeviceId : getDevices(CL_DEVICE_TYPE_ALL))
+			{
+				if (otherDeviceId == deviceId)
+				{
+					continue;
+				}
+
+				code = deviceGroup.addDevice(otherDeviceId, binaryCache, clProgramSource, simulationConfig, autotune, benchmarkCase.numParticles, pageSize, &buildLog);
+				std::cout << "Other device  : " << getDeviceInfoString(otherDeviceId, CL_DEVICE_NAME);
+				if (code != CL_SUCCESS)
+				{
+					std::cout << ", not used (" << getErrorString(code) << ")";
+				}
+				std::cout << std::endl;
+			}
+		}
+
+		// the whole fields are queued before the first frame, the warmup frames absorb the upload
+		for (size_t device = 0; device < deviceGroup.getNumDevices() && !forceFields.empty(); ++device)
+		{
+			ClForceFields& deviceForceFields = deviceGroup.getSimulation(device).getForceFields();
+			for (size_t i = 0; i < forceFields.size(); ++i)
+			{
+				code = deviceForceFields.setField(i, forceFields[i]);
+				CHECK_ERROR_CODE(ClForceFields::setField);
+			}
+			code = deviceForceFields.enqueueUploads(~size_t(0));
+			CHECK_ERROR_CODE(ClForceFields::enqueueUploads);
+		}
+
+		// one per device, then the instanced command written by the culling
+		cl_mem drawCommands = clCreateBuffer(context, CL_MEM_READ_WRITE, (deviceGroup.getNumDevices() + 1) * sizeof(ClDrawArraysIndirectCommand), nullptr, &code);
+		CHECK_ERROR_CODE(clCreateBuffer);
+
+		ClSpatialGrid spatialGrid(context, deviceId, commandQueue);
+		if (gridProgram != nullptr)
+		{
+			code = spatialGrid.create(gridProgram, sortProgram, gridCellSize, benchmarkCase.numParticles);
+			CHECK_ERROR_CODE(ClSpatialGrid::create);
+		}
+		const unsigned int numSortPasses = (spatialGrid.getKeyBits() + ClRadixSort::RADIX_BITS - 1) / ClRadixSort::RADIX_BITS;
+		std::vector<ClProfilingEvent> gridEvents;
+		ClSpatialQuery countQuery;
+		ClSpatialQuery nearestQuery;
+		const cl_float3 queryPoint = { { 0.f, 0.f, 0.f, 0.f } };
+		const cl_float queryRadius = 4.f * gridCellSize;
+
+		ClDepthSort depthSorter(context, deviceId, commandQueue);
+		if (depthSortProgram != nullptr)
+		{
+			code = depthSorter.create(depthSortProgram, sortProgram);
+			CHECK_ERROR_CODE(ClDepthSort::create);
+		}
+		const unsigned int numDepthSortPasses = (ClDepthSort::KEY_BITS + ClRadixSort::RADIX_BITS - 1) / ClRadixSort::RADIX_BITS;
+		std::vector<ClProfilingEvent> depthSortEvents;
+
+		ClMortonOrder mortonOrder(context, deviceId, commandQueue);
+		if (mortonOrderProgram != nullptr)
+		{
+			code = mortonOrder.create(mortonOrderProgram, sortProgram);
+			CHECK_ERROR_CODE(ClMortonOrder::create);
+		}
+		const unsigned int numMortonSortPasses = (ClMortonOrder::KEY_BITS + ClRadixSort::RADIX_BITS - 1) / ClRadixSort::RADIX_BITS;
+		std::vector<ClProfilingEvent> mortonOrderEvents;
+		// column-major, the camera DEPTH_SORT_CAMERA_DISTANCE away on +z looking at the origin
+		const cl_float depthSortModelView[16] = { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, -DEPTH_SORT_CAMERA_DISTANCE, 1.f };
+
+		ClFrustumCull frustumCull(context, deviceId, commandQueue);
+		if (cullProgram != nullptr)
+		{
+			code = frustumCull.create(cullProgram);
+			CHECK_ERROR_CODE(ClFrustumCull::create);
+		}
+		std::vector<ClProfilingEvent> cullEvents;
+		const glm::mat4 cullingProjection = glm::perspectiveFov(glm::radians(CULLING_FIELD_OF_VIEW), CULLING_VIEWPORT_WIDTH, CULLING_VIEWPORT_HEIGHT, 0.1f, 1000.f);
+		const glm::mat4 cullingViewProjection = cullingProjection * glm::make_mat4(depthSortModelView);
+		cl_uint culledCount = 0;
+
+		// the compaction kernels run over every allocated page
+		const double numScanBlocksPerPage = std::ceil(static_cast<double>(simulation.getPageSize()) / static_cast<double>(simulation.getScanWorkGroupSize()));
+
+		PhaseTimings timings;
+		KernelWork simulateWork;
+		KernelWork spawnWork;
+		KernelWork countWork;
+		KernelWork scanWork;
+		KernelWork compactWork;
+		KernelWork gridKeysWork;
+		KernelWork sortWork;
+		KernelWork gridCellsWork;
+		KernelWork depthKeysWork;
+		KernelWork depthSortWork;
+		KernelWork depthScatterWork;
+		KernelWork mortonKeysWork;
+		KernelWork mortonSortWork;
+		KernelWork mortonGatherWork;
+		KernelWork mortonWriteWork;
+		KernelWork cullWork;
+		KernelWork cullWriteWork;
+
+		// the same pool as the device so that neither drops spawns the other makes
+		std::unique_ptr<CpuParticleEngine> cpuEngine;
+		bool cpuPoolFilled = false;
+		// reorders after the first lifetime move particles whose slots were reused, the case the check is after
+		unsigned int numReorders = 0;
+		unsigned int numLateReorders = 0;
+		if (checkCpu)
+		{
+			cpuEngine.reset(new CpuParticleEngine(simulation.getMaxNumParticles(), simulationConfig));
+			cpuEngine->initParticleState();
+		}
+
+		cl_uint aliveParticleCount = 0;
+		size_t maxNumPages = 0;
+		for (unsigned int frame = 0; frame < benchmarkCase.numWarmupFrames + numFrames; ++frame)
+		{
+			// same scheduling as the headless CPU tool, one substep per frame and a blocking read of the count
+			const cl_float currentTimeSeconds = static_cast<cl_float>(frame) * deltaTimeSeconds;
+			const cl_uint numParticlesToSpawn = static_cast<cl_uint>(std::ceil(benchmarkCase.particleSpawnRate * deltaTimeSeconds));
+			const bool measured = frame >= benchmarkCase.numWarmupFrames;
+
+			code = deviceGroup.enqueueSubstep(0, seed, frame, currentTimeSeconds, deltaTimeSeconds, numParticlesToSpawn);
+			CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueSubstep);
+
+			code = deviceGroup.enqueueCompaction(0, renderPositions, renderCapacity, 0.f);
+			CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueCompaction);
+
+			// the render positions of this frame are in the old order, the next compaction gathers the new one
+			const bool reordered = mortonOrderProgram != nullptr && (frame + 1) % mortonOrderInterval == 0;
+			if (reordered)
+			{
+				code = mortonOrder.enqueueReorder(simulation, &mortonOrderEvents);
+				CHECK_ERROR_CODE(ClMortonOrder::enqueueReorder);
+				++numReorders;
+				numLateReorders += static_cast<cl_float>(frame) * deltaTimeSeconds > benchmarkCase.maxAge ? 1 : 0;
+			}
+
+			code = deviceGroup.enqueueGather(0, renderPositions, drawCommands);
+			CHECK_ERROR_CODE(ClParticleDeviceGroup::enqueueGather);
+
+			// completed by the blocking read below like the rest of the frame
+			if (gridProgram != nullptr)
+			{
+				code = spatialGrid.enqueueBuild(simulation, &gridEvents);
+				CHECK_ERROR_CODE(ClSpatialGrid::enqueueBuild);
+				code = spatialGrid.enqueueCountInSphere(queryPoint, queryRadius, countQuery);
+				CHECK_ERROR_CODE(ClSpatialGrid::enqueueCountInSphere);
+				code = spatialGrid.enqueueFindNearest(queryPoint, queryRadius, nearestQuery);
+				CHECK_ERROR_CODE(ClSpatialGrid::enqueueFindNearest);
+			}
+			if (cullProgram != nullptr)
+			{
+				code = frustumCull.enqueueCull(renderPositions, benchmarkCase.numParticles, drawCommands, static_cast<cl_uint>(deviceGroup.getNumDevices()),
+					glm::value_ptr(cullingViewProjection), PARTICLE_SIZE * 0.5f * glm::root_two<float>(), cullingProjection[1][1] * CULLING_VIEWPORT_HEIGHT * 0.5f,
+					CULLING_MIN_PIXEL_SIZE, &cullEvents);
+				CHECK_ERROR_CODE(ClFrustumCull::enqueueCull);
+				// completed by the blocking read below
+				code = clEnqueueReadBuffer(commandQueue, drawCommands, CL_FALSE, 0, sizeof(cl_uint), &culledCount, 0, nullptr, nullptr);
+				CHECK_ERROR_CODE(clEnqueueReadBuffer);
+			}
+			if (depthSortProgram != nullptr)
+			{
+				code = depthSorter.enqueueSort(renderPositions, renderCapacity, drawCommands,
+					static_cast<cl_uint>(deviceGroup.getNumDevices()), depthSortModelView, &depthSortEvents);
+				CHECK_ERROR_CODE(ClDepthSort::enqueueSort);
+			}
+
+			// the CPU engine runs while the device works through the frame
+			if (cpuEngine != nullptr)
+			{
+				cpuEngine->simulateParticles(seed, frame, currentTimeSeconds, deltaTimeSeconds);
+				cpuPoolFilled |= cpuEngine->spawnParticle(numParticlesToSpawn, seed, frame, currentTimeSeconds) < numParticlesToSpawn;
+				cpuEngine->compactAliveParticles();
+			}
+
+			// the second count is the alive count of the selected device, the first one is capped by the render capacity
+			const double previousAliveCount = static_cast<double>(aliveParticleCount);
+			code = clEnqueueReadBuffer(commandQueue, simulation.getAliveCountBuffer(), CL_TRUE, sizeof(cl_uint), sizeof(cl_uint), &aliveParticleCount, 0, nullptr, nullptr);
+			CHECK_ERROR_CODE(clEnqueueReadBuffer);
+
+			const double numParticles = static_cast<double>(simulation.getCapacity());
+			const double numScanBlocks = numScanBlocksPerPage * static_cast<double>(simulation.getNumPages());
+			maxNumPages = std::max(maxNumPages, simulation.getNumPages());
+
+			deviceGroup.collectFrame(0, measured ? &timings : nullptr, "cl/frame");
+			if (!measured)
+			{
+				releaseProfilingEvents(gridEvents);
+				releaseProfilingEvents(cullEvents);
+				releaseProfilingEvents(depthSortEvents);
+				releaseProfilingEvents(mortonOrderEvents);
+				continue;
+			}
+			addProfilingSamples(gridEvents, timings, nullptr);
+			addProfilingSamples(cullEvents, timings, nullptr);
+			addProfilingSamples(depthSortEvents, timings, nullptr);
+			addProfilingSamples(mortonOrderEvents, timings, nullptr);
+
+			const double aliveCount = static_cast<double>(aliveParticleCount);
+			const double gatheredCount = std::min(aliveCount, static_cast<double>(renderCapacity));
+			// alive index, spawn time and spawn id read, position and velocity read and written
+			simulateWork.numParticles += previousAliveCount;
+			simulateWork.numBytes += previousAliveCount * 60.0;
+			// free index, then position, velocity, spawn time, alive flag and spawn id written
+			spawnWork.numParticles += numParticlesToSpawn;
+			spawnWork.numBytes += numParticlesToSpawn * 37.0;
+			// alive flags, one count per block
+			countWork.numParticles += numParticles;
+			countWork.numBytes += numParticles + numScanBlocks * 4.0;
+			// block counts read and written
+			scanWork.numParticles += numParticles;
+			scanWork.numBytes += numScanBlocks * 8.0;
+			// alive flags and block offsets, then alive index written, position and velocity read, render position written
+			compactWork.numParticles += numParticles;
+			compactWork.numBytes += numParticles + numScanBlocks * 4.0 + aliveCount * 4.0 + gatheredCount * 36.0;
+			if (gridProgram != nullptr)
+			{
+				// alive index and position read, key, value, position and particle reference written
+				gridKeysWork.numParticles += aliveCount;
+				gridKeysWork.numBytes += aliveCount * 44.0;
+				// keys and values read twice and written once per pass, the histograms are negligible
+				sortWork.numParticles += aliveCount * numSortPasses;
+				sortWork.numBytes += aliveCount * numSortPasses * 24.0;
+				// keys, value, position and particle reference read, position and particle reference written
+				gridCellsWork.numParticles += aliveCount;
+				gridCellsWork.numBytes += aliveCount * 48.0;
+			}
+			// the selected device draws what fits in the render positions, the others what they gathered the frame before
+			double drawnCount = gatheredCount;
+			const std::vector<ClDrawArraysIndirectCommand>& frameDrawCommands = deviceGroup.getDrawCommands(0);
+			for (size_t i = 1; i < frameDrawCommands.size(); ++i)
+			{
+				drawnCount += static_cast<double>(frameDrawCommands[i].count);
+			}
+			if (cullProgram != nullptr)
+			{
+				// the drawn positions read and the kept ones written
+				cullWork.numParticles += drawnCount;
+				cullWork.numBytes += drawnCount * 12.0 + static_cast<double>(culledCount) * 12.0;
+				// kept positions read and written
+				cullWriteWork.numParticles += culledCount;
+				cullWriteWork.numBytes += static_cast<double>(culledCount) * 24.0;
+				// the depth sort only sees what was kept
+				drawnCount = static_cast<double>(culledCount);
+			}
+			if (depthSortProgram != nullptr)
+			{
+				// position read, key, value and position written
+				depthKeysWork.numParticles += drawnCount;
+				depthKeysWork.numBytes += drawnCount * 32.0;
+				// keys and values read twice and written once per pass
+				depthSortWork.numParticles += drawnCount * numDepthSortPasses;
+				depthSortWork.numBytes += drawnCount * numDepthSortPasses * 24.0;
+				// value and position read, position written
+				depthScatterWork.numParticles += drawnCount;
+				depthScatterWork.numBytes += drawnCount * 28.0;
+			}
+			if (reordered)
+			{
+				// alive index and position read, key and value written
+				mortonKeysWork.numParticles += aliveCount;
+				mortonKeysWork.numBytes += aliveCount * 24.0;
+				mortonSortWork.numParticles += aliveCount * numMortonSortPasses;
+				mortonSortWork.numBytes += aliveCount * numMortonSortPasses * 24.0;
+				// value, position, velocity, spawn time and spawn id read, then written
+				mortonGatherWork.numParticles += aliveCount;
+				mortonGatherWork.numBytes += aliveCount * 68.0;
+				// the state of the alive particles copied back, alive flag, alive index and free index of every slot
+				mortonWriteWork.numParticles += numParticles;
+				mortonWriteWork.numBytes += aliveCount * 64.0 + numParticles * 9.0;
+			}
+		}
+
+		std::cout << "Alive         : " << aliveParticleCount << std::endl;
+		std::cout << "Pages         : " << simulation.getNumPages() << " (" << maxNumPages << " at most) of " << simulation.getPageSize() << " particles" << std::endl;
+		for (size_t i = 1; i < deviceGroup.getNumDevices(); ++i)
+		{
+			std::cout << "Device " << i << "      : " << deviceGroup.getSimulation(i).getNumPages() << " pages, "
+				<< deviceGroup.getShare(i) * 100.0 << "% of the spawns" << std::endl;
+		}
+		if (deviceGroup.getNumDevices() > 1)
+		{
+			std::cout << "Device 0      : " << deviceGroup.getShare(0) * 100.0 << "% of the spawns" << std::endl;
+		}
+		if (cpuEngine != nullptr)
+		{
+			// particles alive at the end of the first lifetime only drew numbers keyed on their spawn, those after it
+			// also reuse the slots freed by the deaths
+			const unsigned int lifetimeFrames = static_cast<unsigned int>(std::ceil(benchmarkCase.maxAge / deltaTimeSeconds));
+			std::cout << "CPU check     : ";
+			if (cpuPoolFilled)
+			{
+				std::cout << "skipped, the pool filled up and the device drops spawns with its own timing" << std::endl;
+			}
+			else
+			{
+				size_t numMismatches = 0;
+				code = compareWithCpuEngine(commandQueue, simulation, *cpuEngine, &numMismatches);
+				CHECK_ERROR_CODE(compareWithCpuEngine);
+				std::cout << cpuEngine->getAliveIndices().size() - std::min(numMismatches, cpuEngine->getAliveIndices().size()) << " of "
+					<< cpuEngine->getAliveIndices().size() << " particles match the CPU engine, " << numMismatches << " mismatches";
+				if (benchmarkCase.numWarmupFrames + numFrames <= lifetimeFrames)
+				{
+					std::cout << ", no particle died yet";
+				}
+				if (mortonOrderProgram != nullptr)
+				{
+					std::cout << ", " << numReorders << " Morton reorders, " << numLateReorders << " after the first lifetime";
+				}
+				std::cout << std::endl;
+				cpuCheckFailed |= numMismatches > 0;
+			}
+			cpuEngine.reset();
+		}
+		if (gridProgram != nullptr)
+		{
+			std::cout << "Grid          : " << spatialGrid.getNumCells() << " cells of " << gridCellSize << ", "
+				<< countQuery.getCount() << " particles within " << queryRadius << " of the origin";
+			if (nearestQuery.getNearestParticle() != ClSpatialQuery::NO_PARTICLE)
+			{
+				std::cout << ", nearest " << nearestQuery.getNearestParticle() << " at " << nearestQuery.getNearestDistance();
+			}
+			std::cout << std::endl;
+		}
+		if (depthSortProgram != nullptr)
+		{
+			std::cout << "Depth sort    : " << ClDepthSort::KEY_BITS << " bit keys over view distances "
+				<< depthSorter.getNearDistance() << " to " << depthSorter.getFarDistance() << std::endl;
+		}
+		if (cullProgram != nullptr)
+		{
+			std::cout << "Culling       : " << culledCount << " positions kept in the view, quads under " << CULLING_MIN_PIXEL_SIZE << " pixel dropped" << std::endl;
+		}
+		if (!forceFields.empty())
+		{
+			size_t numForceFieldBytes = 0;
+			for (const std::shared_ptr<const VectorField>& field : forceFields)
+			{
+				numForceFieldBytes += field->vectors.size() * sizeof(float);
+			}
+			std::cout << "Force fields  : " << forceFields.size() << " sampled by every particle update, "
+				<< numForceFieldBytes / (1024.0 * 1024.0) << " MB of images" << std::endl;
+		}
+		if (depthSortProgram == nullptr)
+		{
+			// how far apart consecutive draws are, what rasterization and passes over the render positions see
+			// the depth sort replaces the storage order of the render positions, the measure would be its own
+			std::cout << "Locality      : " << getRenderPositionsSpread(commandQueue, renderPositions, std::min<size_t>(aliveParticleCount, renderCapacity))
+				<< " mean distance between consecutive render positions";
+			if (mortonOrderProgram != nullptr)
+			{
+				std::cout << ", Morton order every " << mortonOrderInterval << " frames, cells of " << mortonOrder.getCellSize();
+			}
+			std::cout << std::endl;
+		}
+		timings.print(std::cout);
+
+		const std::pair<const char*, const KernelWork*> kernelWorks[] =
+		{
+			{ "cl/simulateParticles", &simulateWork },
+			{ "cl/spawnParticle", &spawnWork },
+			{ "cl/countAliveParticles", &countWork },
+			{ "cl/scanBlockCounts", &scanWork },
+			{ "cl/compactAliveParticles", &compactWork },
+			{ "cl/computeGridKeys", &gridKeysWork },
+			{ "cl/gridSortScatter", &sortWork },
+			{ "cl/buildGridCells", &gridCellsWork },
+			{ "cl/computeDepthKeys", &depthKeysWork },
+			{ "cl/depthSortScatter", &depthSortWork },
+			{ "cl/scatterDepthSorted", &depthScatterWork },
+			{ "cl/computeMortonKeys", &mortonKeysWork },
+			{ "cl/mortonSortScatter", &mortonSortWork },
+			{ "cl/gatherMortonOrder", &mortonGatherWork },
+			{ "cl/writeMortonOrder", &mortonWriteWork },
+			{ "cl/cullParticles", &cullWork },
+			{ "cl/writeCulledPositions", &cullWriteWork },
+		};
+
+		for (const PhaseTimings::Summary& summary : timings.summarize())
+		{
+			const KernelWork* work = nullptr;
+			for (const std::pair<const char*, const KernelWork*>& kernelWork : kernelWorks)
+			{
+				if (summary.phase == kernelWork.first)
+				{
+					work = kernelWork.second;
+				}
+			}
+
+			const double totalSeconds = summary.mean * static_cast<double>(summary.numSamples) * 0.001;
+			const double particlesPerSecond = work != nullptr && totalSeconds > 0.0 ? work->numParticles / totalSeconds : 0.0;
+			const double bytesPerSecond = work != nullptr && totalSeconds > 0.0 ? work->numBytes / totalSeconds : 0.0;
+
+			if (work != nullptr)
+			{
+				std::cout << summary.phase << ": " << particlesPerSecond * 1e-6 << " M particles/s, "
+					<< bytesPerSecond * 1e-9 << " GB/s" << std::endl;
+			}
+
+			if (csvFile.is_open())
+			{
+				csvFile << benchmarkCase.numParticles << ',' << benchmarkCase.particleSpawnRate << ',' << benchmarkCase.maxAge << ','
+					<< summary.phase << ',' << summary.numSamples << ','
+					<< summary.mean << ',' << summary.p50 << ',' << summary.p95 << ',' << summary.p99 << ','
+					<< particlesPerSecond << ',' << bytesPerSecond << std::endl;
+			}
+		}
+
+		countQuery.release();
+		nearestQuery.release();
+		spatialGrid.release();
+		depthSorter.release();
+		frustumCull.release();
+		mortonOrder.release();
+		deviceGroup.release();
+		clReleaseMemObject(drawCommands);
+		clReleaseMemObject(renderPositions);
+	}
+
+	clReleaseCommandQueue(commandQueue);
+	clReleaseContext(context);
+
+	if (cpuCheckFailed)
+	{
+		std::cerr << "The device and the CPU engine disagree" << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,425 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "engine/BinaryCache.h"
+#include "engine/ParticleModifiers.h"
+#include "engine/PhaseTimings.h"
+#include "vulkan/VulkanContext.h"
+#include "vulkan/VulkanErrors.h"
+#include "vulkan/VulkanParticleRenderer.h"
+#include "vulkan/VulkanParticleSimulation.h"
+#include "vulkan/VulkanProfiling.h"
+#include "vulkan/VulkanShaders.h"
+
+// runs shaders/particle.comp and draws the particles with Vulkan, without a window: simulation and rendering are
+// submitted to their own queues and ordered by timeline semaphores only, so that the simulation of a frame overlaps
+// the draws of the previous one, then reports the same phases as the OpenCL path with a vk/ prefix
+// on lavapipe (--device llvmpipe) it runs anywhere Mesa does
+
+#define CHECK_RESULT(function)																\
+	if (result != VK_SUCCESS)																\
+	{																						\
+		std::cerr << #function " returned " << result << ": " << getVkResultString(result)	\
+			<< " (line " << __LINE__ << ")" << std::endl;									\
+		return EXIT_FAILURE;																\
+	}
+
+namespace
+{
+// a frame renders a slot while the next one simulates into the other
+const size_t NUM_FRAMES_IN_FLIGHT = 2;
+// substeps record simulate and spawn, compactions count, scan and compact
+const uint32_t MAX_TIMED_COMPUTE_COMMANDS = 5;
+
+// the command buffers of a frame in flight, reused once the commands of the frame NUM_FRAMES_IN_FLIGHT earlier completed
+struct FrameSlot
+{
+	VkCommandBuffer computeCommands = VK_NULL_HANDLE;
+	VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+	VulkanTimestamps computeTimestamps;
+	VulkanTimestamps drawTimestamps;
+};
+
+void printUsage(const char* programName)
+{
+	std::cerr << "usage: " << programName << " [--particles N] [--frames N] [--dt SECONDS] [--spawn-rate N] [--seed N]" << std::endl
+		<< "    [--device cpu|gpu|NAME] [--width N] [--height N] [--timings FILE.csv|FILE.json] [--image FILE.ppm]" << std::endl
+		<< "    [--validation off|on]" << std::endl
+		<< "--validation runs under VK_LAYER_KHRONOS_validation and fails if it reports any warning or error" << std::endl;
+}
+
+std::string readFile(const std::string& filePath)
+{
+	std::ifstream file(filePath.c_str(), std::ifstream::binary);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return buffer.str();
+}
+
+// binary RGB, the alpha the particles were blended with is dropped
+bool writePpm(const std::string& path, const std::vector<uint8_t>& rgbaPixels, uint32_t width, uint32_t height)
+{
+	std::ofstream file(path.c_str(), std::ofstream::binary);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for (size_t i = 0; i + 3 < rgbaPixels.size(); i += 4)
+	{
+		file.write(reinterpret_cast<const char*>(&rgbaPixels[i]), 3);
+	}
+	return static_cast<bool>(file);
+}
+
+VkResult createTimelineSemaphore(VkDevice device, VkSemaphore* semaphore)
+{
+	VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {};
+	semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	semaphoreTypeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &semaphoreTypeInfo;
+	return vkCreateSemaphore(device, &semaphoreInfo, nullptr, semaphore);
+}
+
+// waits on the timeline semaphore for waitValue when it is not 0, then signals signalValue
+VkResult submit(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore, uint64_t waitValue,
+	VkPipelineStageFlags waitStageMask, VkSemaphore signalSemaphore, uint64_t signalValue)
+{
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = waitValue > 0 ? 1 : 0;
+	timelineInfo.pWaitSemaphoreValues = &waitValue;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = waitValue > 0 ? 1 : 0;
+	submitInfo.pWaitSemaphores = &waitSemaphore;
+	submitInfo.pWaitDstStageMask = &waitStageMask;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &signalSemaphore;
+	return vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+}
+
+// waits on the host until both semaphores reached value
+VkResult waitTimelines(VkDevice device, VkSemaphore firstSemaphore, VkSemaphore secondSemaphore, uint64_t value)
+{
+	const VkSemaphore semaphores[2] = { firstSemaphore, secondSemaphore };
+	const uint64_t values[2] = { value, value };
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 2;
+	waitInfo.pSemaphores = semaphores;
+	waitInfo.pValues = values;
+	return vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+VkResult createCommandBuffers(VkDevice device, uint32_t queueFamily, VkCommandPool* commandPool, VkCommandBuffer* commandBuffers, uint32_t numCommandBuffers)
+{
+	VkCommandPoolCreateInfo commandPoolInfo = {};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	commandPoolInfo.queueFamilyIndex = queueFamily;
+	VkResult result = vkCreateCommandPool(device, &commandPoolInfo, nullptr, commandPool);
+	if (result != VK_SUCCESS)
+	{
+		return result;
+	}
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = *commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = numCommandBuffers;
+	return vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers);
+}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t numParticles = 1000000;
+	unsigned int numFrames = 600;
+	float deltaTimeSeconds = 1.f / 60.f;
+	float particleSpawnRate = 200000.f;
+	unsigned int seed = 0;
+	std::string deviceOverride;
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	std::string timingsPath;
+	std::string imagePath;
+	bool validation = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], "--particles") == 0)
+			numParticles = std::strtoull(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--frames") == 0)
+			numFrames = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--dt") == 0)
+			deltaTimeSeconds = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--spawn-rate") == 0)
+			particleSpawnRate = std::strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--seed") == 0)
+			seed = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--device") == 0)
+			deviceOverride = value;
+		else if (strcmp(argv[i - 1], "--width") == 0)
+			width = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--height") == 0)
+			height = std::strtoul(value, nullptr, 10);
+		else if (strcmp(argv[i - 1], "--timings") == 0)
+			timingsPath = value;
+		else if (strcmp(argv[i - 1], "--image") == 0)
+			imagePath = value;
+		else if (strcmp(argv[i - 1], "--validation") == 0 && strcmp(value, "off") == 0)
+			validation = false;
+		else if (strcmp(argv[i - 1], "--validation") == 0 && strcmp(value, "on") == 0)
+			validation = true;
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (numParticles == 0 || width == 0 || height == 0)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	VulkanContext context;
+	VkResult result = context.create(deviceOverride, validation);
+	CHECK_RESULT(VulkanContext::create);
+	const VkDevice device = context.getDevice();
+	std::cout << "Device        : " << context.getProperties().deviceName << std::endl;
+	std::cout << "Queues        : " << (context.hasSeparateComputeQueue() ? "separate compute and graphics" : "one for compute and graphics") << std::endl;
+	std::cout << "Particles     : " << numParticles << std::endl;
+
+	// the particle shaders read no force field, the Vulkan backend binds none
+	BinaryCache binaryCache(getDefaultCacheDirectory());
+	const ParticleSimulationConfig simulationConfig = getDefaultParticleSimulationConfig();
+	const std::vector<std::string> computeSources = { generateParticleModifierGlslSource(simulationConfig), readFile("shaders/particle.comp") };
+	std::vector<VkShaderModule> computeShaders(NUM_VULKAN_PARTICLE_KERNELS, VK_NULL_HANDLE);
+	VkShaderModule vertexShader = VK_NULL_HANDLE;
+	VkShaderModule fragmentShader = VK_NULL_HANDLE;
+	std::string log;
+	for (size_t i = 0; i < NUM_VULKAN_PARTICLE_KERNELS && result == VK_SUCCESS; ++i)
+	{
+		result = createShaderModule(device, &binaryCache, VK_SHADER_STAGE_COMPUTE_BIT,
+			{ getVulkanParticleKernelSource(static_cast<VulkanParticleKernel>(i), computeSources) }, &computeShaders[i], &log);
+	}
+	if (result == VK_SUCCESS)
+	{
+		result = createShaderModule(device, &binaryCache, VK_SHADER_STAGE_VERTEX_BIT, { readFile("shaders/billboard.vert") }, &vertexShader, &log);
+	}
+	if (result == VK_SUCCESS)
+	{
+		result = createShaderModule(device, &binaryCache, VK_SHADER_STAGE_FRAGMENT_BIT, { readFile("shaders/shader.frag") }, &fragmentShader, &log);
+	}
+	if (result != VK_SUCCESS && !log.empty())
+	{
+		std::cerr << "Log:" << std::endl << log << std::endl;
+	}
+	CHECK_RESULT(createShaderModule);
+
+	VulkanParticleSimulation simulation;
+	result = simulation.create(context, computeShaders, numParticles, NUM_FRAMES_IN_FLIGHT);
+	CHECK_RESULT(VulkanParticleSimulation::create);
+
+	VulkanParticleRenderer renderer;
+	result = renderer.create(context, vertexShader, fragmentShader, width, height, NUM_FRAMES_IN_FLIGHT);
+	CHECK_RESULT(VulkanParticleRenderer::create);
+
+	// the pipelines hold what they need
+	for (VkShaderModule shaderModule : computeShaders)
+	{
+		vkDestroyShaderModule(device, shaderModule, nullptr);
+	}
+	vkDestroyShaderModule(device, vertexShader, nullptr);
+	vkDestroyShaderModule(device, fragmentShader, nullptr);
+
+	FrameSlot frameSlots[NUM_FRAMES_IN_FLIGHT];
+	VkCommandBuffer computeCommandBuffers[NUM_FRAMES_IN_FLIGHT];
+	VkCommandBuffer graphicsCommandBuffers[NUM_FRAMES_IN_FLIGHT];
+	VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+	VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+	result = createCommandBuffers(device, context.getComputeQueueFamily(), &computeCommandPool, computeCommandBuffers, NUM_FRAMES_IN_FLIGHT);
+	CHECK_RESULT(createCommandBuffers);
+	result = createCommandBuffers(device, context.getGraphicsQueueFamily(), &graphicsCommandPool, graphicsCommandBuffers, NUM_FRAMES_IN_FLIGHT);
+	CHECK_RESULT(createCommandBuffers);
+	for (size_t i = 0; i < NUM_FRAMES_IN_FLIGHT; ++i)
+	{
+		frameSlots[i].computeCommands = computeCommandBuffers[i];
+		frameSlots[i].graphicsCommands = graphicsCommandBuffers[i];
+		result = frameSlots[i].computeTimestamps.create(context, MAX_TIMED_COMPUTE_COMMANDS);
+		CHECK_RESULT(VulkanTimestamps::create);
+		result = frameSlots[i].drawTimestamps.create(context, 1);
+		CHECK_RESULT(VulkanTimestamps::create);
+	}
+
+	// frame f signals f + 1 on both once its simulation, then its draws, completed
+	VkSemaphore simulationTimeline = VK_NULL_HANDLE;
+	VkSemaphore renderTimeline = VK_NULL_HANDLE;
+	result = createTimelineSemaphore(device, &simulationTimeline);
+	CHECK_RESULT(createTimelineSemaphore);
+	result = createTimelineSemaphore(device, &renderTimeline);
+	CHECK_RESULT(createTimelineSemaphore);
+
+	// the camera the demo starts with
+	const glm::vec3 cameraPosition(0.f, 20.f, -23.f);
+	const float cameraElevation = -glm::pi<float>() * 0.25f;
+	const glm::vec3 cameraForward(0.f, std::sin(cameraElevation), std::cos(cameraElevation));
+	const glm::mat4 modelViewMatrix = glm::lookAt(cameraPosition, cameraPosition + cameraForward, glm::vec3(0.f, 1.f, 0.f));
+	const glm::mat4 projectionMatrix = glm::perspectiveFov(glm::radians(75.f), static_cast<float>(width), static_cast<float>(height), 0.1f, 1000.f);
+
+	typedef std::chrono::steady_clock Clock;
+	auto elapsedMs = [](Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	};
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	PhaseTimings timings;
+
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		FrameSlot& frameSlot = frameSlots[frame % NUM_FRAMES_IN_FLIGHT];
+
+		// same scheduling as the headless CPU engine, time starts at the first frame
+		const float currentTimeSeconds = static_cast<float>(frame) * deltaTimeSeconds;
+		const uint32_t numParticlesToSpawn = static_cast<uint32_t>(std::ceil(particleSpawnRate * deltaTimeSeconds));
+
+		// the only host wait: the frame that used the slot last, NUM_FRAMES_IN_FLIGHT frames ago
+		Clock::time_point t0 = Clock::now();
+		const uint64_t reusedFrameValue = frame >= NUM_FRAMES_IN_FLIGHT ? frame - NUM_FRAMES_IN_FLIGHT + 1 : 0;
+		if (reusedFrameValue > 0)
+		{
+			result = waitTimelines(device, simulationTimeline, renderTimeline, reusedFrameValue);
+			CHECK_RESULT(vkWaitSemaphores);
+			result = frameSlot.computeTimestamps.addSamples(timings, "frame", "vk/");
+			CHECK_RESULT(vkGetQueryPoolResults);
+			result = frameSlot.drawTimestamps.addSamples(timings, nullptr, "vk/");
+			CHECK_RESULT(vkGetQueryPoolResults);
+		}
+
+		Clock::time_point t1 = Clock::now();
+		result = vkBeginCommandBuffer(frameSlot.computeCommands, &beginInfo);
+		CHECK_RESULT(vkBeginCommandBuffer);
+		frameSlot.computeTimestamps.reset(frameSlot.computeCommands);
+		if (frame == 0)
+		{
+			simulation.recordInit(frameSlot.computeCommands);
+		}
+		simulation.recordSubstep(frameSlot.computeCommands, &frameSlot.computeTimestamps, seed, frame, currentTimeSeconds,
+			deltaTimeSeconds, numParticlesToSpawn);
+		simulation.recordCompaction(frameSlot.computeCommands, &frameSlot.computeTimestamps, frame % NUM_FRAMES_IN_FLIGHT, 0.f);
+		result = vkEndCommandBuffer(frameSlot.computeCommands);
+		CHECK_RESULT(vkEndCommandBuffer);
+
+		// the compaction overwrites the positions the draws of the frame that used the slot read
+		result = submit(context.getComputeQueue(), frameSlot.computeCommands, renderTimeline, reusedFrameValue,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, simulationTimeline, frame + 1);
+		CHECK_RESULT(vkQueueSubmit);
+
+		renderer.setFrameUniforms(frame % NUM_FRAMES_IN_FLIGHT, modelViewMatrix, projectionMatrix);
+		result = vkBeginCommandBuffer(frameSlot.graphicsCommands, &beginInfo);
+		CHECK_RESULT(vkBeginCommandBuffer);
+		frameSlot.drawTimestamps.reset(frameSlot.graphicsCommands);
+		renderer.recordDraw(frameSlot.graphicsCommands, &frameSlot.drawTimestamps, frame % NUM_FRAMES_IN_FLIGHT, simulation.getBuffer(),
+			simulation.getRenderPositionsOffset(frame % NUM_FRAMES_IN_FLIGHT), simulation.getDrawCommandsOffset(frame % NUM_FRAMES_IN_FLIGHT));
+		result = vkEndCommandBuffer(frameSlot.graphicsCommands);
+		CHECK_RESULT(vkEndCommandBuffer);
+
+		// the draws wait for this frame's compaction only, the simulation of the next frame overlaps them
+		result = submit(context.getGraphicsQueue(), frameSlot.graphicsCommands, simulationTimeline, frame + 1,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, renderTimeline, frame + 1);
+		CHECK_RESULT(vkQueueSubmit);
+
+		Clock::time_point t2 = Clock::now();
+		timings.addSample("host/stall", elapsedMs(t0, t1));
+		timings.addSample("host/enqueue", elapsedMs(t1, t2));
+		timings.addSample("host/frame", elapsedMs(t0, t2));
+	}
+
+	// the frames still in flight
+	result = waitTimelines(device, simulationTimeline, renderTimeline, numFrames);
+	CHECK_RESULT(vkWaitSemaphores);
+	for (unsigned int frame = numFrames > NUM_FRAMES_IN_FLIGHT ? numFrames - NUM_FRAMES_IN_FLIGHT : 0; frame < numFrames; ++frame)
+	{
+		FrameSlot& frameSlot = frameSlots[frame % NUM_FRAMES_IN_FLIGHT];
+		result = frameSlot.computeTimestamps.addSamples(timings, "frame", "vk/");
+		CHECK_RESULT(vkGetQueryPoolResults);
+		result = frameSlot.drawTimestamps.addSamples(timings, nullptr, "vk/");
+		CHECK_RESULT(vkGetQueryPoolResults);
+	}
+
+	timings.print(std::cout);
+
+	if (!imagePath.empty() && numFrames > 0)
+	{
+		std::vector<uint8_t> pixels;
+		result = renderer.readPixels(context, pixels);
+		CHECK_RESULT(VulkanParticleRenderer::readPixels);
+		if (!writePpm(imagePath, pixels, width, height))
+		{
+			std::cerr << "Could not write " << imagePath << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	vkDeviceWaitIdle(device);
+	vkDestroySemaphore(device, simulationTimeline, nullptr);
+	vkDestroySemaphore(device, renderTimeline, nullptr);
+	for (FrameSlot& frameSlot : frameSlots)
+	{
+		frameSlot.computeTimestamps.release();
+		frameSlot.drawTimestamps.release();
+	}
+	vkDestroyCommandPool(device, computeCommandPool, nullptr);
+	vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+	renderer.release();
+	simulation.release();
+	context.release();
+
+	if (!timingsPath.empty() && !timings.write(timingsPath))
+	{
+		std::cerr << "Could not write " << timingsPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// counted up to the destruction of the instance
+	if (context.getNumValidationMessages() > 0)
+	{
+		std::cerr << "The validation layer reported " << context.getNumValidationMessages() << " warnings and errors" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}